@@ -82,8 +82,19 @@ std::vector<dhcp_message> database_load_entry(std::string path)
             break;
         }
 
-        /* -36 because 4 bytes for parsed time and 32 bytes for msg_type which is not in database */
-        if (read(fd, &msg_buffer, 576) != 576) {
+        /* 
+         * Packet is stored without trailing padding, its lenght is in metadata (L:). Older entries
+         * have whole 576 bytes, -36 because 4 bytes for parsed time and 32 bytes for msg_type 
+         * which is not in database
+         */
+        size_t lenght = 576;
+        unsigned int stored_lenght;
+        const char *l = strstr(header_buff, "L:");
+        if (l && sscanf(l, "L:%04x", &stored_lenght) == 1 && stored_lenght <= 576)
+            lenght = stored_lenght;
+
+        memset(&msg_buffer, 0, 576);
+        if (read(fd, &msg_buffer, lenght) != (ssize_t)lenght) {
             log("Corupted database entry " + path + ", failed to load data"); 
             break;
         }
@@ -6,7 +6,7 @@
 #include <stdint.h>
 
 #define DB_FILE_PATH_FORMAT "/var/dhcp/database/%08x_%02x%02x%02x%02x%02x%02x.dhcp"
-#define METADATA_FORMAT "T:%08lxCA:%02x%02x%02x%02x%02x%02xP:"
+#define METADATA_FORMAT "T:%08lxCA:%02x%02x%02x%02x%02x%02xL:%04zxP:"
 #define METADATA_LEN 128
 
 struct dhcp_message {
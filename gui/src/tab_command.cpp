@@ -66,8 +66,10 @@ void TabCommand::initialize_commands()
     // Server handled commands
     this->commands.push_back({"echo", true, nullptr, "Echoes back what the user types in arguments", "echo param1 param2 ..."});
     this->commands.push_back({"stop-server", true, nullptr, "Stops the running dhcp server", "stop-server"});
-    this->commands.push_back({"rogue-scan", true, nullptr, "Perform a scan for potential dhcp rogue servers (running server must have support for scanning)", "rogue-scan <mac-address> [legit-server-ip ...]"});
+    this->commands.push_back({"rogue-scan", true, nullptr, "Start a scan for potential dhcp rogue servers in background (running server must have support for scanning)", "rogue-scan <mac-address> [legit-server-ip ...]"});
+    this->commands.push_back({"rogue-scan-result", true, nullptr, "Collect result of a finished rogue server scan", "rogue-scan-result <scan-id>"});
     this->commands.push_back({"pool-status", true, nullptr, "See the current number of available addresses in each pool", "pool-status"});
+    this->commands.push_back({"io-stats", true, nullptr, "See batch size, ingress queue depths and drops, option cache hits, transaction cache usage, packets dropped by the XDP filter and number of packets received and sent by the server", "io-stats"});
 }
 
 void TabCommand::refresh()
@@ -66,11 +66,15 @@ TabConfig::TabConfig()
                 text(this->config_entries[CONF_INTERFACE].name) | bold,
                 text(this->config_entries[CONF_TICK_DELAY].name) | bold,
                 text(this->config_entries[CONF_CACHE_SIZE].name) | bold,
+                text(this->config_entries[CONF_CACHE_MEMORY_LIMIT].name) | bold,
+                text(this->config_entries[CONF_BATCH_SIZE].name) | bold,
+                text(this->config_entries[CONF_WORKERS].name) | bold,
                 text(this->config_entries[CONF_TRANSACTION_DURATION].name) | bold,
                 text(this->config_entries[CONF_LEASE_EXPIRATION_CHECK].name) | bold,
                 text(this->config_entries[CONF_LOG_VERBOSITY].name) | bold,
                 text(this->config_entries[CONF_LEASE_TIME].name) | bold,
                 text(this->config_entries[CONF_DB_ENABLE].name) | bold,
+                text(this->config_entries[CONF_UNICAST_ENABLE].name) | bold,
             });
         }),
         Renderer([] {return separatorEmpty();}),
@@ -78,11 +82,15 @@ TabConfig::TabConfig()
             Input(&this->config_entries[CONF_INTERFACE].val),
             Input(&this->config_entries[CONF_TICK_DELAY].val),
             Input(&this->config_entries[CONF_CACHE_SIZE].val),
+            Input(&this->config_entries[CONF_CACHE_MEMORY_LIMIT].val),
+            Input(&this->config_entries[CONF_BATCH_SIZE].val),
+            Input(&this->config_entries[CONF_WORKERS].val),
             Input(&this->config_entries[CONF_TRANSACTION_DURATION].val),
             Input(&this->config_entries[CONF_LEASE_EXPIRATION_CHECK].val),
             Input(&this->config_entries[CONF_LOG_VERBOSITY].val),
             Input(&this->config_entries[CONF_LEASE_TIME].val),
             Toggle(&TabConfig::boolean_toogle ,&this->config_entries[CONF_DB_ENABLE].val_i),
+            Toggle(&TabConfig::boolean_toogle ,&this->config_entries[CONF_UNICAST_ENABLE].val_i),
         })
         | CatchEvent([&] (Event event) {
             Component &inputs = this->config_menu_server->ChildAt(2)->ChildAt(0);
@@ -115,6 +123,8 @@ TabConfig::TabConfig()
                         text("Start address") | bold,   
                         text("End address") | bold,   
                         text("Subnet mask") | bold,   
+                        text("Interface") | bold,   
+                        text("Strategy") | bold,   
                     });
                 })
             }),
@@ -161,6 +171,9 @@ TabConfig::TabConfig()
                     text(this->config_entries[CONF_SEC_ACL_ENABLE].name) | bold,
                     text(this->config_entries[CONF_SEC_DYN_ACL_ENABLE].name) | bold,
                     text(this->config_entries[CONF_SEC_ACL_MODE].name) | bold,
+                    text(this->config_entries[CONF_SEC_XDP_ENABLE].name) | bold,
+                    text(this->config_entries[CONF_SEC_XDP_RATE_LIMIT].name) | bold,
+                    text(this->config_entries[CONF_SEC_XDP_RATE_BURST].name) | bold,
                 });
             }),
             Renderer([] {return separatorEmpty() | size(WIDTH, EQUAL, 3);}),
@@ -168,6 +181,9 @@ TabConfig::TabConfig()
                 Toggle(&TabConfig::enable_disable_toggle, &this->config_entries[CONF_SEC_ACL_ENABLE].val_i),
                 Toggle(&TabConfig::enable_disable_toggle, &this->config_entries[CONF_SEC_DYN_ACL_ENABLE].val_i),
                 Toggle(&TabConfig::blacklist_whitelist_toggle, &this->config_entries[CONF_SEC_ACL_MODE].val_i),
+                Toggle(&TabConfig::enable_disable_toggle, &this->config_entries[CONF_SEC_XDP_ENABLE].val_i),
+                Input(&this->config_entries[CONF_SEC_XDP_RATE_LIMIT].val),
+                Input(&this->config_entries[CONF_SEC_XDP_RATE_BURST].val),
             }),
         }),
         Renderer([] {return vbox({
@@ -301,7 +317,7 @@ int TabConfig::load_config_file()
     //      server config
     // -------------------------
 
-    for (int i = CONF_INTERFACE; i <= CONF_DB_ENABLE; i++) {
+    for (int i = CONF_INTERFACE; i <= CONF_UNICAST_ENABLE; i++) {
         ConfEntry &entry = config_entries[i];
         entry.json = cJSON_GetObjectItem(config_json.server, entry.json_path.c_str());
 
@@ -401,6 +417,32 @@ int TabConfig::load_config_file()
         acl_list.json = cJSON_AddArrayToObject(config_json.security, acl_list.json_path.c_str());
     }
 
+    ConfEntry &xdp_enable = config_entries[CONF_SEC_XDP_ENABLE];
+    xdp_enable.json = cJSON_GetObjectItem(config_json.security, xdp_enable.json_path.c_str());
+    if (!xdp_enable.json) {
+        xdp_enable.json = cJSON_AddBoolToObject(config_json.security, xdp_enable.json_path.c_str(), xdp_enable.def_val_i);
+    }
+    if (!cJSON_IsBool(xdp_enable.json)) {
+        log("XDP enable is not bool");
+        return -1;
+    }
+    xdp_enable.val_i = cJSON_IsTrue(xdp_enable.json);
+
+    for (int i = CONF_SEC_XDP_RATE_LIMIT; i <= CONF_SEC_XDP_RATE_BURST; i++) {
+        ConfEntry &entry = config_entries[i];
+        entry.json = cJSON_GetObjectItem(config_json.security, entry.json_path.c_str());
+        if (!entry.json) {
+            entry.json = cJSON_AddNumberToObject(config_json.security, entry.json_path.c_str(), std::stoi(entry.def_val));
+        }
+        if (!cJSON_IsNumber(entry.json)) {
+            log(entry.name + " Is not a number");
+            return -1;
+        }
+        std::ostringstream oss;
+        oss << std::fixed << std::setprecision(0) << cJSON_GetNumberValue(entry.json);
+        entry.val = oss.str();
+    }
+
     if (!cJSON_IsBool(acl_enable.json)) {
         log("ACL enable is not bool");
         return -1;
@@ -436,6 +478,10 @@ int TabConfig::load_config_file()
             .start_addr = cJSON_GetStringValue(cJSON_GetObjectItem(e, "start")),
             .end_addr = cJSON_GetStringValue(cJSON_GetObjectItem(e, "end")),
             .subnet = cJSON_GetStringValue(cJSON_GetObjectItem(e, "subnet")),
+            .interface = cJSON_HasObjectItem(e, "interface") ? 
+                            cJSON_GetStringValue(cJSON_GetObjectItem(e, "interface")) : "",
+            .strategy = cJSON_HasObjectItem(e, "strategy") ? 
+                            cJSON_GetStringValue(cJSON_GetObjectItem(e, "strategy")) : "",
             .options_json = cJSON_GetObjectItem(e, "options")
         };
 
@@ -528,7 +574,7 @@ int TabConfig::initialize()
     // Initialize 'Cache Size' entry.
     ConfEntry c_cache_size = {
         .name = "Cache Size",
-        .description = "Maximum number of items stored in the server cache. The higher the size, the more clients can be handled at a time. Lower values provide protection against DHCP starvation attack.",
+        .description = "Number of transactions the server cache holds initially. The cache grows when it is full, up to the Cache Memory Limit.",
         .json_path = "cache_size",
         .type = NUMERIC,
         .val = "25",
@@ -536,6 +582,39 @@ int TabConfig::initialize()
     };
     config_entries.push_back(c_cache_size);
 
+    // Initialize 'Cache Memory Limit' entry.
+    ConfEntry c_cache_memory_limit = {
+        .name = "Cache Memory Limit",
+        .description = "Memory (in MiB) the transaction caches of all workers can grow to when they are full. When the limit is reached, the oldest unfinished transactions are evicted to make room for new clients.",
+        .json_path = "cache_memory_limit",
+        .type = NUMERIC,
+        .val = "16",
+        .def_val = "16",
+    };
+    config_entries.push_back(c_cache_memory_limit);
+
+    // Initialize 'Batch Size' entry.
+    ConfEntry c_batch_size = {
+        .name = "Batch Size",
+        .description = "Maximum number of DHCP packets received or sent by a single system call. Higher values lower the overhead when many clients request addresses at once.",
+        .json_path = "batch_size",
+        .type = NUMERIC,
+        .val = "32",
+        .def_val = "32",
+    };
+    config_entries.push_back(c_batch_size);
+
+    // Initialize 'Workers' entry.
+    ConfEntry c_workers = {
+        .name = "Workers",
+        .description = "Number of worker threads serving clients. Each worker has its own socket and transaction cache, clients are distributed between workers by their MAC address.",
+        .json_path = "workers",
+        .type = NUMERIC,
+        .val = "1",
+        .def_val = "1",
+    };
+    config_entries.push_back(c_workers);
+
     // Initialize 'Transaction Duration' entry.
     ConfEntry c_transaction_duration = {
         .name = "Transaction Duration",
@@ -591,6 +670,17 @@ int TabConfig::initialize()
     };
     config_entries.push_back(c_db_enable);
 
+    // Initialize 'Unicast Enable' entry.
+    ConfEntry c_unicast_enable = {
+        .name = "Unicast Enable",
+        .description = "Unicast replies to clients which do not have an IP address yet and did not ask for broadcast, as described by RFC 2131. Frames are sent over packet socket, which requires CAP_NET_RAW. When disabled, such replies are broadcasted",
+        .json_path = "unicast_enable",
+        .type = BOOLEAN,
+        .val_i = 0,
+        .def_val_i = 0,
+    };
+    config_entries.push_back(c_unicast_enable);
+
     // -------------------------------------
     //           security configs 
     // ------------------------------------
@@ -625,6 +715,36 @@ int TabConfig::initialize()
     };
     config_entries.push_back(c_dacl_enabled);
 
+    ConfEntry c_xdp_enable = {
+        .name = "XDP filter",
+        .description = "Drop packets of clients denied by ACL or dynamic ACL in an XDP program attached to served interfaces, before the kernel passes them to the server. Needs CAP_BPF and CAP_NET_ADMIN.",
+        .json_path = "xdp_enable",
+        .type = BOOLEAN,
+        .val_i = 0,
+        .def_val_i = 0,
+    };
+    config_entries.push_back(c_xdp_enable);
+
+    ConfEntry c_xdp_rate_limit = {
+        .name = "XDP rate limit",
+        .description = "Number of DHCP packets per second allowed to every client by the XDP filter, packets over the limit are dropped. 0 disables rate limiting.",
+        .json_path = "xdp_rate_limit",
+        .type = NUMERIC,
+        .val = "0",
+        .def_val = "0",
+    };
+    config_entries.push_back(c_xdp_rate_limit);
+
+    ConfEntry c_xdp_rate_burst = {
+        .name = "XDP rate burst",
+        .description = "Number of DHCP packets a client can send at once before the XDP rate limit applies.",
+        .json_path = "xdp_rate_burst",
+        .type = NUMERIC,
+        .val = "10",
+        .def_val = "10",
+    };
+    config_entries.push_back(c_xdp_rate_burst);
+
     // Not really used, just for completion sake and JSON handling. Values are stored in a vector
     ConfEntry c_acl_entries = {
         .name = "ACL entries",
@@ -701,7 +821,7 @@ static void apply_options(DHCPOptionConfig &o)
 int TabConfig::apply_settings()
 {
     ConfEntry &entry = config_entries[0];
-    for (int i = 0; i <= CONF_DB_ENABLE; i++) {
+    for (int i = 0; i <= CONF_UNICAST_ENABLE; i++) {
         entry = config_entries[i];
         entry.json = cJSON_GetObjectItem(config_json.server, entry.json_path.c_str());
         if (entry.json) {
@@ -762,6 +882,9 @@ int TabConfig::apply_settings()
     cJSON_SetBoolValue(dacl_enable.json, dacl_enable.val_i);
     cJSON_SetBoolValue(acl_enable.json, acl_enable.val_i);
     cJSON_SetBoolValue(acl_mode.json, acl_mode.val_i);
+    cJSON_SetBoolValue(config_entries[CONF_SEC_XDP_ENABLE].json, config_entries[CONF_SEC_XDP_ENABLE].val_i);
+    cJSON_SetNumberValue(config_entries[CONF_SEC_XDP_RATE_LIMIT].json, std::stoi(config_entries[CONF_SEC_XDP_RATE_LIMIT].val));
+    cJSON_SetNumberValue(config_entries[CONF_SEC_XDP_RATE_BURST].json, std::stoi(config_entries[CONF_SEC_XDP_RATE_BURST].val));
     
     clearArray(acl_list.json);
     for(auto &entry : security_acl_entries) {
@@ -781,6 +904,10 @@ int TabConfig::apply_settings()
         cJSON_AddStringToObject(json_pool, "start", p.start_addr.c_str());
         cJSON_AddStringToObject(json_pool, "end", p.end_addr.c_str());
         cJSON_AddStringToObject(json_pool, "subnet", p.subnet.c_str());
+        if (p.interface.length())
+            cJSON_AddStringToObject(json_pool, "interface", p.interface.c_str());
+        if (p.strategy.length())
+            cJSON_AddStringToObject(json_pool, "strategy", p.strategy.c_str());
         cJSON *pool_options = cJSON_AddArrayToObject(json_pool, "options");
 
         if (i + 1 < options_config_entries.size()) {
@@ -931,6 +1058,8 @@ void TabConfig::pools_refresh()
         pools_value_container->Add({Input(&p.start_addr)});
         pools_value_container->Add({Input(&p.end_addr)});
         pools_value_container->Add({Input(&p.subnet)});
+        pools_value_container->Add({Input(&p.interface, "all interfaces")});
+        pools_value_container->Add({Input(&p.strategy, "first (or hash, random, lru)")});
     }
 
     pools_pool_selected_last = pools_pool_selected;
@@ -948,6 +1077,8 @@ void TabConfig::pool_ctl(bool remove)
             .start_addr = "0.0.0.0",
             .end_addr = "0.0.0.0",
             .subnet = "0.0.0.0",
+            .interface = "",
+            .strategy = "",
             .options_json = cJSON_CreateArray()  
         };
 
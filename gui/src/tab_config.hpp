@@ -12,15 +12,22 @@ enum ConfigName {
     CONF_INTERFACE,
     CONF_TICK_DELAY,
     CONF_CACHE_SIZE,
+    CONF_CACHE_MEMORY_LIMIT,
+    CONF_BATCH_SIZE,
+    CONF_WORKERS,
     CONF_TRANSACTION_DURATION,
     CONF_LEASE_EXPIRATION_CHECK,
     CONF_LOG_VERBOSITY,
     CONF_LEASE_TIME,
     CONF_DB_ENABLE,
+    CONF_UNICAST_ENABLE,
 
     CONF_SEC_ACL_ENABLE,
     CONF_SEC_ACL_MODE,
     CONF_SEC_DYN_ACL_ENABLE,
+    CONF_SEC_XDP_ENABLE,
+    CONF_SEC_XDP_RATE_LIMIT,
+    CONF_SEC_XDP_RATE_BURST,
     CONF_SEC_ACL_ENTRIES,
     CONFIG_COUNT // Add this to keep track of the number of configs
 };
@@ -48,6 +55,8 @@ struct DHCPPool {
     std::string start_addr;
     std::string end_addr;
     std::string subnet;
+    std::string interface;  // empty if pool is offered on every interface
+    std::string strategy;   // address selection strategy, empty means first available address
     cJSON *options_json;
 };
 
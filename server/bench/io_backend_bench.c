@@ -0,0 +1,287 @@
+#define _GNU_SOURCE
+#include <io_batch.h>
+#include <uring.h>
+#include <cclog.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Compares socket backends of dhcp server over loopback. Client sends bursts of
+ * BENCH_BURST packets, server side receives them and queues reply for every packet,
+ * exactly like dhcp_server_receive does. Client waits for all replies before next
+ * burst, so no datagram is lost due to full socket buffers.
+ *
+ * io_uring backend is measured only when built with make IO_URING=y bench
+ */
+
+#define BENCH_PACKETS 200000
+#define BENCH_BURST 32
+
+typedef struct bench_ctx {
+        int client_fd;
+        int server_fd;
+        struct sockaddr_in client_addr;
+        struct sockaddr_in server_addr;
+        dhcp_packet_t packets[BENCH_BURST];
+        struct mmsghdr hdr[BENCH_BURST];
+        struct iovec iov[BENCH_BURST];
+        uint32_t replies;
+#ifdef CONFIG_IO_URING
+        uring_t *ring;
+#endif
+} bench_ctx_t;
+
+typedef struct bench_result {
+        double seconds;
+        double cpu_seconds;
+        uint64_t syscalls;
+} bench_result_t;
+
+static int open_loopback_socket(struct sockaddr_in *addr)
+{
+        socklen_t len = sizeof(struct sockaddr_in);
+        int size = 4 * 1024 * 1024;
+        int fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+        if (fd < 0)
+                return -1;
+
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+        memset(addr, 0, sizeof(struct sockaddr_in));
+        addr->sin_family = AF_INET;
+        addr->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+        if (bind(fd, (struct sockaddr*)addr, len) < 0 ||
+            getsockname(fd, (struct sockaddr*)addr, &len) < 0) {
+                close(fd);
+                return -1;
+        }
+
+        return fd;
+}
+
+static int bench_ctx_init(bench_ctx_t *ctx)
+{
+        memset(ctx, 0, sizeof(bench_ctx_t));
+        ctx->client_fd = open_loopback_socket(&ctx->client_addr);
+        ctx->server_fd = open_loopback_socket(&ctx->server_addr);
+        if (ctx->client_fd < 0 || ctx->server_fd < 0)
+                return -1;
+
+        for (int i = 0; i < BENCH_BURST; i++) {
+                ctx->iov[i].iov_base = &ctx->packets[i];
+                ctx->iov[i].iov_len = sizeof(dhcp_packet_t);
+                ctx->hdr[i].msg_hdr.msg_iov = &ctx->iov[i];
+                ctx->hdr[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        return 0;
+}
+
+static void bench_ctx_uninit(bench_ctx_t *ctx)
+{
+        if (ctx->client_fd >= 0)
+                close(ctx->client_fd);
+        if (ctx->server_fd >= 0)
+                close(ctx->server_fd);
+}
+
+static int client_send_burst(bench_ctx_t *ctx, uint32_t first)
+{
+        for (int i = 0; i < BENCH_BURST; i++) {
+                ctx->packets[i].xid = htonl(first + i);
+                ctx->hdr[i].msg_hdr.msg_name = &ctx->server_addr;
+                ctx->hdr[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+        }
+
+        return sendmmsg(ctx->client_fd, ctx->hdr, BENCH_BURST, 0) == BENCH_BURST ? 0 : -1;
+}
+
+/* Drain replies, returns number of received replies */
+static int client_receive(bench_ctx_t *ctx)
+{
+        for (int i = 0; i < BENCH_BURST; i++) {
+                ctx->hdr[i].msg_hdr.msg_name = NULL;
+                ctx->hdr[i].msg_hdr.msg_namelen = 0;
+        }
+
+        int rv = recvmmsg(ctx->client_fd, ctx->hdr, BENCH_BURST, MSG_DONTWAIT, NULL);
+        return rv < 0 ? 0 : rv;
+}
+
+static double now(void)
+{
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double cpu_time(void)
+{
+        struct rusage ru;
+        getrusage(RUSAGE_SELF, &ru);
+        return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 +
+               ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+}
+
+static int bench_io_batch(bench_result_t *res)
+{
+        bench_ctx_t ctx;
+        io_batch_t *batch = NULL;
+        int rv = -1;
+        int epoll_fd = epoll_create1(0);
+        struct epoll_event ev = { .events = EPOLLIN };
+
+        if (bench_ctx_init(&ctx) < 0 || epoll_fd < 0)
+                goto exit;
+
+        batch = io_batch_new(BENCH_BURST, NULL);
+        if (!batch)
+                goto exit;
+
+        ev.data.fd = ctx.server_fd;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, ctx.server_fd, &ev);
+
+        uint64_t waits = 0;
+        double start = now();
+        double cpu = cpu_time();
+
+        for (uint32_t sent = 0; sent < BENCH_PACKETS; sent += BENCH_BURST) {
+                if (client_send_burst(&ctx, sent) < 0)
+                        goto exit;
+
+                uint32_t handled = 0;
+                while (handled < BENCH_BURST) {
+                        epoll_wait(epoll_fd, &ev, 1, -1);
+                        waits++;
+
+                        int received = io_batch_receive(batch, ctx.server_fd);
+                        for (int i = 0; i < received; i++)
+                                io_batch_queue(batch, ctx.server_fd, batch->rx_messages[i]->packet,
+                                               sizeof(dhcp_packet_t), &ctx.client_addr);
+                        io_batch_flush(batch, ctx.server_fd);
+                        handled += received > 0 ? received : 0;
+                }
+
+                uint32_t replies = 0;
+                while (replies < BENCH_BURST)
+                        replies += client_receive(&ctx);
+        }
+
+        res->seconds = now() - start;
+        res->cpu_seconds = cpu_time() - cpu;
+        res->syscalls = waits + batch->stats.rx_calls + batch->stats.tx_calls;
+        rv = 0;
+exit:
+        io_batch_destroy(&batch);
+        bench_ctx_uninit(&ctx);
+        if (epoll_fd >= 0)
+                close(epoll_fd);
+        return rv;
+}
+
+#ifdef CONFIG_IO_URING
+static void bench_uring_reply(void *priv, dhcp_message_t *message, size_t len)
+{
+        bench_ctx_t *ctx = priv;
+
+        uring_queue_send(ctx->ring, message->packet, len, &ctx->client_addr);
+        ctx->replies++;
+}
+
+static int bench_uring(bench_result_t *res)
+{
+        bench_ctx_t ctx;
+        int rv = -1;
+        int epoll_fd = epoll_create1(0);
+        struct epoll_event ev = { .events = EPOLLIN };
+        uint64_t count;
+
+        if (bench_ctx_init(&ctx) < 0 || epoll_fd < 0)
+                goto exit;
+
+        ctx.ring = uring_new(ctx.server_fd, BENCH_BURST, NULL);
+        if (!ctx.ring)
+                goto exit;
+
+        ev.data.fd = ctx.ring->event_fd;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, ctx.ring->event_fd, &ev);
+
+        uint64_t waits = 0;
+        double start = now();
+        double cpu = cpu_time();
+
+        for (uint32_t sent = 0; sent < BENCH_PACKETS; sent += BENCH_BURST) {
+                if (client_send_burst(&ctx, sent) < 0)
+                        goto exit;
+
+                ctx.replies = 0;
+                while (ctx.replies < BENCH_BURST) {
+                        epoll_wait(epoll_fd, &ev, 1, -1);
+                        waits += 2;
+                        read(ctx.ring->event_fd, &count, sizeof(count));
+                        uring_receive(ctx.ring, bench_uring_reply, &ctx);
+                }
+
+                uint32_t replies = 0;
+                while (replies < BENCH_BURST)
+                        replies += client_receive(&ctx);
+        }
+
+        res->seconds = now() - start;
+        res->cpu_seconds = cpu_time() - cpu;
+        res->syscalls = waits + ctx.ring->stats.submits;
+        rv = 0;
+exit:
+        uring_destroy(&ctx.ring);
+        bench_ctx_uninit(&ctx);
+        if (epoll_fd >= 0)
+                close(epoll_fd);
+        return rv;
+}
+#endif
+
+static void print_result(const char *name, bench_result_t *res)
+{
+        printf("%-10s %10.0f packets/s  %8.3f s  cpu %8.3f s  server syscalls/packet %.3f\n",
+               name, BENCH_PACKETS / res->seconds, res->seconds, res->cpu_seconds,
+               (double)res->syscalls / BENCH_PACKETS);
+}
+
+int main(void)
+{
+        bench_result_t res = {0};
+
+        cclogger_init(LOGGING_SINGLE_FILE, "/dev/null", "dhcps_bench");
+        cclogger_set_verbosity_level(-1000);
+
+        printf("Receiving and replying to %d packets in bursts of %d\n", BENCH_PACKETS, BENCH_BURST);
+
+        if (bench_io_batch(&res) < 0) {
+                fprintf(stderr, "io_batch benchmark failed: %s\n", strerror(errno));
+                return 1;
+        }
+        print_result("recvmmsg", &res);
+
+#ifdef CONFIG_IO_URING
+        memset(&res, 0, sizeof(res));
+        if (bench_uring(&res) < 0) {
+                fprintf(stderr, "io_uring benchmark failed: %s\n", strerror(errno));
+                return 1;
+        }
+        print_result("io_uring", &res);
+#else
+        printf("io_uring   not built, run make IO_URING=y bench\n");
+#endif
+
+        cclogger_uninit();
+        return 0;
+}
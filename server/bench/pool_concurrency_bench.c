@@ -0,0 +1,147 @@
+#include <address_pool.h>
+#include <cclog.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Measures how allocation from one pool scales with number of threads. Every thread
+ * keeps BENCH_HELD addresses and in every round releases the oldest of them and
+ * assigns a new one, so the pool stays at constant occupancy. Pools take addresses
+ * by atomic operations on bitmap words, "first+mutex" serialises every operation by
+ * a global mutex as the allocator did before, for comparison.
+ */
+
+#define BENCH_POOL_START        "10.0.0.1"
+#define BENCH_POOL_END          "10.0.255.254"
+#define BENCH_POOL_MASK         "255.255.0.0"
+#define BENCH_ROUNDS            500000
+#define BENCH_HELD              2048
+#define BENCH_MAX_THREADS       16
+
+typedef struct bench_thread {
+        pthread_t thread;
+        address_pool_t *pool;
+        pthread_mutex_t *lock;          // NULL if pool is used without lock
+        uint32_t id;
+        uint32_t failures;
+} bench_thread_t;
+
+static double now_s(void)
+{
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *bench_thread(void *priv)
+{
+        bench_thread_t *t = (bench_thread_t*)priv;
+        uint32_t *held = calloc(BENCH_HELD, sizeof(uint32_t));
+        uint8_t chaddr[6] = {0x02, t->id, 0, 0, 0, 0};
+        uint32_t address;
+
+        if (!held) {
+                t->failures++;
+                return NULL;
+        }
+
+        for (uint32_t round = 0; round < BENCH_ROUNDS + BENCH_HELD; round++) {
+                uint32_t slot = round % BENCH_HELD;
+                memcpy(chaddr + 2, &round, sizeof(round));
+
+                if (t->lock)
+                        pthread_mutex_lock(t->lock);
+                if (held[slot])
+                        address_pool_clear_address_allocation(t->pool, held[slot]);
+                if (address_pool_assign(t->pool, chaddr, &address) < 0) {
+                        t->failures++;
+                        address = 0;
+                }
+                if (t->lock)
+                        pthread_mutex_unlock(t->lock);
+
+                held[slot] = address;
+        }
+
+        free(held);
+        return NULL;
+}
+
+/* Returns millions of release and assign pairs per second, negative value on failure */
+static double bench_run(enum address_pool_strategy strategy, bool locked, uint32_t threads)
+{
+        bench_thread_t t[BENCH_MAX_THREADS];
+        pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+        double rate = -1;
+        uint32_t started = 0;
+
+        address_pool_t *pool = address_pool_new_str("bench", BENCH_POOL_START, BENCH_POOL_END,
+                                                     BENCH_POOL_MASK);
+        if (!pool || address_pool_set_strategy(pool, strategy) < 0)
+                goto exit;
+
+        double start = now_s();
+        for (; started < threads; started++) {
+                t[started] = (bench_thread_t) {.pool = pool, .lock = locked ? &lock : NULL,
+                                               .id = started};
+                if (pthread_create(&t[started].thread, NULL, bench_thread, &t[started]) != 0)
+                        break;
+        }
+
+        uint32_t failures = 0;
+        for (uint32_t i = 0; i < started; i++) {
+                pthread_join(t[i].thread, NULL);
+                failures += t[i].failures;
+        }
+
+        if (started == threads && !failures)
+                rate = (double)threads * (BENCH_ROUNDS + BENCH_HELD) / (now_s() - start) / 1e6;
+exit:
+        address_pool_destroy(&pool);
+        return rate;
+}
+
+int main(void)
+{
+        uint32_t thread_counts[] = {1, 2, 4, 8, 16};
+        uint32_t count = 0;
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+        cclogger_init(LOGGING_SINGLE_FILE, "/dev/null", "dhcps_bench");
+        cclogger_set_verbosity_level(-1000);
+
+        printf("Pool %s - %s, %d rounds per thread holding %d addresses, %ld CPUs\n",
+               BENCH_POOL_START, BENCH_POOL_END, BENCH_ROUNDS, BENCH_HELD, cpus);
+        printf("%-12s", "Mops/s");
+        for (; count < sizeof(thread_counts) / sizeof(thread_counts[0]); count++) {
+                if (thread_counts[count] > BENCH_MAX_THREADS ||
+                    (count && thread_counts[count] > 2 * cpus))
+                        break;
+                printf("  %4u thr", thread_counts[count]);
+        }
+        printf("\n");
+
+        for (int s = -1; s < ADDRESS_POOL_STRATEGY_COUNT; s++) {
+                enum address_pool_strategy strategy = s < 0 ? ADDRESS_POOL_STRATEGY_FIRST : s;
+                printf("%-12s", s < 0 ? "first+mutex" : address_pool_strategy_name(strategy));
+
+                for (uint32_t i = 0; i < count; i++) {
+                        double rate = bench_run(strategy, s < 0, thread_counts[i]);
+                        if (rate < 0) {
+                                fprintf(stderr, "\nbenchmark with %u threads failed\n", thread_counts[i]);
+                                return 1;
+                        }
+                        printf("  %8.2f", rate);
+                        fflush(stdout);
+                }
+                printf("\n");
+        }
+
+        cclogger_uninit();
+        return 0;
+}
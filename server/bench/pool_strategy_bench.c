@@ -0,0 +1,183 @@
+#include <address_pool.h>
+#include <cclog.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*
+ * Compares address selection strategies of pools (see address_pool_assign).
+ *
+ * Fill: pool is filled by new clients, cost of assignment is measured in bands of
+ * occupancy. For hash strategy, collisions are clients which did not get their own
+ * address (the one they would get from empty pool) because other client took it.
+ *
+ * Churn: at BENCH_CHURN_OCCUPANCY percent occupancy a random client leaves and a new
+ * one comes every round. Immediate reuse is the share of new clients which got address
+ * released in the same round, reuse distance the mean number of rounds after which
+ * released address is assigned again. Short distance means new client gets address
+ * whose previous owner may still be in ARP caches of other hosts.
+ */
+
+#define BENCH_POOL_START        "10.0.0.1"
+#define BENCH_POOL_END          "10.0.255.254"
+#define BENCH_POOL_MASK         "255.255.0.0"
+#define BENCH_CHURN_OCCUPANCY   90
+#define BENCH_CHURN_ROUNDS      200000
+
+static const uint32_t bands[] = {50, 90, 99, 100};
+#define BENCH_BANDS (sizeof(bands) / sizeof(bands[0]))
+
+typedef struct bench_result {
+        double ns_per_assign[BENCH_BANDS];
+        uint32_t collisions;
+        double immediate_reuse;
+        double reuse_distance;
+        double churn_ns_per_round;
+} bench_result_t;
+
+static double now_ns(void)
+{
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void client_chaddr(uint32_t client, uint8_t chaddr[6])
+{
+        chaddr[0] = 0x02;
+        chaddr[1] = 0x00;
+        chaddr[2] = client >> 24;
+        chaddr[3] = client >> 16;
+        chaddr[4] = client >> 8;
+        chaddr[5] = client;
+}
+
+/* Address client would get from empty pool */
+static uint32_t home_address(address_pool_t *empty, const uint8_t chaddr[6])
+{
+        uint32_t address = 0;
+        address_pool_assign(empty, chaddr, &address);
+        address_pool_clear_address_allocation(empty, address);
+        return address;
+}
+
+static int bench_strategy(enum address_pool_strategy strategy, bench_result_t *res)
+{
+        int rv = -1;
+        uint8_t chaddr[6];
+        uint32_t address;
+        uint32_t client = 0;
+
+        address_pool_t *pool = address_pool_new_str("bench", BENCH_POOL_START, BENCH_POOL_END,
+                                                     BENCH_POOL_MASK);
+        address_pool_t *empty = address_pool_new_str("empty", BENCH_POOL_START, BENCH_POOL_END,
+                                                      BENCH_POOL_MASK);
+        uint32_t size = pool ? pool->available_addresses : 0;
+        uint32_t *owner = calloc(size, sizeof(uint32_t));
+        uint32_t *released_at = calloc(size, sizeof(uint32_t));
+        if (!pool || !empty || !owner || !released_at)
+                goto exit;
+
+        if (address_pool_set_strategy(pool, strategy) < 0 ||
+            address_pool_set_strategy(empty, strategy) < 0)
+                goto exit;
+
+        /* Fill */
+        for (uint32_t b = 0; b < BENCH_BANDS; b++) {
+                uint32_t target = (uint64_t)size * bands[b] / 100;
+                uint32_t count = target - client;
+                double start = now_ns();
+
+                for (; client < target; client++) {
+                        client_chaddr(client, chaddr);
+                        if (address_pool_assign(pool, chaddr, &address) < 0)
+                                goto exit;
+                        owner[address - pool->start_address] = client;
+                }
+
+                res->ns_per_assign[b] = count ? (now_ns() - start) / count : 0;
+        }
+
+        if (strategy == ADDRESS_POOL_STRATEGY_HASH) {
+                for (uint32_t n = 0; n < size; n++) {
+                        client_chaddr(owner[n], chaddr);
+                        res->collisions += home_address(empty, chaddr) != pool->start_address + n;
+                }
+        }
+
+        /* Release clients down to churn occupancy */
+        srand(1);
+        uint32_t keep = (uint64_t)size * BENCH_CHURN_OCCUPANCY / 100;
+        for (uint32_t n = 0; pool->available_addresses < size - keep; n++) {
+                if (rand() % 10 == 0)
+                        address_pool_clear_address_allocation(pool, pool->start_address + n % size);
+        }
+
+        /* Churn, round numbers start at 1 so 0 means never released */
+        uint64_t immediate = 0, reused = 0, distance = 0;
+        double start = now_ns();
+        for (uint32_t round = 1; round <= BENCH_CHURN_ROUNDS; round++) {
+                uint32_t n;
+                do {
+                        n = rand() % size;
+                } while (!address_pool_get_address_allocation(pool, pool->start_address + n));
+
+                address_pool_clear_address_allocation(pool, pool->start_address + n);
+                released_at[n] = round;
+
+                client_chaddr(client++, chaddr);
+                if (address_pool_assign(pool, chaddr, &address) < 0)
+                        goto exit;
+
+                n = address - pool->start_address;
+                if (released_at[n]) {
+                        reused++;
+                        immediate += released_at[n] == round;
+                        distance += round - released_at[n];
+                }
+        }
+        res->churn_ns_per_round = (now_ns() - start) / BENCH_CHURN_ROUNDS;
+        res->immediate_reuse = 100.0 * immediate / BENCH_CHURN_ROUNDS;
+        res->reuse_distance = reused ? (double)distance / reused : 0;
+
+        rv = 0;
+exit:
+        free(owner);
+        free(released_at);
+        address_pool_destroy(&pool);
+        address_pool_destroy(&empty);
+        return rv;
+}
+
+int main(void)
+{
+        cclogger_init(LOGGING_SINGLE_FILE, "/dev/null", "dhcps_bench");
+        cclogger_set_verbosity_level(-1000);
+
+        printf("Pool %s - %s, churn of %d rounds at %d%% occupancy\n", BENCH_POOL_START,
+               BENCH_POOL_END, BENCH_CHURN_ROUNDS, BENCH_CHURN_OCCUPANCY);
+        printf("%-8s ns/assign at fill:  <50%%   <90%%   <99%%  <100%%  collisions  "
+               "churn ns/round  immediate reuse  reuse distance\n", "");
+
+        for (int s = 0; s < ADDRESS_POOL_STRATEGY_COUNT; s++) {
+                bench_result_t res = {0};
+                if (bench_strategy(s, &res) < 0) {
+                        fprintf(stderr, "%s strategy benchmark failed\n", address_pool_strategy_name(s));
+                        return 1;
+                }
+
+                char collisions[16] = "-";
+                if (s == ADDRESS_POOL_STRATEGY_HASH)
+                        snprintf(collisions, sizeof(collisions), "%u", res.collisions);
+
+                printf("%-8s %26.1f %6.1f %6.1f %6.1f  %10s  %14.1f  %14.2f%%  %14.0f\n",
+                       address_pool_strategy_name(s), res.ns_per_assign[0], res.ns_per_assign[1],
+                       res.ns_per_assign[2], res.ns_per_assign[3], collisions,
+                       res.churn_ns_per_round, res.immediate_reuse, res.reuse_distance);
+        }
+
+        cclogger_uninit();
+        return 0;
+}
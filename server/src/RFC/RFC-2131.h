@@ -3,6 +3,15 @@
 
 #define MAGIC_COOKIE 0x63825363
 
+#define DHCP_SERVER_PORT 67
+#define DHCP_CLIENT_PORT 68
+
+/* Client asks server to broadcast replies, flags in host byte order */
+#define DHCP_FLAG_BROADCAST 0x8000
+
+/* Hardware type of 10Mb Ethernet (RFC 1700) */
+#define DHCP_HTYPE_ETHERNET 1
+
 enum dhcp_message_type {
     DHCP_DISCOVER = 1,
     DHCP_OFFER = 2,
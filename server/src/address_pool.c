@@ -10,6 +10,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 static void log_with_pool_info(int log_level, const char *format, 
                 uint32_t start, uint32_t end, uint32_t mask)
@@ -25,9 +26,46 @@ static void log_with_pool_info(int log_level, const char *format,
         free(subnet_mask);
 }
 
+/* Returns number of 64 bit words of bitmask with bit for every address in range */
 static uint32_t pool_range(uint32_t start_addr, uint32_t end_addr)
 {
-        return (end_addr - start_addr + 8) / 8;
+        return (end_addr - start_addr + 64) / 64;
+}
+
+/* Returns bits of word of leases_bm after the last address of pool */
+static uint64_t pool_word_padding(const address_pool_t *pool, uint32_t word)
+{
+        uint32_t last_bits = (pool->end_address - pool->start_address + 1) % 64;
+
+        if (word == pool->leases_bm_words - 1 && last_bits)
+                return ~0ULL << last_bits;
+
+        return 0;
+}
+
+/* Returns word of leases_bm with bits after the last address of pool set as if they were in use */
+static uint64_t pool_word_used(const address_pool_t *pool, uint32_t word)
+{
+        return __atomic_load_n(&pool->leases_bm[word], __ATOMIC_ACQUIRE) | pool_word_padding(pool, word);
+}
+
+/* 
+ * Mark word as full in summary level after an address of it was taken. Address of the word 
+ * can be released concurrently before the mark is set, so the word is checked again and 
+ * unmarked. Releasing thread unmarks the word after changing it, so word with available 
+ * address never stays marked as full. Word marked as not full while it is full only costs 
+ * a look at it
+ */
+static void pool_mark_full(address_pool_t *pool, uint32_t word)
+{
+        uint64_t bit = 1ULL << (word % 64);
+
+        if (pool_word_used(pool, word) != ~0ULL)
+                return;
+
+        __atomic_fetch_or(&pool->full_bm[word / 64], bit, __ATOMIC_SEQ_CST);
+        if (pool_word_used(pool, word) != ~0ULL)
+                __atomic_fetch_and(&pool->full_bm[word / 64], ~bit, __ATOMIC_SEQ_CST);
 }
 
 static bool can_range_be_on_subnet(uint32_t start, uint32_t end, uint32_t mask)
@@ -75,9 +113,17 @@ address_pool_t* address_pool_new(const char *name, uint32_t start_address,
 
         if_failed(dhcp_option_add(pool->dhcp_option_override, opt_subnet_mask), error);
 
-        pool->leases_bm = calloc(pool_range(start_address, end_address), sizeof(uint8_t));
-        if_null(pool->leases_bm, error_leases);
+        pool->leases_bm_words = pool_range(start_address, end_address);
+        pool->leases_bm = calloc(pool->leases_bm_words, sizeof(uint64_t));
+        pool->full_bm = calloc((pool->leases_bm_words + 63) / 64, sizeof(uint64_t));
+        if (!pool->leases_bm || !pool->full_bm) {
+                free(pool->leases_bm);
+                free(pool->full_bm);
+                goto error_leases;
+        }
         pool->available_addresses = end_address - start_address + 1;
+        pool->random_state = ((uint64_t)time(NULL) << 32) ^ (uintptr_t)pool;
+        pthread_mutex_init(&pool->lru_lock, NULL);
 
         log_with_pool_info(LOG_MSG, "Created new address pool from %s to %s on subnet %s",
                         start_address, end_address, subnet_mask);
@@ -108,7 +154,12 @@ void address_pool_destroy(address_pool_t **pool)
 
         dhcp_option_destroy_list(&(*pool)->dhcp_option_override);
         free((*pool)->leases_bm);
+        free((*pool)->full_bm);
+        free((*pool)->lru_next);
+        free((*pool)->lru_prev);
+        pthread_mutex_destroy(&(*pool)->lru_lock);
         free((*pool)->name);
+        free((*pool)->interface);
         free(*pool);
         *pool = NULL;
 }
@@ -123,6 +174,240 @@ bool address_belongs_to_pool_str(address_pool_t *pool, const char *address)
         return address_belongs_to_pool(pool, ipv4_address_to_uint32(address));
 }
 
+bool address_pool_is_served_on(const address_pool_t *pool, const char *interface)
+{
+        if (!pool)
+                return false;
+
+        return !interface || !pool->interface || !strcmp(pool->interface, interface);
+}
+
+/* Returns number of addresses in pool */
+static uint32_t pool_size(const address_pool_t *pool)
+{
+        return pool->end_address - pool->start_address + 1;
+}
+
+/* Returns first word at or after word which is not marked as full, leases_bm_words if there is none */
+static uint32_t pool_next_free_word(const address_pool_t *pool, uint32_t word)
+{
+        uint32_t summary_words = (pool->leases_bm_words + 63) / 64;
+        uint32_t s = word / 64;
+
+        if (s >= summary_words)
+                return pool->leases_bm_words;
+
+        /* Skip full words 64 at a time using summary level, sequential consistency for pool_raise_hint */
+        uint64_t not_full = ~__atomic_load_n(&pool->full_bm[s], __ATOMIC_SEQ_CST) & (~0ULL << (word % 64));
+        while (!not_full && ++s < summary_words)
+                not_full = ~__atomic_load_n(&pool->full_bm[s], __ATOMIC_SEQ_CST);
+
+        if (!not_full)
+                return pool->leases_bm_words;
+
+        word = s * 64 + __builtin_ctzll(not_full);
+        return word < pool->leases_bm_words ? word : pool->leases_bm_words;
+}
+
+/* Lower free_hint to word if it is above it */
+static void pool_lower_hint(address_pool_t *pool, uint32_t word)
+{
+        uint32_t hint = __atomic_load_n(&pool->free_hint, __ATOMIC_SEQ_CST);
+
+        while (word < hint && !__atomic_compare_exchange_n(&pool->free_hint, &hint, word, true,
+                                __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+                ;
+}
+
+/* 
+ * Raise free_hint from hint to word after words between them were found full. Address of 
+ * those words can be released while the releasing thread still sees the old hint and does 
+ * not lower it, so the words are checked again after the new hint is published. Either the 
+ * check sees the released word as not full or the releasing thread sees the new hint
+ */
+static void pool_raise_hint(address_pool_t *pool, uint32_t hint, uint32_t word)
+{
+        if (word <= hint || !__atomic_compare_exchange_n(&pool->free_hint, &hint, word, false,
+                                __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+                return;
+
+        pool_lower_hint(pool, pool_next_free_word(pool, hint));
+}
+
+/* 
+ * Bit from which thread looks for available address in a word after it lost a race for 
+ * an address of the word, so threads allocating at once spread over the word
+ */
+static uint32_t pool_thread_offset(void)
+{
+        static uint32_t threads;
+        static __thread uint32_t offset = UINT32_MAX;
+
+        if (offset == UINT32_MAX)
+                offset = (__atomic_fetch_add(&threads, 1, __ATOMIC_RELAXED) * 23) % 64;
+
+        return offset;
+}
+
+/* Account address number taken by fetch-or of its bit */
+static void pool_taken(address_pool_t *pool, uint32_t number)
+{
+        __atomic_sub_fetch(&pool->available_addresses, 1, __ATOMIC_RELAXED);
+        pool_mark_full(pool, number / 64);
+}
+
+/* Take address number if it is available. Returns true on success */
+static bool pool_try_take(address_pool_t *pool, uint32_t number)
+{
+        uint64_t mask = 1ULL << (number % 64);
+
+        if (__atomic_fetch_or(&pool->leases_bm[number / 64], mask, __ATOMIC_ACQ_REL) & mask)
+                return false;
+
+        pool_taken(pool, number);
+        return true;
+}
+
+/* 
+ * Take available address of word, the lowest one at or after bit start if there is one. 
+ * Returns true and address number in number on success, false if word is full
+ */
+static bool pool_take_in_word(address_pool_t *pool, uint32_t word, uint32_t start, uint32_t *number)
+{
+        uint64_t used = pool_word_used(pool, word);
+
+        while (used != ~0ULL) {
+                uint64_t preferred = ~used & (~0ULL << start);
+                uint32_t bit = __builtin_ctzll(preferred ? preferred : ~used);
+                uint64_t mask = 1ULL << bit;
+                uint64_t old = __atomic_fetch_or(&pool->leases_bm[word], mask, __ATOMIC_ACQ_REL);
+
+                if (!(old & mask)) {
+                        *number = word * 64 + bit;
+                        pool_taken(pool, *number);
+                        return true;
+                }
+
+                /* Other thread took it, old is the current state of the word */
+                used = old | pool_word_padding(pool, word);
+                start = pool_thread_offset();
+        }
+
+        return false;
+}
+
+/* Take the first available address at or after word. Returns 0 on success, -1 if there is none */
+static int pool_take_first_from(address_pool_t *pool, uint32_t word, uint32_t start, uint32_t *number)
+{
+        for (word = pool_next_free_word(pool, word); word < pool->leases_bm_words;
+             word = pool_next_free_word(pool, word + 1)) {
+                if (pool_take_in_word(pool, word, start, number))
+                        return 0;
+
+                /* Word was taken by other threads, make sure it is not searched again */
+                pool_mark_full(pool, word);
+                start = 0;
+        }
+
+        return -1;
+}
+
+static void pool_lru_unlink(address_pool_t *pool, uint32_t number)
+{
+        uint32_t next = pool->lru_next[number];
+        uint32_t prev = pool->lru_prev[number];
+
+        if (prev == ADDRESS_POOL_LRU_NONE)
+                pool->lru_head = next;
+        else
+                pool->lru_next[prev] = next;
+
+        if (next == ADDRESS_POOL_LRU_NONE)
+                pool->lru_tail = prev;
+        else
+                pool->lru_prev[next] = prev;
+}
+
+static void pool_lru_append(address_pool_t *pool, uint32_t number)
+{
+        pool->lru_next[number] = ADDRESS_POOL_LRU_NONE;
+        pool->lru_prev[number] = pool->lru_tail;
+
+        if (pool->lru_tail == ADDRESS_POOL_LRU_NONE)
+                pool->lru_head = number;
+        else
+                pool->lru_next[pool->lru_tail] = number;
+
+        pool->lru_tail = number;
+}
+
+/* splitmix64, every thread advances the shared state by one step atomically */
+static uint64_t pool_random(address_pool_t *pool)
+{
+        uint64_t z = __atomic_add_fetch(&pool->random_state, 0x9E3779B97F4A7C15ULL, __ATOMIC_RELAXED);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        return z ^ (z >> 31);
+}
+
+/* Take uniformly random available address. Returns 0 on success, -1 if there is none */
+static int pool_take_random(address_pool_t *pool, uint32_t *number)
+{
+        /* Random probes are enough unless pool is almost depleted */
+        for (int i = 0; i < 16; i++) {
+                *number = pool_random(pool) % pool_size(pool);
+                if (pool_try_take(pool, *number))
+                        return 0;
+        }
+
+        /* Pick k-th available address */
+        uint32_t available = __atomic_load_n(&pool->available_addresses, __ATOMIC_RELAXED);
+        if (!available)
+                return -1;
+
+        uint32_t k = pool_random(pool) % available;
+        uint32_t word = pool_next_free_word(pool, 0);
+
+        for (; word < pool->leases_bm_words; word = pool_next_free_word(pool, word + 1)) {
+                uint64_t free_bits = ~pool_word_used(pool, word);
+                uint32_t count = __builtin_popcountll(free_bits);
+
+                if (k >= count) {
+                        k -= count;
+                        continue;
+                }
+
+                while (k--)
+                        free_bits &= free_bits - 1;
+
+                if (pool_take_in_word(pool, word, __builtin_ctzll(free_bits), number))
+                        return 0;
+        }
+
+        /* Addresses were taken concurrently while counting */
+        return pool_take_first_from(pool, 0, 0, number);
+}
+
+/* Returns number of address to which chaddr hashes, Fibonacci hashing of the 48 bit address */
+static uint32_t pool_hash_chaddr(const address_pool_t *pool, const uint8_t *chaddr)
+{
+        uint64_t key = 0;
+        memcpy(&key, chaddr, 6);
+
+        return ((key * 0x9E3779B97F4A7C15ULL) >> 32) * pool_size(pool) >> 32;
+}
+
+/* Take the address from hash of chaddr or the next available one, wraps around */
+static int pool_take_hash(address_pool_t *pool, const uint8_t *chaddr, uint32_t *number)
+{
+        uint32_t home = pool_hash_chaddr(pool, chaddr);
+
+        if (pool_take_first_from(pool, home / 64, home % 64, number) == 0)
+                return 0;
+
+        return pool_take_first_from(pool, 0, 0, number);
+}
+
 int address_pool_address_allocation_ctl(address_pool_t *pool, uint32_t address, int action)
 {
         int rv = -1;
@@ -130,27 +415,43 @@ int address_pool_address_allocation_ctl(address_pool_t *pool, uint32_t address,
         if_false(address_belongs_to_pool(pool, address), exit);
 
         uint32_t address_number = address - pool->start_address;
-        uint32_t index = address_number / 8;
-        uint8_t bit = address_number % 8;
-        uint8_t address_bit = (pool->leases_bm[index] & (uint8_t)(1 << bit)) != 0;
+        uint32_t index = address_number / 64;
+        uint64_t mask = 1ULL << (address_number % 64);
 
         switch (action) {
         case 's':   // set address alocation
-                if_true(address_bit, exit);
+                if (pool->lru_next)
+                        pthread_mutex_lock(&pool->lru_lock);
+
+                if (pool_try_take(pool, address_number)) {
+                        if (pool->lru_next)
+                                pool_lru_unlink(pool, address_number);
+                        rv = 0;
+                }
 
-                pool->leases_bm[index] |= (uint8_t)(1 << bit);
-                pool->available_addresses -= 1;
-                rv = 0;
+                if (pool->lru_next)
+                        pthread_mutex_unlock(&pool->lru_lock);
                 break;
         case 'c':   // clear address allocation
-                if_false(address_bit, exit);
-
-                pool->leases_bm[index] -= (uint8_t)(1 << bit);
-                pool->available_addresses += 1;
-                rv = 0;
+                if (pool->lru_next)
+                        pthread_mutex_lock(&pool->lru_lock);
+
+                if (__atomic_fetch_and(&pool->leases_bm[index], ~mask, __ATOMIC_SEQ_CST) & mask) {
+                        __atomic_fetch_and(&pool->full_bm[index / 64], ~(1ULL << (index % 64)), 
+                                        __ATOMIC_SEQ_CST);
+                        __atomic_add_fetch(&pool->available_addresses, 1, __ATOMIC_RELAXED);
+                        pool_lower_hint(pool, index);
+
+                        if (pool->lru_next)
+                                pool_lru_append(pool, address_number);
+                        rv = 0;
+                }
+
+                if (pool->lru_next)
+                        pthread_mutex_unlock(&pool->lru_lock);
                 break;
         case 'g':   // get address allocation
-                rv = address_bit;
+                rv = (__atomic_load_n(&pool->leases_bm[index], __ATOMIC_ACQUIRE) & mask) != 0;
                 break;
         default:
                 cclog(LOG_ERROR, NULL, "Invalid action \'%c\' for address allocation ctl", action);
@@ -190,3 +491,118 @@ int address_pool_clear_address_allocation_str(address_pool_t *pool, const char *
         return address_pool_address_allocation_ctl(pool, ipv4_address_to_uint32(address), 'c');
 }
 
+int address_pool_assign_first(address_pool_t *pool, uint32_t *address)
+{
+        if (!pool || !address || !__atomic_load_n(&pool->available_addresses, __ATOMIC_RELAXED))
+                return -1;
+
+        uint32_t number;
+        uint32_t hint = __atomic_load_n(&pool->free_hint, __ATOMIC_RELAXED);
+
+        /* Hint can skip address released concurrently, search is repeated from the start */
+        if (pool_take_first_from(pool, hint, 0, &number) < 0 &&
+            (!hint || pool_take_first_from(pool, 0, 0, &number) < 0))
+                return -1;
+
+        /* Move the hint unless it was changed meanwhile */
+        pool_raise_hint(pool, hint, number / 64);
+
+        *address = pool->start_address + number;
+        return 0;
+}
+
+int address_pool_assign(address_pool_t *pool, const uint8_t *chaddr, uint32_t *address)
+{
+        if (!pool || !address || !__atomic_load_n(&pool->available_addresses, __ATOMIC_RELAXED))
+                return -1;
+
+        int rv = -1;
+        uint32_t number;
+
+        switch (pool->strategy) {
+        case ADDRESS_POOL_STRATEGY_HASH:
+                if (!chaddr)
+                        return address_pool_assign_first(pool, address);
+                rv = pool_take_hash(pool, chaddr, &number);
+                break;
+        case ADDRESS_POOL_STRATEGY_RANDOM:
+                rv = pool_take_random(pool, &number);
+                break;
+        case ADDRESS_POOL_STRATEGY_LRU:
+                pthread_mutex_lock(&pool->lru_lock);
+                number = pool->lru_head;
+                if (number != ADDRESS_POOL_LRU_NONE && pool_try_take(pool, number)) {
+                        pool_lru_unlink(pool, number);
+                        rv = 0;
+                }
+                pthread_mutex_unlock(&pool->lru_lock);
+                break;
+        default:
+                return address_pool_assign_first(pool, address);
+        }
+
+        if (rv == 0)
+                *address = pool->start_address + number;
+        return rv;
+}
+
+int address_pool_set_strategy(address_pool_t *pool, enum address_pool_strategy strategy)
+{
+        if (!pool || strategy >= ADDRESS_POOL_STRATEGY_COUNT)
+                return -1;
+
+        free(pool->lru_next);
+        free(pool->lru_prev);
+        pool->lru_next = NULL;
+        pool->lru_prev = NULL;
+        pool->strategy = strategy;
+
+        if (strategy != ADDRESS_POOL_STRATEGY_LRU)
+                return 0;
+
+        pool->lru_next = malloc(pool_size(pool) * sizeof(uint32_t));
+        pool->lru_prev = malloc(pool_size(pool) * sizeof(uint32_t));
+        if (!pool->lru_next || !pool->lru_prev) {
+                free(pool->lru_next);
+                free(pool->lru_prev);
+                pool->lru_next = NULL;
+                pool->lru_prev = NULL;
+                pool->strategy = ADDRESS_POOL_STRATEGY_FIRST;
+                cclog(LOG_ERROR, NULL, "Cannot allocate LRU queue of pool %s", pool->name);
+                return -1;
+        }
+
+        /* Addresses that were never used are queued in ascending order */
+        pool->lru_head = pool->lru_tail = ADDRESS_POOL_LRU_NONE;
+        for (uint32_t n = 0; n < pool_size(pool); n++) {
+                if (!(pool->leases_bm[n / 64] & (1ULL << (n % 64))))
+                        pool_lru_append(pool, n);
+        }
+
+        return 0;
+}
+
+static const char *pool_strategy_names[ADDRESS_POOL_STRATEGY_COUNT] = {
+        [ADDRESS_POOL_STRATEGY_FIRST]   = "first",
+        [ADDRESS_POOL_STRATEGY_HASH]    = "hash",
+        [ADDRESS_POOL_STRATEGY_RANDOM]  = "random",
+        [ADDRESS_POOL_STRATEGY_LRU]     = "lru",
+};
+
+const char *address_pool_strategy_name(enum address_pool_strategy strategy)
+{
+        return strategy < ADDRESS_POOL_STRATEGY_COUNT ? pool_strategy_names[strategy] : "unknown";
+}
+
+int address_pool_strategy_parse(const char *name)
+{
+        if (!name)
+                return -1;
+
+        for (int i = 0; i < ADDRESS_POOL_STRATEGY_COUNT; i++) {
+                if (!strcmp(pool_strategy_names[i], name))
+                        return i;
+        }
+
+        return -1;
+}
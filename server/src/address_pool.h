@@ -2,10 +2,21 @@
 #define __ADDRESS_POOL_H__
 
 #include "utils/llist.h"
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdint.h>
 
 #define ADDRESS_POOL_NAME_MAX_LENGHT 64
+#define ADDRESS_POOL_LRU_NONE UINT32_MAX
+
+/* How address_pool_assign chooses available address for a client */
+enum address_pool_strategy {
+    ADDRESS_POOL_STRATEGY_FIRST = 0,    // lowest available address
+    ADDRESS_POOL_STRATEGY_HASH,         // address derived from client chaddr, next available one on collision
+    ADDRESS_POOL_STRATEGY_RANDOM,       // uniformly random available address
+    ADDRESS_POOL_STRATEGY_LRU,          // address released the longest time ago
+    ADDRESS_POOL_STRATEGY_COUNT,
+};
 
 typedef struct pool {
     char *name;
@@ -17,17 +28,45 @@ typedef struct pool {
     /* 
      * Bitmask storing information about which IP address in pool is leased and 
      * which is available. 0 Means it is available, 1 means it is in use.
+     * Address n of the pool is bit n % 64 of word n / 64, bits after the last 
+     * address stay 0.
      * NOTE: Even if address is reserved, if the client is not using it it should 
      * be marked as available.
+     *
+     * Addresses are taken and released by atomic fetch-or/fetch-and of their bit, so 
+     * threads can allocate from one pool at once without a lock. Only the LRU queue 
+     * needs lru_lock. full_bm, free_hint and available_addresses are updated atomically 
+     * after the bit and can lag behind it for a moment.
      */
-    uint8_t *leases_bm;
+    uint64_t *leases_bm;
+    uint32_t leases_bm_words;
+    /* Summary level of leases_bm, bit n is set if every address of word n is in use */
+    uint64_t *full_bm;
+    /* No address below word free_hint of leases_bm is available */
+    uint32_t free_hint;
     /* 
      * Count of curretnly not assigned addresses from this pool. 
      * Or number of 0 valued bits in leases_bm
      */
     uint32_t available_addresses;
 
+    enum address_pool_strategy strategy;
+    uint64_t random_state;              // state of generator of random strategy
+    /* 
+     * Queue of available addresses of LRU strategy, only allocated for it. Doubly linked 
+     * list of address numbers, released addresses are appended to the tail and assigned 
+     * from the head. ADDRESS_POOL_LRU_NONE terminates the list
+     */
+    uint32_t *lru_next;
+    uint32_t *lru_prev;
+    uint32_t lru_head;
+    uint32_t lru_tail;
+    pthread_mutex_t lru_lock;
+
     llist_t *dhcp_option_override;
+
+    /* Name of interface on which the pool is offered, NULL means every served interface */
+    char *interface;
 } address_pool_t;
 
 address_pool_t* address_pool_new(const char *name, uint32_t start_address,
@@ -42,6 +81,9 @@ bool address_belongs_to_pool(address_pool_t *pool, uint32_t address);
 
 bool address_belongs_to_pool_str(address_pool_t *pool, const char *address);
 
+/* Returns true if pool is offered on interface. Interface NULL matches every pool */
+bool address_pool_is_served_on(const address_pool_t *pool, const char *interface);
+
 /**
  * Function controlls pools allocation tracking bitmask. sets or gets appropriate 
  * bit belonging to address in pools leases_bm bitmask.
@@ -61,5 +103,30 @@ int address_pool_get_address_allocation(address_pool_t *pool, uint32_t address);
 int address_pool_get_address_allocation_str(address_pool_t *pool, const char *address);
 
 int address_pool_clear_address_allocation(address_pool_t *pool, uint32_t address);
+/* 
+ * Find the lowest available address of pool, mark it as in use and store it to address. 
+ * Returns 0 on success, -1 if pool is depleted
+ */
+int address_pool_assign_first(address_pool_t *pool, uint32_t *address);
+
+/*
+ * Find available address of pool using its strategy, mark it as in use and store it to 
+ * address. Hash strategy needs chaddr of the client, without it (chaddr NULL) the lowest 
+ * available address is assigned. Returns 0 on success, -1 if pool is depleted
+ */
+int address_pool_assign(address_pool_t *pool, const uint8_t *chaddr, uint32_t *address);
+
+/* 
+ * Change strategy of pool. Must not be called while other threads allocate from the pool. 
+ * Returns 0 on success, -1 on failure 
+ */
+int address_pool_set_strategy(address_pool_t *pool, enum address_pool_strategy strategy);
+
+/* Returns name of strategy used in configuration, e.g. "lru" */
+const char *address_pool_strategy_name(enum address_pool_strategy strategy);
+
+/* Returns strategy named name, -1 if there is no such strategy */
+int address_pool_strategy_parse(const char *name);
+
 int address_pool_clear_address_allocation_str(address_pool_t *pool, const char *address);
 #endif // !__ADDRESS_POOL_H__
@@ -58,22 +58,113 @@ void allocator_destroy(address_allocator_t **a)
                 address_pool_destroy(&ap);
         })
         llist_destroy(&(*a)->address_pools);
+        free((*a)->pool_ranges);
+        free((*a)->pools_by_name);
 
         free(*a);
         *a = NULL;
 }
 
+static uint32_t pool_name_hash(const address_allocator_t *a, const char *name)
+{
+        /* FNV-1a */
+        uint32_t hash = 2166136261U;
+        for (; *name; name++)
+                hash = (hash ^ (uint8_t)*name) * 16777619U;
+
+        return (hash * 2654435769U) >> (32 - a->pools_by_name_bits);
+}
+
+/* Returns position of pool name in pools_by_name, or of the empty entry where it would be inserted */
+static uint32_t pool_name_find(const address_allocator_t *a, const char *name)
+{
+        uint32_t mask = (1U << a->pools_by_name_bits) - 1;
+        uint32_t pos = pool_name_hash(a, name);
+
+        while (a->pools_by_name[pos] && strcmp(a->pools_by_name[pos]->name, name) != 0)
+                pos = (pos + 1) & mask;
+
+        return pos;
+}
+
+/* Make room for one more pool in pools_by_name, table is rebuilt twice as large when it would be half full */
+static int allocator_reserve_pool_name(address_allocator_t *a)
+{
+        if (2 * (a->pool_count + 1) > (1U << a->pools_by_name_bits)) {
+                uint32_t bits = a->pools_by_name_bits ? a->pools_by_name_bits + 1 : 4;
+                address_pool_t **table = calloc(1U << bits, sizeof(address_pool_t*));
+                if_null_log(table, error, LOG_ERROR, NULL, "Failed to allocate pool name index");
+
+                address_pool_t **old = a->pools_by_name;
+                uint32_t old_size = a->pools_by_name_bits ? 1U << a->pools_by_name_bits : 0;
+                a->pools_by_name = table;
+                a->pools_by_name_bits = bits;
+                for (uint32_t i = 0; i < old_size; i++) {
+                        if (old[i])
+                                table[pool_name_find(a, old[i]->name)] = old[i];
+                }
+                free(old);
+        }
+
+        return 0;
+error:
+        return -1;
+}
+
+/* 
+ * Returns pool_ranges with parts of pool range which are not served by other pools added, 
+ * count is set to their number. Ranges stay sorted, so lookup by address is binary search
+ */
+static struct allocator_pool_range *allocator_add_pool_range(address_allocator_t *a, address_pool_t *pool,
+        uint32_t *count_buf)
+{
+        /* Every existing range can split pool range at most once */
+        struct allocator_pool_range *ranges = malloc(sizeof(struct allocator_pool_range) * 
+                                                     (2 * a->pool_range_count + 1));
+        if_null_log(ranges, error, LOG_ERROR, NULL, "Failed to allocate pool address index");
+
+        uint32_t count = 0;
+        uint64_t next = pool->start_address;      // first address of pool not covered yet
+        for (uint32_t i = 0; i < a->pool_range_count; i++) {
+                struct allocator_pool_range *r = &a->pool_ranges[i];
+
+                if (next <= pool->end_address && r->start > next) {
+                        uint32_t end = (r->start - 1 < pool->end_address) ? r->start - 1 : pool->end_address;
+                        ranges[count++] = (struct allocator_pool_range){next, end, pool};
+                        next = (uint64_t)end + 1;
+                }
+
+                ranges[count++] = *r;
+                if (r->end >= next)
+                        next = (uint64_t)r->end + 1;
+        }
+
+        if (next <= pool->end_address)
+                ranges[count++] = (struct allocator_pool_range){next, pool->end_address, pool};
+
+        *count_buf = count;
+        return ranges;
+error:
+        return NULL;
+}
+
 address_pool_t* allocator_get_pool_by_address(address_allocator_t *a, uint32_t addr)
 {
         if_null(a, exit);
 
-        address_pool_t *pool = NULL;
-        llist_foreach(a->address_pools, {
-                pool = (address_pool_t*)node->data;
+        /* Find the last range starting at or before addr */
+        uint32_t low = 0;
+        uint32_t high = a->pool_range_count;
+        while (low < high) {
+                uint32_t mid = low + (high - low) / 2;
+                if (a->pool_ranges[mid].start <= addr)
+                        low = mid + 1;
+                else
+                        high = mid;
+        }
 
-                if (address_belongs_to_pool(pool, addr))
-                        return pool;
-        })
+        if (low && addr <= a->pool_ranges[low - 1].end)
+                return a->pool_ranges[low - 1].pool;
 
 exit:
         return NULL;
@@ -85,13 +176,10 @@ address_pool_t* allocator_get_pool_by_name(address_allocator_t* a, const char* n
         if_null(a, exit);
         if_null(name, exit);
 
-        address_pool_t *pool;
+        if (!a->pool_count)
+                return NULL;
 
-        llist_foreach(a->address_pools, {
-                pool = (address_pool_t*)node->data;
-                if (!strcmp(pool->name, name))
-                        return node->data;
-        })
+        return a->pools_by_name[pool_name_find(a, name)];
 
 exit:
         return NULL;
@@ -110,7 +198,22 @@ int allocator_add_pool(address_allocator_t *allocator, address_pool_t *pool)
                 goto error;
         }
 
-        if_failed(llist_append(allocator->address_pools, pool, false), error);
+        /* Indexes are changed only after everything that can fail succeeded */
+        uint32_t range_count;
+        if_failed(allocator_reserve_pool_name(allocator), error);
+        struct allocator_pool_range *ranges = allocator_add_pool_range(allocator, pool, &range_count);
+        if_null(ranges, error);
+        if (llist_append(allocator->address_pools, pool, false) != 0) {
+                free(ranges);
+                goto error;
+        }
+
+        free(allocator->pool_ranges);
+        allocator->pool_ranges = ranges;
+        allocator->pool_range_count = range_count;
+        allocator->pools_by_name[pool_name_find(allocator, pool->name)] = pool;
+        allocator->pool_count++;
+        allocator_options_changed(allocator);
 
         rv = ALLOCATOR_OK;
 error:
@@ -120,17 +223,10 @@ error:
 }
 
 
-static int allocator_assign_first_from_pool(address_pool_t *pool, uint32_t *addr_buf)
+static int allocator_assign_from_pool(address_pool_t *pool, const uint8_t *chaddr, 
+        uint32_t *addr_buf)
 {
-        for (uint32_t a = pool->start_address; a <= pool->end_address; a++) {
-                if (address_pool_get_address_allocation(pool, a) == 0) {
-                        address_pool_set_address_allocation(pool, a);
-                        *addr_buf = a;
-                        return ALLOCATOR_OK;
-                }
-        }
-
-        return ALLOCATOR_POOL_DEPLETED;
+        return (address_pool_assign(pool, chaddr, addr_buf) == 0) ? ALLOCATOR_OK : ALLOCATOR_POOL_DEPLETED;
 }
 
 int allocator_request_any_address(address_allocator_t *allocator, uint32_t *addr_buf)
@@ -144,7 +240,7 @@ int allocator_request_any_address(address_allocator_t *allocator, uint32_t *addr
         llist_foreach(allocator->address_pools, {
                 pool = (address_pool_t*)node->data;
 
-                if (pool->available_addresses == 0) {
+                if (__atomic_load_n(&pool->available_addresses, __ATOMIC_RELAXED) == 0) {
                         if (node == allocator->address_pools->last) {
                                 rv = ALLOCATOR_POOL_DEPLETED;
                                 break;
@@ -152,7 +248,7 @@ int allocator_request_any_address(address_allocator_t *allocator, uint32_t *addr
                         continue;
                 }
 
-                if(allocator_assign_first_from_pool(pool, addr_buf) == 0) {
+                if(allocator_assign_from_pool(pool, NULL, addr_buf) == 0) {
                         break;
                 }
         })
@@ -162,6 +258,33 @@ exit:
         return rv;
 }
 
+int allocator_request_address_on_interface(address_allocator_t *allocator, const char *interface,
+        const uint8_t *chaddr, uint32_t *addr_buf)
+{
+        int rv = ALLOCATOR_ERROR;
+        if_null(allocator, exit);
+        if_null(addr_buf, exit);
+
+        address_pool_t *pool = NULL;
+
+        rv = ALLOCATOR_POOL_DEPLETED;
+        llist_foreach(allocator->address_pools, {
+                pool = (address_pool_t*)node->data;
+
+                if (__atomic_load_n(&pool->available_addresses, __ATOMIC_RELAXED) == 0 || 
+                    !address_pool_is_served_on(pool, interface))
+                        continue;
+
+                if (allocator_assign_from_pool(pool, chaddr, addr_buf) == ALLOCATOR_OK) {
+                        rv = ALLOCATOR_OK;
+                        break;
+                }
+        })
+
+exit:
+        return rv;
+}
+
 int allocator_request_address_from_pool(address_allocator_t *allocator,
         const char *pool_name, uint32_t *addr_buf)
 {
@@ -174,7 +297,7 @@ int allocator_request_address_from_pool(address_allocator_t *allocator,
         if_null_log(p, exit, LOG_WARN, NULL, 
                         "Pool named %s wasnt found, make sure it exists", pool_name);
 
-        rv = allocator_assign_first_from_pool(p, addr_buf);
+        rv = allocator_assign_from_pool(p, NULL, addr_buf);
 
 exit:
         return rv;
@@ -195,15 +318,12 @@ int allocator_request_this_address(address_allocator_t *allocator,
                 goto exit;
         }
 
-        if (address_pool_get_address_allocation(p, requested_addres) == 1) {
+        /* Setting the bit fails only if address is in use, possibly taken by other thread */
+        if (address_pool_set_address_allocation(p, requested_addres) < 0) {
                 rv = ALLOCATOR_ADDR_IN_USE;
                 goto exit;
         }
 
-        if_failed_log(address_pool_set_address_allocation(p, requested_addres), 
-                exit, LOG_ERROR, NULL, "Failed to set address allocation for address %s",
-                uint32_to_ipv4_address(requested_addres));
-
         *addr_buf = requested_addres;
         rv = ALLOCATOR_OK;
 exit:
@@ -227,15 +347,11 @@ int allocator_release_address(address_allocator_t *allocator, uint32_t address)
                         "Pool containing address %s was not found, cannot release",
                         uint32_to_ipv4_address(address));
 
-        if (address_pool_get_address_allocation(p, address) == 0) {
+        if (address_pool_clear_address_allocation(p, address) < 0) {
                 rv = ALLOCATOR_ADDR_NOT_IN_USE;
                 goto exit;
         }
 
-        if_failed_log(address_pool_clear_address_allocation(p, address), 
-                exit, LOG_ERROR, NULL, "Failed to clear address allocation for address %s",
-                uint32_to_ipv4_address(address));
-
         rv = ALLOCATOR_OK;
 exit:
         return rv;
@@ -259,6 +375,7 @@ int allocator_add_dhcp_option(address_allocator_t *allocator, dhcp_option_t *opt
 
         if_failed_log(llist_append(allocator->default_options, option, false), exit,
                         LOG_ERROR, NULL,"Failed to add dhcp option to allocator");
+        allocator_options_changed(allocator);
 
         rv = ALLOCATOR_OK;
 exit:
@@ -278,12 +395,19 @@ int allocator_change_dhcp_option(address_allocator_t *allocator, uint32_t tag,
 
         memcpy(option->value.binary_data, new_value, new_length);
         option->lenght = new_length;
+        allocator_options_changed(allocator);
 
         rv = ALLOCATOR_OK;
 exit:
         return rv;
 }
 
+void allocator_options_changed(address_allocator_t *allocator)
+{
+        if (allocator)
+                __atomic_add_fetch(&allocator->options_generation, 1, __ATOMIC_RELEASE);
+}
+
 bool allocator_is_address_available(address_allocator_t *allocator, uint32_t address)
 {
         if_null(allocator, exit);
@@ -20,9 +20,34 @@ enum allocator_status {
     ALLOCATOR_CANNOT_CREATE_LEASE = -9,
 };
 
+/* Part of address space served from pool, see allocator_t.pool_ranges */
+struct allocator_pool_range {
+    uint32_t start;
+    uint32_t end;
+    address_pool_t *pool;
+};
+
+/*
+ * Pools and default options are only modified during initialisation. Address
+ * allocation bitmasks are shared between server workers, pools take and release 
+ * addresses atomically (see address_pool_t), so workers allocate without a lock.
+ */
 typedef struct allocator {
     llist_t *default_options;
     llist_t *address_pools;
+
+    /* 
+     * Indexes of address_pools rebuilt when pool is added. pool_ranges are disjoint 
+     * and sorted by address, address in more pools belongs to the one added first. 
+     * pools_by_name is open addressing table with 2^pools_by_name_bits entries
+     */
+    struct allocator_pool_range *pool_ranges;
+    uint32_t pool_range_count;
+    address_pool_t **pools_by_name;
+    uint32_t pools_by_name_bits;
+    uint32_t pool_count;
+
+    uint32_t options_generation;    // changed whenever global or pool options change, see option_cache.h
 } address_allocator_t;
 
 /**
@@ -42,10 +67,23 @@ void allocator_destroy(address_allocator_t **a);
 /* add pool to allocator */
 int allocator_add_pool(address_allocator_t *allocator, address_pool_t *pool);
 
-/* request first available address in first pool with available address */
+/* 
+ * Addresses are chosen from pool by its strategy (see address_pool_assign), functions 
+ * without chaddr of the client assign the lowest available address from hash pools
+ */
+
+/* request available address in first pool with available address */
 int allocator_request_any_address(address_allocator_t *allocator, uint32_t *addr_buf);
 
-/* request first available address from specific pool */
+/* 
+ * request available address for client chaddr (can be NULL) in pools offered on interface 
+ * (see address_pool_is_served_on). Returns ALLOCATOR_POOL_DEPLETED if none of them has 
+ * available address
+ */
+int allocator_request_address_on_interface(address_allocator_t *allocator, const char *interface,
+        const uint8_t *chaddr, uint32_t *addr_buf);
+
+/* request available address from specific pool */
 int allocator_request_address_from_pool(address_allocator_t *allocator,
         const char *pool, uint32_t *addr_buf);
 
@@ -66,6 +104,18 @@ int allocator_add_dhcp_option(address_allocator_t *allocator, dhcp_option_t *opt
 int allocator_change_dhcp_option(address_allocator_t *allocator, uint32_t tag, 
         void *new_value, uint8_t new_length);
 
+/* 
+ * Invalidate reply options cached from global and pool options. Has to be called when 
+ * options of a pool are changed directly, allocator API functions call it themselves
+ */
+void allocator_options_changed(address_allocator_t *allocator);
+
+/* Returns current generation of options, cached reply options of other generation are stale */
+static inline uint32_t allocator_options_generation(address_allocator_t *allocator)
+{
+        return __atomic_load_n(&allocator->options_generation, __ATOMIC_ACQUIRE);
+}
+
 /* Check if address is available for lease */
 bool allocator_is_address_available(address_allocator_t *allocator, uint32_t address);
 bool allocator_is_address_available_str(address_allocator_t *allocator, const char *address);
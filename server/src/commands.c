@@ -39,12 +39,12 @@ char *command_rogue_scan(cJSON *params, dhcp_server_t *server)
 #ifndef  CONFIG_SECURITY_ENABLE_DHCP_SNOOPING
         return strdup("[\"DHCP snooping is not supported. Please read the manual.\"]");
 #else 
-        char *res = NULL;
         llist_t *ll = llist_new();
+        char buff[BUFSIZ];
 
         int i = 0;
         cJSON *e;
-        cJSON *mac;
+        cJSON *mac = NULL;
         cJSON_ArrayForEach(e, params) {
                 if (i == 0) {
                         mac = e;
@@ -59,9 +59,46 @@ char *command_rogue_scan(cJSON *params, dhcp_server_t *server)
                 i++;
         }
 
-        if (dhcp_snooper_perform_scan(server, cJSON_GetStringValue(mac), ll, &res) < 0)
+        /* Scan runs in the event loop, its result is collected by rogue-scan-result */
+        int id = dhcp_snooper_start_scan(server, cJSON_GetStringValue(mac), ll);
+        if (id < 0)
                 goto error;
 
+        cJSON *json = cJSON_CreateArray();
+        snprintf(buff, BUFSIZ, "Started scan %d, collect its result in %d seconds using rogue-scan-result %d", 
+                 id, DHCP_SNOOP_SCAN_DURATION, id);
+        cJSON_AddItemToArray(json, cJSON_CreateString(buff));
+
+        return cJSON_PrintUnformatted(json);
+error:
+        return strdup("[\"Error\"]");
+#endif
+}
+
+char *command_rogue_scan_result(cJSON *params, dhcp_server_t *server)
+{
+#ifndef  CONFIG_SECURITY_ENABLE_DHCP_SNOOPING
+        return strdup("[\"DHCP snooping is not supported. Please read the manual.\"]");
+#else 
+        char *res = NULL;
+        uint32_t id = 0;
+
+        cJSON *e = cJSON_GetArrayItem(params, 0);
+        if (!cJSON_GetStringValue(e) || sscanf(cJSON_GetStringValue(e), "%u", &id) != 1)
+                return strdup("[\"Usage: rogue-scan-result <scan-id>\"]");
+
+        switch (dhcp_snooper_scan_result(id, &res)) {
+        case DHCP_SNOOP_SCAN_RUNNING:
+                return strdup("[\"Scan is still running\"]");
+        case DHCP_SNOOP_UNKNOWN_SCAN:
+                return strdup("[\"Unknown scan, results can be collected only once\"]");
+        case DHCP_SNOOP_NO_THREAT:
+        case DHCP_SNOOP_POTENTIAL_ROGUE:
+                break;
+        default:
+                goto error;
+        }
+
         cJSON *json = cJSON_CreateArray();
         char *res_start = res;
         char *token;
@@ -87,27 +124,143 @@ char *command_pool_status(cJSON *params, dhcp_server_t *server)
         llist_t *pools = server->allocator->address_pools;
         char buff[BUFSIZ];
 
+        char start[IPV4_ADDRESS_STRLEN];
+        char end[IPV4_ADDRESS_STRLEN];
+
         address_pool_t *p;
         llist_foreach(pools, {
                 p = (address_pool_t*) node->data;
 
-                char *start = strdup(uint32_to_ipv4_address(p->start_address));
-                char *end= strdup(uint32_to_ipv4_address(p->end_address));
+                snprintf(buff, BUFSIZ, "%s (%s to %s): %u available leases", p->name, 
+                         uint32_to_ipv4_address_r(p->start_address, start, IPV4_ADDRESS_STRLEN), 
+                         uint32_to_ipv4_address_r(p->end_address, end, IPV4_ADDRESS_STRLEN), 
+                         __atomic_load_n(&p->available_addresses, __ATOMIC_RELAXED));
+                if (p->interface)
+                        snprintf(buff + strlen(buff), BUFSIZ - strlen(buff), " on %s", p->interface);
+                if (p->strategy != ADDRESS_POOL_STRATEGY_FIRST)
+                        snprintf(buff + strlen(buff), BUFSIZ - strlen(buff), ", %s strategy", 
+                                 address_pool_strategy_name(p->strategy));
+
+                cJSON_AddItemToArray(json, cJSON_CreateString(buff));
+        });
+
+        return cJSON_PrintUnformatted(json);
+error:
+        return strdup("[\"Error\"]");
+}
 
-                if (!start || !end)
+
+char *command_io_stats(cJSON *params, dhcp_server_t *server)
+{
+        if_null(server, error);
+        if_null(server->interfaces, error);
+
+        cJSON *json = cJSON_CreateArray();
+        dhcp_server_t *w;
+        dhcp_interface_t *iface;
+        io_batch_t *b;
+        char buff[BUFSIZ];
+        uint64_t xdp_drops[XDP_FILTER_DROP_COUNT];
+
+        /* XDP filter is shared by all workers */
+        if (server->xdp && xdp_filter_stats(server->xdp, xdp_drops) == 0) {
+                snprintf(buff, BUFSIZ, "XDP filter on %u interfaces dropped: %lu ACL, %lu dynamic ACL, "
+                         "%lu rate limited", server->xdp->link_count, xdp_drops[XDP_FILTER_DROP_ACL],
+                         xdp_drops[XDP_FILTER_DROP_DACL], xdp_drops[XDP_FILTER_DROP_RATE]);
+                cJSON_AddItemToArray(json, cJSON_CreateString(buff));
+        }
+
+        /* Each worker has its own interfaces and slab, worker 0 is the server itself */
+        for (uint32_t i = 0; i < server->workers.count; i++) {
+                w = (i == 0) ? server : &server->workers.servers[i - 1];
+                if (!w->interfaces)
                         continue;
 
-                snprintf(buff, BUFSIZ, "%s (%s to %s): %u available leases", 
-                         p->name, start, end, p->available_addresses);
+                if (w->slab) {
+                        snprintf(buff, BUFSIZ, "Worker %u message slab: %u of %u in use (max %u), %lu heap fallbacks",
+                                 i, w->slab->size - w->slab->free_count, w->slab->size, 
+                                 w->slab->stats.max_in_use, w->slab->stats.fallbacks);
+                        cJSON_AddItemToArray(json, cJSON_CreateString(buff));
+                        snprintf(buff, BUFSIZ, "Worker %u message slab work buffers: %u of %u in use (max %u), "
+                                 "%lu stored packets on heap", i, w->slab->work_size - w->slab->free_work_count,
+                                 w->slab->work_size, w->slab->stats.max_work_in_use, w->slab->stats.packet_fallbacks);
+                        cJSON_AddItemToArray(json, cJSON_CreateString(buff));
+                }
+
+                if (w->ingress) {
+                        for (int p = 0; p < INGRESS_PRIO_COUNT; p++) {
+                                snprintf(buff, BUFSIZ, "Worker %u ingress %s priority: %u queued (max %u of %u), "
+                                         "%lu queued in total, %lu dropped", i, ingress_priority_to_str(p),
+                                         w->ingress->queues[p].count, w->ingress->stats.max_depth[p],
+                                         w->ingress->depth, w->ingress->stats.enqueued[p],
+                                         w->ingress->stats.dropped[p]);
+                                cJSON_AddItemToArray(json, cJSON_CreateString(buff));
+                        }
+                        snprintf(buff, BUFSIZ, "Worker %u ingress shed %lu low priority packets due to backlog",
+                                 i, w->ingress->stats.shed);
+                        cJSON_AddItemToArray(json, cJSON_CreateString(buff));
+                }
 
-                free(start);
-                free(end);
+                if (w->trans_cache) {
+                        transaction_cache_t *c = w->trans_cache;
+                        snprintf(buff, BUFSIZ, "Worker %u transaction cache: %u of %u in use (max %u, limit %u), "
+                                 "%zu KiB, %lu grown, %lu shrunk, %lu evicted, %lu dropped", i, 
+                                 trans_cache_in_use(c), c->size, c->stats.max_in_use, c->max_size,
+                                 trans_cache_memory(c) >> 10, c->stats.grown, c->stats.shrunk,
+                                 c->stats.evicted, c->stats.dropped);
+                        cJSON_AddItemToArray(json, cJSON_CreateString(buff));
+                }
 
+                snprintf(buff, BUFSIZ, "Worker %u dropped before parsing: %lu server messages, "
+                         "%lu snooping, %lu ACL, %lu dynamic ACL", i, w->early_drops.replies,
+                         w->early_drops.snooping, w->early_drops.acl, w->early_drops.dynamic_acl);
                 cJSON_AddItemToArray(json, cJSON_CreateString(buff));
-        });
+
+                if (w->option_cache) {
+                        snprintf(buff, BUFSIZ, "Worker %u option cache: %lu hits, %lu misses (%lu stale)",
+                                 i, w->option_cache->stats.hits, w->option_cache->stats.misses,
+                                 w->option_cache->stats.stale);
+                        cJSON_AddItemToArray(json, cJSON_CreateString(buff));
+                }
+
+                for (uint32_t j = 0; j < w->interface_count; j++) {
+                        iface = &w->interfaces[j];
+                        b = iface->io_batch;
+                        if (!b)
+                                continue;
+
+                        snprintf(buff, BUFSIZ, "Worker %u interface %s batch size: %u", i, iface->name, b->size);
+                        cJSON_AddItemToArray(json, cJSON_CreateString(buff));
+                        snprintf(buff, BUFSIZ, "Received: %lu packets in %lu batches (largest batch %u)", 
+                                 b->stats.rx_packets, b->stats.rx_calls, b->stats.rx_max_batch);
+                        cJSON_AddItemToArray(json, cJSON_CreateString(buff));
+                        snprintf(buff, BUFSIZ, "Sent: %lu packets in %lu batches, %lu failed", 
+                                 b->stats.tx_packets, b->stats.tx_calls, b->stats.tx_dropped);
+                        cJSON_AddItemToArray(json, cJSON_CreateString(buff));
+
+                        raw_tx_t *raw = iface->raw_tx;
+                        if (raw) {
+                                snprintf(buff, BUFSIZ, "Unicast: sent %lu frames in %lu flushes, %lu dropped", 
+                                         raw->stats.tx_frames, raw->stats.tx_flushes, raw->stats.tx_dropped);
+                                cJSON_AddItemToArray(json, cJSON_CreateString(buff));
+                        }
+
+#ifdef CONFIG_IO_URING
+                        uring_t *r = iface->uring;
+                        if (!r)
+                                continue;
+
+                        snprintf(buff, BUFSIZ, "io_uring: received %lu packets (%lu rearms, %lu without buffer)", 
+                                 r->stats.rx_packets, r->stats.rx_rearms, r->stats.rx_nobufs);
+                        cJSON_AddItemToArray(json, cJSON_CreateString(buff));
+                        snprintf(buff, BUFSIZ, "io_uring: sent %lu packets, %lu failed, %lu submissions", 
+                                 r->stats.tx_packets, r->stats.tx_dropped, r->stats.submits);
+                        cJSON_AddItemToArray(json, cJSON_CreateString(buff));
+#endif
+                }
+        }
 
         return cJSON_PrintUnformatted(json);
 error:
         return strdup("[\"Error\"]");
 }
-
@@ -8,7 +8,6 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
-#include <ifaddrs.h>
 #include <arpa/inet.h>
 #include <stdio.h>
 #include <getopt.h>
@@ -19,6 +18,7 @@
 #include "RFC/RFC-2132.h"
 #include "address_pool.h"
 #include "allocator.h"
+#include "dhcp_interface.h"
 #include "cclog_macros.h"
 #include "logging.h"
 #include "dhcp_options.h"
@@ -41,35 +41,8 @@ int config_get_interface_info(dhcp_server_t *server)
         if (!server)
                 return -1;
 
-        struct ifaddrs *ifap, *ifa;
-
-        /* Get list of all interfaces and itterate through them to find out interface */
-        if (getifaddrs(&ifap) != 0) {
-                fprintf(stderr, "Failed to retrieve list of interfaces, exiting\n");
-        }
-
-        for (ifa = ifap; ifa != NULL; ifa = ifa->ifa_next) {
-                if (strcmp(ifa->ifa_name, server->config.interface) || !ifa->ifa_addr)
-                        continue;
-
-                if (ifa->ifa_addr->sa_family == AF_INET) {
-                        struct sockaddr_in *addr = (struct sockaddr_in *)ifa->ifa_addr;
-                        server->config.bound_ip = ntohl(addr->sin_addr.s_addr);
-                }
-
-                if (ifa->ifa_broadaddr != NULL && ifa->ifa_addr->sa_family == AF_INET) {
-                        struct sockaddr_in *broadcast = (struct sockaddr_in *)ifa->ifa_broadaddr;
-                        server->config.broadcast_addr = ntohl(broadcast->sin_addr.s_addr);
-                }
-
-                /* If we have both interface ip and broadcast addresses, we can exit the loop */
-                if (server->config.bound_ip && server->config.broadcast_addr)
-                        break;
-        }
-
-        freeifaddrs(ifap);
-        
-        if (!server->config.bound_ip || !server->config.broadcast_addr) {
+        if (dhcp_interface_get_addresses(server->config.interface, &server->config.bound_ip, 
+                                         &server->config.broadcast_addr) < 0) {
                 fprintf(stderr, "Failed to retrieve information on interface '%s'. Check if the "
                                 "interface name is correct", server->config.interface);
                 return -1;
@@ -132,11 +105,40 @@ static int config_load_security_config(dhcp_server_t *server, cJSON *security_co
                 server->config.dynamic_acl_enable = (object) ? cJSON_IsTrue(object) : CONFIG_DEFAULT_DACL;
         }
 
+        if (server->config.xdp_enable == CONFIG_UNTOUCHED) {
+                object = cJSON_GetObjectItem(security_config, "xdp_enable");
+                server->config.xdp_enable = (object) ? cJSON_IsTrue(object) : CONFIG_DEFAULT_XDP_ENABLE;
+        }
+
+        if (!server->config.xdp_rate_limit) {
+                object = cJSON_GetObjectItem(security_config, "xdp_rate_limit");
+                server->config.xdp_rate_limit = (object) ? cJSON_GetNumberValue(object) : CONFIG_DEFAULT_XDP_RATE_LIMIT;
+        }
+
+        if (!server->config.xdp_rate_burst) {
+                object = cJSON_GetObjectItem(security_config, "xdp_rate_burst");
+                server->config.xdp_rate_burst = (object) ? cJSON_GetNumberValue(object) : CONFIG_DEFAULT_XDP_RATE_BURST;
+        }
+
         rv = 0;
 
         return rv;
 }
 
+/* Check whether interface is primary interface or one of additional interfaces */
+static bool config_is_served_interface(dhcp_server_t *server, const char *name)
+{
+        if (!strcmp(server->config.interface, name))
+                return true;
+
+        for (uint32_t i = 0; i < server->config.interface_count; i++) {
+                if (!strcmp(server->config.interfaces[i], name))
+                        return true;
+        }
+
+        return false;
+}
+
 static int config_load_server_config(dhcp_server_t *server, cJSON *server_config)
 {
         if (!server)
@@ -161,6 +163,26 @@ static int config_load_server_config(dhcp_server_t *server, cJSON *server_config
                 }
         }
 
+        /* Additional interfaces, each with its own socket and server identifier */
+        object = cJSON_GetObjectItem(server_config, "interfaces");
+        cJSON *interface = NULL;
+        cJSON_ArrayForEach(interface, object) {
+                const char *name = cJSON_GetStringValue(interface);
+                if (!name || !strlen(name) || strlen(name) >= IFNAMSIZ) {
+                        fprintf(stderr, "Invalid interface name in interfaces list, skipping\n");
+                        continue;
+                }
+                if (config_is_served_interface(server, name))
+                        continue;
+                if (server->config.interface_count >= DHCP_MAX_INTERFACES - 1) {
+                        fprintf(stderr, "Too many interfaces, at most %d can be served\n", DHCP_MAX_INTERFACES);
+                        goto exit;
+                }
+
+                strncpy(server->config.interfaces[server->config.interface_count++], name, IFNAMSIZ - 1);
+        }
+
+        /* Period of the tick timer in milliseconds */
         if (!server->config.tick_delay) {
                 object = cJSON_GetObjectItem(server_config, "tick_delay");
                 server->config.tick_delay = (object) ? cJSON_GetNumberValue(object) : CONFIG_DEFAULT_TICK_DELAY;
@@ -171,6 +193,11 @@ static int config_load_server_config(dhcp_server_t *server, cJSON *server_config
                 server->config.cache_size = (object) ? cJSON_GetNumberValue(object) : CONFIG_DEFAULT_CACHE_SIZE;
         }
 
+        if (!server->config.cache_memory_limit) {
+                object = cJSON_GetObjectItem(server_config, "cache_memory_limit");
+                server->config.cache_memory_limit = (object) ? cJSON_GetNumberValue(object) : CONFIG_DEFAULT_CACHE_MEMORY_LIMIT;
+        }
+
         if (!server->config.trans_duration) {
                 object = cJSON_GetObjectItem(server_config, "trans_duration");
                 server->config.trans_duration = (object) ? cJSON_GetNumberValue(object) : CONFIG_DEFAULT_TRANS_DURATION;
@@ -181,6 +208,21 @@ static int config_load_server_config(dhcp_server_t *server, cJSON *server_config
                 server->config.lease_expiration_check = (object) ? cJSON_GetNumberValue(object) : CONFIG_DEFAULT_LEASE_EXPIRATION_CHECK;
         }
 
+        if (!server->config.batch_size) {
+                object = cJSON_GetObjectItem(server_config, "batch_size");
+                server->config.batch_size = (object) ? cJSON_GetNumberValue(object) : CONFIG_DEFAULT_BATCH_SIZE;
+        }
+
+        if (!server->config.workers) {
+                object = cJSON_GetObjectItem(server_config, "workers");
+                server->config.workers = (object) ? cJSON_GetNumberValue(object) : CONFIG_DEFAULT_WORKERS;
+        }
+
+        if (!server->config.ingress_depth) {
+                object = cJSON_GetObjectItem(server_config, "ingress_depth");
+                server->config.ingress_depth = (object) ? cJSON_GetNumberValue(object) : CONFIG_DEFAULT_INGRESS_DEPTH;
+        }
+
         if (!server->config.log_verbosity) {
                 object = cJSON_GetObjectItem(server_config, "log_verbosity");
                 server->config.log_verbosity = (object) ? cJSON_GetNumberValue(object) : CONFIG_DEFAULT_LOG_VERBOSITY;
@@ -196,6 +238,11 @@ static int config_load_server_config(dhcp_server_t *server, cJSON *server_config
                 server->config.db_enable = (object) ? cJSON_IsTrue(object) : CONFIG_DEFAULT_DB_ENABLE;
         }
 
+        if (server->config.unicast_enable == CONFIG_UNTOUCHED) {
+                object = cJSON_GetObjectItem(server_config, "unicast_enable");
+                server->config.unicast_enable = (object) ? cJSON_IsTrue(object) : CONFIG_DEFAULT_UNICAST_ENABLE;
+        }
+
         rv = 0;
 exit:
         return rv;
@@ -344,6 +391,27 @@ static int config_load_pools_config(dhcp_server_t *server, cJSON *pools_config)
                         continue;
                 }
 
+                /* Pool without interface is offered on every interface */
+                object = cJSON_GetObjectItem(pool, "interface");
+                if (object && cJSON_GetStringValue(object)) {
+                        new_pool->interface = strdup(cJSON_GetStringValue(object));
+                        if (!config_is_served_interface(server, new_pool->interface))
+                                fprintf(stderr, "Warning: pool %s is assigned to interface %s, which "
+                                                "is not served\n", pool_name, new_pool->interface);
+                }
+
+                /* Pool without strategy assigns the lowest available address */
+                object = cJSON_GetObjectItem(pool, "strategy");
+                if (object && cJSON_GetStringValue(object)) {
+                        int strategy = address_pool_strategy_parse(cJSON_GetStringValue(object));
+                        if (strategy < 0)
+                                fprintf(stderr, "Unknown address selection strategy %s of pool %s, "
+                                                "using first\n", cJSON_GetStringValue(object), pool_name);
+                        else if (address_pool_set_strategy(new_pool, strategy) < 0)
+                                fprintf(stderr, "Failed to set address selection strategy of pool "
+                                                "%s, using first\n", pool_name);
+                }
+
                 /* Add dhcp options to pool, options can be null */
                 object = cJSON_GetObjectItem(pool, "options");
                 if (object && config_load_dhcp_options(new_pool->dhcp_option_override, object) < 0) {
@@ -421,16 +489,24 @@ static int config_load_defaults(dhcp_server_t *server)
         strcpy(server->config.interface, optarg);
         server->config.tick_delay = CONFIG_DEFAULT_TICK_DELAY;
         server->config.cache_size = CONFIG_DEFAULT_CACHE_SIZE;
+        server->config.cache_memory_limit = CONFIG_DEFAULT_CACHE_MEMORY_LIMIT;
         server->config.trans_duration = CONFIG_DEFAULT_TRANS_DURATION;
         server->config.lease_expiration_check = CONFIG_DEFAULT_LEASE_EXPIRATION_CHECK;
         server->config.log_verbosity = CONFIG_DEFAULT_LOG_VERBOSITY;
         server->config.lease_time = CONFIG_DEFAULT_LEASE_TIME;
+        server->config.batch_size = CONFIG_DEFAULT_BATCH_SIZE;
+        server->config.workers = CONFIG_DEFAULT_WORKERS;
+        server->config.ingress_depth = CONFIG_DEFAULT_INGRESS_DEPTH;
+        server->config.xdp_rate_limit = CONFIG_DEFAULT_XDP_RATE_LIMIT;
+        server->config.xdp_rate_burst = CONFIG_DEFAULT_XDP_RATE_BURST;
         
         /* Default config doesnt have acl at all */
         server->config.acl_enable = CONFIG_BOOL_FALSE;
         server->config.acl_blacklist = CONFIG_BOOL_FALSE;
         server->config.db_enable = CONFIG_DEFAULT_DB_ENABLE;
         server->config.dynamic_acl_enable = CONFIG_DEFAULT_DACL;
+        server->config.unicast_enable = CONFIG_DEFAULT_UNICAST_ENABLE;
+        server->config.xdp_enable = CONFIG_DEFAULT_XDP_ENABLE;
         
         uint32_t lease_time_value = CONFIG_DEFAULT_LEASE_TIME;
         if (dhcp_option_add(server->allocator->default_options, dhcp_option_new_values(
@@ -577,6 +653,8 @@ int config_parse_arguments(dhcp_server_t *server, int argc, char **argv)
         server->config.acl_blacklist = CONFIG_UNTOUCHED;
         server->config.db_enable = CONFIG_UNTOUCHED;
         server->config.dynamic_acl_enable = CONFIG_UNTOUCHED;
+        server->config.unicast_enable = CONFIG_UNTOUCHED;
+        server->config.xdp_enable = CONFIG_UNTOUCHED;
 
         static struct option long_options[] = {
                 {"version",                 no_argument,        0, 'v'},
@@ -591,12 +669,16 @@ int config_parse_arguments(dhcp_server_t *server, int argc, char **argv)
                 {"lease-expiration-check",  required_argument, 0, 'e'},
                 {"lease-time",              required_argument, 0, 'l'},
                 {"log",                     required_argument, 0,  2 },
+                {"batch-size",              required_argument, 0, 'b'},
+                {"workers",                 required_argument, 0, 'w'},
+                {"ingress-depth",           required_argument, 0, 'q'},
 
                 {"acl-disable",             no_argument,       0,  3 },
                 {"acl-whitelist-mode",      no_argument,       0,  4 },
                 {"dynamic-acl-disable",     no_argument,       0,  5 },
 
                 {"db-disable",              no_argument,       0,  6 },
+                {"unicast-enable",          no_argument,       0,  7 },
 
                 {"pool",    required_argument, 0, 'p'},
                 {"option",  required_argument, 0, 'o'},
@@ -607,7 +689,7 @@ int config_parse_arguments(dhcp_server_t *server, int argc, char **argv)
         int option_index = 0;
 
         rv = 0;
-        while ((opt = getopt_long(argc, argv, "vhci:d:s:t:e:l:p:o:", long_options, &option_index)) != -1 && rv == 0) {
+        while ((opt = getopt_long(argc, argv, "vhci:d:s:t:e:l:b:w:q:p:o:", long_options, &option_index)) != -1 && rv == 0) {
                 switch (opt) {
                 case 'v':
                         print_version();
@@ -643,6 +725,18 @@ int config_parse_arguments(dhcp_server_t *server, int argc, char **argv)
                         if (sscanf(optarg, "%u", &server->config.lease_time) != 1)
                                 rv = -1;
                         break;
+                case 'b':
+                        if (sscanf(optarg, "%u", &server->config.batch_size) != 1)
+                                rv = -1;
+                        break;
+                case 'w':
+                        if (sscanf(optarg, "%u", &server->config.workers) != 1)
+                                rv = -1;
+                        break;
+                case 'q':
+                        if (sscanf(optarg, "%u", &server->config.ingress_depth) != 1)
+                                rv = -1;
+                        break;
                 case 'p':
                         rv = config_add_pool(server);
                         break;
@@ -673,6 +767,9 @@ int config_parse_arguments(dhcp_server_t *server, int argc, char **argv)
                 case 6:
                         server->config.db_enable = CONFIG_BOOL_FALSE;
                         break;
+                case 7:
+                        server->config.unicast_enable = CONFIG_BOOL_TRUE;
+                        break;
                 default:
                         if (optopt == 0) {
                                 fprintf(stderr, "Unknown option '%s' use --help for usage\n", argv[optind - 1]);
@@ -694,9 +791,15 @@ void _config_dump(dhcp_server_t *server)
         printf("Broadcast ip: %s\n", uint32_to_ipv4_address(server->config.broadcast_addr));
         printf("config path:  %s\n", server->config.config_path);
         printf("interface:    %s\n", server->config.interface);
+        for (uint32_t i = 0; i < server->config.interface_count; i++)
+                printf("interface:    %s\n", server->config.interfaces[i]);
 
-        printf("tick delay:   %u\n", server->config.tick_delay);
+        printf("tick delay:   %u ms\n", server->config.tick_delay);
         printf("cache size:   %u\n", server->config.cache_size);
+        printf("cache memory: %u\n", server->config.cache_memory_limit);
+        printf("batch size:   %u\n", server->config.batch_size);
+        printf("workers:      %u\n", server->config.workers);
+        printf("ingress depth: %u\n", server->config.ingress_depth);
         printf("trans durat:  %u\n", server->config.trans_duration);
         printf("lease expir:  %u\n", server->config.lease_expiration_check);
         printf("lease time:   %u\n", server->config.lease_time);
@@ -705,6 +808,10 @@ void _config_dump(dhcp_server_t *server)
         printf("dacl enable:  %d\n", server->config.dynamic_acl_enable);
         printf("acl blacklist:  %d\n", server->config.acl_blacklist);
         printf("db_enable:  %d\n", server->config.db_enable);
+        printf("unicast enable:  %d\n", server->config.unicast_enable);
+        printf("xdp enable:  %d\n", server->config.xdp_enable);
+        printf("xdp rate limit:  %u\n", server->config.xdp_rate_limit);
+        printf("xdp rate burst:  %u\n", server->config.xdp_rate_burst);
         
         llist_foreach(server->acl->entries, {
                 printf("%s\n", (char *)node->data);
@@ -11,11 +11,17 @@
 #define CONFIG_BOOL_TRUE  1 
 
 #define CONFIG_DEFAULT_PATH "/etc/dhcp/config.json"
-#define CONFIG_DEFAULT_TICK_DELAY 1000
+#define CONFIG_DEFAULT_TICK_DELAY 1000         // ms
 #define CONFIG_DEFAULT_CACHE_SIZE 25
+#define CONFIG_DEFAULT_CACHE_MEMORY_LIMIT 16
 #define CONFIG_DEFAULT_TRANS_DURATION 60
 #define CONFIG_DEFAULT_LEASE_EXPIRATION_CHECK 60
 #define CONFIG_DEFAULT_LOG_VERBOSITY 4
+#define CONFIG_DEFAULT_BATCH_SIZE 32
+#define CONFIG_DEFAULT_WORKERS 1
+#define CONFIG_DEFAULT_INGRESS_DEPTH 256
+#define CONFIG_DEFAULT_XDP_RATE_LIMIT 0
+#define CONFIG_DEFAULT_XDP_RATE_BURST 10
 
 #define CONFIG_DEFAULT_LEASE_TIME 43200
 #define CONFIG_DEFAULT_POOL_NAME "Pool"
@@ -27,6 +33,8 @@
 #define CONFIG_DEFAULT_ACL_BLACKLIST    CONFIG_BOOL_TRUE
 #define CONFIG_DEFAULT_DB_ENABLE        CONFIG_BOOL_TRUE
 #define CONFIG_DEFAULT_DACL             CONFIG_BOOL_TRUE
+#define CONFIG_DEFAULT_UNICAST_ENABLE   CONFIG_BOOL_FALSE
+#define CONFIG_DEFAULT_XDP_ENABLE       CONFIG_BOOL_FALSE
 
 int config_parse_arguments(dhcp_server_t *server, int argc, char **argv);
 
@@ -1,6 +1,7 @@
 #include "database.h"
 #include "dhcp_packet.h"
 #include "logging.h"
+#include "message_slab.h"
 #include "transaction.h"
 #include "utils/xtoy.h"
 #include <cclog.h>
@@ -18,9 +19,22 @@
 #include <stdlib.h>
 
 #define DB_FILE_PATH_FORMAT "/var/dhcp/database/%08x_%02x%02x%02x%02x%02x%02x.dhcp"
-#define METADATA_FORMAT "T:%08lxCA:%02x%02x%02x%02x%02x%02xP:"
+/* L is lenght of packet following the metadata, entries without it have whole dhcp_packet_t */
+#define METADATA_FORMAT "T:%08lxCA:%02x%02x%02x%02x%02x%02xL:%04zxP:"
 #define METADATA_LEN 128
 
+/* Lenght of packet stored after metadata in buff */
+static size_t database_packet_lenght(const char *buff)
+{
+        const char *l = strstr(buff, "L:");
+        unsigned int lenght;
+
+        if (!l || sscanf(l, "L:%04x", &lenght) != 1 || lenght > sizeof(dhcp_packet_t))
+                return sizeof(dhcp_packet_t);
+
+        return lenght;
+}
+
 int database_store_message(dhcp_message_t *message)
 {
         if (!message)
@@ -48,11 +62,12 @@ int database_store_message(dhcp_message_t *message)
                 message->chaddr[2],
                 message->chaddr[3],
                 message->chaddr[4],
-                message->chaddr[5]);
+                message->chaddr[5],
+                dhcp_message_lenght(message));
         
         if_failed_log_n((rv = write(fd, buff, METADATA_LEN)), exit, LOG_WARN, NULL, "Failed to write message "
                         "from %lx metadata to database. %s", time(NULL), strerror(errno));
-        if_failed_log_n(write(fd, &message->packet, sizeof(dhcp_packet_t)), exit, LOG_WARN, NULL, 
+        if_failed_log_n(write(fd, message->packet, dhcp_message_lenght(message)), exit, LOG_WARN, NULL, 
                 "Failed to write message from %lx packet data to database. %s", message->xid, strerror(errno));
 
         rv = 0;
@@ -69,6 +84,7 @@ transaction_t *database_load_transaction(uint32_t xid, uint8_t mac[6])
         if (!xid || !mac)
                 return NULL;
 
+        dhcp_message_t *message = NULL;
         transaction_t *trans = trans_new(0);
         if_null_log(trans, error, LOG_ERROR, NULL, "Failed to allocate space for transaction");
 
@@ -77,30 +93,38 @@ transaction_t *database_load_transaction(uint32_t xid, uint8_t mac[6])
         int fd = open(path, O_RDONLY);
         if_failed_log_n(fd, error, LOG_ERROR, NULL, "Failed to open database file: %s", strerror(errno));
 
-        dhcp_message_t *message = dhcp_message_new();
-        if_null_log(message, error, LOG_ERROR, NULL, "Cannot allocate space for dhcp message");
-
         char buff[BUFSIZ];
         int rv = 0;
         do {
+                /* Transaction keeps reference to the message, so every message needs its own */
+                dhcp_message_unref(&message);
+                message = dhcp_message_new();
+                if_null_log(message, error, LOG_ERROR, NULL, "Cannot allocate space for dhcp message");
+
                 memset(buff, 0, BUFSIZ);
                 if_failed_log_n((rv = read(fd, buff, METADATA_LEN)), error, LOG_ERROR, NULL, 
                         "Failed to read from database file %s. %s", path, strerror(errno));
-                if_failed_log_n((rv = read(fd, &message->packet, sizeof(dhcp_packet_t))), error, LOG_ERROR, NULL, 
+                if (rv == 0)
+                        break;
+                if_failed_log_n((rv = read(fd, message->packet, database_packet_lenght(buff))), error, LOG_ERROR, NULL, 
                         "Failed to read from database file %s. %s", path, strerror(errno));
                 if (rv == 0)
                         break;
+                message->packet_lenght = rv;
 
                 if (sscanf(buff, "T:%08lx", (unsigned long *)&message->time) != 1) {
                         cclog(LOG_ERROR, NULL, "Corrupted metadata in transaction %lx", xid);
                         continue;
                 }
                 if_failed_log(dhcp_packet_parse(message), error, LOG_ERROR, NULL, "Failed to parse dhcp message from database");
+                if_failed_log(dhcp_message_compact(message), error, LOG_ERROR, NULL, "Failed to store dhcp message from database");
                 if_failed_log(trans_add(trans, message), error, LOG_ERROR, NULL, "Failed to load dhcp message to transaction");
         } while (true);
 
+        dhcp_message_unref(&message);
         return trans;
 error:
+        dhcp_message_unref(&message);
         if (trans)
                 trans_destroy(&trans);
         return NULL;
@@ -0,0 +1,56 @@
+#include "dhcp_interface.h"
+#include <arpa/inet.h>
+#include <ifaddrs.h>
+#include <string.h>
+#include <unistd.h>
+
+int dhcp_interface_get_addresses(const char *name, uint32_t *bound_ip, uint32_t *broadcast_addr)
+{
+        if (!name || !bound_ip || !broadcast_addr)
+                return -1;
+
+        struct ifaddrs *ifap, *ifa;
+        uint32_t ip = 0;
+        uint32_t broadcast = 0;
+
+        if (getifaddrs(&ifap) != 0)
+                return -1;
+
+        for (ifa = ifap; ifa != NULL; ifa = ifa->ifa_next) {
+                if (strcmp(ifa->ifa_name, name) || !ifa->ifa_addr || ifa->ifa_addr->sa_family != AF_INET)
+                        continue;
+
+                ip = ntohl(((struct sockaddr_in *)ifa->ifa_addr)->sin_addr.s_addr);
+                if (ifa->ifa_broadaddr)
+                        broadcast = ntohl(((struct sockaddr_in *)ifa->ifa_broadaddr)->sin_addr.s_addr);
+
+                /* If we have both interface ip and broadcast addresses, we can exit the loop */
+                if (ip && broadcast)
+                        break;
+        }
+
+        freeifaddrs(ifap);
+
+        if (!ip || !broadcast)
+                return -1;
+
+        *bound_ip = ip;
+        *broadcast_addr = broadcast;
+        return 0;
+}
+
+void dhcp_interface_close(dhcp_interface_t *iface)
+{
+        if (!iface)
+                return;
+
+        io_batch_destroy(&iface->io_batch);
+#ifdef CONFIG_IO_URING
+        uring_destroy(&iface->uring);
+#endif
+        raw_tx_destroy(&iface->raw_tx);
+
+        if (iface->sock_fd >= 0)
+                close(iface->sock_fd);
+        iface->sock_fd = -1;
+}
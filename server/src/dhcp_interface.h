@@ -0,0 +1,39 @@
+#ifndef __DHCP_INTERFACE_H__
+#define __DHCP_INTERFACE_H__
+
+#include "io_batch.h"
+#include "uring.h"
+#include "raw_tx.h"
+#include <net/if.h>
+#include <stdint.h>
+
+/* Maximum number of interfaces served by one server process */
+#define DHCP_MAX_INTERFACES 64
+
+/*
+ * Network interface served by the server. When server serves more interfaces,
+ * every interface has its own socket bound to the device, so the interface on
+ * which a message arrived is known from the socket it was read from. Replies
+ * use server identifier and broadcast address of that interface.
+ */
+typedef struct dhcp_interface {
+    char name[IFNAMSIZ];
+    uint32_t bound_ip;              // HOST BYTE ORDER, server identifier on this interface
+    uint32_t broadcast_addr;        // HOST BYTE ORDER
+
+    int sock_fd;
+    io_batch_t *io_batch;           // batched socket I/O, NULL until server starts serving
+    uring_t *uring;                 // io_uring backend, NULL if not built with CONFIG_IO_URING
+    raw_tx_t *raw_tx;               // packet tx ring for unicast to clients without address, NULL if disabled
+} dhcp_interface_t;
+
+/*
+ * Retrieve ip address and broadcast address (HOST BYTE ORDER) of interface name.
+ * Returns 0 on success, -1 if the interface doesnt exist or has no IPv4 address
+ */
+int dhcp_interface_get_addresses(const char *name, uint32_t *bound_ip, uint32_t *broadcast_addr);
+
+/* Free I/O resources of interface and close its socket */
+void dhcp_interface_close(dhcp_interface_t *iface);
+
+#endif // !__DHCP_INTERFACE_H__
@@ -169,6 +169,28 @@ exit:
         return rv;
 }
 
+/*
+ * Find next option in raw_options starting at *i, pad bytes are skipped. Stores offset 
+ * of the option tag into *i. Returns 1 if option was found, 0 at the end of options 
+ * and -1 if the option does not fit into raw_options
+ */
+static int next_option(const uint8_t raw_options[], size_t *i)
+{
+        while (*i < DHCP_PACKET_OPTIONS_SIZE && raw_options[*i] == DHCP_OPTION_PAD)
+                (*i)++;
+
+        if (*i >= DHCP_PACKET_OPTIONS_SIZE || raw_options[*i] == DHCP_OPTION_END)
+                return 0;
+
+        if (*i + 2 > DHCP_PACKET_OPTIONS_SIZE || 
+            *i + 2 + raw_options[*i + 1] > DHCP_PACKET_OPTIONS_SIZE) {
+                cclog(LOG_WARN, NULL, "DHCP option %d exceeds options field", raw_options[*i]);
+                return -1;
+        }
+
+        return 1;
+}
+
 int dhcp_option_parse(llist_t *dest, uint8_t raw_options[])
 {
         int rv = -1;
@@ -177,14 +199,11 @@ int dhcp_option_parse(llist_t *dest, uint8_t raw_options[])
         
         dhcp_option_t *option = NULL;
         uint8_t value_buf[DHCP_OPTION_MAX_LENGHT];
+        size_t i = 0;
 
-        for (size_t i = 0; i < DHCP_PACKET_OPTIONS_SIZE;) {
-                if (raw_options[i] == DHCP_OPTION_PAD)
-                        continue;
-                if (raw_options[i] == DHCP_OPTION_END)
-                        break;
-
+        while ((rv = next_option(raw_options, &i)) > 0) {
                 option = dhcp_option_new();
+                if_null(option, error);
                 option->tag = raw_options[i++];
                 option->type = dhcp_option_tag_to_type(option->tag);
                 option->lenght = raw_options[i++];
@@ -193,38 +212,182 @@ int dhcp_option_parse(llist_t *dest, uint8_t raw_options[])
                 memcpy(value_buf, raw_options+i, option->lenght);
 
                 if_failed_log(parse_option_value(option, value_buf), 
-                        exit, LOG_WARN, NULL, "Invalid dhcp option %d value", option->tag);
+                        error, LOG_WARN, NULL, "Invalid dhcp option %d value", option->tag);
                 if_failed_log(dhcp_option_add(dest, option),
-                                exit, LOG_ERROR, NULL, "Failed to add dhcp option");
+                                error, LOG_ERROR, NULL, "Failed to add dhcp option");
 
                 i += option->lenght;
         }       
 
-        rv = 0;
 exit:
         return rv;
+error:
+        dhcp_option_destroy(&option);
+        return -1;
+}
+
+int dhcp_option_view_parse(dhcp_option_view_t *view, const uint8_t raw_options[])
+{
+        if (!view || !raw_options)
+                return -1;
+
+        int rv;
+        size_t i = 0;
+        uint8_t tag;
+        uint32_t count = 0;
+
+        memset(view, 0, sizeof(dhcp_option_view_t));
+
+        /* First pass marks present tags, so slots of tags are known */
+        while ((rv = next_option(raw_options, &i)) > 0) {
+                tag = raw_options[i];
+                if (!dhcp_option_view_has(view, tag)) {
+                        /* Tags left out could hide options the server relies on, e.g. 53 or 82 */
+                        if (count == DHCP_OPTION_VIEW_SIZE) {
+                                cclog(LOG_WARN, NULL, "DHCP options hold more than %d distinct tags",
+                                                DHCP_OPTION_VIEW_SIZE);
+                                rv = -1;
+                                break;
+                        }
+                        view->present[tag >> 6] |= 1ULL << (tag & 63);
+                        count++;
+                }
+
+                i += 2 + raw_options[i + 1];
+        }
+
+        for (int w = 1; w < 4; w++)
+                view->rank[w] = view->rank[w - 1] + __builtin_popcountll(view->present[w - 1]);
+
+        /* Second pass stores offset of first occurence of every present tag */
+        i = 0;
+        while (next_option(raw_options, &i) > 0) {
+                tag = raw_options[i];
+                if (dhcp_option_view_has(view, tag)) {
+                        uint16_t *offset = &view->offset[dhcp_option_view_slot(view, tag)];
+                        if (!*offset)
+                                *offset = i + 2;
+                }
+
+                i += 2 + raw_options[i + 1];
+        }
+
+        return rv;
+}
+
+int dhcp_option_view_number(const dhcp_option_view_t *view, const uint8_t raw_options[], 
+        uint8_t tag, uint32_t *value)
+{
+        if (!view || !raw_options)
+                return -1;
+
+        uint8_t lenght = 0;
+        const uint8_t *v = dhcp_option_view_get(view, raw_options, tag, &lenght);
+
+        return dhcp_option_value_number(v, lenght, value);
+}
+
+const uint8_t *dhcp_options_find(const uint8_t raw_options[], size_t size, uint8_t tag, uint8_t *lenght)
+{
+        if (!raw_options)
+                return NULL;
+
+        for (size_t i = 0; i < size;) {
+                if (raw_options[i] == DHCP_OPTION_PAD) {
+                        i++;
+                        continue;
+                }
+                if (raw_options[i] == DHCP_OPTION_END || i + 2 > size || 
+                    i + 2 + raw_options[i + 1] > size)
+                        break;
+                if (raw_options[i] == tag) {
+                        if (lenght)
+                                *lenght = raw_options[i + 1];
+                        return raw_options + i + 2;
+                }
+
+                i += 2 + raw_options[i + 1];
+        }
+
+        return NULL;
+}
+
+size_t dhcp_options_used(const uint8_t raw_options[], size_t size)
+{
+        if (!raw_options)
+                return 0;
+
+        for (size_t i = 0; i < size;) {
+                if (raw_options[i] == DHCP_OPTION_PAD) {
+                        i++;
+                        continue;
+                }
+                if (raw_options[i] == DHCP_OPTION_END)
+                        return i + 1;
+                if (i + 2 > size)
+                        break;
+
+                i += 2 + raw_options[i + 1];
+        }
+
+        return size;
+}
+
+int dhcp_option_value_number(const uint8_t *v, uint8_t lenght, uint32_t *value)
+{
+        if (!v || !value || lenght == 0 || lenght > 4)
+                return -1;
+
+        *value = 0;
+        for (uint8_t i = 0; i < lenght; i++)
+                *value = (*value << 8) | v[i];
+
+        return 0;
 }
 
 int dhcp_options_serialize(llist_t *options, uint8_t raw_options[])
+{
+        return dhcp_options_serialize_at(options, raw_options, 0);
+}
+
+int dhcp_options_serialize_at(llist_t *options, uint8_t raw_options[], size_t offset)
 {
         int rv = -1;
         if_null(options, exit);
+
+        llnode_t *next = llist_get_index(options, 0);
+        if_failed_n(dhcp_options_serialize_part(&next, raw_options, offset, DHCP_PACKET_OPTIONS_SIZE), exit);
+        if (next) {
+                cclog(LOG_INFO, NULL, "Cannot serialize option %d and onwards: maximum "
+                                "dhcp options size would be exceeded", ((dhcp_option_t*)next->data)->tag);
+                goto exit;
+        }
+
+        rv = 0;
+exit:
+        return rv;
+}
+
+int dhcp_options_serialize_part(llnode_t **from, uint8_t raw_options[], size_t offset, size_t size)
+{
+        int rv = -1;
+        if_null(from, exit);
         if_null(raw_options, exit);
+        if_false_log((offset < size), exit, LOG_ERROR, NULL, 
+                        "Options offset %zu exceeds options field", offset);
 
         dhcp_option_t *o = NULL;
-        size_t bytes = 0;
+        size_t bytes = offset;
+        llnode_t *node = *from;
 
-        llist_foreach(options, {
+        for (; node; node = node->next) {
                 o = (dhcp_option_t*)node->data;
                 if (!o)
                         continue;
 
-                if ((bytes + 2 + o->lenght) > DHCP_PACKET_OPTIONS_SIZE) {
-                        cclog(LOG_INFO, NULL, "Cannot serialize option %d and onwards: maximum "
-                                        "dhcp options size would be exceeded", o->tag);
-                        raw_options[bytes] = 0xff;
-                        goto exit;
-                }
+                /* One byte is left for END */
+                if ((bytes + 2 + o->lenght) >= size)
+                        break;
 
                 raw_options[bytes++] = o->tag;
                 raw_options[bytes++] = o->lenght;
@@ -232,12 +395,13 @@ int dhcp_options_serialize(llist_t *options, uint8_t raw_options[])
                                 "Invalid DHCP option %d value, cannot serialize", o->tag);
 
                 bytes += o->lenght;
-        })
+        }
 
         /* Terminate DHCP options */
-        raw_options[bytes] = 0xff;
+        raw_options[bytes++] = DHCP_OPTION_END;
+        *from = node;
 
-        rv = 0;
+        rv = bytes;
 exit:
         return rv;
 }
@@ -307,15 +471,24 @@ void dhcp_option_destroy_list(llist_t **ll)
         if (!ll || !*ll)
                 return;
 
+        dhcp_option_clear_list(*ll);
+        llist_destroy(ll);
+}
+
+void dhcp_option_clear_list(llist_t *ll)
+{
+        if (!ll)
+                return;
+
         dhcp_option_t *o;
 
-        llist_foreach(*ll, {
+        llist_foreach(ll, {
                 o = (dhcp_option_t*)node->data;
                 if (o)
                         dhcp_option_destroy(&o);
         })
 
-        llist_destroy(ll);
+        llist_clear(ll);
 }
 
 void dhcp_options_dump(llist_t *l)
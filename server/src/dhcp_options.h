@@ -5,6 +5,7 @@
 #include "utils/llist.h"
 #include "RFC/RFC-2132.h"
 
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 
@@ -30,6 +31,25 @@ typedef struct dhcp_option {
     } value;
 } dhcp_option_t;
 
+/* Maximum number of distinct options held by dhcp_option_view_t */
+#define DHCP_OPTION_VIEW_SIZE 64
+
+/*
+ * Parsed view of raw dhcp options of a received packet. present is a bitmap of tags
+ * found in the options, offset holds offset of the option value inside the raw options
+ * for every present tag in ascending order of tags. Slot of a tag is the number of
+ * present tags lower than it, counted from rank (present tags in preceding words of
+ * the bitmap) and popcount of the tag word, so options are looked up in constant time
+ * without copying them. Lenght of value is the byte preceding it in the raw options.
+ * If an option appears more than once, first occurence is used. At most
+ * DHCP_OPTION_VIEW_SIZE distinct tags are held, clients send far fewer.
+ */
+typedef struct dhcp_option_view {
+    uint64_t present[4];
+    uint8_t rank[4];
+    uint16_t offset[DHCP_OPTION_VIEW_SIZE];
+} dhcp_option_view_t;
+
 /**
  * Allocate memory for dhcp_option_t struct */
 dhcp_option_t* dhcp_option_new();
@@ -49,18 +69,93 @@ void dhcp_option_destroy(dhcp_option_t **option);
  */
 void dhcp_option_destroy_list(llist_t **ll);
 
+/**
+ * Frees all DHCP options in the list, the list itself stays allocated and empty
+ */
+void dhcp_option_clear_list(llist_t *ll);
+
 /**
  * Parse raw_options[] into multiple dhcp_option_t and put them into the 
  * dest linked list 
  */
 int dhcp_option_parse(llist_t *dest, uint8_t raw_options[]);
 
+/*
+ * Fill view with options in raw_options[] (DHCP_PACKET_OPTIONS_SIZE bytes), nothing
+ * is allocated. Returns 0 on success, -1 if an option runs past the end of raw_options 
+ * or options hold more than DHCP_OPTION_VIEW_SIZE distinct tags (view then holds 
+ * options preceding it)
+ */
+int dhcp_option_view_parse(dhcp_option_view_t *view, const uint8_t raw_options[]);
+
+static inline bool dhcp_option_view_has(const dhcp_option_view_t *view, uint8_t tag)
+{
+        return (view->present[tag >> 6] >> (tag & 63)) & 1;
+}
+
+/* Returns index of present tag into view->offset */
+static inline uint32_t dhcp_option_view_slot(const dhcp_option_view_t *view, uint8_t tag)
+{
+        uint64_t lower = view->present[tag >> 6] & ((1ULL << (tag & 63)) - 1);
+        return view->rank[tag >> 6] + __builtin_popcountll(lower);
+}
+
+/* Returns value of option tag in raw_options and stores its lenght, NULL if it is not present */
+static inline const uint8_t *dhcp_option_view_get(const dhcp_option_view_t *view, 
+        const uint8_t raw_options[], uint8_t tag, uint8_t *lenght)
+{
+        if (!dhcp_option_view_has(view, tag))
+                return NULL;
+
+        uint16_t offset = view->offset[dhcp_option_view_slot(view, tag)];
+
+        if (lenght)
+                *lenght = raw_options[offset - 1];
+        return raw_options + offset;
+}
+
+/*
+ * Store numeric or ip value (HOST BYTE ORDER) of option tag into value. Returns 0 on
+ * success, -1 if the option is not present, is empty or is longer than 4 bytes
+ */
+int dhcp_option_view_number(const dhcp_option_view_t *view, const uint8_t raw_options[], 
+        uint8_t tag, uint32_t *value);
+
+/*
+ * Returns value of first option tag in size bytes of raw_options and stores its lenght, 
+ * NULL if it is not present. Options are walked, use for packets without view
+ */
+const uint8_t *dhcp_options_find(const uint8_t raw_options[], size_t size, uint8_t tag, uint8_t *lenght);
+
+/* 
+ * Returns number of bytes of raw_options (size bytes) up to and including END option,
+ * size if options are not terminated
+ */
+size_t dhcp_options_used(const uint8_t raw_options[], size_t size);
+
+/*
+ * Store option value v of lenght bytes as number (HOST BYTE ORDER) into value. Returns 0 
+ * on success, -1 if v is NULL, empty or longer than 4 bytes
+ */
+int dhcp_option_value_number(const uint8_t *v, uint8_t lenght, uint32_t *value);
+
 /**
  * Serializes parsed dhcp options from linked list to raw_options,
  * which can be sent as a part of DHCP message
  */
 int dhcp_options_serialize(llist_t *options, uint8_t raw_options[]);
 
+/* Same as dhcp_options_serialize, but options are written from offset of raw_options */
+int dhcp_options_serialize_at(llist_t *options, uint8_t raw_options[], size_t offset);
+
+/*
+ * Serializes options starting at node *from into raw_options of size bytes, from offset
+ * and terminated by END. Serialization stops at the first option which does not fit,
+ * *from is set to it so the rest can be placed elsewhere (NULL when all options fit).
+ * Returns number of bytes of raw_options used including END, -1 on failure
+ */
+int dhcp_options_serialize_part(llnode_t **from, uint8_t raw_options[], size_t offset, size_t size);
+
 /**
  * Retrieve a dhcp_option_t from linked list based on tag 
  */
@@ -54,100 +54,144 @@ void dhcp_packet_dump(dhcp_packet_t *p)
         printf("\n");
 }
 
-int dhcp_packet_parse(dhcp_message_t *m)
+int dhcp_packet_peek_type(const dhcp_packet_t *packet)
 {
-        int rv = -1;
-        if_null(m, exit);
+        if (!packet)
+                return -1;
 
-        m->opcode = m->packet.opcode;
-        m->htype = m->packet.htype;
-        m->hlen = m->packet.hlen;
-        m->hops = m->packet.hops;
+        /* Bounded walk over options until message type is found */
+        uint8_t lenght = 0;
+        const uint8_t *type = dhcp_options_find(packet->options, sizeof(packet->options), 
+                                                DHCP_OPTION_DHCP_MESSAGE_TYPE, &lenght);
 
-        m->xid = ntohl(m->packet.xid);
-        m->secs = ntohs(m->packet.secs);
-        m->flags = ntohs(m->packet.flags);
+        return type && lenght == 1 ? *type : -1;
+}
 
-        m->ciaddr = ntohl(m->packet.ciaddr);
-        m->yiaddr = ntohl(m->packet.yiaddr);
-        m->siaddr = ntohl(m->packet.siaddr);
-        m->giaddr = ntohl(m->packet.giaddr);
+int dhcp_packet_parse(dhcp_message_t *m)
+{
+        int rv = -1;
+        if_null(m, exit);
+        if_null_log(m->work, exit, LOG_WARN, NULL, "Cannot parse stored dhcp message");
 
-        memcpy(m->chaddr, m->packet.chaddr, 16);
-        memcpy(m->sname, m->packet.sname, 64);
-        memcpy(m->filename, m->packet.filename, 128);
+        /* Header is read from packet when needed, only keys are parsed */
+        m->xid = ntohl(m->packet->xid);
+        memcpy(m->chaddr, m->packet->chaddr, CHADDR_LEN);
 
-        m->cookie = ntohl(m->packet.cookie);
-        if (m->cookie != MAGIC_COOKIE) {
+        if (dhcp_message_cookie(m) != MAGIC_COOKIE) {
                 cclog(LOG_WARN, NULL, 
                         "Received DHCP message with invalid cookie, message will be dropped");
                 goto exit;
         }
 
-        /* 
-         * This is to to avoid collision when adding parsed dhcp options, 
-         * since dhcp options cannot be duplicate. Otherwise, big parsing errors 
-         * could occur when using dhcp_message_t as a buffer for 
-         * receiving/sending dhcp messages 
-         */
-        if (m->dhcp_options) {
-                dhcp_option_destroy_list(&m->dhcp_options);
-                m->dhcp_options = llist_new();
-        }
-        if_null(m->dhcp_options, exit);
-        if_failed_log(dhcp_option_parse(m->dhcp_options, m->packet.options), exit, LOG_WARN,
+        /* Options are only indexed, handlers read them from the packet through the view */
+        if_failed_log(dhcp_option_view_parse(&m->work->options, m->packet->options), exit, LOG_WARN,
                         NULL, "Failed to parse dhcp options");
 
         /* 
          * Assign the message a type. This is required by this implementation of 
          * DHCP server. If the option 53 is not present, the message MUST be rejected
          */ 
-        
-        dhcp_option_t *o = dhcp_option_retrieve(m->dhcp_options, DHCP_OPTION_DHCP_MESSAGE_TYPE);
-        if_null_log(o, exit, LOG_WARN, NULL,
+        uint32_t type;
+        if_failed_log(dhcp_message_option_number(m, DHCP_OPTION_DHCP_MESSAGE_TYPE, &type), exit, 
+                        LOG_WARN, NULL,
                         "Received DHCP message of with missing option 53, message will be dropped");
 
-        m->type = o->value.number;
+        m->type = type;
 
         rv = 0;
 exit:
         return rv;
 }
 
-int dhcp_packet_build(dhcp_message_t *m)
+/* Bytes of options field the client accepts */
+static size_t dhcp_packet_options_limit(const dhcp_message_t *m)
+{
+        size_t size = m->work->max_message_size;
+        if (size < DHCP_MIN_MAX_MESSAGE_SIZE)
+                size = DHCP_MIN_MAX_MESSAGE_SIZE;
+
+        size -= DHCP_IP_UDP_HEADERS_SIZE + DHCP_PACKET_HEADER_SIZE;
+        if (size > sizeof(m->packet->options))
+                size = sizeof(m->packet->options);
+
+        /* Prebuilt block of option cache cannot be split */
+        if (size < m->work->options_prebuilt + 1U)
+                size = m->work->options_prebuilt + 1U;
+
+        return size;
+}
+
+/* 
+ * Serialize options which did not fit into options field into file and then sname field 
+ * (RFC 2132, section 9.3). Returns number of bytes used in options field, -1 on failure
+ */
+static int dhcp_packet_overload(dhcp_message_t *m, size_t limit)
 {
         int rv = -1;
-        if_null(m, exit);
+        if_false_log((!m->packet->filename[0] && !m->packet->sname[0]), exit, LOG_WARN, NULL,
+                        "DHCP options do not fit into message and file and sname fields are in use");
+
+        /* Three bytes are left for option 52 */
+        llnode_t *next = llist_get_index(m->work->dhcp_options, 0);
+        int used = dhcp_options_serialize_part(&next, m->packet->options, m->work->options_prebuilt, limit - 3);
+        if_failed_n(used, exit);
+
+        uint8_t overload = 0;
+        uint8_t *fields[] = {(uint8_t*)m->packet->filename, (uint8_t*)m->packet->sname};
+        size_t sizes[] = {sizeof(m->packet->filename), sizeof(m->packet->sname)};
+        for (int i = 0; i < 2 && next; i++) {
+                memset(fields[i], 0, sizes[i]);
+                if_failed_n(dhcp_options_serialize_part(&next, fields[i], 0, sizes[i]), exit);
+                overload |= (1 << i);
+        }
 
-        m->packet.opcode = m->opcode;
-        m->packet.htype = m->htype;
-        m->packet.hlen = m->hlen;
-        m->packet.hops = m->hops;
+        if (next) {
+                cclog(LOG_INFO, NULL, "Cannot serialize option %d and onwards: maximum "
+                                "dhcp message size would be exceeded", ((dhcp_option_t*)next->data)->tag);
+                goto exit;
+        }
 
-        m->packet.xid = htonl(m->xid);
-        m->packet.secs = htons(m->secs);
-        m->packet.flags = htons(m->flags);
+        /* Option 52 takes place of END */
+        used--;
+        m->packet->options[used++] = DHCP_OPTION_OVERLOAD;
+        m->packet->options[used++] = 1;
+        m->packet->options[used++] = overload;
+        m->packet->options[used++] = DHCP_OPTION_END;
 
+        rv = used;
+exit:
+        return rv;
+}
 
-        m->packet.ciaddr = htonl(m->ciaddr);
-        m->packet.yiaddr = htonl(m->yiaddr);
-        m->packet.siaddr = htonl(m->siaddr);
-        m->packet.giaddr = htonl(m->giaddr);
+int dhcp_packet_build(dhcp_message_t *m)
+{
+        int rv = -1;
+        if_null(m, exit);
+        if_null_log(m->work, exit, LOG_WARN, NULL, "Cannot build stored dhcp message");
 
-        memcpy(m->packet.chaddr, m->chaddr, 16);
-        memcpy(m->packet.sname, m->sname, 64);
-        memcpy(m->packet.filename, m->filename, 128);
+        /* Rest of the header is written to packet directly by message builders */
+        m->packet->xid = htonl(m->xid);
+        memcpy(m->packet->chaddr, m->chaddr, CHADDR_LEN);
         
-        if (m->cookie != MAGIC_COOKIE) {
+        if (dhcp_message_cookie(m) != MAGIC_COOKIE) {
                 cclog(LOG_WARN, NULL, 
                         "Created DHCP message has invalid cookie, terminating packet build");
                 goto exit;
         }
 
-        m->packet.cookie = htonl(m->cookie); 
-
-        if_failed_log(dhcp_options_serialize(m->dhcp_options, m->packet.options), exit, LOG_ERROR,
-                        NULL, "Failed to serialize dhcp options, terminating packet build");
+        size_t limit = dhcp_packet_options_limit(m);
+        llnode_t *next = llist_get_index(m->work->dhcp_options, 0);
+        int used = dhcp_options_serialize_part(&next, m->packet->options, m->work->options_prebuilt, limit);
+        if (used >= 0 && next)
+                used = dhcp_packet_overload(m, limit);
+        if_failed_log_n(used, exit, LOG_ERROR, NULL, "Failed to serialize dhcp options, terminating packet build");
+
+        /* Short messages are padded, the padding must not carry options of previous message */
+        m->packet_lenght = DHCP_PACKET_HEADER_SIZE + used;
+        if (m->packet_lenght < DHCP_PACKET_MIN_SIZE) {
+                memset(m->packet->options + used, 0, DHCP_PACKET_MIN_SIZE - m->packet_lenght);
+                m->packet_lenght = DHCP_PACKET_MIN_SIZE;
+        }
 
         rv = 0;
 exit:
@@ -159,22 +203,33 @@ dhcp_message_t *dhcp_message_new()
         dhcp_message_t *m = calloc(1, sizeof(dhcp_message_t));
         if_null_log(m, error, LOG_ERROR, NULL, "Could not allocate memory for dhcp_message");
 
-        m->dhcp_options = llist_new();
-        if_null_log(m->dhcp_options, error, LOG_ERROR, NULL, "Could not allocate memory for llist");
+        m->work = calloc(1, sizeof(dhcp_message_work_t));
+        if_null_log(m->work, error, LOG_ERROR, NULL, "Could not allocate memory for dhcp_message");
+        m->packet = &m->work->packet;
+
+        m->work->dhcp_options = llist_new();
+        if_null_log(m->work->dhcp_options, error, LOG_ERROR, NULL, "Could not allocate memory for llist");
+        m->refs = 1;
 
         return m;
 error:
+        dhcp_message_destroy(&m);
         return NULL;
 }
 
 void dhcp_message_destroy(dhcp_message_t **m)
 {
-        if (!m)
+        if (!m || !*m)
                 return;
 
-        dhcp_option_destroy_list(&(*m)->dhcp_options);
+        /* Stored messages own buffer of their packet, see dhcp_message_compact */
+        if ((*m)->work) {
+                dhcp_option_destroy_list(&(*m)->work->dhcp_options);
+                free((*m)->work);
+        } else {
+                free((*m)->packet);
+        }
         
         free(*m);
         *m = NULL;
 }
-
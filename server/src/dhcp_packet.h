@@ -3,10 +3,20 @@
 
 #include "utils/llist.h"
 #include "RFC/RFC-2131.h"
+#include "dhcp_options.h"
 
+#include <arpa/inet.h>
 #include <stdint.h>
 
-#define CHADDR_LEN 18
+#define CHADDR_LEN 16
+
+/* BOOTP header including magic cookie, options field follows it */
+#define DHCP_PACKET_HEADER_SIZE     240
+/* Shortest BOOTP message relay agents and BOOTP clients accept (RFC 1542, section 2.1) */
+#define DHCP_PACKET_MIN_SIZE        300
+/* Message size every client accepts, including IP and UDP headers (RFC 2131, section 2) */
+#define DHCP_MIN_MAX_MESSAGE_SIZE   576
+#define DHCP_IP_UDP_HEADERS_SIZE    28
 
 /*
  * Raw dhcp packet as received from recv() syscall. 
@@ -37,40 +47,138 @@ typedef struct dhcp_packet {
     uint8_t options[336];
 } dhcp_packet_t;
 
+/*
+ * Buffers of a message which is being received, parsed or built. Message gives them 
+ * back once it is stored (see dhcp_message_compact), so messages held by transactions
+ * keep only packet bytes they need
+ */
+typedef struct dhcp_message_work {
+    /* Whole packet, received packets are written here and replies built here */
+    dhcp_packet_t packet;
+    /* Options of received packet indexed by tag, filled by dhcp_packet_parse */
+    dhcp_option_view_t options;
+    /* 
+     * Linked list of dhcp options of messages built by server, serialized into packet 
+     * by dhcp_packet_build. Received messages leave it empty, see options
+     */
+    llist_t *dhcp_options;
+    /* 
+     * Number of option bytes already placed at the start of packet.options (see option_cache.h),
+     * dhcp_options are serialized after them
+     */
+    uint16_t options_prebuilt;
+    /* 
+     * Largest reply the client accepts including IP and UDP headers, taken from option 57
+     * of its request. Zero means DHCP_MIN_MAX_MESSAGE_SIZE
+     */
+    uint16_t max_message_size;
+} dhcp_message_work_t;
+
 /**
- * Parsed version of dhcp_packet_t struct in host byte order. 
- * Contains the raw dhcp packet and and parsed information from said packet
+ * DHCP message, the raw dhcp packet with small metadata. Header fields are not copied,
+ * they are read and written in the packet: single byte fields, sname and file directly,
+ * multi-byte fields through dhcp_message_<field>() and dhcp_message_set_<field>() in 
+ * host byte order. Only fields used as keys by the server (xid, chaddr) are kept parsed
  */
 typedef struct dhcp_message {
-    /* raw dhcp packet as received from recv() syscall, in NETWORK byte order */
-    dhcp_packet_t packet;
+    /* 
+     * Raw dhcp packet in NETWORK byte order. Points to work->packet while the message has 
+     * work buffers, afterwards to buffer of packet_lenght bytes, so only the header and
+     * packet_lenght bytes of it can be accessed
+     */
+    dhcp_packet_t *packet;
+    /* Buffers for receiving, parsing and building the message, NULL once it is stored */
+    dhcp_message_work_t *work;
+    /* Slab owning the message, NULL if allocated by dhcp_message_new() */
+    struct message_slab *slab;
+
     enum dhcp_message_type type;
+    uint32_t xid;                           // HOST BYTE ORDER, copied to packet by dhcp_packet_build
+    uint8_t chaddr[CHADDR_LEN];             // copied to packet by dhcp_packet_build
+    /* UNIX time indicating when was the message sent/received */
+    uint32_t time;
+    /* 
+     * Number of bytes of packet, set by receiver, dhcp_packet_build or dhcp_message_compact. 
+     * Zero means whole packet
+     */
+    uint16_t packet_lenght;
+    /* 
+     * Number of holders of the message (see message_slab.h). Zero means the 
+     * message is not reference counted, e.g. it is on stack
+     */
+    uint16_t refs;
+} dhcp_message_t;
 
-    uint8_t opcode;
-    uint8_t htype;
-    uint8_t hlen;
-    uint8_t hops;
+/* Multi-byte header fields of packet in HOST BYTE ORDER */
+static inline uint16_t dhcp_message_secs(const dhcp_message_t *m)
+{
+        return ntohs(m->packet->secs);
+}
 
-    uint32_t xid;
+static inline void dhcp_message_set_secs(dhcp_message_t *m, uint16_t secs)
+{
+        m->packet->secs = htons(secs);
+}
 
-    uint16_t secs;
-    uint16_t flags;
+static inline uint16_t dhcp_message_flags(const dhcp_message_t *m)
+{
+        return ntohs(m->packet->flags);
+}
 
-    uint32_t ciaddr;
-    uint32_t yiaddr;
-    uint32_t siaddr;
-    uint32_t giaddr;
-    
-    uint8_t chaddr[CHADDR_LEN];
-    char sname[64];
-    char filename[128];
-    uint32_t cookie;
-   
-    /* Linked list containing parsed dhcp options */
-    llist_t *dhcp_options;
-    /* UNIX time indicating when was the message sent/received */
-    uint32_t time;
-} dhcp_message_t;
+static inline void dhcp_message_set_flags(dhcp_message_t *m, uint16_t flags)
+{
+        m->packet->flags = htons(flags);
+}
+
+static inline uint32_t dhcp_message_ciaddr(const dhcp_message_t *m)
+{
+        return ntohl(m->packet->ciaddr);
+}
+
+static inline void dhcp_message_set_ciaddr(dhcp_message_t *m, uint32_t ciaddr)
+{
+        m->packet->ciaddr = htonl(ciaddr);
+}
+
+static inline uint32_t dhcp_message_yiaddr(const dhcp_message_t *m)
+{
+        return ntohl(m->packet->yiaddr);
+}
+
+static inline void dhcp_message_set_yiaddr(dhcp_message_t *m, uint32_t yiaddr)
+{
+        m->packet->yiaddr = htonl(yiaddr);
+}
+
+static inline uint32_t dhcp_message_siaddr(const dhcp_message_t *m)
+{
+        return ntohl(m->packet->siaddr);
+}
+
+static inline void dhcp_message_set_siaddr(dhcp_message_t *m, uint32_t siaddr)
+{
+        m->packet->siaddr = htonl(siaddr);
+}
+
+static inline uint32_t dhcp_message_giaddr(const dhcp_message_t *m)
+{
+        return ntohl(m->packet->giaddr);
+}
+
+static inline void dhcp_message_set_giaddr(dhcp_message_t *m, uint32_t giaddr)
+{
+        m->packet->giaddr = htonl(giaddr);
+}
+
+static inline uint32_t dhcp_message_cookie(const dhcp_message_t *m)
+{
+        return ntohl(m->packet->cookie);
+}
+
+static inline void dhcp_message_set_cookie(dhcp_message_t *m, uint32_t cookie)
+{
+        m->packet->cookie = htonl(cookie);
+}
 
 /* dumps dhcp message header to stdout */
 void dhcp_packet_dump(dhcp_packet_t *p);
@@ -82,14 +190,65 @@ void dhcp_packet_dump(dhcp_packet_t *p);
  */
 int dhcp_packet_parse(dhcp_message_t *m);
 
+/*
+ * Returns DHCP message type (option 53) read straight from raw options of packet, -1 if
+ * the packet has none. Options are only walked until option 53, nothing is parsed or
+ * copied, so received packets can be classified and dropped before dhcp_packet_parse
+ */
+int dhcp_packet_peek_type(const dhcp_packet_t *packet);
+
+/* Number of bytes of packet to send or store */
+static inline size_t dhcp_message_lenght(const dhcp_message_t *m)
+{
+        return m->packet_lenght ? m->packet_lenght : sizeof(dhcp_packet_t);
+}
+
+/* 
+ * Returns value of option tag of received message and stores its lenght, NULL if the 
+ * message does not have the option. Stored messages have no option view, their options
+ * are walked instead
+ */
+static inline const uint8_t *dhcp_message_option(const dhcp_message_t *m, uint8_t tag, uint8_t *lenght)
+{
+        if (m->work)
+                return dhcp_option_view_get(&m->work->options, m->packet->options, tag, lenght);
+
+        size_t size = dhcp_message_lenght(m);
+        size = size > DHCP_PACKET_HEADER_SIZE ? size - DHCP_PACKET_HEADER_SIZE : 0;
+        return dhcp_options_find(m->packet->options, size, tag, lenght);
+}
+
+/* Same as dhcp_option_view_number for option of received message */
+static inline int dhcp_message_option_number(const dhcp_message_t *m, uint8_t tag, uint32_t *value)
+{
+        uint8_t lenght = 0;
+        const uint8_t *v = dhcp_message_option(m, tag, &lenght);
+
+        return dhcp_option_value_number(v, lenght, value);
+}
+
+/* Maximum message size of reply to request, from option 57 of request (RFC 2132, section 9.10) */
+static inline uint16_t dhcp_message_max_size(const dhcp_message_t *request)
+{
+        uint32_t size = 0;
+        if (dhcp_message_option_number(request, DHCP_OPTION_MAX_DHCP_MESSAGE_SIZE, &size) < 0 ||
+            size < DHCP_MIN_MAX_MESSAGE_SIZE || size > UINT16_MAX)
+                return DHCP_MIN_MAX_MESSAGE_SIZE;
+
+        return size;
+}
+
 /**
  * Builds a raw packet in network byte order (m->dhcp_packet_t) using information 
  * from parent dhcp_message_t struct. This packet is than ready to be sent.
+ * Options are limited by m->work->max_message_size, the ones which do not fit continue 
+ * in file and sname fields (option 52). Lenght of the packet, padded to 
+ * DHCP_PACKET_MIN_SIZE, is stored in m->packet_lenght
  */
 int dhcp_packet_build(dhcp_message_t *m);
 
 /**
- * Allocates space in memory to store a dhcp_message_t struct.
+ * Allocates space in memory to store a dhcp_message_t struct with its work buffers.
  * Returns null on failure, pointer to allocated struct on success 
  */
 dhcp_message_t *dhcp_message_new();
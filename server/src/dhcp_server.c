@@ -10,7 +10,6 @@
 #include "logging.h"
 #include "messages/dhcp_messages.h"
 #include "timer.h"
-#include "timer_args.h"
 #include "transaction.h"
 #include "unix_server.h"
 #include "utils/llist.h"
@@ -19,6 +18,7 @@
 #include "security/acl.h"
 #include "database.h"
 #include "security/dhcp_snooping/dhcp_snoop.h"
+#include "socket_filter.h"
 #include "security/dynamic_acl.h"
 
 #include <arpa/inet.h>
@@ -34,8 +34,14 @@
 #include <fcntl.h>
 #include <signal.h>
 #include <errno.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <linux/filter.h>
+#include <pthread.h>
 
 #define BACKLOG_SIZE 50
+#define EPOLL_MAX_EVENTS 8
+#define RAW_TX_RETRY_DELAY 1                    // ms
 
 static volatile int server_keep_running = 1;
 static void stop_running(int signo)
@@ -43,41 +49,157 @@ static void stop_running(int signo)
 	server_keep_running = 0;
 }
 
-int init_dhcp_server(dhcp_server_t *server)
+/* 
+ * Create non-blocking dhcp server socket bound to port 67. In multi-threaded mode every 
+ * worker opens its own socket, all of them are bound with SO_REUSEPORT. When more 
+ * interfaces are served, socket is bound to device of iface
+ */
+static int dhcp_server_open_socket(dhcp_server_t *server, dhcp_interface_t *iface)
 {
-	int rv = -1;
-
-	if_null_log(server, exit, LOG_INFO, NULL, "server parameter is null");
-
-	server->sock_fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
-	if_failed_log_n(server->sock_fd, exit, LOG_CRITICAL, NULL, 
-		"Failed to create socket with return code %d", server->sock_fd);
+	int fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	if_failed_log_n(fd, error, LOG_CRITICAL, NULL, 
+		"Failed to create socket with return code %d", fd);
 
 	/* Setting socket option to reuse address */
 	int reuse_addr = 1;
-	if_failed_log(setsockopt(server->sock_fd, SOL_SOCKET, SO_REUSEADDR, &reuse_addr, sizeof(int)), 
-		exit, LOG_CRITICAL, NULL, "Failed to set reuse address socket option");
+	if_failed_log(setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse_addr, sizeof(int)), 
+		error, LOG_CRITICAL, NULL, "Failed to set reuse address socket option");
+
+	if (server->config.workers > 1) {
+		if_failed_log(setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &reuse_addr, sizeof(int)), 
+			error, LOG_CRITICAL, NULL, "Failed to set reuse port socket option");
+	}
+
+        if (server->interface_count > 1) {
+                if_failed_log(setsockopt(fd, SOL_SOCKET, SO_BINDTODEVICE, iface->name, strlen(iface->name)),
+                        error, LOG_CRITICAL, NULL, "Failed to bind socket to interface %s: %s", 
+                        iface->name, strerror(errno));
+        }
 
 	/* Setting socket option to reuse address */
 	int broadcast = 1;
-	if_failed_log(setsockopt(server->sock_fd, SOL_SOCKET, SO_BROADCAST, &broadcast, sizeof(int)), 
-		exit, LOG_CRITICAL, NULL, "Failed to set broadcast socket option");
+	if_failed_log(setsockopt(fd, SOL_SOCKET, SO_BROADCAST, &broadcast, sizeof(int)), 
+		error, LOG_CRITICAL, NULL, "Failed to set broadcast socket option");
 	
         /* Setting up non-blocking socket */
-	int flags = fcntl(server->sock_fd, F_GETFL, 0);
-	if_failed_log_n(flags, exit, LOG_CRITICAL, NULL, "Failed to obtain socket fd flags");
+	int flags = fcntl(fd, F_GETFL, 0);
+	if_failed_log_n(flags, error, LOG_CRITICAL, NULL, "Failed to obtain socket fd flags");
 
-	if_failed_log(fcntl(server->sock_fd, F_SETFL, flags | O_NONBLOCK), 
-		exit, LOG_CRITICAL, NULL, "Failed to set socket to non-blocking state");
+	if_failed_log(fcntl(fd, F_SETFL, flags | O_NONBLOCK), 
+		error, LOG_CRITICAL, NULL, "Failed to set socket to non-blocking state");
+
+        /* Filter is attached before bind, so junk is not queued even for a moment. Failure is not fatal */
+        socket_filter_attach(fd, server->acl);
 
 	struct sockaddr_in addr = {0};
 	addr.sin_family = AF_INET;
         addr.sin_addr.s_addr = INADDR_ANY;
-	addr.sin_port = htons(67);
+	addr.sin_port = htons(DHCP_SERVER_PORT);
+
+	if_failed_log(bind(fd, (struct sockaddr*)&addr, sizeof(struct sockaddr_in)),
+		error, LOG_CRITICAL, NULL, "Failed to bind socket to address");
+
+	return fd;
+error:
+	if (fd >= 0)
+		close(fd);
+	return -1;
+}
+
+/* Free interfaces of server or worker and close their sockets */
+static void dhcp_server_close_interfaces(dhcp_server_t *server)
+{
+        if (!server->interfaces)
+                return;
+
+        for (uint32_t i = 0; i < server->interface_count; i++)
+                dhcp_interface_close(&server->interfaces[i]);
+
+        free(server->interfaces);
+        server->interfaces = NULL;
+        server->iface = NULL;
+        server->interface_count = 0;
+}
+
+/* 
+ * Allocate interface array of server or worker and open socket on every interface. 
+ * Addresses of interfaces are taken from template, which is NULL for worker 0
+ */
+static int dhcp_server_open_interfaces(dhcp_server_t *server, const dhcp_interface_t *template, 
+                uint32_t count)
+{
+        int rv = -1;
+
+        server->interfaces = calloc(count, sizeof(dhcp_interface_t));
+        if_null_log(server->interfaces, exit, LOG_CRITICAL, NULL, "Failed to allocate interfaces");
+        server->interface_count = count;
+
+        for (uint32_t i = 0; i < count; i++)
+                server->interfaces[i].sock_fd = -1;
+
+        for (uint32_t i = 0; i < count; i++) {
+                dhcp_interface_t *iface = &server->interfaces[i];
+
+                if (template) {
+                        memcpy(iface->name, template[i].name, IFNAMSIZ);
+                        iface->bound_ip = template[i].bound_ip;
+                        iface->broadcast_addr = template[i].broadcast_addr;
+                } else {
+                        /* Interface 0 is the primary interface */
+                        strncpy(iface->name, (i == 0) ? server->config.interface : 
+                                        server->config.interfaces[i - 1], IFNAMSIZ - 1);
+                        if_failed_log(dhcp_interface_get_addresses(iface->name, &iface->bound_ip, 
+                                                &iface->broadcast_addr), exit, LOG_CRITICAL, NULL,
+                                "Failed to retrieve addresses of interface %s", iface->name);
+                }
+
+                iface->sock_fd = dhcp_server_open_socket(server, iface);
+                if_failed_n(iface->sock_fd, exit);
+        }
+
+        rv = 0;
+exit:
+        return rv;
+}
+
+void dhcp_server_update_filters(dhcp_server_t *server)
+{
+        if (!server || !server->interfaces)
+                return;
 
-	if_failed_log(bind(server->sock_fd, (struct sockaddr*)&addr, sizeof(struct sockaddr_in)),
-		exit, LOG_CRITICAL, NULL, "Failed to bind socket to address");
+        for (uint32_t i = 0; i < server->interface_count; i++) {
+                if (server->interfaces[i].sock_fd >= 0)
+                        socket_filter_attach(server->interfaces[i].sock_fd, server->acl);
+        }
+
+        if (server->xdp)
+                xdp_filter_sync_acl(server->xdp, server->acl);
+}
+
+int init_dhcp_server(dhcp_server_t *server)
+{
+	int rv = -1;
+
+	if_null_log(server, exit, LOG_INFO, NULL, "server parameter is null");
 
+        /* Event loop descriptors are created when the server starts serving */
+        server->epoll_fd = -1;
+        server->tick_fd = -1;
+        server->workers.id = 0;
+        server->workers.count = 1;
+
+        if_failed(dhcp_server_open_interfaces(server, NULL, server->config.interface_count + 1), exit);
+
+        /* Identifier of primary interface is the default server identifier option */
+        if (!server->config.bound_ip) {
+                server->config.bound_ip = server->interfaces[0].bound_ip;
+                server->config.broadcast_addr = server->interfaces[0].broadcast_addr;
+        }
+
+        for (uint32_t i = 0; i < server->interface_count; i++) {
+                cclog(LOG_MSG, NULL, "Serving interface %s with server identifier %s", 
+                        server->interfaces[i].name, uint32_to_ipv4_address(server->interfaces[i].bound_ip));
+        }
 	cclog(LOG_MSG, NULL, "Server socket successfully initialised");
 
 	/* Setting up sigint signal for proper shutdown */
@@ -106,7 +228,7 @@ static int check_lease(uint32_t current_time, address_pool_t *pool, dhcp_server_
                 if (allocator_is_address_available(server->allocator, a))
                         continue;
                 
-                if (lease_retrieve(&lease, a, pool->name) < 0) {
+                if (lease_find_address(&lease, a) != LEASE_OK) {
                         cclog(LOG_WARN, NULL, 
                                 "Failed to retrieve lease of address %s, possible missconfiguration",
                                 uint32_to_ipv4_address(a));
@@ -159,6 +281,9 @@ int check_lease_expirations(uint32_t check_time, void *priv)
                 released_leases += check_lease(check_time, pool, server);
         )
 
+        if (released_leases > 0)
+                cclog(LOG_MSG, NULL, "Released %d addresses from lease database", released_leases);
+
         rv = released_leases;
 exit:
         return rv;
@@ -190,14 +315,28 @@ int uninit_dhcp_server(dhcp_server_t *server)
 
 	if_null_log(server, exit, LOG_INFO, NULL, "server parameter is null");
 
-	if_failed_log(close(server->sock_fd), exit, LOG_ERROR, NULL, "Failed to close socket");
+        dhcp_server_close_interfaces(server);
+        if (server->tick_fd >= 0)
+                close(server->tick_fd);
+        if (server->epoll_fd >= 0)
+                close(server->epoll_fd);
+        server->tick_fd = server->epoll_fd = -1;
         allocator_destroy(&server->allocator);
         trans_cache_destroy(&server->trans_cache);
+        lease_index_uninit();
+        ingress_destroy(&server->ingress);
+        option_cache_destroy(&server->option_cache);
+        /* Transactions, ingress and I/O hold references to slab messages, so slab goes last */
+        message_slab_destroy(&server->slab);
 
+        xdp_filter_destroy(&server->xdp);
         ACL_destroy(&server->acl);
         ACL_destroy(&server->dacl);
 
         timer_destroy(&server->timers.lease_expiration_check);
+        /* Scans have deadlines on the timing wheel and sockets in epoll of the server */
+        dhcp_snooper_cleanup();
+        timer_wheel_destroy(&server->timers.wheel);
 
 	cclog(LOG_MSG, NULL, "Server stoped successfully");
 	rv = 0;
@@ -205,134 +344,713 @@ exit:
 	return rv;
 }
 
-void update_timers(dhcp_server_t *server)
+/* 
+ * Process single received packet stored in msg->packet. Messages of servers, snooping 
+ * scans and clients denied by ACL were already dropped by dhcp_server_enqueue
+ */
+static int dhcp_server_handle_packet(dhcp_server_t *server, dhcp_message_t *msg)
 {
-        trans_update_args_t trans_args = {
-                .server = server,
-                .index  = 0
-        };
-        /* Update timers on transaction cache entries. */
-        for (int i = 0; i < server->trans_cache->size; i++) {
-                trans_args.index = i;
-                if (server->trans_cache->transactions[i]->timer->is_running)
-                        trans_update_timer(&trans_args);
+        int rv = -1;
+
+        /* Parse the packet, errors in packet parsing are handled in the parse function */
+        if (dhcp_packet_parse(msg) < 0)
+                return 0;
+
+        /* Store the received message in cache for future use */
+        cclog(LOG_MSG, NULL, "Received message of type %s from %s", 
+                        rfc2131_dhcp_message_type_to_str(msg->type),
+                        uint8_array_to_mac((uint8_t*)msg->chaddr));
+
+        /*
+         * Store message in cache for future reference, drop communication if the message 
+         * cannot be stored, for example due to full cache (log should be made)
+         */
+        if (trans_cache_add_message(server->trans_cache, msg) < 0)
+                return 0;
+        /* 
+         * This database is only used for debugging purposes, we dont need to raise 
+         * and error if it fails
+         */
+        if (server->config.db_enable)
+                database_store_message(msg);
+        
+        switch (msg->type) {
+                case DHCP_DISCOVER: 
+                        rv = message_dhcpdiscover_handle(server, msg); 
+                        break;
+                case DHCP_REQUEST: 
+                        rv = message_dhcprequest_handle(server, msg);
+                        break;
+                case DHCP_DECLINE:
+                        rv = message_dhcpdecline_handle(server, msg);
+                        break;
+                case DHCP_INFORM:
+                        rv = message_dhcpinform_handle(server, msg);
+                        break;
+                case DHCP_RELEASE:
+                        rv = message_dhcprelease_handle(server, msg);
+                        break;
+                default:
+                        cclog(LOG_WARN, NULL, "Invalid DHCP message type received (%d), "
+                                        "dropping message", msg->type);
+                        rv = 0;
+                        break;
         }
 
-        int released_leases = timer_update(server->timers.lease_expiration_check, server);
-        if (released_leases == TIMER_ERROR)
-                cclog(LOG_WARN, NULL, "Failed to update lease expiration check timer");
-        else if (released_leases > 0)
-                cclog(LOG_MSG, NULL, "Released %d addresses from lease database", released_leases);
+        if_failed_log_n_ng(rv, LOG_ERROR, NULL, "Failed to handle %s from %s", 
+                        rfc2131_dhcp_message_type_to_str(msg->type),
+                        uint8_array_to_mac((uint8_t*)msg->chaddr));
 
-        /* Introduce a slight delay between loop cycles in order to lower cpu load */
-        // usleep(server->config.tick_delay);
+        /* Message is handled, transaction keeps only its packet */
+        dhcp_message_compact(msg);
+
+        return rv;
 }
 
-int dhcp_server_serve(dhcp_server_t *server)
+/* Create I/O backends of interface and register it with epoll */
+static int init_interface_io(dhcp_server_t *server, dhcp_interface_t *iface)
 {
-	int rv = -1;
+        int rv = -1;
+        struct epoll_event ev = {0};
 
-	if_null_log(server, exit, LOG_CRITICAL, NULL, "server parameter is null");
+        ev.events = EPOLLIN;
+        ev.data.fd = iface->sock_fd;
+#ifdef CONFIG_IO_URING
+        /* Socket is read by the ring, epoll only waits for its completion eventfd */
+        iface->uring = uring_new(iface->sock_fd, server->config.batch_size, server->slab);
+        if (iface->uring)
+                ev.data.fd = iface->uring->event_fd;
+        else
+                cclog(LOG_WARN, NULL, "io_uring is not available, falling back to batched socket I/O");
+#endif
+        if_failed_log_n(epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, ev.data.fd, &ev), exit, 
+                LOG_CRITICAL, NULL, "Failed to register socket of interface %s with epoll", iface->name);
 
-        dhcp_message_t *dhcp_msg = dhcp_message_new();
-        if_null_log(dhcp_msg, exit, LOG_ERROR, NULL, "Cannot allocate memory for dhcp_message_t");
+        iface->io_batch = io_batch_new(server->config.batch_size, server->slab);
+        if_null_log(iface->io_batch, exit, LOG_CRITICAL, NULL, "Failed to initialise I/O batch");
 
-	do
-	{
-                /* Update various timers used by server (e.g. transaction cache timers) */
-                update_timers(server);
-                /*
-                 * Handle pottention communication on unix server. 
-                 * PARAMETER IS VOID POINTER TO DHCP SERVER due to limitations
-                 */
-                unix_server_handle(server);
-
-		rv = recv(server->sock_fd, &dhcp_msg->packet, sizeof(dhcp_packet_t), 0);
-		if (rv < 0 && errno == EAGAIN) {
-			continue;
-		} else if (rv < 0) {
-			cclog(LOG_WARN, NULL, "Failed to receive dhcp packet with return code %d", rv);
-			continue;
-		}
-
-                /* Parse the packet, errors in packet parsing are handled in the parse function */
-                if (dhcp_packet_parse(dhcp_msg) < 0)
-                        continue;
+        /* Ring holds replies to two batches, without it replies are broadcasted */
+        if (server->config.unicast_enable) {
+                iface->raw_tx = raw_tx_new(iface->name, iface->bound_ip, 2 * server->config.batch_size);
+                if (!iface->raw_tx)
+                        cclog(LOG_WARN, NULL, "Packet socket is not available on %s, replies to clients "
+                                        "without address will be broadcasted", iface->name);
+        }
+
+        rv = 0;
+exit:
+        return rv;
+}
+
+/* 
+ * Create epoll instance and register sockets of interfaces, unix server socket and tick timer 
+ * with it. Tick timer replaces the previous busy loop, timers are updated every tick_delay miliseconds
+ */
+static int init_event_loop(dhcp_server_t *server)
+{
+        int rv = -1;
+        struct epoll_event ev = {0};
+        uint32_t tick = server->config.tick_delay ? server->config.tick_delay : 1000;
+        struct itimerspec its = {
+                .it_interval = { .tv_sec = tick / 1000, .tv_nsec = (tick % 1000) * 1000000 },
+                .it_value    = { .tv_sec = tick / 1000, .tv_nsec = (tick % 1000) * 1000000 },
+        };
+
+        server->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        if_failed_log_n(server->epoll_fd, exit, LOG_CRITICAL, NULL, 
+                "Failed to create epoll instance: %s", strerror(errno));
+
+        /* 
+         * Cached transaction usually holds DORA messages. Work buffers are needed only while
+         * messages are received or built: socket I/O holds up to two batches per interface, 
+         * ingress holds deferred messages and handler builds one reply at a time. If that 
+         * is not enough, slab falls back to heap allocation
+         */
+        uint32_t in_flight = 2 * server->config.batch_size * server->interface_count + 
+                             INGRESS_PRIO_COUNT * server->config.ingress_depth + 1;
+        server->slab = message_slab_new(server->config.cache_size * 4 + in_flight, in_flight);
+        if_null_log(server->slab, exit, LOG_CRITICAL, NULL, "Failed to initialise message slab");
+
+        server->ingress = ingress_new(server->config.ingress_depth);
+        if_null_log(server->ingress, exit, LOG_CRITICAL, NULL, "Failed to initialise ingress queues");
+
+        server->option_cache = option_cache_new(OPTION_CACHE_SIZE);
+        if_null_log(server->option_cache, exit, LOG_CRITICAL, NULL, "Failed to initialise option cache");
+
+        server->tick_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if_failed_log_n(server->tick_fd, exit, LOG_CRITICAL, NULL, 
+                "Failed to create tick timer: %s", strerror(errno));
+
+        if_failed_log_n(timerfd_settime(server->tick_fd, 0, &its, NULL), exit, LOG_CRITICAL, NULL,
+                "Failed to arm tick timer: %s", strerror(errno));
+
+        /* Server timers are scheduled on a timing wheel advanced by ticks of the tick timer */
+        server->timers.wheel = timer_wheel_new(tick);
+        if_null_log(server->timers.wheel, exit, LOG_CRITICAL, NULL, "Failed to initialise timing wheel");
+        if_failed_log(trans_cache_schedule_on(server->trans_cache, server->timers.wheel, server), exit, 
+                LOG_CRITICAL, NULL, "Failed to schedule transaction timers");
+        if (server->timers.lease_expiration_check)
+                timer_wheel_attach(server->timers.wheel, server->timers.lease_expiration_check, server);
+
+        for (uint32_t i = 0; i < server->interface_count; i++)
+                if_failed(init_interface_io(server, &server->interfaces[i]), exit);
+
+        ev.events = EPOLLIN;
+        ev.data.fd = server->tick_fd;
+        if_failed_log_n(epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, server->tick_fd, &ev), exit, 
+                LOG_CRITICAL, NULL, "Failed to register tick timer with epoll");
+
+        /* Server can run without IPC, unix_server_init already warned about it */
+        if (server->unix_server.fd >= 0) {
+                ev.data.fd = server->unix_server.fd;
+                if_failed_log_n(epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, server->unix_server.fd, &ev), 
+                        exit, LOG_CRITICAL, NULL, "Failed to register UNIX server socket with epoll");
+        }
+
+        cclog(LOG_MSG, NULL, "Event loop initialised with tick of %u ms", tick);
+        rv = 0;
+exit:
+        return rv;
+}
+
+/* Send replies queued on every interface */
+static void dhcp_server_flush(dhcp_server_t *server)
+{
+        dhcp_interface_t *iface;
+
+        for (uint32_t i = 0; i < server->interface_count; i++) {
+                iface = &server->interfaces[i];
+#ifdef CONFIG_IO_URING
+                if (iface->uring)
+                        uring_flush(iface->uring);
+#endif
+                if (iface->io_batch && iface->io_batch->tx_count)
+                        io_batch_flush(iface->io_batch, iface->sock_fd);
+                raw_tx_flush(iface->raw_tx);
+        }
+}
+
+/* 
+ * Decide whether received packet will be handled, using only fixed fields of raw packet
+ * and its message type. Returns false if the packet has to be dropped
+ */
+static bool dhcp_server_accept_packet(dhcp_server_t *server, dhcp_packet_t *packet, int type)
+{
+        /* If we capture a message sent by a server, drop it */
+        if (packet->opcode != BOOTREQUEST || 
+                type == DHCP_OFFER || 
+                type == DHCP_ACK || 
+                type == DHCP_NAK) {
+                server->early_drops.replies++;
+                return false;
+        }
 
 #ifdef CONFIG_SECURITY_ENABLE_DHCP_SNOOPING
-                if (dhcp_snooper_check_xid(dhcp_msg->xid))
-                        continue;
+        /* Discovers of our own scans */
+        if (dhcp_snooper_check_xid(ntohl(packet->xid))) {
+                server->early_drops.snooping++;
+                return false;
+        }
 #endif
 
-                /* Check ACL database to determine if the client is allowed to be served */
-                if (ACL_check_client(server->acl, dhcp_msg->chaddr) != ACL_ALLOW) {
-                        cclog(LOG_INFO, NULL, "ACL denied client %s.", uint8_array_to_mac(dhcp_msg->chaddr));
-                        continue;
-                }
+        /* Check ACL database to determine if the client is allowed to be served */
+        if (ACL_check_client(server->acl, packet->chaddr) != ACL_ALLOW) {
+                cclog(LOG_INFO, NULL, "ACL denied client %s.", uint8_array_to_mac(packet->chaddr));
+                server->early_drops.acl++;
+                return false;
+        }
+
+        /* Check/update dynamic ACL */
+        if (dynamic_ACL_check(server->dacl, packet->chaddr, server->trans_cache) != ACL_ALLOW) {
+               cclog(LOG_WARN, NULL, "Dynamic ACL detected potential threat %s. "
+                                     "Inspect and take action if needed", 
+                                     uint8_array_to_mac(packet->chaddr));
+               server->early_drops.dynamic_acl++;
+               /* Further packets of the client are dropped before they reach the socket */
+               if (server->xdp)
+                       xdp_filter_deny(server->xdp, packet->chaddr);
+               return false;
+        }
+
+        return true;
+}
+
+/* 
+ * Queue received message for handling. Messages of clients of other workers and messages
+ * which would be dropped anyway are dropped here, before they are parsed or take space in 
+ * ingress queues
+ */
+static void dhcp_server_enqueue(dhcp_server_t *server, dhcp_message_t *msg, dhcp_interface_t *iface)
+{
+        dhcp_packet_t *packet = msg->packet;
+
+        /* 
+         * Broadcasts are delivered to socket of every worker, reuseport steering only applies 
+         * to unicast. Only the worker owning the client handles the message.
+         */
+        if (server->workers.count > 1 && 
+            dhcp_server_worker_for(packet->chaddr, server->workers.count) != server->workers.id)
+                return;
+
+        int type = dhcp_packet_peek_type(packet);
+        if (!dhcp_server_accept_packet(server, packet, type))
+                return;
+
+        ingress_push_classified(server->ingress, msg, iface, ingress_classify_type(packet, type));
+}
 
-                /* Check/update dynamic ACL */
-                if (dynamic_ACL_check(server->dacl, dhcp_msg->chaddr, server->trans_cache) != ACL_ALLOW) {
-                       cclog(LOG_WARN, NULL, "Dynamic ACL detected potential threat %s. "
-                                             "Inspect and take action if needed", 
-                                             uint8_array_to_mac(dhcp_msg->chaddr));
-                       continue;
+/* 
+ * Handle up to budget queued messages, highest priority first, and send their replies. 
+ * Returns number of handled messages
+ */
+static uint32_t dhcp_server_dispatch(dhcp_server_t *server, uint32_t budget)
+{
+        ingress_entry_t entry;
+        uint32_t handled = 0;
+
+        while (handled < budget && ingress_pop(server->ingress, &entry)) {
+                server->iface = entry.iface;
+                dhcp_server_handle_packet(server, entry.message);
+                dhcp_message_unref(&entry.message);
+                handled++;
+        }
+        server->iface = NULL;
+
+        if (handled)
+                dhcp_server_flush(server);
+
+        return handled;
+}
+
+/* 
+ * Drain every datagram waiting on socket of interface. Datagrams are received in batches 
+ * into ingress queues, one batch worth of queued messages is handled between receives, 
+ * so high priority messages received later overtake deferred low priority ones. 
+ * Replies to handled messages are sent by one syscall
+ */
+static void dhcp_server_receive(dhcp_server_t *server, dhcp_interface_t *iface)
+{
+        int received;
+        io_batch_t *batch = iface->io_batch;
+
+        while (server_keep_running) {
+                received = io_batch_receive(batch, iface->sock_fd);
+
+                for (int i = 0; i < received; i++)
+                        dhcp_server_enqueue(server, batch->rx_messages[i], iface);
+
+                dhcp_server_dispatch(server, batch->size);
+
+                /* Socket queue is empty and nothing is deferred, no need for another syscall */
+                if (received < (int)batch->size && ingress_count(server->ingress) == 0)
+                        break;
+        }
+}
+
+#ifdef CONFIG_IO_URING
+static void dhcp_server_uring_packet(void *priv, dhcp_message_t *message, size_t len)
+{
+        dhcp_server_t *server = (dhcp_server_t*)priv;
+
+        dhcp_server_enqueue(server, message, server->iface);
+}
+
+/* 
+ * Handle completions of io_uring. Received messages are queued into ingress queues and 
+ * handled in batches, replies of every batch are submitted by one io_uring_enter
+ */
+static void dhcp_server_receive_uring(dhcp_server_t *server, dhcp_interface_t *iface)
+{
+        uint64_t count;
+
+        /* Reset eventfd before reaping so that completions posted meanwhile wake us again */
+        if (read(iface->uring->event_fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+                cclog(LOG_WARN, NULL, "Failed to read io_uring eventfd: %s", strerror(errno));
+
+        while (server_keep_running) {
+                server->iface = iface;
+                uring_receive(iface->uring, dhcp_server_uring_packet, server);
+                server->iface = NULL;
+
+                if (dhcp_server_dispatch(server, server->config.batch_size) == 0)
+                        break;
+        }
+}
+#endif
+
+static int dhcp_server_send_to(dhcp_server_t *server, dhcp_message_t *message, 
+                uint32_t addr, uint16_t port)
+{
+        if (!server || !message)
+                return -1;
+
+        int rv = -1;
+
+        /* Replies go out of the interface the request came from, primary interface otherwise */
+        dhcp_interface_t *iface = server->iface ? server->iface : server->interfaces;
+        if_null_log(iface, exit, LOG_ERROR, NULL, "Server has no interface to send dhcp packet from");
+
+        struct sockaddr_in saddr = {0};
+        saddr.sin_family = AF_INET;
+        saddr.sin_port = htons(port);
+        saddr.sin_addr.s_addr = htonl(addr);
+        size_t len = dhcp_message_lenght(message);
+
+#ifdef CONFIG_IO_URING
+        if (iface->uring)
+                return uring_queue_send(iface->uring, message->packet, len, &saddr);
+#endif
+        if (iface->io_batch)
+                return io_batch_queue(iface->io_batch, iface->sock_fd, message->packet, len, &saddr);
+
+        if_failed_log_n(sendto(iface->sock_fd, message->packet, len, 0,
+                                (struct sockaddr*)&saddr, sizeof(saddr)), 
+                        exit, LOG_ERROR, NULL, "Failed to send dhcp packet: %s", strerror(errno));
+
+        rv = 0;
+exit:
+        return rv;
+}
+
+int dhcp_server_send(dhcp_server_t *server, dhcp_message_t *message, uint32_t addr)
+{
+        return dhcp_server_send_to(server, message, addr, DHCP_CLIENT_PORT);
+}
+
+int dhcp_server_send_reply(dhcp_server_t *server, dhcp_message_t *message)
+{
+        if (!server || !message)
+                return -1;
+
+        dhcp_interface_t *iface = server->iface ? server->iface : server->interfaces;
+        uint32_t broadcast = iface ? iface->broadcast_addr : server->config.broadcast_addr;
+
+        /* Destination of server reply as specified by RFC 2131 section 4.1 */
+        uint32_t giaddr = dhcp_message_giaddr(message);
+        uint32_t ciaddr = dhcp_message_ciaddr(message);
+        uint32_t yiaddr = dhcp_message_yiaddr(message);
+        if (giaddr)
+                return dhcp_server_send_to(server, message, giaddr, DHCP_SERVER_PORT);
+
+        if (message->type == DHCP_NAK)
+                return dhcp_server_send(server, message, broadcast);
+
+        if (ciaddr)
+                return dhcp_server_send(server, message, ciaddr);
+
+        /* 
+         * Client without address which did not ask for broadcast. It cannot answer ARP,
+         * so the frame is addressed to chaddr directly. Broadcast is used when that is 
+         * not possible, which every client has to accept
+         */
+        if (iface && iface->raw_tx && yiaddr && !(dhcp_message_flags(message) & DHCP_FLAG_BROADCAST) && 
+            message->packet->htype == DHCP_HTYPE_ETHERNET && message->packet->hlen == 6 &&
+            raw_tx_queue(iface->raw_tx, message->chaddr, yiaddr, DHCP_CLIENT_PORT,
+                         message->packet, dhcp_message_lenght(message)) == 0)
+                return 0;
+
+        return dhcp_server_send(server, message, broadcast);
+}
+
+uint32_t dhcp_server_identifier(const dhcp_server_t *server)
+{
+        if (!server)
+                return 0;
+
+        return server->iface ? server->iface->bound_ip : server->config.bound_ip;
+}
+
+void dhcp_server_set_identifier(const dhcp_server_t *server, dhcp_message_t *reply)
+{
+        if (!server || !reply)
+                return;
+
+        /* Option is copied from global options, which hold identifier of primary interface */
+        dhcp_option_t *o54 = dhcp_option_retrieve(reply->work->dhcp_options, DHCP_OPTION_SERVER_IDENTIFIER);
+        if (o54)
+                o54->value.ip = dhcp_server_identifier(server);
+}
+
+const char *dhcp_server_interface_name(const dhcp_server_t *server)
+{
+        return (server && server->iface) ? server->iface->name : NULL;
+}
+
+size_t dhcp_server_cache_memory_limit(const dhcp_server_t *server)
+{
+        if (!server)
+                return 0;
+
+        /* Every worker has its own cache, limit is split between them */
+        uint32_t workers = server->config.workers ? server->config.workers : 1;
+        return ((size_t)server->config.cache_memory_limit << 20) / workers;
+}
+
+uint32_t dhcp_server_worker_for(const uint8_t *chaddr, uint32_t workers)
+{
+        if (!chaddr || workers <= 1)
+                return 0;
+
+        /* Must match the reuseport steering program in attach_steering_program */
+        uint32_t hi = ((uint32_t)chaddr[0] << 24) | ((uint32_t)chaddr[1] << 16) | 
+                      ((uint32_t)chaddr[2] << 8) | chaddr[3];
+        uint32_t lo = ((uint32_t)chaddr[4] << 8) | chaddr[5];
+
+        return (hi ^ lo) % workers;
+}
+
+/*
+ * Attach classic BPF program to the reuseport group of every interface, which selects socket of worker 
+ * owning the client. Program runs with UDP payload at offset 0, chaddr is at offset 28.
+ * Failure is not fatal, workers drop packets of clients they dont own anyway.
+ */
+static void attach_steering_program(dhcp_server_t *server)
+{
+        struct sock_filter code[] = {
+                BPF_STMT(BPF_LD  | BPF_W   | BPF_ABS, 28),                       /* A = chaddr[0..3] */
+                BPF_STMT(BPF_ST, 0),                                            /* M[0] = A */
+                BPF_STMT(BPF_LD  | BPF_H   | BPF_ABS, 32),                       /* A = chaddr[4..5] */
+                BPF_STMT(BPF_LDX | BPF_MEM, 0),                                 /* X = M[0] */
+                BPF_STMT(BPF_ALU | BPF_XOR | BPF_X, 0),                         /* A ^= X */
+                BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, server->workers.count),     /* A %= workers */
+                BPF_STMT(BPF_RET | BPF_A, 0),
+        };
+        struct sock_fprog prog = {
+                .len = sizeof(code) / sizeof(code[0]),
+                .filter = code,
+        };
+
+        for (uint32_t i = 0; i < server->interface_count; i++) {
+                if (setsockopt(server->interfaces[i].sock_fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, 
+                               &prog, sizeof(prog)) < 0)
+                        cclog(LOG_WARN, NULL, "Failed to attach reuseport steering program on %s: %s", 
+                                server->interfaces[i].name, strerror(errno));
+        }
+}
+
+/* Returns interface owning descriptor fd (its socket or io_uring eventfd), NULL if there is none */
+static dhcp_interface_t *dhcp_server_interface_for_fd(dhcp_server_t *server, int fd)
+{
+        for (uint32_t i = 0; i < server->interface_count; i++) {
+                dhcp_interface_t *iface = &server->interfaces[i];
+#ifdef CONFIG_IO_URING
+                if (iface->uring && iface->uring->event_fd == fd)
+                        return iface;
+#endif
+                if (iface->sock_fd == fd)
+                        return iface;
+        }
+
+        return NULL;
+}
+
+/* Flush raw frames left pending by previous flush. Returns true if some are still pending */
+static bool dhcp_server_retry_raw_tx(dhcp_server_t *server)
+{
+        bool pending = false;
+
+        for (uint32_t i = 0; i < server->interface_count; i++) {
+                raw_tx_t *raw = server->interfaces[i].raw_tx;
+                if (raw && raw->pending) {
+                        raw_tx_flush(raw);
+                        pending |= raw->pending != 0;
                 }
+        }
 
-                /* If we capture a message sent by a server, drop it */
-                if (dhcp_msg->type == DHCP_OFFER || 
-                        dhcp_msg->type == DHCP_ACK || 
-                        dhcp_msg->type == DHCP_NAK)
-                        continue;
+        return pending;
+}
 
-                /* Store the received message in cache for future use */
-                cclog(LOG_MSG, NULL, "Received message of type %s from %s", 
-                                rfc2131_dhcp_message_type_to_str(dhcp_msg->type),
-                                uint8_array_to_mac((uint8_t*)dhcp_msg->chaddr));
+static int dhcp_server_run(dhcp_server_t *server)
+{
+	int rv = -1;
+        int nfds;
+        uint64_t expirations;
+        struct epoll_event events[EPOLL_MAX_EVENTS];
+        dhcp_interface_t *iface;
 
-                /*
-                 * Store message in cache for future reference, drop communication if the message 
-                 * cannot be stored, for example due to full cache (log should be made)
-                 */
-                if (trans_cache_add_message(server->trans_cache, dhcp_msg) < 0)
+        if_failed(init_event_loop(server), exit);
+
+	while (server_keep_running) {
+                /* Quiet link would leave unsent frames in tx ring, so wait only shortly */
+                int timeout = dhcp_server_retry_raw_tx(server) ? RAW_TX_RETRY_DELAY : -1;
+                nfds = epoll_wait(server->epoll_fd, events, EPOLL_MAX_EVENTS, timeout);
+                if (nfds < 0 && errno == EINTR) {
                         continue;
-                /* 
-                 * This database is only used for debugging purposes, we dont need to raise 
-                 * and error if it fails
-                 */
-                if (server->config.db_enable)
-                        database_store_message(dhcp_msg);
-                
-                switch (dhcp_msg->type) {
-                        case DHCP_DISCOVER: 
-                                rv = message_dhcpdiscover_handle(server, dhcp_msg); 
-                                break;
-                        case DHCP_REQUEST: 
-                                rv = message_dhcprequest_handle(server, dhcp_msg);
-                                break;
-                        case DHCP_DECLINE:
-                                rv = message_dhcpdecline_handle(server, dhcp_msg);
-                                break;
-                        case DHCP_INFORM:
-                                rv = message_dhcpinform_handle(server, dhcp_msg);
-                                break;
-                        case DHCP_RELEASE:
-                                rv = message_dhcprelease_handle(server, dhcp_msg);
-                                break;
-                        default:
-                                cclog(LOG_WARN, NULL, "Invalid DHCP message type received (%d), "
-                                                "dropping message", dhcp_msg->type);
-                                rv = 0;
-                                break;
+                } else if (nfds < 0) {
+                        cclog(LOG_CRITICAL, NULL, "Failed to wait for events: %s", strerror(errno));
+                        goto exit;
                 }
 
-                if_failed_log_n_ng(rv, LOG_ERROR, NULL, "Failed to handle %s from %s", 
-                                rfc2131_dhcp_message_type_to_str(dhcp_msg->type),
-                                uint8_array_to_mac((uint8_t*)dhcp_msg->chaddr));
-
-	} while (server_keep_running);
+                for (int i = 0; i < nfds; i++) {
+                        iface = dhcp_server_interface_for_fd(server, events[i].data.fd);
+                        if (iface) {
+#ifdef CONFIG_IO_URING
+                                if (iface->uring) {
+                                        dhcp_server_receive_uring(server, iface);
+                                        continue;
+                                }
+#endif
+                                dhcp_server_receive(server, iface);
+                        } else if (events[i].data.fd == server->tick_fd) {
+                                /* 
+                                 * Advance timers used by server (e.g. transaction cache timers) by number 
+                                 * of elapsed ticks. Tick also wakes up workers which didnt receive the SIGINT
+                                 */
+                                if (read(server->tick_fd, &expirations, sizeof(expirations)) > 0) {
+                                        timer_wheel_advance(server->timers.wheel, expirations);
+                                        trans_cache_shrink(server->trans_cache);
+                                }
+                        } else if (events[i].data.fd == server->unix_server.fd) {
+                                /*
+                                 * Handle pending communication on unix server. 
+                                 * PARAMETER IS VOID POINTER TO DHCP SERVER due to limitations
+                                 */
+                                unix_server_handle(server);
+                        } else {
+                                /* Sockets of running DHCP snooping scans */
+                                dhcp_snooper_handle_fd(events[i].data.fd);
+                        }
+                }
+	}
 
 	rv = 0;
 exit:
 	return rv;
 }
 
+/* Free resources owned by worker. Shared resources are freed by uninit_dhcp_server */
+static void dhcp_server_worker_clean(dhcp_server_t *worker)
+{
+        dhcp_server_close_interfaces(worker);
+        trans_cache_destroy(&worker->trans_cache);
+        timer_wheel_destroy(&worker->timers.wheel);
+        ingress_destroy(&worker->ingress);
+        option_cache_destroy(&worker->option_cache);
+        message_slab_destroy(&worker->slab);
+        dynamic_ACL_destroy(&worker->dacl);
+
+        if (worker->tick_fd >= 0)
+                close(worker->tick_fd);
+        if (worker->epoll_fd >= 0)
+                close(worker->epoll_fd);
+        worker->tick_fd = worker->epoll_fd = -1;
+}
+
+static void *dhcp_server_worker_main(void *priv)
+{
+        dhcp_server_t *worker = (dhcp_server_t*)priv;
+
+        if (dhcp_server_run(worker) < 0) {
+                cclog(LOG_CRITICAL, NULL, "Worker %u stopped due to an error", worker->workers.id);
+                server_keep_running = 0;
+        }
+
+        return NULL;
+}
+
+/* Create workers 1..N-1, worker 0 is the calling thread */
+static int dhcp_server_start_workers(dhcp_server_t *server)
+{
+        int rv = -1;
+        uint32_t count = server->config.workers;
+        dhcp_server_t *w;
+
+        server->workers.servers = calloc(count - 1, sizeof(dhcp_server_t));
+        server->workers.threads = calloc(count - 1, sizeof(pthread_t));
+        if_null_log(server->workers.servers, exit, LOG_CRITICAL, NULL, "Failed to allocate workers");
+        if_null_log(server->workers.threads, exit, LOG_CRITICAL, NULL, "Failed to allocate workers");
+
+        /* 
+         * Sockets have to be bound in order of worker ids, since it is the index in reuseport 
+         * group. Every interface has its own group
+         */
+        for (uint32_t i = 1; i < count; i++) {
+                w = &server->workers.servers[i - 1];
+                memcpy(w, server, sizeof(dhcp_server_t));
+                w->workers.id = i;
+                w->workers.count = count;
+                w->workers.servers = NULL;
+                w->workers.threads = NULL;
+                w->timers.lease_expiration_check = NULL;
+                w->timers.wheel = NULL;
+                w->unix_server.fd = -1;
+                w->interfaces = NULL;
+                w->interface_count = 0;
+                w->iface = NULL;
+                w->slab = NULL;
+                w->ingress = NULL;
+                w->option_cache = NULL;
+                w->trans_cache = NULL;
+                w->dacl = NULL;
+                w->epoll_fd = w->tick_fd = -1;
+
+                if_failed(dhcp_server_open_interfaces(w, server->interfaces, server->interface_count), exit);
+
+                w->trans_cache = trans_cache_new(server->config.cache_size, server->config.trans_duration);
+                if_null_log(w->trans_cache, exit, LOG_CRITICAL, NULL, 
+                        "Failed to initialise transaction cache of worker %u", i);
+                trans_cache_set_memory_limit(w->trans_cache, dhcp_server_cache_memory_limit(server));
+
+                w->dacl = dynamic_ACL_new();
+                if_null_log(w->dacl, exit, LOG_CRITICAL, NULL, 
+                        "Failed to initialise dynamic ACL of worker %u", i);
+                w->dacl->enabled = server->dacl ? server->dacl->enabled : false;
+        }
+
+        server->workers.count = count;
+        attach_steering_program(server);
+
+        for (uint32_t i = 1; i < count; i++) {
+                w = &server->workers.servers[i - 1];
+                w->workers.count = count;
+                if (pthread_create(&server->workers.threads[i - 1], NULL, dhcp_server_worker_main, w)) {
+                        cclog(LOG_CRITICAL, NULL, "Failed to start worker %u", i);
+                        server->workers.count = i;
+                        goto exit;
+                }
+        }
+
+        cclog(LOG_MSG, NULL, "Started %u server workers", count);
+        rv = 0;
+exit:
+        return rv;
+}
+
+static void dhcp_server_stop_workers(dhcp_server_t *server)
+{
+        if (!server->workers.servers)
+                return;
+
+        server_keep_running = 0;
+        for (uint32_t i = 1; i < server->workers.count; i++)
+                pthread_join(server->workers.threads[i - 1], NULL);
+
+        /* Workers which failed to initialise have id 0 and own no resources */
+        for (uint32_t i = 1; i < server->config.workers; i++) {
+                if (server->workers.servers[i - 1].workers.id)
+                        dhcp_server_worker_clean(&server->workers.servers[i - 1]);
+        }
+
+        free(server->workers.servers);
+        free(server->workers.threads);
+        server->workers.servers = NULL;
+        server->workers.threads = NULL;
+        server->workers.count = 1;
+}
+
+int dhcp_server_serve(dhcp_server_t *server)
+{
+	int rv = -1;
+
+	if_null_log(server, exit, LOG_CRITICAL, NULL, "server parameter is null");
+
+        if (server->config.workers > 1) {
+                if_failed(dhcp_server_start_workers(server), exit);
+        }
+
+        rv = dhcp_server_run(server);
+exit:
+        if (server)
+                dhcp_server_stop_workers(server);
+	return rv;
+}
@@ -6,37 +6,90 @@
 #include "timer.h"
 #include "utils/llist.h"
 #include "security/acl.h"
+#include "security/xdp_filter.h"
 #include "unix_server.h"
+#include "dhcp_interface.h"
+#include "message_slab.h"
+#include "ingress.h"
+#include "option_cache.h"
+#include "dhcp_packet.h"
 #include <linux/limits.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdint.h>
 
 typedef struct dhcp_server {
-    int sock_fd;
+    int epoll_fd;                           // epoll instance multiplexing every descriptor the server waits on
+    int tick_fd;                            // timerfd firing every tick_delay miliseconds to advance timers.wheel
     address_allocator_t *allocator;
     transaction_cache_t *trans_cache;
+    message_slab_t *slab;                   // preallocated messages for received packets and replies
+    ingress_t *ingress;                     // priority queues of received messages waiting to be handled
+    option_cache_t *option_cache;           // serialized options of replies, built on first use
+    xdp_filter_t *xdp;                      // XDP program dropping denied clients on served interfaces, shared by workers
+
+    /* Received packets dropped before parsing, see dhcp_server_enqueue */
+    struct {
+        uint64_t replies;                   // BOOTREPLY packets and messages of servers
+        uint64_t snooping;                  // messages of our own DHCP snooping scans
+        uint64_t acl;                       // clients denied by ACL
+        uint64_t dynamic_acl;               // clients denied by dynamic ACL
+    } early_drops;
+
+    /* 
+     * Served interfaces, interface 0 is config.interface. Every worker has its own 
+     * array with its own sockets. iface points to the interface on which the message 
+     * being handled was received, replies are sent from it
+     */
+    dhcp_interface_t *interfaces;
+    uint32_t interface_count;
+    dhcp_interface_t *iface;
+
+    /*
+     * Multi-threaded mode. Worker 0 is the main server structure, other workers are 
+     * shallow copies of it with their own sockets, transaction cache, dynamic ACL and 
+     * I/O batches. Allocator, ACL and configuration are shared. Clients are steered 
+     * to workers by their chaddr, so whole transaction is handled by one worker.
+     */
+    struct {
+        uint32_t id;                        // index of this worker
+        uint32_t count;                     // number of running workers (1 when mode is disabled)
+        struct dhcp_server *servers;        // worker structures 1..count-1, only in worker 0
+        pthread_t *threads;
+    } workers;
 
     /* Wrapper structure to hold all timers used by server */
     struct {
+        timer_wheel_t *wheel;               // schedules lease check and transaction timers of this worker
         struct timer *lease_expiration_check;
     } timers;
 
     struct {
         char        config_path[PATH_MAX];
         char        interface[256];         // name of bound interface. Can be empty if ip address is specified
+        char        interfaces[DHCP_MAX_INTERFACES][IFNAMSIZ]; // additional served interfaces
+        uint32_t    interface_count;        // number of additional served interfaces
         uint32_t    bound_ip;               // HOST BYTE ORDER ip address of server. Is retrieved using the interace name
         uint32_t    broadcast_addr;         // HOST BYTE ORDER broadcast domain of the server. Is determined from interface name
         uint32_t    tick_delay;             // delay in miliseconds between server ticks.
-        uint32_t    cache_size;             // number of max transactions held in a cache 
+        uint32_t    cache_size;             // number of transactions a cache holds initially
+        uint32_t    cache_memory_limit;     // MiB of memory caches of all workers can grow to
         uint32_t    trans_duration;         // duration in seconds for which the transactions are stored in cache
         uint32_t    lease_expiration_check; // period in seconds after which server checks lease database for expired leases and removes them.
         uint32_t    lease_time;
+        uint32_t    batch_size;             // maximum number of datagrams received/sent by one syscall
+        uint32_t    workers;                // number of worker threads, each with its own SO_REUSEPORT socket
+        uint32_t    ingress_depth;          // capacity of every ingress priority queue
+        uint32_t    xdp_rate_limit;         // DHCP packets per second allowed to every client by XDP filter, 0 means unlimited
+        uint32_t    xdp_rate_burst;         // DHCP packets a client can send at once before XDP filter limits it
         uint8_t     log_verbosity;          // verbosity of logger messages
         
         uint8_t     acl_enable;             // enable ACL security feature (default true)
         uint8_t     dynamic_acl_enable;     // enable dynamic ACL security feature (default true)
         uint8_t     acl_blacklist;          // is ACL a blacklist? (default true)
         uint8_t     db_enable;              // enable or disable dhcp packet database logging
+        uint8_t     unicast_enable;         // unicast replies to clients without address over packet socket (default false)
+        uint8_t     xdp_enable;             // enforce ACL and rate limit in XDP program on served interfaces (default false)
     } config;
 
     ACL_t *acl;
@@ -50,6 +103,12 @@ typedef struct dhcp_server {
  */
 int init_dhcp_server(dhcp_server_t *server);
 
+/* 
+ * Rebuild socket filters of server interfaces (see socket_filter.h) and ACL map of XDP 
+ * filter, has to be called when ACL entries are loaded after the sockets were opened
+ */
+void dhcp_server_update_filters(dhcp_server_t *server);
+
 /* Initialise timers used by dhcp server */
 int init_dhcp_server_timers(dhcp_server_t *server);
 
@@ -64,4 +123,34 @@ int uninit_dhcp_server(dhcp_server_t *server);
  */
 int dhcp_server_serve(dhcp_server_t *server);
 
+/*
+ * Send dhcp message to client port of address addr (HOST BYTE ORDER). 
+ * When the server is serving, reply is queued and sent together with 
+ * other replies from the same receive batch.
+ */
+int dhcp_server_send(dhcp_server_t *server, dhcp_message_t *message, uint32_t addr);
+
+/*
+ * Send reply to client as specified by RFC 2131 section 4.1. Reply goes to relay 
+ * agent in giaddr, to ciaddr if client has an address, or to broadcast address. 
+ * If unicast_enable is set and client did not set broadcast flag, reply is 
+ * unicasted to chaddr and yiaddr over packet socket instead of broadcasting
+ */
+int dhcp_server_send_reply(dhcp_server_t *server, dhcp_message_t *message);
+
+/* Returns server identifier (HOST BYTE ORDER) on interface of currently handled message */
+uint32_t dhcp_server_identifier(const dhcp_server_t *server);
+
+/* Set server identifier option of reply to the identifier of the interface */
+void dhcp_server_set_identifier(const dhcp_server_t *server, dhcp_message_t *reply);
+
+/* Returns name of interface of currently handled message, NULL if it is not known */
+const char *dhcp_server_interface_name(const dhcp_server_t *server);
+
+/* Returns memory limit in bytes of transaction cache of one worker */
+size_t dhcp_server_cache_memory_limit(const dhcp_server_t *server);
+
+/* Returns index of worker responsible for client with hardware address chaddr */
+uint32_t dhcp_server_worker_for(const uint8_t *chaddr, uint32_t workers);
+
 #endif /* __DHC_SERVER_H__ */
@@ -0,0 +1,157 @@
+#include "ingress.h"
+#include "message_slab.h"
+#include "logging.h"
+#include "RFC/RFC-2131.h"
+#include "RFC/RFC-2132.h"
+#include <cclog_macros.h>
+#include <stdlib.h>
+
+ingress_t *ingress_new(uint32_t depth)
+{
+        ingress_t *ingress = NULL;
+
+        if_false_log(depth, error, LOG_ERROR, NULL, "Invalid ingress queue depth 0");
+
+        ingress = calloc(1, sizeof(ingress_t));
+        if_null_log(ingress, error, LOG_ERROR, NULL, "Failed to allocate ingress queues");
+
+        for (int i = 0; i < INGRESS_PRIO_COUNT; i++) {
+                ingress->queues[i].entries = calloc(depth, sizeof(ingress_entry_t));
+                if_null_log(ingress->queues[i].entries, error, LOG_ERROR, NULL,
+                                "Failed to allocate ingress queue of %u entries", depth);
+        }
+
+        ingress->depth = depth;
+        /* Discovers are worth handling only while there is not much lease holder work waiting */
+        ingress->shed_threshold = depth / 2 ? depth / 2 : 1;
+
+        return ingress;
+error:
+        ingress_destroy(&ingress);
+        return NULL;
+}
+
+enum ingress_priority ingress_classify(const dhcp_packet_t *packet)
+{
+        if (!packet || packet->opcode != BOOTREQUEST)
+                return INGRESS_PRIO_LOW;
+
+        return ingress_classify_type(packet, dhcp_packet_peek_type(packet));
+}
+
+enum ingress_priority ingress_classify_type(const dhcp_packet_t *packet, int type)
+{
+        switch (type) {
+        case DHCP_RELEASE:
+        case DHCP_DECLINE:
+                return INGRESS_PRIO_HIGH;
+        case DHCP_REQUEST:
+                /* RENEWING and REBINDING clients fill ciaddr (RFC 2131 4.3.2) */
+                return packet->ciaddr ? INGRESS_PRIO_HIGH : INGRESS_PRIO_NORMAL;
+        case DHCP_INFORM:
+                return INGRESS_PRIO_NORMAL;
+        default:
+                return INGRESS_PRIO_LOW;
+        }
+}
+
+int ingress_push(ingress_t *ingress, dhcp_message_t *message, struct dhcp_interface *iface)
+{
+        if (!message)
+                return -1;
+
+        return ingress_push_classified(ingress, message, iface, ingress_classify(message->packet));
+}
+
+int ingress_push_classified(ingress_t *ingress, dhcp_message_t *message, struct dhcp_interface *iface,
+                enum ingress_priority prio)
+{
+        if (!ingress || !message || prio >= INGRESS_PRIO_COUNT)
+                return -1;
+
+        struct ingress_queue *q = &ingress->queues[prio];
+
+        if (prio == INGRESS_PRIO_LOW && ingress->queues[INGRESS_PRIO_HIGH].count +
+                        ingress->queues[INGRESS_PRIO_NORMAL].count >= ingress->shed_threshold) {
+                ingress->stats.shed++;
+                return -1;
+        }
+
+        if (q->count == ingress->depth) {
+                ingress->stats.dropped[prio]++;
+                return -1;
+        }
+
+        ingress_entry_t *e = &q->entries[(q->head + q->count) % ingress->depth];
+        e->message = dhcp_message_ref(message);
+        e->iface = iface;
+        q->count++;
+
+        ingress->stats.enqueued[prio]++;
+        if (q->count > ingress->stats.max_depth[prio])
+                ingress->stats.max_depth[prio] = q->count;
+
+        return 0;
+}
+
+bool ingress_pop(ingress_t *ingress, ingress_entry_t *entry)
+{
+        if (!ingress || !entry)
+                return false;
+
+        for (int i = 0; i < INGRESS_PRIO_COUNT; i++) {
+                struct ingress_queue *q = &ingress->queues[i];
+                if (q->count == 0)
+                        continue;
+
+                *entry = q->entries[q->head];
+                q->entries[q->head].message = NULL;
+                q->head = (q->head + 1) % ingress->depth;
+                q->count--;
+                return true;
+        }
+
+        return false;
+}
+
+uint32_t ingress_count(const ingress_t *ingress)
+{
+        if (!ingress)
+                return 0;
+
+        uint32_t count = 0;
+        for (int i = 0; i < INGRESS_PRIO_COUNT; i++)
+                count += ingress->queues[i].count;
+
+        return count;
+}
+
+const char *ingress_priority_to_str(enum ingress_priority prio)
+{
+        switch (prio) {
+        case INGRESS_PRIO_HIGH:   return "high";
+        case INGRESS_PRIO_NORMAL: return "normal";
+        case INGRESS_PRIO_LOW:    return "low";
+        default:                  return "unknown";
+        }
+}
+
+void ingress_destroy(ingress_t **ingress)
+{
+        if (!ingress || !*ingress)
+                return;
+
+        ingress_t *in = *ingress;
+        ingress_entry_t entry;
+
+        if (in->depth) {
+                while (ingress_pop(in, &entry))
+                        dhcp_message_unref(&entry.message);
+        }
+
+        for (int i = 0; i < INGRESS_PRIO_COUNT; i++)
+                free(in->queues[i].entries);
+
+        free(in);
+        *ingress = NULL;
+}
@@ -0,0 +1,86 @@
+#ifndef __INGRESS_H__
+#define __INGRESS_H__
+
+#include "dhcp_packet.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Ingress stage between socket receive and packet handlers.
+ * Received messages are classified from their raw packet (message type and ciaddr,
+ * no parsing) into bounded priority queues and handled highest priority first.
+ * When the server falls behind, e.g. during a DISCOVER storm after a mass reboot,
+ * clients renewing their leases are still served in time and new clients wait
+ * or are dropped (they retransmit anyway).
+ *
+ * Queues hold references to messages, so deferred messages stay valid after the
+ * receive buffers are reused. Ingress is not thread safe, every worker has its own.
+ */
+
+enum ingress_priority {
+    INGRESS_PRIO_HIGH = 0,          // clients holding a lease: RENEWING/REBINDING requests, releases, declines
+    INGRESS_PRIO_NORMAL,            // requests finishing address acquisition, informs
+    INGRESS_PRIO_LOW,               // discovers and packets which could not be classified
+    INGRESS_PRIO_COUNT,
+};
+
+struct dhcp_interface;
+
+typedef struct ingress_entry {
+    dhcp_message_t *message;
+    struct dhcp_interface *iface;   // interface on which the message was received
+} ingress_entry_t;
+
+typedef struct ingress {
+    uint32_t depth;                 // capacity of every queue
+    uint32_t shed_threshold;        // number of queued high and normal messages above which low ones are dropped
+
+    struct ingress_queue {
+        ingress_entry_t *entries;   // ring buffer of depth entries
+        uint32_t head;
+        uint32_t count;
+    } queues[INGRESS_PRIO_COUNT];
+
+    struct {
+        uint64_t enqueued[INGRESS_PRIO_COUNT];
+        uint64_t dropped[INGRESS_PRIO_COUNT];   // messages dropped because their queue was full
+        uint64_t shed;                          // low priority messages dropped due to backlog of higher ones
+        uint32_t max_depth[INGRESS_PRIO_COUNT];
+    } stats;
+} ingress_t;
+
+/* Create ingress with queues of depth entries. Returns NULL on failure */
+ingress_t *ingress_new(uint32_t depth);
+
+/* Returns priority of raw packet. Only header and option 53 are read */
+enum ingress_priority ingress_classify(const dhcp_packet_t *packet);
+
+/* Same as ingress_classify for BOOTREQUEST packet whose type was already read by dhcp_packet_peek_type */
+enum ingress_priority ingress_classify_type(const dhcp_packet_t *packet, int type);
+
+/*
+ * Classify message and queue it, taking a reference. Returns 0 when the message
+ * was queued, -1 when it was dropped (queue is full or low priority work is shed)
+ */
+int ingress_push(ingress_t *ingress, dhcp_message_t *message, struct dhcp_interface *iface);
+
+/* Same as ingress_push for message already classified into prio */
+int ingress_push_classified(ingress_t *ingress, dhcp_message_t *message, struct dhcp_interface *iface,
+        enum ingress_priority prio);
+
+/*
+ * Dequeue message with highest priority into entry. Caller owns the reference of
+ * entry->message. Returns false if all queues are empty
+ */
+bool ingress_pop(ingress_t *ingress, ingress_entry_t *entry);
+
+/* Returns number of queued messages */
+uint32_t ingress_count(const ingress_t *ingress);
+
+/* Returns name of priority for logging and statistics */
+const char *ingress_priority_to_str(enum ingress_priority prio);
+
+/* Drops references of queued messages and frees ingress, sets the pointer to NULL */
+void ingress_destroy(ingress_t **ingress);
+
+#endif // !__INGRESS_H__
@@ -50,6 +50,7 @@ int init_cache(dhcp_server_t *server)
         server->trans_cache = trans_cache_new(server->config.cache_size,
                                               server->config.trans_duration);
         if_null(server->trans_cache, error);
+        trans_cache_set_memory_limit(server->trans_cache, dhcp_server_cache_memory_limit(server));
 
         return 0;
 error:
@@ -78,6 +79,9 @@ int init_ACL(dhcp_server_t *server)
                 goto error;
         }
 
+        /* Blacklisted clients are rejected already by socket filters */
+        dhcp_server_update_filters(server);
+
         return 0;
 error:
         cclog(LOG_CRITICAL, NULL, "Failed to initialise acl");
@@ -110,7 +114,9 @@ int init_unix_commands(unix_server_t *s)
         if_failed(register_command(s, "echo", command_echo), error);
         if_failed(register_command(s, "stop-server", command_stop), error);
         if_failed(register_command(s, "rogue-scan", command_rogue_scan), error);
+        if_failed(register_command(s, "rogue-scan-result", command_rogue_scan_result), error);
         if_failed(register_command(s, "pool-status", command_pool_status), error);
+        if_failed(register_command(s, "io-stats", command_io_stats), error);
 
         return 0;
 error:
@@ -132,3 +138,26 @@ error:
         return -1;
 }
 
+int init_xdp_filter(dhcp_server_t *server)
+{
+        if (!server)
+                return -1;
+
+        if (server->config.xdp_enable != CONFIG_BOOL_TRUE)
+                return 0;
+
+        /* Server repeats every check of the program, so it can run without it */
+        server->xdp = xdp_filter_new(server->acl, server->config.xdp_rate_limit, 
+                                     server->config.xdp_rate_burst);
+        if_null_log(server->xdp, exit, LOG_WARN, NULL, "Failed to load XDP filter, "
+                        "packets are filtered only by the server");
+
+        for (uint32_t i = 0; i < server->interface_count; i++)
+                xdp_filter_attach(server->xdp, server->interfaces[i].name);
+
+        if (server->xdp->link_count == 0)
+                xdp_filter_destroy(&server->xdp);
+exit:
+        return 0;
+}
+
@@ -8,6 +8,7 @@ int init_dhcp_options(dhcp_server_t *server);
 int init_cache(dhcp_server_t *server);
 int init_ACL(dhcp_server_t *server);
 int init_dynamic_ACL(dhcp_server_t *server);
+int init_xdp_filter(dhcp_server_t *server);
 int init_unix_commands(unix_server_t *server);
 
 #endif // !__INIT_H__
@@ -0,0 +1,193 @@
+#define _GNU_SOURCE
+#include "io_batch.h"
+#include "logging.h"
+#include <cclog_macros.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+io_batch_t *io_batch_new(uint32_t size, message_slab_t *slab)
+{
+        io_batch_t *batch = NULL;
+
+        if (size == 0 || size > IO_BATCH_MAX_SIZE) {
+                cclog(LOG_ERROR, NULL, "Invalid I/O batch size %u (allowed 1 - %u)",
+                                size, IO_BATCH_MAX_SIZE);
+                goto error;
+        }
+
+        batch = calloc(1, sizeof(io_batch_t));
+        if_null_log(batch, error, LOG_ERROR, NULL, "Failed to allocate I/O batch");
+
+        batch->size = size;
+        batch->slab = slab;
+        batch->rx_messages = calloc(size, sizeof(dhcp_message_t*));
+        batch->rx_hdr = calloc(size, sizeof(struct mmsghdr));
+        batch->rx_iov = calloc(size, sizeof(struct iovec));
+        batch->tx_packets = calloc(size, sizeof(dhcp_packet_t));
+        batch->tx_addr = calloc(size, sizeof(struct sockaddr_in));
+        batch->tx_hdr = calloc(size, sizeof(struct mmsghdr));
+        batch->tx_iov = calloc(size, sizeof(struct iovec));
+        if (!batch->rx_messages || !batch->rx_hdr || !batch->rx_iov || !batch->tx_packets ||
+            !batch->tx_addr || !batch->tx_hdr || !batch->tx_iov) {
+                cclog(LOG_ERROR, NULL, "Failed to allocate I/O batch buffers");
+                goto error;
+        }
+
+        /* Headers point to the same buffers for whole lifetime of batch */
+        for (uint32_t i = 0; i < size; i++) {
+                batch->rx_messages[i] = message_slab_alloc(slab);
+                if_null(batch->rx_messages[i], error);
+
+                batch->rx_iov[i].iov_base = batch->rx_messages[i]->packet;
+                batch->rx_iov[i].iov_len = sizeof(dhcp_packet_t);
+                batch->rx_hdr[i].msg_hdr.msg_iov = &batch->rx_iov[i];
+                batch->rx_hdr[i].msg_hdr.msg_iovlen = 1;
+
+                batch->tx_iov[i].iov_base = &batch->tx_packets[i];
+                batch->tx_hdr[i].msg_hdr.msg_iov = &batch->tx_iov[i];
+                batch->tx_hdr[i].msg_hdr.msg_iovlen = 1;
+                batch->tx_hdr[i].msg_hdr.msg_name = &batch->tx_addr[i];
+                batch->tx_hdr[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+        }
+
+        cclog(LOG_MSG, NULL, "Initialised I/O batch of size %u", size);
+
+        return batch;
+error:
+        io_batch_destroy(&batch);
+        return NULL;
+}
+
+/* 
+ * Replace messages kept by someone else, so that recvmmsg doesnt overwrite them, and 
+ * messages which were stored without work buffers meanwhile
+ */
+static int io_batch_refill(io_batch_t *batch)
+{
+        for (uint32_t i = 0; i < batch->size; i++) {
+                if (dhcp_message_can_receive(batch->rx_messages[i]))
+                        continue;
+
+                dhcp_message_unref(&batch->rx_messages[i]);
+                batch->rx_messages[i] = message_slab_alloc(batch->slab);
+                if_null_log(batch->rx_messages[i], error, LOG_ERROR, NULL, 
+                                "Failed to allocate message for I/O batch");
+                batch->rx_iov[i].iov_base = batch->rx_messages[i]->packet;
+        }
+
+        return 0;
+error:
+        return -1;
+}
+
+int io_batch_receive(io_batch_t *batch, int fd)
+{
+        if (!batch)
+                return -1;
+
+        int rv = io_batch_refill(batch);
+        if (rv < 0)
+                return rv;
+
+        do {
+                rv = recvmmsg(fd, batch->rx_hdr, batch->size, MSG_DONTWAIT, NULL);
+        } while (rv < 0 && errno == EINTR);
+
+        if (rv < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                return 0;
+        if_failed_log_n(rv, exit, LOG_WARN, NULL, "Failed to receive dhcp packets: %s",
+                        strerror(errno));
+
+        /* Short datagrams must not leave options of previous packet in the buffer */
+        for (int i = 0; i < rv; i++) {
+                batch->rx_messages[i]->packet_lenght = batch->rx_hdr[i].msg_len;
+                if (batch->rx_hdr[i].msg_len < sizeof(dhcp_packet_t))
+                        memset((uint8_t*)batch->rx_messages[i]->packet + batch->rx_hdr[i].msg_len,
+                               0, sizeof(dhcp_packet_t) - batch->rx_hdr[i].msg_len);
+        }
+
+        if (rv > 0) {
+                batch->stats.rx_calls++;
+                batch->stats.rx_packets += rv;
+                if (rv > batch->stats.rx_max_batch)
+                        batch->stats.rx_max_batch = rv;
+        }
+exit:
+        return rv;
+}
+
+int io_batch_queue(io_batch_t *batch, int fd, const dhcp_packet_t *packet, size_t len,
+        const struct sockaddr_in *addr)
+{
+        if (!batch || !packet || !addr || len > sizeof(dhcp_packet_t))
+                return -1;
+
+        if (batch->tx_count == batch->size)
+                io_batch_flush(batch, fd);
+
+        uint32_t i = batch->tx_count++;
+        memcpy(&batch->tx_packets[i], packet, len);
+        memcpy(&batch->tx_addr[i], addr, sizeof(struct sockaddr_in));
+        batch->tx_iov[i].iov_len = len;
+
+        return 0;
+}
+
+int io_batch_flush(io_batch_t *batch, int fd)
+{
+        if (!batch)
+                return -1;
+
+        int rv;
+        uint32_t sent = 0;
+        uint32_t delivered = 0;
+
+        /* sendmmsg can send less messages than requested, so we retry with the rest */
+        while (sent < batch->tx_count) {
+                rv = sendmmsg(fd, batch->tx_hdr + sent, batch->tx_count - sent, 0);
+                if (rv < 0 && errno == EINTR)
+                        continue;
+
+                batch->stats.tx_calls++;
+                if (rv <= 0) {
+                        /* Skip the failing datagram so it cannot block the rest of queue */
+                        cclog(LOG_ERROR, NULL, "Failed to send dhcp packet: %s", strerror(errno));
+                        batch->stats.tx_dropped++;
+                        sent++;
+                        continue;
+                }
+
+                batch->stats.tx_packets += rv;
+                delivered += rv;
+                sent += rv;
+        }
+
+        batch->tx_count = 0;
+        return delivered;
+}
+
+void io_batch_destroy(io_batch_t **batch)
+{
+        if (!batch || !*batch)
+                return;
+
+        io_batch_t *b = *batch;
+        if (b->rx_messages) {
+                for (uint32_t i = 0; i < b->size; i++) {
+                        dhcp_message_unref(&b->rx_messages[i]);
+                }
+        }
+
+        free(b->rx_messages);
+        free(b->rx_hdr);
+        free(b->rx_iov);
+        free(b->tx_packets);
+        free(b->tx_addr);
+        free(b->tx_hdr);
+        free(b->tx_iov);
+        free(b);
+        *batch = NULL;
+}
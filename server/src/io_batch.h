@@ -0,0 +1,72 @@
+#ifndef __IO_BATCH_H__
+#define __IO_BATCH_H__
+
+#include "dhcp_packet.h"
+#include "message_slab.h"
+#include <netinet/in.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+#define IO_BATCH_MAX_SIZE 1024
+
+/*
+ * Structure for batched socket I/O.
+ * Received datagrams are read with a single recvmmsg() call directly into
+ * preallocated array of dhcp messages taken from message slab. If a message is 
+ * still referenced after handling (e.g. by transaction), its slot gets a new 
+ * message before next receive. Replies are queued into tx slots
+ * (packet is copied, so the message can be freed or reused) and sent
+ * with a single sendmmsg() call when io_batch_flush is called or when the
+ * queue is full.
+ */
+typedef struct io_batch {
+    uint32_t size;                  // maximum number of datagrams handled by one syscall
+    message_slab_t *slab;           // source of rx messages, can be NULL
+
+    dhcp_message_t **rx_messages;   // preallocated messages, filled by io_batch_receive
+    struct mmsghdr *rx_hdr;
+    struct iovec *rx_iov;
+
+    uint32_t tx_count;              // number of currently queued replies
+    dhcp_packet_t *tx_packets;
+    struct sockaddr_in *tx_addr;
+    struct mmsghdr *tx_hdr;
+    struct iovec *tx_iov;
+
+    struct {
+        uint64_t rx_calls;          // number of recvmmsg calls which returned datagrams
+        uint64_t rx_packets;
+        uint64_t tx_calls;          // number of sendmmsg calls
+        uint64_t tx_packets;
+        uint64_t tx_dropped;        // replies which failed to be sent
+        uint32_t rx_max_batch;      // largest number of datagrams received by one call
+    } stats;
+} io_batch_t;
+
+/* 
+ * Allocate batch with size slots, messages are taken from slab (can be NULL). 
+ * Returns NULL on failure or invalid size 
+ */
+io_batch_t *io_batch_new(uint32_t size, message_slab_t *slab);
+
+/*
+ * Receive up to size datagrams from non-blocking socket fd into rx_messages.
+ * Lenght of datagram n is stored in rx_hdr[n].msg_len.
+ * Returns number of received datagrams, 0 if there is no datagram
+ * waiting and -1 on error.
+ */
+int io_batch_receive(io_batch_t *batch, int fd);
+
+/*
+ * Queue packet of len bytes to be sent to addr. If the queue is full, it is
+ * flushed first. Returns 0 on success, -1 on failure
+ */
+int io_batch_queue(io_batch_t *batch, int fd, const dhcp_packet_t *packet, size_t len,
+        const struct sockaddr_in *addr);
+
+/* Send all queued packets. Returns number of sent packets or -1 on error */
+int io_batch_flush(io_batch_t *batch, int fd);
+
+void io_batch_destroy(io_batch_t **batch);
+
+#endif // !__IO_BATCH_H__
@@ -16,6 +16,314 @@
 #include <sys/stat.h>
 #include <unistd.h>
 #include <time.h>
+#include <pthread.h>
+
+/*
+ * Lease files are rewritten as a whole on every change, so concurrent read-modify-write 
+ * cycles from multiple workers would lose leases. Only public functions take the lock.
+ */
+static pthread_mutex_t lease_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* 
+ * In memory copy of leases in .lease files, see lease_find_address. Every record is in 
+ * chain of its address and of its chaddr, records with client identifier also in chain 
+ * of the identifier.
+ */
+struct lease_record {
+        lease_t lease;
+        uint64_t seq;                   // order in which records were added, newer is higher
+        struct lease_record *next_address;
+        struct lease_record *next_chaddr;
+        struct lease_record *next_client_id;
+};
+
+static struct {
+        struct lease_record **by_address;
+        struct lease_record **by_chaddr;
+        struct lease_record **by_client_id;
+        uint32_t bits;                  // every table has 2^bits chains
+        uint32_t count;
+        uint64_t seq;
+        llist_t *pool_names;            // copies of pool names referenced by records
+} lease_index;
+
+static uint32_t hash_address(uint32_t address)
+{
+        return (address * 2654435769U) >> (32 - lease_index.bits);
+}
+
+static uint32_t hash_chaddr(const uint8_t *chaddr)
+{
+        uint64_t key = 0;
+        memcpy(&key, chaddr, 6);
+        return (uint32_t)((key * 11400714819323198485ULL) >> (64 - lease_index.bits));
+}
+
+static uint32_t hash_client_id(const uint8_t *client_id, uint8_t lenght)
+{
+        /* FNV-1a */
+        uint32_t hash = 2166136261U;
+        for (uint8_t i = 0; i < lenght; i++)
+                hash = (hash ^ client_id[i]) * 16777619U;
+
+        return (hash * 2654435769U) >> (32 - lease_index.bits);
+}
+
+/* Returns copy of pool name that lives until lease_index_uninit */
+static const char *index_pool_name(const char *name)
+{
+        if (!lease_index.pool_names && !(lease_index.pool_names = llist_new()))
+                return NULL;
+
+        llist_foreach(lease_index.pool_names, {
+                if (!strcmp((char*)node->data, name))
+                        return node->data;
+        })
+
+        char *copy = strdup(name);
+        if (!copy || llist_append(lease_index.pool_names, copy, true) != 0) {
+                free(copy);
+                return NULL;
+        }
+
+        return copy;
+}
+
+static void index_link(struct lease_record *r)
+{
+        uint32_t h = hash_address(r->lease.address);
+        r->next_address = lease_index.by_address[h];
+        lease_index.by_address[h] = r;
+
+        h = hash_chaddr(r->lease.client_mac_address);
+        r->next_chaddr = lease_index.by_chaddr[h];
+        lease_index.by_chaddr[h] = r;
+
+        if (r->lease.client_id_lenght) {
+                h = hash_client_id(r->lease.client_id, r->lease.client_id_lenght);
+                r->next_client_id = lease_index.by_client_id[h];
+                lease_index.by_client_id[h] = r;
+        }
+}
+
+/* Rebuild tables with 2^bits chains, order of records in chains is kept */
+static int index_resize(uint32_t bits)
+{
+        struct lease_record **by_address = calloc(1U << bits, sizeof(struct lease_record*));
+        struct lease_record **by_chaddr = calloc(1U << bits, sizeof(struct lease_record*));
+        struct lease_record **by_client_id = calloc(1U << bits, sizeof(struct lease_record*));
+        if (!by_address || !by_chaddr || !by_client_id) {
+                cclog(LOG_ERROR, NULL, "Failed to allocate lease index");
+                free(by_address);
+                free(by_chaddr);
+                free(by_client_id);
+                return -1;
+        }
+
+        struct lease_record *all = NULL;
+        struct lease_record *r, *next;
+        uint32_t old_size = lease_index.bits ? 1U << lease_index.bits : 0;
+        for (uint32_t i = 0; i < old_size; i++) {
+                for (r = lease_index.by_address[i]; r; r = next) {
+                        next = r->next_address;
+                        r->next_address = all;
+                        all = r;
+                }
+        }
+
+        free(lease_index.by_address);
+        free(lease_index.by_chaddr);
+        free(lease_index.by_client_id);
+        lease_index.by_address = by_address;
+        lease_index.by_chaddr = by_chaddr;
+        lease_index.by_client_id = by_client_id;
+        lease_index.bits = bits;
+
+        for (r = all; r; r = next) {
+                next = r->next_address;
+                index_link(r);
+        }
+
+        return 0;
+}
+
+static struct lease_record *index_find_address(uint32_t address)
+{
+        if (!lease_index.count)
+                return NULL;
+
+        struct lease_record *r = lease_index.by_address[hash_address(address)];
+        while (r && r->lease.address != address)
+                r = r->next_address;
+
+        return r;
+}
+
+static void index_remove(uint32_t address)
+{
+        struct lease_record *r = index_find_address(address);
+        if (!r)
+                return;
+
+        struct lease_record **p = &lease_index.by_address[hash_address(address)];
+        while (*p != r)
+                p = &(*p)->next_address;
+        *p = r->next_address;
+
+        p = &lease_index.by_chaddr[hash_chaddr(r->lease.client_mac_address)];
+        while (*p != r)
+                p = &(*p)->next_chaddr;
+        *p = r->next_chaddr;
+
+        if (r->lease.client_id_lenght) {
+                p = &lease_index.by_client_id[hash_client_id(r->lease.client_id, r->lease.client_id_lenght)];
+                while (*p != r)
+                        p = &(*p)->next_client_id;
+                *p = r->next_client_id;
+        }
+
+        free(r);
+        lease_index.count--;
+}
+
+/* Insert copy of lease, replacing record of the same address */
+static int index_add(const lease_t *lease)
+{
+        if (!lease->pool_name)
+                return -1;
+
+        index_remove(lease->address);
+
+        /* Chains are kept short by having at least as many of them as records */
+        if (lease_index.count + 1 > (lease_index.bits ? 1U << lease_index.bits : 0) &&
+            index_resize(lease_index.bits ? lease_index.bits + 1 : 6) < 0)
+                return -1;
+
+        struct lease_record *r = calloc(1, sizeof(struct lease_record));
+        if_null_log(r, error, LOG_ERROR, NULL, "Failed to allocate lease record");
+
+        r->lease = *lease;
+        r->lease.pool_name = (char*)index_pool_name(lease->pool_name);
+        if (!r->lease.pool_name) {
+                free(r);
+                goto error;
+        }
+
+        r->seq = ++lease_index.seq;
+        index_link(r);
+        lease_index.count++;
+        return 0;
+error:
+        return -1;
+}
+
+void lease_index_clear()
+{
+        struct lease_record *r, *next;
+
+        pthread_mutex_lock(&lease_lock);
+        uint32_t size = lease_index.bits ? 1U << lease_index.bits : 0;
+        for (uint32_t i = 0; i < size; i++) {
+                for (r = lease_index.by_address[i]; r; r = next) {
+                        next = r->next_address;
+                        free(r);
+                }
+        }
+
+        free(lease_index.by_address);
+        free(lease_index.by_chaddr);
+        free(lease_index.by_client_id);
+        lease_index.by_address = lease_index.by_chaddr = lease_index.by_client_id = NULL;
+        lease_index.bits = 0;
+        lease_index.count = 0;
+        pthread_mutex_unlock(&lease_lock);
+}
+
+void lease_index_uninit()
+{
+        lease_index_clear();
+
+        pthread_mutex_lock(&lease_lock);
+        llist_destroy(&lease_index.pool_names);
+        pthread_mutex_unlock(&lease_lock);
+}
+
+int lease_find_address(lease_t *result, uint32_t addr)
+{
+        if (!result)
+                return LEASE_ERROR;
+
+        int rv = LEASE_DOESNT_EXITS;
+
+        pthread_mutex_lock(&lease_lock);
+        struct lease_record *r = index_find_address(addr);
+        if (r) {
+                *result = r->lease;
+                rv = LEASE_OK;
+        }
+        pthread_mutex_unlock(&lease_lock);
+
+        return rv;
+}
+
+bool lease_belongs_to_client(const lease_t *lease, const uint8_t *chaddr, 
+        const uint8_t *client_id, uint8_t client_id_lenght)
+{
+        if (!lease || !chaddr)
+                return false;
+
+        /* Identifiers longer than LEASE_CLIENT_ID_MAX_LENGHT are never stored */
+        if (client_id_lenght > LEASE_CLIENT_ID_MAX_LENGHT)
+                client_id = NULL;
+
+        if (client_id && client_id_lenght && lease->client_id_lenght)
+                return lease->client_id_lenght == client_id_lenght && 
+                       !memcmp(lease->client_id, client_id, client_id_lenght);
+
+        return !memcmp(lease->client_mac_address, chaddr, 6);
+}
+
+int lease_find_client(lease_t *result, const uint8_t *chaddr, 
+        const uint8_t *client_id, uint8_t client_id_lenght)
+{
+        if (!result || !chaddr)
+                return LEASE_ERROR;
+
+        int rv = LEASE_DOESNT_EXITS;
+        struct lease_record *r, *newest = NULL;
+        bool has_id = client_id && client_id_lenght && client_id_lenght <= LEASE_CLIENT_ID_MAX_LENGHT;
+
+        pthread_mutex_lock(&lease_lock);
+        if (!lease_index.count)
+                goto unlock;
+
+        if (has_id) {
+                r = lease_index.by_client_id[hash_client_id(client_id, client_id_lenght)];
+                for (; r; r = r->next_client_id) {
+                        if (lease_belongs_to_client(&r->lease, chaddr, client_id, client_id_lenght) &&
+                            (!newest || r->seq > newest->seq))
+                                newest = r;
+                }
+        }
+
+        /* Lease without client identifier belongs to client with the same chaddr */
+        if (!newest) {
+                r = lease_index.by_chaddr[hash_chaddr(chaddr)];
+                for (; r; r = r->next_chaddr) {
+                        if (!memcmp(r->lease.client_mac_address, chaddr, 6) && 
+                            !(has_id && r->lease.client_id_lenght) && (!newest || r->seq > newest->seq))
+                                newest = r;
+                }
+        }
+
+        if (newest) {
+                *result = newest->lease;
+                rv = LEASE_OK;
+        }
+unlock:
+        pthread_mutex_unlock(&lease_lock);
+        return rv;
+}
 
 /* Allocate space for new lease */
 lease_t *lease_new()
@@ -143,6 +451,9 @@ static cJSON* lease_to_cjson(lease_t *lease)
                                                 lease->client_mac_address[4],
                                                 lease->client_mac_address[5]);
         cJSON *mac = cJSON_CreateString(mac_str);
+        char client_id_str[2 * LEASE_CLIENT_ID_MAX_LENGHT + 1] = {0};
+        for (uint8_t i = 0; i < lease->client_id_lenght && i < LEASE_CLIENT_ID_MAX_LENGHT; i++)
+                snprintf(client_id_str + 2 * i, 3, "%02x", lease->client_id[i]);
 
         if_null(address, exit);
         if_null(subnet, exit);
@@ -161,6 +472,8 @@ static cJSON* lease_to_cjson(lease_t *lease)
         cJSON_AddItemToObject(o, "lease_expire", lease_end);
         cJSON_AddItemToObject(o, "flags", flags);
         cJSON_AddItemToObject(o, "client_mac_address", mac);
+        if (lease->client_id_lenght)
+                cJSON_AddStringToObject(o, "client_id", client_id_str);
 
         return o;
 exit:
@@ -181,7 +494,17 @@ static int json_to_lease(lease_t *result, cJSON *json, const char *pool_name)
         result->lease_expire = cJSON_GetNumberValue(cJSON_GetObjectItem(json, "lease_expire"));
         result->flags        = cJSON_GetNumberValue(cJSON_GetObjectItem(json, "flags"));
         const char *mac      = cJSON_GetStringValue(cJSON_GetObjectItem(json, "client_mac_address"));
+        const char *client_id = cJSON_GetStringValue(cJSON_GetObjectItem(json, "client_id"));
         result->pool_name = (char *)pool_name;
+
+        /* Client identifier is optional */
+        result->client_id_lenght = 0;
+        for (; client_id && client_id[0] && client_id[1] && 
+             result->client_id_lenght < LEASE_CLIENT_ID_MAX_LENGHT; client_id += 2) {
+                if (sscanf(client_id, "%2hhx", &result->client_id[result->client_id_lenght]) != 1)
+                        break;
+                result->client_id_lenght++;
+        }
         
         if_null(mac, error);
 
@@ -207,7 +530,7 @@ error:
 }
 
 
-int lease_retrieve(lease_t *result, uint32_t addr, char *pool_name)
+static int _lease_retrieve(lease_t *result, uint32_t addr, char *pool_name)
 {
         if (!result || !pool_name)
                 return LEASE_ERROR;
@@ -249,7 +572,16 @@ exit:
         return rv;
 }
 
-int lease_add(lease_t *lease)
+int lease_retrieve(lease_t *result, uint32_t addr, char *pool_name)
+{
+        pthread_mutex_lock(&lease_lock);
+        int rv = _lease_retrieve(result, addr, pool_name);
+        pthread_mutex_unlock(&lease_lock);
+
+        return rv;
+}
+
+static int _lease_add(lease_t *lease)
 {
         if (!lease || !lease->pool_name)
                 return LEASE_ERROR;
@@ -283,12 +615,24 @@ int lease_add(lease_t *lease)
         free(json);
         close(fd);
         cJSON_Delete(leases_root);
+
+        if_failed_log_ng(index_add(lease), LOG_WARN, NULL, "Failed to index lease of address %s",
+                        uint32_to_ipv4_address(lease->address));
         rv = LEASE_OK;
 exit:
         return rv;
 }
 
-int lease_remove(lease_t *lease)
+int lease_add(lease_t *lease)
+{
+        pthread_mutex_lock(&lease_lock);
+        int rv = _lease_add(lease);
+        pthread_mutex_unlock(&lease_lock);
+
+        return rv;
+}
+
+static int _lease_remove(lease_t *lease)
 {
         if (!lease)
                 return LEASE_ERROR;
@@ -337,10 +681,21 @@ int lease_remove(lease_t *lease)
         free(json);
         close(fd);
         cJSON_Delete(root);
+
+        index_remove(lease->address);
 exit:
         return rv;
 }
 
+int lease_remove(lease_t *lease)
+{
+        pthread_mutex_lock(&lease_lock);
+        int rv = _lease_remove(lease);
+        pthread_mutex_unlock(&lease_lock);
+
+        return rv;
+}
+
 int lease_remove_address_pool(uint32_t address, char *pool_name)
 {
         if (!pool_name)
@@ -391,6 +746,11 @@ static int load_pool_leases(dhcp_server_t *server, address_pool_t *pool)
                         continue;
                 }
                 
+                pthread_mutex_lock(&lease_lock);
+                if_failed_log_ng(index_add(&lease), LOG_WARN, NULL, "Failed to index lease of address %s",
+                                uint32_to_ipv4_address(lease.address));
+                pthread_mutex_unlock(&lease_lock);
+
                 cclog(LOG_INFO, NULL, "Marking address %s as used", uint32_to_ipv4_address(lease.address));
                 /* Mark the address as in use */
                 if_failed_log_ng(address_pool_set_address_allocation(pool, lease.address), 
@@ -3,6 +3,7 @@
 
 #include "dhcp_server.h"
 #include "utils/llist.h"
+#include <stdbool.h>
 #include <stdint.h>
 
 /* COMMENT OUT FOR RELEASE BUILD */
@@ -14,6 +15,9 @@
 #define LEASE_PATH_PREFIX "/etc/dhcp/lease/"
 #endif // __LEASES_TEST_BUILD
 
+/* Longer client identifiers are not stored, such clients are recognised by chaddr */
+#define LEASE_CLIENT_ID_MAX_LENGHT 64
+
 enum lease_flags {
     LEASE_FLAG_STATIC_ALLOCATION = (1 << 0),
 };
@@ -39,6 +43,8 @@ enum lease_status {
  * flags: flags for allocated address, for now, only one flag exists, 
  *        rest is reserved for future use
  * client_mac_address: mac address of client to which the lease belongs.
+ * client_id: client identifier (option 61) of the client, client_id_lenght is 0 if 
+ *            client did not send it
  */
 typedef struct ip_lease {
     uint32_t address;
@@ -51,6 +57,8 @@ typedef struct ip_lease {
     uint32_t xid;
     uint8_t flags;
     uint8_t client_mac_address[6];
+    uint8_t client_id_lenght;
+    uint8_t client_id[LEASE_CLIENT_ID_MAX_LENGHT];
 } lease_t;
 
 /* Allocate space for new lease */
@@ -69,6 +77,33 @@ int lease_retrieve_address(lease_t *result, uint32_t addr, llist_t *pools);
 /* Retrieves information on lease of address in addr from pool_name */
 int lease_retrieve(lease_t *result, uint32_t addr, char *pool_name);
 
+/*
+ * Leases in .lease files are also kept in memory, indexed by address, client identifier 
+ * and chaddr. Index is filled by init_load_persisten_leases and updated by lease_add and 
+ * lease_remove, so lookups below never touch the disk. pool_name of found lease stays 
+ * valid until lease_index_uninit.
+ */
+
+/* Drop every lease from the index, .lease files are not changed */
+void lease_index_clear();
+
+/* Drop every lease from the index and free memory of the index */
+void lease_index_uninit();
+
+/* Find lease of address. Returns LEASE_OK or LEASE_DOESNT_EXITS */
+int lease_find_address(lease_t *result, uint32_t addr);
+
+/* 
+ * Find the newest lease of client. Client is identified by client identifier if it has 
+ * one (client_id can be NULL), otherwise by chaddr. Returns LEASE_OK or LEASE_DOESNT_EXITS 
+ */
+int lease_find_client(lease_t *result, const uint8_t *chaddr, 
+        const uint8_t *client_id, uint8_t client_id_lenght);
+
+/* Returns true if lease belongs to client, see lease_find_client */
+bool lease_belongs_to_client(const lease_t *lease, const uint8_t *chaddr, 
+        const uint8_t *client_id, uint8_t client_id_lenght);
+
 /* Adds lease information to the lease->pool_name's .lease file */
 int lease_add(lease_t *lease);
 
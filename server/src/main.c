@@ -37,11 +37,14 @@ static void print_program_usage(const char *proc_name)
                "--default-configuration (interface): use default configuration for the server. Specify interface name as the argument\n\n\t"
                
                "--interface  -i (interface): Specify which interface the server should use\n\t"
-               "--tick-delay -d (number): Time in milliseconds between each server tick\n\t"
+               "--tick-delay -d (number): Period in milliseconds of the tick timer advancing server timers (default 1000, i.e. 1 s)\n\t"
                "--cache-size -s (number): Maximum number of transactions to handle at any given time\n\t"
                "--transaction-duration -t (number): Time in seconds for which a transaction will be stored in cache\n\t"
                "--lease-expiration-check -e (number): Interval in seconds to check for expired leases\n\t"
                "--lease-time -l (number): Default lease time in seconds for the clients\n\t"
+               "--batch-size -b (number): Maximum number of packets received or sent by a single system call\n\t"
+               "--workers    -w (number): Number of worker threads serving clients (default 1)\n\t"
+               "--ingress-depth -q (number): Capacity of each priority queue of received packets (default 256)\n\t"
                "--log           (number): Specify verbosity of log files (1 - 5)\n\n\t"
 
                "--pool       -p (range): Specify the IP address range to be used for the DHCP pool. \n\t\t\t"
@@ -54,7 +57,8 @@ static void print_program_usage(const char *proc_name)
                "--acl-disable            : Disable Access Control List\n\t"
                "--acl-whitelist-mode     : Switch to whitelist mode for Access Control List\n\t"
                "--dynamic-acl-disable    : Disable dynamic updates to Access Control List\n\t"
-               "--db-disable             : Disable the use of database for storing detailed transaction information\n"
+               "--db-disable             : Disable the use of database for storing detailed transaction information\n\t"
+               "--unicast-enable         : Unicast replies to clients without address over packet socket (needs CAP_NET_RAW)\n"
                , proc_name);
 }
 
@@ -118,6 +122,7 @@ int main(int argc, char *argv[])
         /* dynamic ACL requires cache */
         if_failed(init_cache(&dhcp_server), exit);
         if_failed(init_dynamic_ACL(&dhcp_server), exit);
+        if_failed(init_xdp_filter(&dhcp_server), exit);
         /* We need to have address pools and allocator initialised before loading leases */
         if_failed(init_load_persisten_leases(&dhcp_server), exit);
 
@@ -0,0 +1,245 @@
+#include "message_slab.h"
+#include "dhcp_options.h"
+#include "logging.h"
+#include <cclog_macros.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* 
+ * Packet buffers of stored messages. Requests of clients and replies of the server usually 
+ * end within first 80 bytes of options, longer ones are rare, so bigger classes have
+ * 1/share as many buffers as the slab has messages
+ */
+static const struct {
+        uint16_t size;
+        uint16_t share;
+} message_slab_class_sizes[MESSAGE_SLAB_CLASSES] = {
+        {DHCP_PACKET_HEADER_SIZE + 80, 1},
+        {DHCP_PACKET_HEADER_SIZE + 208, 4},
+        {sizeof(dhcp_packet_t), 16},
+};
+
+message_slab_t *message_slab_new(uint32_t size, uint32_t work_size)
+{
+        message_slab_t *slab = NULL;
+
+        if_false_log((size && work_size), error, LOG_ERROR, NULL, "Invalid message slab size 0");
+
+        slab = calloc(1, sizeof(message_slab_t));
+        if_null_log(slab, error, LOG_ERROR, NULL, "Failed to allocate message slab");
+
+        slab->messages = calloc(size, sizeof(dhcp_message_t));
+        slab->free = calloc(size, sizeof(dhcp_message_t*));
+        slab->work = calloc(work_size, sizeof(dhcp_message_work_t));
+        slab->free_work = calloc(work_size, sizeof(dhcp_message_work_t*));
+        if (!slab->messages || !slab->free || !slab->work || !slab->free_work) {
+                cclog(LOG_ERROR, NULL, "Failed to allocate message slab of %u messages", size);
+                goto error;
+        }
+        slab->size = size;
+        slab->work_size = work_size;
+
+        for (uint32_t i = 0; i < size; i++) {
+                slab->messages[i].slab = slab;
+                slab->free[i] = &slab->messages[size - 1 - i];
+        }
+        slab->free_count = size;
+
+        /* Option lists are allocated once and only cleared when work buffers are reused */
+        for (uint32_t i = 0; i < work_size; i++) {
+                slab->work[i].dhcp_options = llist_new();
+                if_null_log(slab->work[i].dhcp_options, error, LOG_ERROR, NULL,
+                                "Failed to allocate message slab");
+                slab->free_work[i] = &slab->work[work_size - 1 - i];
+        }
+        slab->free_work_count = work_size;
+
+        for (int c = 0; c < MESSAGE_SLAB_CLASSES; c++) {
+                message_slab_class_t *class = &slab->classes[c];
+                class->buffer_size = message_slab_class_sizes[c].size;
+                class->count = (size + message_slab_class_sizes[c].share - 1) / message_slab_class_sizes[c].share;
+                class->buffers = calloc(class->count, class->buffer_size);
+                class->free = calloc(class->count, sizeof(uint8_t*));
+                if (!class->buffers || !class->free) {
+                        cclog(LOG_ERROR, NULL, "Failed to allocate message slab packet buffers");
+                        goto error;
+                }
+
+                for (uint32_t i = 0; i < class->count; i++)
+                        class->free[i] = class->buffers + (class->count - 1 - i) * class->buffer_size;
+                class->free_count = class->count;
+        }
+
+        cclog(LOG_MSG, NULL, "Initialised message slab of %u messages, %u with work buffers", 
+                        size, work_size);
+
+        return slab;
+error:
+        message_slab_destroy(&slab);
+        return NULL;
+}
+
+dhcp_message_t *message_slab_alloc(message_slab_t *slab)
+{
+        if (!slab)
+                return dhcp_message_new();
+
+        slab->stats.allocs++;
+        if (slab->free_count == 0 || slab->free_work_count == 0) {
+                slab->stats.fallbacks++;
+                return dhcp_message_new();
+        }
+
+        dhcp_message_t *m = slab->free[--slab->free_count];
+        dhcp_message_work_t *work = slab->free_work[--slab->free_work_count];
+        llist_t *options = work->dhcp_options;
+
+        memset(m, 0, sizeof(dhcp_message_t));
+        memset(work, 0, sizeof(dhcp_message_work_t));
+        work->dhcp_options = options;
+        m->work = work;
+        m->packet = &work->packet;
+        m->slab = slab;
+        m->refs = 1;
+
+        if (slab->size - slab->free_count > slab->stats.max_in_use)
+                slab->stats.max_in_use = slab->size - slab->free_count;
+        if (slab->work_size - slab->free_work_count > slab->stats.max_work_in_use)
+                slab->stats.max_work_in_use = slab->work_size - slab->free_work_count;
+
+        return m;
+}
+
+void message_slab_destroy(message_slab_t **slab)
+{
+        if (!slab || !*slab)
+                return;
+
+        message_slab_t *s = *slab;
+        if (s->work) {
+                for (uint32_t i = 0; i < s->work_size; i++)
+                        dhcp_option_destroy_list(&s->work[i].dhcp_options);
+        }
+
+        for (int c = 0; c < MESSAGE_SLAB_CLASSES; c++) {
+                free(s->classes[c].buffers);
+                free(s->classes[c].free);
+        }
+
+        free(s->messages);
+        free(s->free);
+        free(s->work);
+        free(s->free_work);
+        free(s);
+        *slab = NULL;
+}
+
+/* Return work buffers of message allocated from slab */
+static void message_slab_free_work(message_slab_t *slab, dhcp_message_work_t *work)
+{
+        /* Options are freed now, so that idle buffers dont hold memory */
+        dhcp_option_clear_list(work->dhcp_options);
+        slab->free_work[slab->free_work_count++] = work;
+}
+
+/* Buffer of lenght bytes from the smallest class which has one free, heap if there is none */
+static void *message_slab_packet_alloc(message_slab_t *slab, size_t lenght)
+{
+        if (!slab)
+                return malloc(lenght);
+
+        for (int c = 0; c < MESSAGE_SLAB_CLASSES; c++) {
+                message_slab_class_t *class = &slab->classes[c];
+                if (class->buffer_size >= lenght && class->free_count)
+                        return class->free[--class->free_count];
+        }
+
+        slab->stats.packet_fallbacks++;
+        return malloc(lenght);
+}
+
+static void message_slab_packet_free(message_slab_t *slab, void *packet)
+{
+        for (int c = 0; slab && c < MESSAGE_SLAB_CLASSES; c++) {
+                message_slab_class_t *class = &slab->classes[c];
+                if ((uint8_t*)packet >= class->buffers && 
+                    (uint8_t*)packet < class->buffers + class->count * class->buffer_size) {
+                        class->free[class->free_count++] = packet;
+                        return;
+                }
+        }
+
+        free(packet);
+}
+
+int dhcp_message_compact(dhcp_message_t *message)
+{
+        if (!message)
+                return -1;
+        if (!message->work)
+                return 0;
+
+        int rv = -1;
+        dhcp_message_work_t *work = message->work;
+
+        /* Padding after END option carries nothing */
+        size_t lenght = dhcp_message_lenght(message);
+        if (lenght > DHCP_PACKET_HEADER_SIZE)
+                lenght = DHCP_PACKET_HEADER_SIZE + 
+                         dhcp_options_used(work->packet.options, lenght - DHCP_PACKET_HEADER_SIZE);
+        else
+                lenght = DHCP_PACKET_HEADER_SIZE;
+
+        dhcp_packet_t *packet = message_slab_packet_alloc(message->slab, lenght);
+        if_null_log(packet, exit, LOG_ERROR, NULL, "Failed to allocate buffer of stored dhcp message");
+
+        memcpy(packet, &work->packet, lenght);
+        message->packet = packet;
+        message->packet_lenght = lenght;
+        message->work = NULL;
+
+        if (message->slab) {
+                message_slab_free_work(message->slab, work);
+        } else {
+                dhcp_option_destroy_list(&work->dhcp_options);
+                free(work);
+        }
+
+        rv = 0;
+exit:
+        return rv;
+}
+
+dhcp_message_t *dhcp_message_ref(dhcp_message_t *message)
+{
+        if (message && message->refs)
+                message->refs++;
+
+        return message;
+}
+
+void dhcp_message_unref(dhcp_message_t **message)
+{
+        if (!message || !*message)
+                return;
+
+        dhcp_message_t *m = *message;
+        *message = NULL;
+
+        if (m->refs == 0 || --m->refs > 0)
+                return;
+
+        if (!m->slab) {
+                dhcp_message_destroy(&m);
+                return;
+        }
+
+        if (m->work)
+                message_slab_free_work(m->slab, m->work);
+        else
+                message_slab_packet_free(m->slab, m->packet);
+        m->work = NULL;
+        m->packet = NULL;
+
+        m->slab->free[m->slab->free_count++] = m;
+}
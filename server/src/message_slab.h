@@ -0,0 +1,105 @@
+#ifndef __MESSAGE_SLAB_H__
+#define __MESSAGE_SLAB_H__
+
+#include "dhcp_packet.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Number of size classes of packet buffers of stored messages */
+#define MESSAGE_SLAB_CLASSES 3
+
+typedef struct message_slab_class {
+    uint16_t buffer_size;
+    uint32_t count;
+    uint8_t *buffers;
+    uint8_t **free;                 // stack of unused buffers
+    uint32_t free_count;
+} message_slab_class_t;
+
+/*
+ * Preallocated pool of dhcp messages.
+ * Messages are received directly into slab messages and transactions hold
+ * references to them instead of copies. Message returns to the slab when
+ * its last reference is dropped. When the slab is empty, messages are
+ * allocated by dhcp_message_new() so the server keeps working, such
+ * allocations are counted in stats.fallbacks.
+ *
+ * Only messages being received, parsed or built need whole packet and option
+ * view, so they have work buffers of which the slab holds fewer than messages. 
+ * Stored message gives its work buffers back (dhcp_message_compact) and keeps
+ * its packet up to END option in buffer of the smallest class it fits.
+ *
+ * Slab is not thread safe, every worker has its own.
+ */
+typedef struct message_slab {
+    uint32_t size;
+    dhcp_message_t *messages;
+    dhcp_message_t **free;          // stack of unused messages
+    uint32_t free_count;
+
+    uint32_t work_size;
+    dhcp_message_work_t *work;
+    dhcp_message_work_t **free_work; // stack of unused work buffers
+    uint32_t free_work_count;
+
+    /* Packet buffers of stored messages, smallest first */
+    message_slab_class_t classes[MESSAGE_SLAB_CLASSES];
+
+    struct {
+        uint64_t allocs;
+        uint64_t fallbacks;         // allocations served by heap because slab was empty
+        uint32_t max_in_use;
+        uint32_t max_work_in_use;
+        uint64_t packet_fallbacks;  // stored packets served by heap because their classes were empty
+    } stats;
+} message_slab_t;
+
+/* 
+ * Allocate slab of size messages, work_size of them can have work buffers at once. 
+ * Returns NULL on failure
+ */
+message_slab_t *message_slab_new(uint32_t size, uint32_t work_size);
+
+/*
+ * Returns cleared message with work buffers holding one reference. Slab can be NULL,
+ * message is then allocated by dhcp_message_new(). Returns NULL on failure
+ */
+dhcp_message_t *message_slab_alloc(message_slab_t *slab);
+
+/*
+ * Frees the slab. All references to its messages must be dropped before,
+ * e.g. by destroying transaction cache and I/O batches
+ */
+void message_slab_destroy(message_slab_t **slab);
+
+/*
+ * Give back work buffers of message which is only kept for reference, e.g. by transaction
+ * once the message was handled or sent. Packet is moved to buffer of its lenght up to END 
+ * option, packet_lenght is set to it. Option view and option list are dropped, options 
+ * are then looked up by walking the packet. Returns 0 on success (also if message has no
+ * work buffers), -1 on failure, message then keeps its work buffers
+ */
+int dhcp_message_compact(dhcp_message_t *message);
+
+/* Take reference to message. Returns the message */
+dhcp_message_t *dhcp_message_ref(dhcp_message_t *message);
+
+/*
+ * Drop reference to message and set the pointer to NULL. Last reference returns
+ * the message to its slab or frees it. Messages with no reference count are untouched
+ */
+void dhcp_message_unref(dhcp_message_t **message);
+
+/* Returns true if anyone else than the caller holds the message */
+static inline bool dhcp_message_is_shared(const dhcp_message_t *message)
+{
+        return message && message->refs > 1;
+}
+
+/* Returns true if packet can be received into message, nobody else holds it and it has work buffers */
+static inline bool dhcp_message_can_receive(const dhcp_message_t *message)
+{
+        return message && message->work && !dhcp_message_is_shared(message);
+}
+
+#endif // !__MESSAGE_SLAB_H__
@@ -4,6 +4,7 @@
 #include "../logging.h"
 #include "../dhcp_options.h"
 #include "../database.h"
+#include "../option_cache.h"
 #include <errno.h>
 #include <netinet/in.h>
 #include <stdint.h>
@@ -15,6 +16,12 @@
 #include <stdlib.h>
 #include <fcntl.h>
 
+/* Options lists of DHCPACK, they are part of option cache key so they must be static */
+static const uint8_t ack_required_options[]           = {51, 54, 0};
+static const uint8_t ack_blacklisted_options[]        = {50, 55, 61, 57, 0};
+static const uint8_t inform_ack_required_options[]    = {54, 0};
+static const uint8_t inform_ack_blacklisted_options[] = {50, 51, 55, 61, 57, 0};
+
 int message_dhcpack_send(dhcp_server_t *server, dhcp_message_t *message, const char *reason)
 {
         if (!server || !message)
@@ -22,80 +29,87 @@ int message_dhcpack_send(dhcp_server_t *server, dhcp_message_t *message, const c
 
         int rv = -1;
 
-        struct sockaddr_in addr = {0};
-        memset(&addr, 0, sizeof(addr));
-        addr.sin_family = AF_INET;
-        addr.sin_port = htons(68);
-        addr.sin_addr.s_addr = (message->ciaddr) ? htonl(message->ciaddr) : htonl(server->config.broadcast_addr);
-
-        cclog(LOG_MSG, NULL, "Sending dhcp ack message %s address %s to %s",
-                        reason, uint32_to_ipv4_address(message->yiaddr), uint32_to_ipv4_address(addr.sin_addr.s_addr));
-        if_failed_log_n(sendto(server->sock_fd, &message->packet, sizeof(dhcp_packet_t), 0,
-                        (struct sockaddr*)&addr, sizeof(addr)), 
-                        exit, LOG_ERROR, NULL, "Failed to send dhcp ACK message: %s", 
-                                                strerror(errno));
+        cclog(LOG_MSG, NULL, "Sending dhcp ack message %s address %s to client %s",
+                        reason, uint32_to_ipv4_address(dhcp_message_yiaddr(message)), 
+                        uint8_array_to_mac((uint8_t*)message->chaddr));
+        if_failed_log_n(dhcp_server_send_reply(server, message), 
+                        exit, LOG_ERROR, NULL, "Failed to send dhcp ACK message");
 
         rv = 0;              
 exit:
         return rv;
 }
 
-static int get_requested_dhcp_options(address_allocator_t *allocator, dhcp_message_t *dhcp_request,
+static int get_requested_dhcp_options(dhcp_server_t *server, dhcp_message_t *dhcp_request,
                 uint32_t leased_address, dhcp_message_t *dhcp_ack)
 {
-        if (!allocator || !dhcp_request)
+        if (!server || !server->allocator || !dhcp_request)
                 return -1;
 
         int rv = -1;
+        address_allocator_t *allocator = server->allocator;
 
-        /* We get requested options */
-        dhcp_option_t *requested_options_list = dhcp_option_retrieve(dhcp_request->dhcp_options, 
-                                                        DHCP_OPTION_PARAMETER_REQUEST_LIST);
+        /* We get requested options, list must be 0 terminated */
+        uint8_t prl_lenght = 0;
+        const uint8_t *prl = dhcp_message_option(dhcp_request, DHCP_OPTION_PARAMETER_REQUEST_LIST, &prl_lenght);
         uint8_t requested_options[256];
-        memset(requested_options, 0, 256);
-        memcpy(requested_options, requested_options_list->value.binary_data, 
-                        requested_options_list->lenght);
 
         /* Get the pool options of the address */
         address_pool_t *pool = allocator_get_pool_by_address(allocator, leased_address);
         if_null(pool, exit);
 
-        if_failed_log(dhcp_option_build_required_options(dhcp_ack->dhcp_options, requested_options, 
-                        /* required */   (uint8_t[]) {51, 54, 0}, 
-                        /* blacklised */ (uint8_t[]) {50, 55, 61, 57, 0},
-                        allocator->default_options, pool->dhcp_option_override, DHCP_ACK),
-                        exit, LOG_WARN, NULL, "Failed to build dhcp options for DHCP_ACK message");
+        if (server->option_cache) {
+                if_failed(option_cache_fill(server->option_cache, allocator, pool, dhcp_ack, DHCP_ACK,
+                                        prl, prl_lenght, ack_required_options, ack_blacklisted_options,
+                                        dhcp_server_identifier(server)), exit);
+        } else {
+                memset(requested_options, 0, 256);
+                if (prl)
+                        memcpy(requested_options, prl, prl_lenght);
+
+                if_failed_log(dhcp_option_build_required_options(dhcp_ack->work->dhcp_options, requested_options, 
+                                (uint8_t*)ack_required_options, (uint8_t*)ack_blacklisted_options,
+                                allocator->default_options, pool->dhcp_option_override, DHCP_ACK),
+                                exit, LOG_WARN, NULL, "Failed to build dhcp options for DHCP_ACK message");
+        }
 
         rv = 0;
 exit:
         return rv;
 }
 
-static int get_requested_dhcp_options_inform_response(address_allocator_t *allocator, 
+static int get_requested_dhcp_options_inform_response(dhcp_server_t *server, 
                 dhcp_message_t *dhcp_inform, dhcp_message_t *dhcp_ack)
 {
-        if (!allocator || !dhcp_inform)
+        if (!server || !server->allocator || !dhcp_inform)
                 return -1;
 
         int rv = -1;
+        address_allocator_t *allocator = server->allocator;
 
-        /* We get requested options */
-        dhcp_option_t *requested_options_list = dhcp_option_retrieve(dhcp_inform->dhcp_options, 
-                                                        DHCP_OPTION_PARAMETER_REQUEST_LIST);
+        /* We get requested options, list must be 0 terminated */
+        uint8_t prl_lenght = 0;
+        const uint8_t *prl = dhcp_message_option(dhcp_inform, DHCP_OPTION_PARAMETER_REQUEST_LIST, &prl_lenght);
         uint8_t requested_options[256];
-        memset(requested_options, 0, 256);
-        memcpy(requested_options, requested_options_list->value.binary_data, 
-                        requested_options_list->lenght);
 
         /* Get the pool options of the address */
-        address_pool_t *pool = allocator_get_pool_by_address(allocator, dhcp_inform->ciaddr);
+        address_pool_t *pool = allocator_get_pool_by_address(allocator, dhcp_message_ciaddr(dhcp_inform));
         if_null(pool, exit);
 
-        if_failed_log(dhcp_option_build_required_options(dhcp_ack->dhcp_options, requested_options, 
-                        /* required */   (uint8_t[]) {54, 0}, 
-                        /* blacklised */ (uint8_t[]) {50, 51, 55, 61, 57, 0},
-                        allocator->default_options, pool->dhcp_option_override, DHCP_ACK),
-                        exit, LOG_WARN, NULL, "Failed to build dhcp options for DHCP_ACK message");
+        if (server->option_cache) {
+                if_failed(option_cache_fill(server->option_cache, allocator, pool, dhcp_ack, DHCP_ACK,
+                                        prl, prl_lenght, inform_ack_required_options, inform_ack_blacklisted_options,
+                                        dhcp_server_identifier(server)), exit);
+        } else {
+                memset(requested_options, 0, 256);
+                if (prl)
+                        memcpy(requested_options, prl, prl_lenght);
+
+                if_failed_log(dhcp_option_build_required_options(dhcp_ack->work->dhcp_options, requested_options, 
+                                (uint8_t*)inform_ack_required_options, (uint8_t*)inform_ack_blacklisted_options,
+                                allocator->default_options, pool->dhcp_option_override, DHCP_ACK),
+                                exit, LOG_WARN, NULL, "Failed to build dhcp options for DHCP_ACK message");
+        }
 
         rv = 0;
 exit:
@@ -110,33 +124,36 @@ int message_dhcpack_build(dhcp_server_t *server, dhcp_message_t *dhcp_request,
 
         int rv = -1;
 
-        dhcp_message_t *ack = dhcp_message_new();
-
-        ack->opcode = BOOTREPLY;
-        ack->htype  = dhcp_request->htype;
-        ack->hlen   = dhcp_request->hlen;
-        ack->hops   = 0;
-        ack->xid    = dhcp_request->xid;
-        ack->secs   = 0;
-        ack->ciaddr = dhcp_request->ciaddr;
-        ack->yiaddr = leased_address;
-        ack->siaddr = server->config.bound_ip;
-        ack->flags  = dhcp_request->flags;
-        ack->giaddr = dhcp_request->giaddr;
-        ack->cookie = dhcp_request->cookie;
+        dhcp_message_t *ack = message_slab_alloc(server->slab);
+        if_null(ack, exit);
+
+        ack->packet->opcode = BOOTREPLY;
+        ack->packet->htype  = dhcp_request->packet->htype;
+        ack->packet->hlen   = dhcp_request->packet->hlen;
+        ack->xid            = dhcp_request->xid;
+        ack->packet->ciaddr = dhcp_request->packet->ciaddr;
+        ack->packet->flags  = dhcp_request->packet->flags;
+        ack->packet->giaddr = dhcp_request->packet->giaddr;
+        ack->packet->cookie = dhcp_request->packet->cookie;
+        dhcp_message_set_yiaddr(ack, leased_address);
+        dhcp_message_set_siaddr(ack, dhcp_server_identifier(server));
         memcpy(ack->chaddr, dhcp_request->chaddr, CHADDR_LEN);
-        if_failed(get_requested_dhcp_options(server->allocator, dhcp_request, 
+        ack->work->max_message_size = dhcp_message_max_size(dhcp_request);
+        if_failed(get_requested_dhcp_options(server, dhcp_request, 
                                  leased_address, ack), 
                         exit);
 
+        dhcp_server_set_identifier(server, ack);
         if_failed(dhcp_packet_build(ack), exit);
         if_failed(message_dhcpack_send(server, ack, "acknownledging new lease of"), exit);
         if_failed(trans_cache_add_message(server->trans_cache, ack), exit);
+        dhcp_message_compact(ack);
         if (server->config.db_enable)
                 database_store_message(ack);
 
         rv = 0;
 exit:
+        dhcp_message_unref(&ack);
         return rv;
 }
 
@@ -147,32 +164,34 @@ int message_dhcpack_build_lease_renew(dhcp_server_t *server, dhcp_message_t *req
 
         int rv = -1;
 
-        dhcp_message_t *ack = dhcp_message_new();
-
-        ack->opcode = BOOTREPLY;
-        ack->htype  = request->htype;
-        ack->hlen   = request->hlen;
-        ack->hops   = 0;
-        ack->xid    = request->xid;
-        ack->secs   = 0;
-        ack->ciaddr = request->ciaddr;
-        ack->yiaddr = request->ciaddr;
-        ack->siaddr = server->config.bound_ip;
-        ack->flags  = request->flags;
-        ack->giaddr = 0;
-        ack->cookie = request->cookie;
+        dhcp_message_t *ack = message_slab_alloc(server->slab);
+        if_null(ack, exit);
+
+        ack->packet->opcode = BOOTREPLY;
+        ack->packet->htype  = request->packet->htype;
+        ack->packet->hlen   = request->packet->hlen;
+        ack->xid            = request->xid;
+        ack->packet->ciaddr = request->packet->ciaddr;
+        ack->packet->yiaddr = request->packet->ciaddr;
+        ack->packet->flags  = request->packet->flags;
+        ack->packet->cookie = request->packet->cookie;
+        dhcp_message_set_siaddr(ack, dhcp_server_identifier(server));
         memcpy(ack->chaddr, request->chaddr, CHADDR_LEN);
-        if_failed(get_requested_dhcp_options(server->allocator, request, ack->ciaddr, ack), exit);
+        ack->work->max_message_size = dhcp_message_max_size(request);
+        if_failed(get_requested_dhcp_options(server, request, dhcp_message_ciaddr(ack), ack), exit);
 
+        dhcp_server_set_identifier(server, ack);
         if_failed(dhcp_packet_build(ack), exit);
         if_failed(message_dhcpack_send(server,ack, "renewing lease of"), exit);
         if_failed(trans_cache_add_message(server->trans_cache, ack), exit);
+        dhcp_message_compact(ack);
 
         if (server->config.db_enable)
                 database_store_message(ack);
 
         rv = 0;
 exit:
+        dhcp_message_unref(&ack);
         return rv;
 }
 
@@ -182,37 +201,40 @@ int message_dhcpack_build_inform_response(dhcp_server_t *server, dhcp_message_t
                 return -1;
 
         int rv = -1;
+        dhcp_message_t *ack = NULL;
 
         /* If client didnt provide its IP address, dhcpinform is invalid */
-        if_false_log(inform->ciaddr, exit, LOG_WARN, NULL, "Received DHCPINFORM has no ciaddr");
-
-        dhcp_message_t *ack = dhcp_message_new();
-
-        ack->opcode = BOOTREPLY;
-        ack->htype  = inform->htype;
-        ack->hlen   = inform->hlen;
-        ack->hops   = 0;
-        ack->xid    = inform->xid;
-        ack->secs   = 0;
-        ack->ciaddr = inform->ciaddr;
-        ack->yiaddr = 0;
-        ack->siaddr = server->config.bound_ip;
-        ack->flags  = inform->flags;
-        ack->giaddr = inform->giaddr;
-        ack->cookie = inform->cookie;
+        if_false_log(dhcp_message_ciaddr(inform), exit, LOG_WARN, NULL, "Received DHCPINFORM has no ciaddr");
+
+        ack = message_slab_alloc(server->slab);
+        if_null(ack, exit);
+
+        ack->packet->opcode = BOOTREPLY;
+        ack->packet->htype  = inform->packet->htype;
+        ack->packet->hlen   = inform->packet->hlen;
+        ack->xid            = inform->xid;
+        ack->packet->ciaddr = inform->packet->ciaddr;
+        ack->packet->flags  = inform->packet->flags;
+        ack->packet->giaddr = inform->packet->giaddr;
+        ack->packet->cookie = inform->packet->cookie;
+        dhcp_message_set_siaddr(ack, dhcp_server_identifier(server));
         ack->type   = DHCP_ACK;
         memcpy(ack->chaddr, inform->chaddr, CHADDR_LEN);
-        if_failed(get_requested_dhcp_options_inform_response(server->allocator, inform, ack),
+        ack->work->max_message_size = dhcp_message_max_size(inform);
+        if_failed(get_requested_dhcp_options_inform_response(server, inform, ack),
                         exit);
 
+        dhcp_server_set_identifier(server, ack);
         if_failed(dhcp_packet_build(ack), exit);
         if_failed(message_dhcpack_send(server,ack, "informing client on"), exit);
         if_failed(trans_cache_add_message(server->trans_cache, ack), exit);
+        dhcp_message_compact(ack);
         if (server->config.db_enable)
                 database_store_message(ack);
 
         rv = 0;
 exit:
+        dhcp_message_unref(&ack);
         return rv;
 }
 
@@ -14,14 +14,15 @@ int message_dhcpdecline_handle(dhcp_server_t *server, dhcp_message_t *message)
         if_null_log(ack, exit, LOG_WARN, NULL,
                         "Handling dhcpdecline failed because no dhcpack found in transaction");
 
-        if_true((ack->yiaddr == 0), exit);
+        uint32_t address = dhcp_message_yiaddr(ack);
+        if_true((address == 0), exit);
         cclog(LOG_WARN, NULL, "Possible misconfiguration: Received DHCPDECLINE on address %s", 
-                        uint32_to_ipv4_address(ack->yiaddr));
+                        uint32_to_ipv4_address(address));
 
         uint32_t addrbuff;
         /* Internally mark the address as in use and create a lease with information on it */
-        if (allocator_is_address_available(server->allocator, ack->yiaddr)) {
-                allocator_request_this_address(server->allocator, ack->yiaddr, &addrbuff);
+        if (allocator_is_address_available(server->allocator, address)) {
+                allocator_request_this_address(server->allocator, address, &addrbuff);
         }
 
         rv = 0;
@@ -7,7 +7,40 @@
 #include "../dhcp_options.h"
 #include "../logging.h"
 #include "../allocator.h"
+#include "../lease.h"
 #include "../utils/xtoy.h"
+#include <time.h>
+
+/* 
+ * Returns address of unexpired lease of client if it can be offered on the interface, 0 otherwise. 
+ * Address of lease stays allocated, so nothing has to be requested from allocator
+ */
+static uint32_t offer_leased_address(dhcp_server_t *server, dhcp_message_t *msg)
+{
+        if (!server || !msg)
+                return 0;
+
+        lease_t lease;
+        uint8_t client_id_lenght = 0;
+        const uint8_t *client_id = dhcp_message_option(msg, DHCP_OPTION_CLIENT_IDENTIFIER, &client_id_lenght);
+
+        if (lease_find_client(&lease, msg->chaddr, client_id, client_id_lenght) != LEASE_OK)
+                return 0;
+
+        if (lease.lease_expire <= time(NULL))
+                return 0;
+
+        address_pool_t *pool = allocator_get_pool_by_address(server->allocator, lease.address);
+        if (!pool || !address_pool_is_served_on(pool, dhcp_server_interface_name(server)))
+                return 0;
+
+        if (allocator_is_address_available(server->allocator, lease.address))
+                return 0;
+
+        cclog(LOG_INFO, NULL, "Client %s has lease of address %s, offering it again", 
+                        uint8_array_to_mac(msg->chaddr), uint32_to_ipv4_address(lease.address));
+        return lease.address;
+}
 
 static uint32_t allocate_particular_address(dhcp_server_t *server, 
                 dhcp_message_t *msg)
@@ -17,28 +50,33 @@ static uint32_t allocate_particular_address(dhcp_server_t *server,
 
         int rv = ALLOCATOR_ERROR;
         uint32_t address = 0;
+        uint32_t requested;
 
-        dhcp_option_t *o50 = dhcp_option_retrieve(msg->dhcp_options, 
-                                                  DHCP_OPTION_REQUESTED_IP_ADDRESS);
-        if_null(o50, exit);
+        if_failed(dhcp_message_option_number(msg, DHCP_OPTION_REQUESTED_IP_ADDRESS, &requested), exit);
+
+        /* Requested address must be from pool offered on interface the message arrived on */
+        address_pool_t *pool = allocator_get_pool_by_address(server->allocator, requested);
+        if (pool && !address_pool_is_served_on(pool, dhcp_server_interface_name(server)))
+                goto exit;
         
-        rv = allocator_request_this_address(server->allocator, o50->value.ip, &address);
+        rv = allocator_request_this_address(server->allocator, requested, &address);
         if_failed_log_n_ng(rv, LOG_WARN, NULL, "Error allocating address %s: %s", 
-                                uint32_to_ipv4_address(o50->value.ip), allocator_strerror(rv));
+                                uint32_to_ipv4_address(requested), allocator_strerror(rv));
         
 exit:
         return address;
 }
 
-static uint32_t allocate_random_address(address_allocator_t *allocator)
+static uint32_t allocate_any_address(dhcp_server_t *server, dhcp_message_t *msg)
 {
-        if (!allocator)
+        if (!server || !msg)
                 return 0;
 
         int rv = ALLOCATOR_ERROR;
         uint32_t address = 0;
 
-        rv = allocator_request_any_address(allocator, &address);
+        rv = allocator_request_address_on_interface(server->allocator, 
+                        dhcp_server_interface_name(server), msg->chaddr, &address);
         if_failed_log_n_ng(rv, LOG_WARN, NULL, "Failed to allocate any address: %s",
                         allocator_strerror(rv));
 
@@ -51,17 +89,16 @@ static uint32_t get_lease_duration(address_allocator_t *allocator, dhcp_message_
                 return 0;
 
         uint32_t lease_time = 0;
-        dhcp_option_t *o51_requested = dhcp_option_retrieve(msg->dhcp_options, 
-                                                  DHCP_OPTION_IP_ADDRESS_LEASE_TIME);
+        uint32_t requested;
         dhcp_option_t *o51_global    = dhcp_option_retrieve(allocator->default_options,
                                                   DHCP_OPTION_IP_ADDRESS_LEASE_TIME);
 
         if_null_log(o51_global, exit, LOG_ERROR, NULL, "Option 51 (Ip address lease time) is "
                                 "not specified globaly, cannot proceed with configuration");
 
-        if (o51_requested) {
-                if (o51_requested->value.number <= o51_global->value.number)
-                        lease_time = o51_requested->value.number;
+        if (dhcp_message_option_number(msg, DHCP_OPTION_IP_ADDRESS_LEASE_TIME, &requested) == 0) {
+                if (requested <= o51_global->value.number)
+                        lease_time = requested;
                 else
                         lease_time = o51_global->value.number;
         } else {
@@ -81,13 +118,15 @@ int message_dhcpdiscover_handle(dhcp_server_t *server, dhcp_message_t *message)
         uint32_t new_address = 0;
         uint32_t lease_time = 0;
 
-        if (dhcp_option_retrieve(message->dhcp_options, 
-                                        DHCP_OPTION_REQUESTED_IP_ADDRESS)) {
+        /* RFC 2131 section 4.3.1, current binding of client is offered first */
+        new_address = offer_leased_address(server, message);
+
+        if (new_address == 0 && dhcp_message_option(message, DHCP_OPTION_REQUESTED_IP_ADDRESS, NULL)) {
                 new_address = allocate_particular_address(server, message);
         }
         
         if (new_address == 0) {
-                new_address = allocate_random_address(server->allocator);
+                new_address = allocate_any_address(server, message);
         }
 
         /* Check whether we still dont have IP address. Errors are logged in allocation functions */
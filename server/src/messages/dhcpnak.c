@@ -17,17 +17,9 @@ int message_nak_send(dhcp_server_t *server, dhcp_message_t *message)
 
         int rv = -1;
 
-        struct sockaddr_in addr = {0};
-        memset(&addr, 0, sizeof(addr));
-        addr.sin_family = AF_INET;
-        addr.sin_port = htons(68);
-        addr.sin_addr.s_addr = (message->ciaddr) ? message->ciaddr : htonl(server->config.broadcast_addr);
-
         cclog(LOG_MSG, NULL, "Sending DHCP NAK message");
-        if_failed_log_n(sendto(server->sock_fd, &message->packet, sizeof(dhcp_packet_t), 0,
-                        (struct sockaddr*)&addr, sizeof(addr)), 
-                        exit, LOG_ERROR, NULL, "Failed to send dhcp NAK message: %s", 
-                                                strerror(errno));
+        if_failed_log_n(dhcp_server_send_reply(server, message), 
+                        exit, LOG_ERROR, NULL, "Failed to send dhcp NAK message");
 
         rv = 0;              
 exit:
@@ -49,7 +41,7 @@ static int get_requested_dhcp_options(address_allocator_t *allocator,
         dhcp_option_t *requested_options_list = dhcp_option_new_values(DHCP_OPTION_PARAMETER_REQUEST_LIST,
                                                                         1, (uint8_t[]) {0});
 
-        if_failed_log(dhcp_option_build_required_options(dhcp_nak->dhcp_options, 
+        if_failed_log(dhcp_option_build_required_options(dhcp_nak->work->dhcp_options, 
                         requested_options_list->value.binary_data, 
                         /* required */   (uint8_t[]) {54, 0}, 
                         /* blacklised */ (uint8_t[]) {0},
@@ -68,33 +60,33 @@ int message_dhcpnak_build(dhcp_server_t *server, dhcp_message_t *request)
 
         int rv = -1;
 
-        dhcp_message_t *nak = dhcp_message_new();
+        dhcp_message_t *nak = message_slab_alloc(server->slab);
         if_null(nak, exit);
 
-        nak->opcode = BOOTREPLY;
-        nak->htype = request->htype;
-        nak->hlen = request->hlen;
-        nak->hops = 0;
+        /* Message is zeroed by slab, only fields of nak which are not 0 are set */
+        nak->packet->opcode = BOOTREPLY;
+        nak->packet->htype = request->packet->htype;
+        nak->packet->hlen = request->packet->hlen;
         nak->xid = request->xid;
-        nak->secs = 0;
-        nak->ciaddr = 0;
-        nak->yiaddr = 0;
-        nak->siaddr = 0;
-        nak->flags = request->flags;
-        nak->giaddr = request->giaddr;
+        nak->packet->flags = request->packet->flags;
+        nak->packet->giaddr = request->packet->giaddr;
         nak->type   = DHCP_NAK;
         memcpy(nak->chaddr, request->chaddr, CHADDR_LEN);
-        nak->cookie = request->cookie;
+        nak->packet->cookie = request->packet->cookie;
+        nak->work->max_message_size = dhcp_message_max_size(request);
         if_failed(get_requested_dhcp_options(server->allocator, nak), exit);
 
+        dhcp_server_set_identifier(server, nak);
         if_failed(dhcp_packet_build(nak), exit);
         if_failed(message_nak_send(server, nak), exit);
         if_failed(trans_cache_add_message(server->trans_cache, nak), exit);
+        dhcp_message_compact(nak);
         if (server->config.db_enable)
                 database_store_message(nak);
 
         rv = 0;
 exit:
+        dhcp_message_unref(&nak);
         return rv;
 }
 
@@ -15,8 +15,13 @@
 #include "../utils/llist.h"
 #include "../logging.h"
 #include "../dhcp_packet.h"
+#include "../option_cache.h"
 #include <unistd.h>
 
+/* Options lists of DHCPOFFER, they are part of option cache key so they must be static */
+static const uint8_t offer_required_options[]    = {51, 54, 0};
+static const uint8_t offer_blacklisted_options[] = {50, 55, 61, 57, 0};
+
 int message_dhcpoffer_send(dhcp_server_t *server, dhcp_message_t *message)
 {
         if (!server || !message)
@@ -24,59 +29,58 @@ int message_dhcpoffer_send(dhcp_server_t *server, dhcp_message_t *message)
 
         int rv = -1;
 
-        struct sockaddr_in addr = {0};
-        memset(&addr, 0, sizeof(addr));
-        addr.sin_family = AF_INET;
-        addr.sin_port = htons(68);
-        addr.sin_addr.s_addr = htonl(server->config.broadcast_addr);
-
         cclog(LOG_MSG, NULL, "Sending DHCP offer message offering address %s to client %s",
-                        uint32_to_ipv4_address(message->yiaddr), 
+                        uint32_to_ipv4_address(dhcp_message_yiaddr(message)), 
                         uint8_array_to_mac((uint8_t*)message->chaddr));
-        /* No need to implement unicast, since dhcpoffer is always broadcasted */
-        if_failed_log_n(sendto(server->sock_fd, &message->packet, sizeof(dhcp_packet_t), 0,
-                                (struct sockaddr*)&addr, sizeof(addr)), 
-                        exit, LOG_ERROR, NULL, "Failed to send dhcp OFFER message: %s", 
-                                                strerror(errno));
+        if_failed_log_n(dhcp_server_send_reply(server, message), 
+                        exit, LOG_ERROR, NULL, "Failed to send dhcp OFFER message");
 
         rv = 0;              
 exit:
         return rv;
 }
 
-static int get_requested_dhcp_options(address_allocator_t *allocator, dhcp_message_t *dhcp_discover,
+static int get_requested_dhcp_options(dhcp_server_t *server, dhcp_message_t *dhcp_discover,
                 uint32_t offered_lease_duration, uint32_t offered_address,
                 dhcp_message_t *dhcp_offer)
 {
-        if (!allocator || !dhcp_discover)
+        if (!server || !server->allocator || !dhcp_discover)
                 return -1;
 
         int rv = -1;
+        address_allocator_t *allocator = server->allocator;
 
-        /* We get requested options */
-        dhcp_option_t *requested_options_list = dhcp_option_retrieve(dhcp_discover->dhcp_options, 
-                                                        DHCP_OPTION_PARAMETER_REQUEST_LIST);
+        /* We get requested options, list must be 0 terminated */
+        uint8_t prl_lenght = 0;
+        const uint8_t *prl = dhcp_message_option(dhcp_discover, DHCP_OPTION_PARAMETER_REQUEST_LIST, &prl_lenght);
         uint8_t requested_options[256];
-        memset(requested_options, 0, 256);
-        memcpy(requested_options, requested_options_list->value.binary_data, 
-                        requested_options_list->lenght);
 
         /* Get the pool options of the address */
         address_pool_t *pool = allocator_get_pool_by_address(allocator, offered_address);
         if_null(pool, exit);
 
-        if_failed_log(dhcp_option_build_required_options(dhcp_offer->dhcp_options, requested_options, 
-                        /* required */   (uint8_t[]) {51, 54, 0}, 
-                        /* blacklised */ (uint8_t[]) {50, 55, 61, 57, 0},
-                        allocator->default_options, pool->dhcp_option_override, DHCP_OFFER),
-                        exit, LOG_WARN, NULL, "Failed to build dhcp options for DHCP_OFFER message");
+        if (server->option_cache) {
+                if_failed(option_cache_fill(server->option_cache, allocator, pool, dhcp_offer, DHCP_OFFER,
+                                        prl, prl_lenght, offer_required_options, offer_blacklisted_options,
+                                        dhcp_server_identifier(server)), exit);
+        } else {
+                memset(requested_options, 0, 256);
+                if (prl)
+                        memcpy(requested_options, prl, prl_lenght);
+
+                if_failed_log(dhcp_option_build_required_options(dhcp_offer->work->dhcp_options, requested_options, 
+                                (uint8_t*)offer_required_options, (uint8_t*)offer_blacklisted_options,
+                                allocator->default_options, pool->dhcp_option_override, DHCP_OFFER),
+                                exit, LOG_WARN, NULL, "Failed to build dhcp options for DHCP_OFFER message");
+        }
 
-        dhcp_option_t *o61_client = dhcp_option_retrieve(dhcp_discover->dhcp_options, DHCP_OPTION_CLIENT_IDENTIFIER);
+        uint8_t o61_lenght = 0;
+        const uint8_t *o61_client = dhcp_message_option(dhcp_discover, DHCP_OPTION_CLIENT_IDENTIFIER, 
+                                                        &o61_lenght);
         if (o61_client) {
                 dhcp_option_t *o61 = dhcp_option_new_values(DHCP_OPTION_CLIENT_IDENTIFIER, 
-                                                            o61_client->lenght, 
-                                                            o61_client->value.binary_data);
-                if_failed_log(dhcp_option_add(dhcp_offer->dhcp_options, o61), exit, LOG_ERROR, NULL,
+                                                            o61_lenght, (void*)o61_client);
+                if_failed_log(dhcp_option_add(dhcp_offer->work->dhcp_options, o61), exit, LOG_ERROR, NULL,
                         "Failed to add dhcp option 61 during dhcp offer building");
         }
 
@@ -94,34 +98,36 @@ int message_dhcpoffer_build(dhcp_server_t *server, dhcp_message_t *dhcp_discover
 
         int rv = -1;
 
-        dhcp_message_t *offer = dhcp_message_new();
-
-        offer->opcode = BOOTREPLY;
-        offer->htype  = dhcp_discover->htype;
-        offer->hlen   = dhcp_discover->hlen;
-        offer->hops   = 0;
-        offer->xid    = dhcp_discover->xid;
-        offer->secs   = 0;
-        offer->ciaddr = 0;
-        offer->yiaddr = offered_address;
-        offer->siaddr = server->config.bound_ip;
-        offer->flags  = dhcp_discover->flags;
-        offer->giaddr = dhcp_discover->giaddr;
-        offer->cookie = dhcp_discover->cookie;
+        dhcp_message_t *offer = message_slab_alloc(server->slab);
+        if_null(offer, exit);
+
+        offer->packet->opcode = BOOTREPLY;
+        offer->packet->htype  = dhcp_discover->packet->htype;
+        offer->packet->hlen   = dhcp_discover->packet->hlen;
+        offer->xid            = dhcp_discover->xid;
+        offer->packet->flags  = dhcp_discover->packet->flags;
+        offer->packet->giaddr = dhcp_discover->packet->giaddr;
+        offer->packet->cookie = dhcp_discover->packet->cookie;
+        dhcp_message_set_yiaddr(offer, offered_address);
+        dhcp_message_set_siaddr(offer, dhcp_server_identifier(server));
         offer->type   = DHCP_OFFER;
         memcpy(offer->chaddr, dhcp_discover->chaddr, CHADDR_LEN);
-        if_failed(get_requested_dhcp_options(server->allocator, dhcp_discover, 
+        offer->work->max_message_size = dhcp_message_max_size(dhcp_discover);
+        if_failed(get_requested_dhcp_options(server, dhcp_discover, 
                                 offered_lease_duration, offered_address, offer), 
                         exit);
 
+        dhcp_server_set_identifier(server, offer);
         if_failed(dhcp_packet_build(offer), exit);
         if_failed(message_dhcpoffer_send(server,offer), exit);
         if_failed(trans_cache_add_message(server->trans_cache, offer), exit);
+        dhcp_message_compact(offer);
         if (server->config.db_enable)
                 database_store_message(offer);
 
         rv = 0;
 exit:
+        dhcp_message_unref(&offer);
         return rv;
 }
 
@@ -12,7 +12,8 @@ int message_dhcprelease_handle(dhcp_server_t *server, dhcp_message_t *message)
 
         int rv = -1;
  
-        if (message->ciaddr == 0) {
+        uint32_t ciaddr = dhcp_message_ciaddr(message);
+        if (ciaddr == 0) {
                 cclog(LOG_INFO, NULL, "Received DHCPRELEASE from %s but ciaddr is 0", 
                                 uint8_array_to_mac((uint8_t*)message->chaddr));
                 goto exit;
@@ -20,10 +21,10 @@ int message_dhcprelease_handle(dhcp_server_t *server, dhcp_message_t *message)
 
         lease_t lease = {0};
         if_failed_log(
-                lease_retrieve_address(&lease, message->ciaddr, server->allocator->address_pools),
+                lease_find_address(&lease, ciaddr),
                 exit, LOG_WARN, NULL, 
                 "Received DHCPRELEASE on address %s from %s but such lease doesnt exist",
-                        uint32_to_ipv4_address(message->ciaddr), 
+                        uint32_to_ipv4_address(ciaddr), 
                         uint8_array_to_mac((uint8_t*)message->chaddr));
 
         if_failed_log(lease_remove(&lease), exit, LOG_ERROR, NULL, 
@@ -35,6 +35,19 @@ static int dhcp_requst_commit_lease(dhcp_server_t *server, dhcp_message_t *reque
         lease->pool_name = pool->name;
         memcpy(lease->client_mac_address, request->chaddr, 6);
 
+        uint8_t client_id_lenght = 0;
+        const uint8_t *client_id = dhcp_message_option(request, DHCP_OPTION_CLIENT_IDENTIFIER, 
+                        &client_id_lenght);
+        if (client_id && client_id_lenght <= LEASE_CLIENT_ID_MAX_LENGHT) {
+                memcpy(lease->client_id, client_id, client_id_lenght);
+                lease->client_id_lenght = client_id_lenght;
+        }
+
+        /* Client accepted its previous address again, its lease is replaced */
+        lease_t previous;
+        if (lease_find_address(&previous, leased_address) == LEASE_OK)
+                lease_remove(&previous);
+
         if_failed_log(lease_add(lease), error, LOG_ERROR, NULL, "Failed to commit lease of address"
                         " %s from pool %s", uint32_to_ipv4_address(lease->address), pool->name);
         
@@ -54,33 +67,38 @@ static bool validate_client_id_and_requested_params(transaction_cache_t *cache,
         dhcp_message_t *discover = trans_cache_retrieve_message(cache, request->xid, DHCP_DISCOVER);
         if_null(discover, error);
 
+        uint8_t request_lenght, discover_lenght;
+
         /* Validate client identifier, it MUST be same in all messages */
-        dhcp_option_t *request_o61 = dhcp_option_retrieve(request->dhcp_options, 
-                        DHCP_OPTION_CLIENT_IDENTIFIER);
-        dhcp_option_t *discover_o61 = dhcp_option_retrieve(discover->dhcp_options, 
-                        DHCP_OPTION_CLIENT_IDENTIFIER);
+        const uint8_t *request_o61 = dhcp_message_option(request, DHCP_OPTION_CLIENT_IDENTIFIER, 
+                        &request_lenght);
+        const uint8_t *discover_o61 = dhcp_message_option(discover, DHCP_OPTION_CLIENT_IDENTIFIER, 
+                        &discover_lenght);
 
         /* We only need to verify if the client sent option in both messages */
         if (request_o61 && discover_o61) {
-                if_failed_log(memcmp(request_o61->value.binary_data, discover_o61->value.binary_data, 
-                        request_o61->lenght), error, LOG_WARN, NULL, 
-                        "Inconsistent client identifier, transaction will not proceed");
+                if (request_lenght != discover_lenght || 
+                    memcmp(request_o61, discover_o61, request_lenght)) {
+                        cclog(LOG_WARN, NULL, "Inconsistent client identifier, transaction will not proceed");
+                        goto error;
+                }
         }
 
         /* Validate parameter request list, it MUST be same in all messages */
-        dhcp_option_t *request_o55 = dhcp_option_retrieve(request->dhcp_options, 
-                        DHCP_OPTION_PARAMETER_REQUEST_LIST);
-        dhcp_option_t *discover_o55 = dhcp_option_retrieve(discover->dhcp_options, 
-                        DHCP_OPTION_PARAMETER_REQUEST_LIST);
+        const uint8_t *request_o55 = dhcp_message_option(request, DHCP_OPTION_PARAMETER_REQUEST_LIST, 
+                        &request_lenght);
+        const uint8_t *discover_o55 = dhcp_message_option(discover, DHCP_OPTION_PARAMETER_REQUEST_LIST, 
+                        &discover_lenght);
 
         if (!request_o55 || !discover_o55) {
                 cclog(LOG_WARN, NULL, "Parameter list was not found in a message, treating as invalid");
                 goto error;
         }
 
-        if_failed_log(memcmp(request_o55->value.binary_data, discover_o55->value.binary_data, 
-                request_o55->lenght), error, LOG_WARN, NULL, 
-                "Inconsistent parameter request list , transaction will not proceed");
+        if (request_lenght != discover_lenght || memcmp(request_o55, discover_o55, request_lenght)) {
+                cclog(LOG_WARN, NULL, "Inconsistent parameter request list , transaction will not proceed");
+                goto error;
+        }
 
         return true;
 error:
@@ -97,18 +115,16 @@ static uint32_t retrieve_client_address(dhcp_message_t *request, transaction_cac
         if (!request || !cache)
                 goto error;
 
-        dhcp_option_t *o50 = dhcp_option_retrieve(request->dhcp_options, 
-                        DHCP_OPTION_REQUESTED_IP_ADDRESS);
+        uint32_t address;
 
         /* If client didnt request address, look for previously offered address */
-        if (!o50) {
+        if (dhcp_message_option_number(request, DHCP_OPTION_REQUESTED_IP_ADDRESS, &address) < 0) {
                 dhcp_message_t *offer = trans_cache_retrieve_message(cache, request->xid, DHCP_OFFER);
                 if_null(offer, error);
-                o50 = dhcp_option_retrieve(offer->dhcp_options, DHCP_OPTION_REQUESTED_IP_ADDRESS);
-                if_null(o50, error);
+                address = dhcp_message_yiaddr(offer);
         }
 
-        return o50->value.ip;
+        return address;
 error:
         return 0;
 }
@@ -140,15 +156,15 @@ error:
 }
 
 static int dhcp_request_response_to_offer(dhcp_server_t *server, dhcp_message_t *request, 
-                dhcp_option_t *o54)
+                uint32_t server_id)
 {
-        if (!server || !request || !o54)
+        if (!server || !request)
                 return -1;
 
         int rv = DHCP_REQUEST_ERROR;
         
         /* Check server identifier option */
-        if (o54->value.ip != server->config.bound_ip) {
+        if (server_id != dhcp_server_identifier(server)) {
                 cclog(LOG_INFO, NULL, "Received request, but with different server identifier");
                 rv = DHCP_REQUEST_DIFFERENT_SERVER_IDENTIFICATOR;
                 goto exit;
@@ -156,8 +172,8 @@ static int dhcp_request_response_to_offer(dhcp_server_t *server, dhcp_message_t
 
         /* dhcp message validation, ciaddr and yiaddr must be 0 if the request is response to offer */
         rv = DHCP_REQUEST_INVALID;
-        if_false((request->ciaddr == 0), exit);
-        if_false((request->yiaddr == 0), exit);
+        if_false((request->packet->ciaddr == 0), exit);
+        if_false((request->packet->yiaddr == 0), exit);
         if_false(validate_client_id_and_requested_params(server->trans_cache, request), exit);
 
         uint32_t requested_ip = retrieve_client_address(request, server->trans_cache);
@@ -183,6 +199,44 @@ exit:
         return rv;
 }
 
+/* Find lease of address and verify it belongs to client which sent request */
+static int dhcp_request_find_client_lease(dhcp_message_t *request, uint32_t address, lease_t *lease)
+{
+        uint8_t client_id_lenght = 0;
+        const uint8_t *client_id = dhcp_message_option(request, DHCP_OPTION_CLIENT_IDENTIFIER, 
+                        &client_id_lenght);
+
+        if (lease_find_address(lease, address) != LEASE_OK)
+                return -1;
+
+        return lease_belongs_to_client(lease, request->chaddr, client_id, client_id_lenght) ? 0 : -1;
+}
+
+/* Start lease again with lease time of its pool */
+static int dhcp_request_extend_lease(dhcp_server_t *server, lease_t *lease)
+{
+        int rv = -1;
+
+        /* Delete existing lease */
+        if_failed_log(lease_remove(lease), exit, LOG_WARN, NULL, 
+                "Failed step 1 of renewing lease of address %s", 
+                uint32_to_ipv4_address(lease->address));
+        
+        /* Set new expiration time for lease */
+        lease->lease_start = time(NULL);
+        lease->lease_expire = lease->lease_start + retrieve_lease_time(lease->address, 
+                                                        server->allocator);
+
+        /* Renew lease */
+        if_failed_log(lease_add(lease), exit, LOG_WARN, NULL, 
+                "Failed step 2 of renewing lease of address %s", 
+                uint32_to_ipv4_address(lease->address));
+
+        rv = 0;
+exit:
+        return rv;
+}
+
 static int dhcp_request_renew_lease(dhcp_server_t *server, dhcp_message_t *request)
 {
         if (!server || !request)
@@ -191,31 +245,50 @@ static int dhcp_request_renew_lease(dhcp_server_t *server, dhcp_message_t *reque
         int rv = -1;
 
         /* If client doesnt specify its address, exit */
-        if_false(request->ciaddr, exit);
+        uint32_t ciaddr = dhcp_message_ciaddr(request);
+        if_false(ciaddr, exit);
 
-        /* Retrieve lease from persistent database */
+        /* Lease must exist and belong to the client */
         lease_t lease = {0};
-        if_failed(lease_retrieve_address(&lease, request->ciaddr, server->allocator->address_pools),
-                exit);
+        if_failed(dhcp_request_find_client_lease(request, ciaddr, &lease), exit);
+        if_failed(dhcp_request_extend_lease(server, &lease), exit);
 
-        /* Verify client hardware address */
-        if_failed(memcmp(lease.client_mac_address, request->chaddr, 6), exit);
+        rv = 0;
+exit:
+        return rv;
+}
 
+/*
+ * Client in INIT-REBOOT state verifies its previous address (RFC 2131 section 4.3.2). Request 
+ * is acknowledged if the client has unexpired lease of the address and refused if the address 
+ * is ours but not leased to the client. Server without record of the address remains silent.
+ */
+static int dhcp_request_init_reboot(dhcp_server_t *server, dhcp_message_t *request, uint32_t requested_ip)
+{
+        if (!server || !request)
+                return -1;
 
-        /* Delete existing lease */
-        if_failed_log(lease_remove(&lease), exit, LOG_WARN, NULL, 
-                "Failed step 1 of renewing lease of address %s", 
-                uint32_to_ipv4_address(request->ciaddr));
-        
-        /* Set new expiration time for lease */
-        lease.lease_start = time(NULL);
-        lease.lease_expire = lease.lease_start + retrieve_lease_time(request->ciaddr, 
-                                                        server->allocator);
+        int rv = -1;
+        lease_t lease = {0};
 
-        /* Renew lease */
-        if_failed_log(lease_add(&lease), exit, LOG_WARN, NULL, 
-                "Failed step 2 of renewing lease of address %s", 
-                uint32_to_ipv4_address(request->ciaddr));
+        if (!allocator_get_pool_by_address(server->allocator, requested_ip))
+                return 0;
+
+        if (dhcp_request_find_client_lease(request, requested_ip, &lease) < 0 || 
+            lease.lease_expire <= time(NULL)) {
+                if (lease_find_address(&lease, requested_ip) != LEASE_OK && 
+                    allocator_is_address_available(server->allocator, requested_ip))
+                        return 0;
+
+                cclog(LOG_INFO, NULL, "Client %s is not allowed to use address %s", 
+                                uint8_array_to_mac(request->chaddr), uint32_to_ipv4_address(requested_ip));
+                if_failed_n(message_dhcpnak_build(server, request), exit);
+                return 0;
+        }
+
+        if_failed(dhcp_request_extend_lease(server, &lease), exit);
+        if_failed_n(message_dhcpack_build(server, request, lease.lease_expire - lease.lease_start, 
+                                requested_ip), exit);
 
         rv = 0;
 exit:
@@ -229,31 +302,33 @@ int message_dhcprequest_handle(dhcp_server_t *server, dhcp_message_t *request)
 
         int rv = -1;
 
-        dhcp_option_t *o54 = dhcp_option_retrieve(request->dhcp_options, DHCP_OPTION_SERVER_IDENTIFIER);
+        uint32_t server_id;
 
         /* 
          * According to RFC-2131, if client sends option 54 in dhcprequest, it is requesting new 
          * address. If not, its eighter rebinding or renewing
          */
-        if (o54) {
-                if ((rv = dhcp_request_response_to_offer(server, request, o54)) < 0) {
+        if (dhcp_message_option_number(request, DHCP_OPTION_SERVER_IDENTIFIER, &server_id) == 0) {
+                if ((rv = dhcp_request_response_to_offer(server, request, server_id)) < 0) {
                         /* Error, send DHCPNAK to client, lease will be freed when transaction expires */
                         if_failed_n(message_dhcpnak_build(server, request), exit);
                 } else if (rv != DHCP_REQUEST_DIFFERENT_SERVER_IDENTIFICATOR) {
                         /* Success, send DHCPACK to client */
-                        dhcp_option_t *o50 = dhcp_option_retrieve(request->dhcp_options, 
-                                        DHCP_OPTION_REQUESTED_IP_ADDRESS);
-                        if_failed_n(message_dhcpack_build(server, request, o54->value.number, 
-                                                o50->value.ip), exit);
+                        if_failed_n(message_dhcpack_build(server, request, server_id, 
+                                                retrieve_client_address(request, server->trans_cache)), 
+                                                exit);
                 }
         } else {
                 /*
                  * RFC-2131 states that the server SHOULD send dhcpack regardless of 
                  * whether it extended the lease or not
                  */
-                if (request->ciaddr) {
+                if (request->packet->ciaddr) {
                         dhcp_request_renew_lease(server, request);
                         if_failed(message_dhcpack_build_lease_renew(server, request), exit);
+                } else if (dhcp_message_option_number(request, DHCP_OPTION_REQUESTED_IP_ADDRESS, 
+                                        &server_id) == 0) {
+                        if_failed(dhcp_request_init_reboot(server, request, server_id), exit);
                 }
         }
 
@@ -0,0 +1,163 @@
+#include "option_cache.h"
+#include "dhcp_options.h"
+#include "logging.h"
+#include "utils/llist.h"
+#include <cclog_macros.h>
+#include <stdlib.h>
+#include <string.h>
+
+option_cache_t *option_cache_new(uint32_t size)
+{
+        option_cache_t *cache = NULL;
+
+        if_false_log(size, error, LOG_ERROR, NULL, "Invalid option cache size 0");
+
+        cache = calloc(1, sizeof(option_cache_t));
+        if_null_log(cache, error, LOG_ERROR, NULL, "Failed to allocate option cache");
+
+        cache->blocks = calloc(size, sizeof(option_block_t));
+        if_null_log(cache->blocks, error, LOG_ERROR, NULL,
+                        "Failed to allocate option cache of %u blocks", size);
+        cache->size = size;
+
+        return cache;
+error:
+        option_cache_destroy(&cache);
+        return NULL;
+}
+
+/* FNV-1a over parameter request list, mixed with the rest of the key */
+static uint32_t option_cache_hash(const address_pool_t *pool, enum dhcp_message_type type,
+                const uint8_t *required, const uint8_t *prl, uint8_t prl_lenght)
+{
+        uint32_t hash = 2166136261u;
+
+        for (uint8_t i = 0; i < prl_lenght; i++) {
+                hash ^= prl[i];
+                hash *= 16777619u;
+        }
+
+        hash ^= (uint32_t)((uintptr_t)pool >> 4) * 2654435761u;
+        hash ^= (uint32_t)((uintptr_t)required >> 2) * 40503u;
+        hash ^= (uint32_t)type << 24;
+
+        return hash;
+}
+
+static bool option_block_matches(const option_block_t *b, const address_pool_t *pool,
+                enum dhcp_message_type type, const uint8_t *required, const uint8_t *blacklisted,
+                const uint8_t *prl, uint8_t prl_lenght)
+{
+        return b->valid && b->pool == pool && b->type == type && b->required == required &&
+               b->blacklisted == blacklisted && b->prl_lenght == prl_lenght &&
+               (prl_lenght == 0 || memcmp(b->prl, prl, prl_lenght) == 0);
+}
+
+/* Build options into reply the same way handlers without cache do and store them in block */
+static int option_block_build(option_block_t *b, address_allocator_t *allocator,
+                address_pool_t *pool, dhcp_message_t *reply, enum dhcp_message_type type,
+                const uint8_t *prl, uint8_t prl_lenght,
+                const uint8_t *required, const uint8_t *blacklisted)
+{
+        int rv = -1;
+        size_t offset = 0;
+        dhcp_option_t *o = NULL;
+
+        llist_t *options = llist_new();
+        if_null(options, exit);
+
+        /* Requested options list must be 0 terminated */
+        uint8_t requested_options[256];
+        memset(requested_options, 0, 256);
+        if (prl)
+                memcpy(requested_options, prl, prl_lenght);
+
+        b->valid = false;
+        if_failed(dhcp_option_build_required_options(options, requested_options, (uint8_t*)required,
+                                (uint8_t*)blacklisted, allocator->default_options,
+                                pool->dhcp_option_override, type), exit);
+        if_failed(dhcp_options_serialize(options, reply->packet->options), exit);
+
+        b->server_id_offset = -1;
+        llist_foreach(options, {
+                o = (dhcp_option_t*)node->data;
+                if (o->tag == DHCP_OPTION_SERVER_IDENTIFIER && o->lenght == 4)
+                        b->server_id_offset = offset + 2;
+                offset += 2 + o->lenght;
+        });
+
+        b->pool = pool;
+        b->type = type;
+        b->required = required;
+        b->blacklisted = blacklisted;
+        b->prl_lenght = prl_lenght;
+        if (prl_lenght)
+                memcpy(b->prl, prl, prl_lenght);
+        b->lenght = offset;
+        memcpy(b->data, reply->packet->options, offset);
+        b->valid = true;
+
+        rv = 0;
+exit:
+        dhcp_option_destroy_list(&options);
+        return rv;
+}
+
+int option_cache_fill(option_cache_t *cache, address_allocator_t *allocator,
+        address_pool_t *pool, dhcp_message_t *reply, enum dhcp_message_type type,
+        const uint8_t *prl, uint8_t prl_lenght,
+        const uint8_t *required, const uint8_t *blacklisted, uint32_t server_id)
+{
+        if (!cache || !allocator || !pool || !reply || !required || !blacklisted)
+                return -1;
+
+        if (!prl)
+                prl_lenght = 0;
+
+        int rv = -1;
+        uint32_t generation = allocator_options_generation(allocator);
+        uint32_t hash = option_cache_hash(pool, type, required, prl, prl_lenght);
+        option_block_t *b = &cache->blocks[hash % cache->size];
+
+        if (option_block_matches(b, pool, type, required, blacklisted, prl, prl_lenght)) {
+                if (b->generation == generation) {
+                        cache->stats.hits++;
+                        memcpy(reply->packet->options, b->data, b->lenght);
+                        goto patch;
+                }
+                cache->stats.stale++;
+        }
+
+        cache->stats.misses++;
+        if_failed_log(option_block_build(b, allocator, pool, reply, type, prl, prl_lenght,
+                                required, blacklisted),
+                        exit, LOG_WARN, NULL, "Failed to build dhcp options for %s message",
+                        rfc2131_dhcp_message_type_to_str(type));
+        b->generation = generation;
+
+patch:
+        /* Only server identifier depends on interface the reply is sent from */
+        if (b->server_id_offset >= 0) {
+                uint8_t *o54 = reply->packet->options + b->server_id_offset;
+                o54[0] = (server_id >> 24) & 0xff;
+                o54[1] = (server_id >> 16) & 0xff;
+                o54[2] = (server_id >> 8) & 0xff;
+                o54[3] = server_id & 0xff;
+        }
+        reply->packet->options[b->lenght] = DHCP_OPTION_END;
+        reply->work->options_prebuilt = b->lenght;
+
+        rv = 0;
+exit:
+        return rv;
+}
+
+void option_cache_destroy(option_cache_t **cache)
+{
+        if (!cache || !*cache)
+                return;
+
+        free((*cache)->blocks);
+        free(*cache);
+        *cache = NULL;
+}
@@ -0,0 +1,71 @@
+#ifndef __OPTION_CACHE_H__
+#define __OPTION_CACHE_H__
+
+#include "allocator.h"
+#include "address_pool.h"
+#include "dhcp_packet.h"
+#include "RFC/RFC-2132.h"
+#include <stdint.h>
+
+#define OPTION_CACHE_SIZE 128
+
+/*
+ * Cache of serialized reply options.
+ * Options of a reply depend only on pool of the address, message type, required and
+ * blacklisted options of the handler and parameter request list (option 55) of the
+ * client, so they are identical for every client of the same kind. Block of options
+ * is built by dhcp_option_build_required_options and serialized on first use, later
+ * replies copy it into the packet and only patch server identifier of the interface.
+ * Per-client options (e.g. client identifier) are added to the message option list
+ * as before and serialized after the block by dhcp_packet_build.
+ *
+ * Blocks remember generation of allocator options they were built from, changing
+ * global or pool options through allocator (or allocator_options_changed) makes
+ * every cached block stale. Cache is not thread safe, every worker has its own.
+ */
+typedef struct option_block {
+    /* Key */
+    const address_pool_t *pool;
+    const uint8_t *required;        // 0 terminated lists of the handler, compared by address
+    const uint8_t *blacklisted;
+    enum dhcp_message_type type;
+    uint8_t prl_lenght;
+    uint8_t prl[255];
+
+    uint32_t generation;            // allocator options generation, block is stale if it differs
+    bool valid;
+
+    uint16_t lenght;                // bytes of serialized options in data, END is not included
+    int16_t server_id_offset;       // offset of option 54 value in data, -1 if not present
+    uint8_t data[DHCP_PACKET_OPTIONS_SIZE];
+} option_block_t;
+
+typedef struct option_cache {
+    uint32_t size;
+    option_block_t *blocks;         // direct mapped by hash of the key
+
+    struct {
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t stale;             // misses caused by changed options
+    } stats;
+} option_cache_t;
+
+/* Create cache of size blocks. Returns NULL on failure */
+option_cache_t *option_cache_new(uint32_t size);
+
+/*
+ * Place options of reply of type for client with parameter request list prl of prl_lenght
+ * bytes (prl can be NULL) at the start of reply packet options and set reply->work->options_prebuilt.
+ * required and blacklisted are 0 terminated lists as in dhcp_option_build_required_options 
+ * and must have static storage, since they are part of the key. Server identifier is set 
+ * to server_id (HOST BYTE ORDER). Returns 0 on success, -1 if options could not be built
+ */
+int option_cache_fill(option_cache_t *cache, address_allocator_t *allocator,
+        address_pool_t *pool, dhcp_message_t *reply, enum dhcp_message_type type,
+        const uint8_t *prl, uint8_t prl_lenght,
+        const uint8_t *required, const uint8_t *blacklisted, uint32_t server_id);
+
+void option_cache_destroy(option_cache_t **cache);
+
+#endif // !__OPTION_CACHE_H__
@@ -0,0 +1,264 @@
+#include "raw_tx.h"
+#include "logging.h"
+#include <cclog_macros.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <linux/if_packet.h>
+#include <net/ethernet.h>
+#include <net/if.h>
+#include <netinet/ip.h>
+#include <netinet/udp.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define RAW_TX_BLOCK_SIZE 4096
+#define RAW_TX_FRAME_SIZE 1024
+#define RAW_TX_DATA_OFFSET TPACKET_ALIGN(sizeof(struct tpacket3_hdr))
+#define RAW_TX_TTL 64
+
+typedef struct raw_frame {
+    struct ether_header eth;
+    struct iphdr ip;
+    struct udphdr udp;
+} __attribute__((packed)) raw_frame_t;
+
+/* Internet checksum (RFC 1071), sum is the partial sum of previous data */
+static uint32_t csum_add(uint32_t sum, const void *data, size_t len)
+{
+        const uint8_t *p = data;
+
+        for (; len > 1; len -= 2, p += 2)
+                sum += (p[0] << 8) | p[1];
+        if (len)
+                sum += p[0] << 8;
+
+        return sum;
+}
+
+static uint16_t csum_fold(uint32_t sum)
+{
+        while (sum >> 16)
+                sum = (sum & 0xffff) + (sum >> 16);
+
+        return htons(~sum & 0xffff);
+}
+
+static int raw_tx_get_interface(raw_tx_t *tx, const char *ifname)
+{
+        struct ifreq ifr = {0};
+
+        strncpy(ifr.ifr_name, ifname, IFNAMSIZ - 1);
+        if_failed_log_n(ioctl(tx->fd, SIOCGIFINDEX, &ifr), error, LOG_ERROR, NULL,
+                        "Failed to get index of interface %s: %s", ifname, strerror(errno));
+        tx->ifindex = ifr.ifr_ifindex;
+
+        if_failed_log_n(ioctl(tx->fd, SIOCGIFHWADDR, &ifr), error, LOG_ERROR, NULL,
+                        "Failed to get MAC address of interface %s: %s", ifname, strerror(errno));
+        memcpy(tx->src_mac, ifr.ifr_hwaddr.sa_data, 6);
+
+        return 0;
+error:
+        return -1;
+}
+
+raw_tx_t *raw_tx_new(const char *ifname, uint32_t src_ip, uint32_t frames)
+{
+        raw_tx_t *tx = NULL;
+        int version = TPACKET_V3;
+
+        if (!ifname || !frames)
+                goto error;
+
+        tx = calloc(1, sizeof(raw_tx_t));
+        if_null_log(tx, error, LOG_ERROR, NULL, "Failed to allocate raw tx");
+        tx->src_ip = src_ip;
+
+        /* Protocol 0, socket is used only for sending */
+        tx->fd = socket(AF_PACKET, SOCK_RAW | SOCK_CLOEXEC, 0);
+        if_failed_log_n(tx->fd, error, LOG_WARN, NULL, "Failed to create packet socket: %s",
+                        strerror(errno));
+        if_failed(raw_tx_get_interface(tx, ifname), error);
+
+        if_failed_log_n(setsockopt(tx->fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)),
+                        error, LOG_WARN, NULL, "Failed to set TPACKET_V3: %s", strerror(errno));
+
+        /* Ring consists of whole blocks, so the number of frames is rounded up */
+        uint32_t per_block = RAW_TX_BLOCK_SIZE / RAW_TX_FRAME_SIZE;
+        uint32_t blocks = (frames + per_block - 1) / per_block;
+        struct tpacket_req3 req = {
+                .tp_block_size = RAW_TX_BLOCK_SIZE,
+                .tp_block_nr = blocks,
+                .tp_frame_size = RAW_TX_FRAME_SIZE,
+                .tp_frame_nr = blocks * per_block,
+        };
+        if_failed_log_n(setsockopt(tx->fd, SOL_PACKET, PACKET_TX_RING, &req, sizeof(req)),
+                        error, LOG_WARN, NULL, "Failed to create packet tx ring: %s", strerror(errno));
+
+        tx->frame_size = RAW_TX_FRAME_SIZE;
+        tx->frame_nr = req.tp_frame_nr;
+        tx->ring_len = (size_t)req.tp_block_size * req.tp_block_nr;
+        tx->ring = mmap(NULL, tx->ring_len, PROT_READ | PROT_WRITE, MAP_SHARED, tx->fd, 0);
+        if (tx->ring == MAP_FAILED) {
+                tx->ring = NULL;
+                cclog(LOG_ERROR, NULL, "Failed to map packet tx ring: %s", strerror(errno));
+                goto error;
+        }
+
+        struct sockaddr_ll sll = {
+                .sll_family = AF_PACKET,
+                .sll_protocol = htons(ETH_P_IP),
+                .sll_ifindex = tx->ifindex,
+        };
+        if_failed_log_n(bind(tx->fd, (struct sockaddr*)&sll, sizeof(sll)), error, LOG_ERROR, NULL,
+                        "Failed to bind packet socket to %s: %s", ifname, strerror(errno));
+
+        cclog(LOG_MSG, NULL, "Initialised packet tx ring of %u frames on %s", tx->frame_nr, ifname);
+
+        return tx;
+error:
+        raw_tx_destroy(&tx);
+        return NULL;
+}
+
+static struct tpacket3_hdr *raw_tx_frame(raw_tx_t *tx, uint32_t index)
+{
+        return (struct tpacket3_hdr*)(tx->ring + (size_t)index * tx->frame_size);
+}
+
+static bool raw_tx_frame_free(struct tpacket3_hdr *hdr)
+{
+        uint32_t status = __atomic_load_n(&hdr->tp_status, __ATOMIC_ACQUIRE);
+
+        if (status == TP_STATUS_WRONG_FORMAT)
+                cclog(LOG_ERROR, NULL, "Kernel rejected malformed frame in packet tx ring");
+
+        return !(status & (TP_STATUS_SEND_REQUEST | TP_STATUS_SENDING));
+}
+
+int raw_tx_queue(raw_tx_t *tx, const uint8_t dst_mac[6], uint32_t dst_ip, uint16_t dst_port,
+        const dhcp_packet_t *packet, size_t len)
+{
+        if (!tx || !dst_mac || !packet || len > sizeof(dhcp_packet_t))
+                return -1;
+
+        struct tpacket3_hdr *hdr = raw_tx_frame(tx, tx->head);
+
+        /* Frame is still owned by kernel, try to push the ring first */
+        if (!raw_tx_frame_free(hdr)) {
+                raw_tx_flush(tx);
+                if (!raw_tx_frame_free(hdr)) {
+                        tx->stats.tx_dropped++;
+                        return -1;
+                }
+        }
+
+        raw_frame_t *f = (raw_frame_t*)((uint8_t*)hdr + RAW_TX_DATA_OFFSET);
+        uint16_t udp_len = sizeof(struct udphdr) + len;
+
+        memcpy(f->eth.ether_dhost, dst_mac, ETH_ALEN);
+        memcpy(f->eth.ether_shost, tx->src_mac, ETH_ALEN);
+        f->eth.ether_type = htons(ETHERTYPE_IP);
+
+        f->ip.version = 4;
+        f->ip.ihl = sizeof(struct iphdr) / 4;
+        f->ip.tos = 0;
+        f->ip.tot_len = htons(sizeof(struct iphdr) + udp_len);
+        f->ip.id = 0;
+        f->ip.frag_off = htons(IP_DF);
+        f->ip.ttl = RAW_TX_TTL;
+        f->ip.protocol = IPPROTO_UDP;
+        f->ip.check = 0;
+        f->ip.saddr = htonl(tx->src_ip);
+        f->ip.daddr = htonl(dst_ip);
+        f->ip.check = csum_fold(csum_add(0, &f->ip, sizeof(struct iphdr)));
+
+        f->udp.source = htons(DHCP_SERVER_PORT);
+        f->udp.dest = htons(dst_port);
+        f->udp.len = htons(udp_len);
+        f->udp.check = 0;
+        memcpy(f + 1, packet, len);
+
+        /* UDP checksum covers pseudo header (addresses, protocol, length), header and payload */
+        uint32_t sum = csum_add(0, &f->ip.saddr, 8);
+        sum += IPPROTO_UDP + udp_len;
+        sum = csum_add(sum, &f->udp, udp_len);
+        f->udp.check = csum_fold(sum);
+        if (f->udp.check == 0)
+                f->udp.check = 0xffff;
+
+        hdr->tp_next_offset = 0;
+        hdr->tp_len = sizeof(raw_frame_t) + len;
+        hdr->tp_snaplen = hdr->tp_len;
+        __atomic_store_n(&hdr->tp_status, TP_STATUS_SEND_REQUEST, __ATOMIC_RELEASE);
+
+        tx->head = (tx->head + 1) % tx->frame_nr;
+        if (tx->pending < tx->frame_nr)
+                tx->pending++;
+        tx->stats.tx_frames++;
+
+        if (tx->pending == tx->frame_nr)
+                return raw_tx_flush(tx);
+
+        return 0;
+}
+
+/* Give frames of failed flush back to ring, they are not sent */
+static void raw_tx_drop_pending(raw_tx_t *tx)
+{
+        uint32_t index = (tx->head + tx->frame_nr - tx->pending) % tx->frame_nr;
+
+        for (uint32_t i = 0; i < tx->pending; i++, index = (index + 1) % tx->frame_nr) {
+                struct tpacket3_hdr *hdr = raw_tx_frame(tx, index);
+                if (__atomic_load_n(&hdr->tp_status, __ATOMIC_ACQUIRE) & TP_STATUS_SEND_REQUEST) {
+                        __atomic_store_n(&hdr->tp_status, TP_STATUS_AVAILABLE, __ATOMIC_RELEASE);
+                        tx->stats.tx_dropped++;
+                }
+        }
+
+        tx->pending = 0;
+}
+
+int raw_tx_flush(raw_tx_t *tx)
+{
+        if (!tx || !tx->pending)
+                return 0;
+
+        int rv;
+        do {
+                rv = send(tx->fd, NULL, 0, MSG_DONTWAIT);
+        } while (rv < 0 && errno == EINTR);
+
+        tx->stats.tx_flushes++;
+
+        /* Kernel could not take everything now, frames stay in ring until next flush */
+        if (rv < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                return 0;
+
+        if (rv < 0) {
+                cclog(LOG_ERROR, NULL, "Failed to send frames from packet tx ring: %s", strerror(errno));
+                raw_tx_drop_pending(tx);
+                return -1;
+        }
+
+        tx->pending = 0;
+        return 0;
+}
+
+void raw_tx_destroy(raw_tx_t **tx)
+{
+        if (!tx || !*tx)
+                return;
+
+        raw_tx_t *t = *tx;
+        if (t->ring)
+                munmap(t->ring, t->ring_len);
+        if (t->fd >= 0)
+                close(t->fd);
+
+        free(t);
+        *tx = NULL;
+}
@@ -0,0 +1,61 @@
+#ifndef __RAW_TX_H__
+#define __RAW_TX_H__
+
+#include "dhcp_packet.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Transmit path over AF_PACKET socket with TPACKET_V3 tx ring.
+ * Used for replies which have to be unicasted to a client that has no IP
+ * address yet (RFC 2131 4.1, broadcast bit is clear and ciaddr is 0). Such
+ * client cannot answer ARP, so the Ethernet/IP/UDP frame is built by hand
+ * with chaddr as destination MAC and yiaddr as destination IP.
+ *
+ * Frames are built directly in the mmaped ring and sent together by
+ * raw_tx_flush() with a single syscall.
+ */
+typedef struct raw_tx {
+    int fd;
+    int ifindex;
+    uint8_t src_mac[6];
+    uint32_t src_ip;                // HOST BYTE ORDER
+
+    uint8_t *ring;
+    size_t ring_len;
+    uint32_t frame_size;
+    uint32_t frame_nr;
+    uint32_t head;                  // next frame to be filled
+    uint32_t pending;               // frames filled since last successful flush
+
+    struct {
+        uint64_t tx_frames;
+        uint64_t tx_flushes;
+        uint64_t tx_dropped;        // frames not queued because ring was full or not sent due to error
+    } stats;
+} raw_tx_t;
+
+/*
+ * Create tx ring of at least frames frames on interface ifname. src_ip in host
+ * byte order is used as source of frames. Returns NULL on failure, e.g. when
+ * server lacks CAP_NET_RAW
+ */
+raw_tx_t *raw_tx_new(const char *ifname, uint32_t src_ip, uint32_t frames);
+
+/*
+ * Build frame with packet of len bytes addressed to dst_mac and dst_ip:dst_port
+ * (both in host byte order). Returns 0 on success, -1 if frame cannot be queued
+ */
+int raw_tx_queue(raw_tx_t *tx, const uint8_t dst_mac[6], uint32_t dst_ip, uint16_t dst_port,
+        const dhcp_packet_t *packet, size_t len);
+
+/*
+ * Send all queued frames. If kernel cannot take them now (EAGAIN), they stay pending
+ * and next flush retries. On other errors frames are dropped from ring.
+ * Returns 0 on success or retry, -1 on failure
+ */
+int raw_tx_flush(raw_tx_t *tx);
+
+void raw_tx_destroy(raw_tx_t **tx);
+
+#endif // !__RAW_TX_H__
@@ -24,12 +24,29 @@
 #include <stdlib.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <sys/epoll.h>
 
 #define STATUS_MSG_LEN 4096
 
-static int keep_waiting_for_offer = 0;
-/* Used to check xid so we dont handle our own message */
-static uint32_t xid_used_in_scan = 0;
+/*
+ * State of a scan. Scan is running while its socket is open. When the deadline 
+ * expires, socket is closed and the result waits in the slot until it is collected
+ */
+typedef struct dhcp_snoop_scan {
+    uint32_t id;                    // 0 if the slot is free
+    enum dhcp_snooper_status status;  // DHCP_SNOOP_SCAN_RUNNING until deadline, then result
+    bool rogue_detected;
+    int sock_fd;
+    uint32_t xid;                   // xid of fake DHCPDISCOVER, read by every worker
+    llist_t *whitelist;
+    struct timer *deadline;
+    dhcp_server_t *server;          // server whose event loop and timing wheel the scan uses
+    char status_msg[STATUS_MSG_LEN];
+} dhcp_snoop_scan_t;
+
+/* Scans are started and handled only by the worker serving unix commands */
+static dhcp_snoop_scan_t scans[DHCP_SNOOP_MAX_SCANS];
+static uint32_t next_scan_id = 1;
 
 static int discover_send(int socket, dhcp_message_t *discover)
 {
@@ -45,7 +62,7 @@ static int discover_send(int socket, dhcp_message_t *discover)
         addr.sin_port = htons(67);
         addr.sin_addr.s_addr = 0xffffffff;
 
-        if_failed_log_n(sendto(socket, &discover->packet, sizeof(dhcp_packet_t), 0,
+        if_failed_log_n(sendto(socket, discover->packet, dhcp_message_lenght(discover), 0,
                         (struct sockaddr*)&addr, sizeof(addr)), 
                         exit, LOG_ERROR, NULL, "DHCP Snoop: Failed to send DISCOVER message: %s", 
                                                 strerror(errno));
@@ -66,7 +83,7 @@ static int get_dhcp_options(dhcp_message_t *discover)
         dhcp_option_t *o = dhcp_option_new_values(DHCP_OPTION_DHCP_MESSAGE_TYPE,
                                                   1,
                                                   &val);
-        if_failed_log(dhcp_option_add(discover->dhcp_options, o), exit, LOG_ERROR, NULL, 
+        if_failed_log(dhcp_option_add(discover->work->dhcp_options, o), exit, LOG_ERROR, NULL, 
                       "Cannot perform DHCP scan, failed to set up dhcp discover options");
 
         rv = 0;
@@ -84,20 +101,17 @@ static int snoop_send_dhcp_discover(int socket, const char *spoofed_mac, uint32_
         dhcp_message_t *discover = dhcp_message_new();
         if_null(discover, exit);
 
-        discover->opcode = BOOTREQUEST;
-        discover->htype  = ETHERNET;
-        discover->hlen   = 6;
-        discover->hops   = 0;
+        discover->packet->opcode = BOOTREQUEST;
+        discover->packet->htype  = ETHERNET;
+        discover->packet->hlen   = 6;
         srand(time(NULL));
-        discover->xid    = rand();
-        xid_used_in_scan = discover->xid;
-        discover->secs   = htons(65535);
-        discover->ciaddr = 0;
-        discover->yiaddr = 0;
-        discover->siaddr = 0;
-        discover->flags  = 32768; // We set broadcast flag 
-        discover->giaddr = 0;
-        discover->cookie = MAGIC_COOKIE;
+        /* xid 0 marks slot without running scan */
+        do {
+                discover->xid = rand();
+        } while (!discover->xid);
+        dhcp_message_set_secs(discover, 65535);
+        dhcp_message_set_flags(discover, DHCP_FLAG_BROADCAST);
+        dhcp_message_set_cookie(discover, MAGIC_COOKIE);
         discover->type   = DHCP_DISCOVER;
 
         uint8_t mac_buffer[6];
@@ -111,26 +125,22 @@ static int snoop_send_dhcp_discover(int socket, const char *spoofed_mac, uint32_
         rv = 0;
         *xid_buf = discover->xid;
 exit:
+        if (discover)
+                dhcp_message_destroy(&discover);
         return rv;
 }
 
-static int cb_turn_off_scanning(uint32_t time, void *priv)
-{
-        keep_waiting_for_offer = 0;
-        return 0;
-}
-
 static bool is_server_whitelisted(llist_t *list, dhcp_message_t *m)
 {
         if (!list || !m)
                 return false;
 
-        dhcp_option_t *o = dhcp_option_retrieve(m->dhcp_options, DHCP_OPTION_SERVER_IDENTIFIER);
-        if (!o)
+        uint32_t server_id;
+        if (dhcp_message_option_number(m, DHCP_OPTION_SERVER_IDENTIFIER, &server_id) < 0)
                 return false;
 
         llist_foreach(list, {
-                if (*(uint32_t*)node->data == o->value.ip)
+                if (*(uint32_t*)node->data == server_id)
                         return true;
         })
 
@@ -143,75 +153,124 @@ static void log_threat(dhcp_message_t *msg, char *status)
                 return;
         
         char buff[512];
+        char hostname[256] = {0};
+        uint32_t server_id;
+        uint8_t lenght;
         
-        dhcp_option_t *o_server_id = dhcp_option_retrieve(msg->dhcp_options, DHCP_OPTION_SERVER_IDENTIFIER);
-        if (!o_server_id) {
+        bool has_server_id = dhcp_message_option_number(msg, DHCP_OPTION_SERVER_IDENTIFIER, &server_id) == 0;
+        if (!has_server_id) {
                 sprintf(buff, "Threat: No_ID - ");
         } else {
-                sprintf(buff, "Threat: %s - ", uint32_to_ipv4_address(o_server_id->value.ip));
+                sprintf(buff, "Threat: %s - ", uint32_to_ipv4_address(server_id));
         }
-        strcat(status, buff);
-        dhcp_option_t *o_hostname = dhcp_option_retrieve(msg->dhcp_options, DHCP_OPTION_HOST_NAME);
-        if (!o_server_id) {
+        strncat(status, buff, STATUS_MSG_LEN - strlen(status) - 1);
+        const uint8_t *o_hostname = dhcp_message_option(msg, DHCP_OPTION_HOST_NAME, &lenght);
+        if (!o_hostname) {
                 sprintf(buff, "No hostname,");
         } else {
-                sprintf(buff, "hostname: %s,", o_hostname->value.string);
+                memcpy(hostname, o_hostname, lenght);
+                snprintf(buff, sizeof(buff), "hostname: %s,", hostname);
         }
-        strcat(status, buff);
+        strncat(status, buff, STATUS_MSG_LEN - strlen(status) - 1);
 
         cclog(LOG_WARN, NULL, "Potential rogue DHCP server. ID: %s, hostname: %s",
-              o_server_id ? uint32_to_ipv4_address(o_server_id->value.ip) : "not provided",
-              o_hostname  ? o_hostname->value.string: "not provided");
+              has_server_id ? uint32_to_ipv4_address(server_id) : "not provided",
+              o_hostname    ? hostname : "not provided");
 }
 
-static enum dhcp_snooper_status listen_to_offers(int socket, 
-                                                llist_t *server_whitelist,
-                                                char *status_msg,
-                                                uint32_t xid)
+/* Evaluate offers waiting on scan socket */
+static void receive_offers(dhcp_snoop_scan_t *scan)
 {
-        if (!status_msg)
-            return DHCP_SNOOP_ERROR;
-
-        int rv = DHCP_SNOOP_ERROR;
-
-        keep_waiting_for_offer = 1;
-        struct timer *timer = timer_new(TIMER_ONCE, 10, true, cb_turn_off_scanning);
-        if_null(timer, exit);
-        dhcp_message_t *message = dhcp_message_new();
-        if_null(message, exit);
-
+        dhcp_message_t *message;
         int bytes = 0;
-        while (keep_waiting_for_offer) {
-                timer_update(timer, NULL);
-        
-                bytes = recv(socket, &message->packet, sizeof(dhcp_packet_t), 0);
-		if (bytes < 0 && errno == EAGAIN) {
-			continue;
-		} else if (bytes < 0) {
-			cclog(LOG_WARN, NULL, "Failed to receive dhcp packet with return code %d", bytes);
-			continue;
-		}
-
-                if (dhcp_packet_parse(message) < 0)
-                        continue;
 
-                if (message->type != DHCP_OFFER || 
-                    message->xid  != xid)
+        while (true) {
+                message = dhcp_message_new();
+                if_null(message, exit);
+
+                bytes = recv(scan->sock_fd, message->packet, sizeof(dhcp_packet_t), 0);
+                if (bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                        goto exit;
+                } else if (bytes < 0) {
+                        cclog(LOG_WARN, NULL, "Failed to receive dhcp packet with return code %d", bytes);
+                        goto exit;
+                }
+
+                if (dhcp_packet_parse(message) < 0 || 
+                    message->type != DHCP_OFFER || 
+                    message->xid  != scan->xid || 
+                    is_server_whitelisted(scan->whitelist, message)) {
+                        dhcp_message_destroy(&message);
                         continue;
+                }
 
-                if (is_server_whitelisted(server_whitelist, message))
-                        continue;
+                log_threat(message, scan->status_msg);
+                scan->rogue_detected = true;
+                dhcp_message_destroy(&message);
+        }
+
+exit:
+        if (message)
+                dhcp_message_destroy(&message);
+}
 
-                log_threat(message, status_msg);
-                rv = DHCP_SNOOP_POTENTIAL_ROGUE;
+/* Stop listening for offers, result of the scan is kept until it is collected */
+static void finish_scan(dhcp_snoop_scan_t *scan)
+{
+        if (scan->sock_fd >= 0) {
+                epoll_ctl(scan->server->epoll_fd, EPOLL_CTL_DEL, scan->sock_fd, NULL);
+                close(scan->sock_fd);
         }
-        
-        if (rv != DHCP_SNOOP_POTENTIAL_ROGUE) {
-                strcat(status_msg, "No threats detected");
-                rv = DHCP_SNOOP_NO_THREAT;
+        scan->sock_fd = -1;
+        __atomic_store_n(&scan->xid, 0, __ATOMIC_RELEASE);
+        llist_destroy(&scan->whitelist);
+
+        if (scan->rogue_detected) {
+                scan->status = DHCP_SNOOP_POTENTIAL_ROGUE;
+        } else {
+                strncat(scan->status_msg, "No threats detected", 
+                        STATUS_MSG_LEN - strlen(scan->status_msg) - 1);
+                scan->status = DHCP_SNOOP_NO_THREAT;
         }
-exit:
-        return rv;
+
+        cclog(LOG_MSG, NULL, "DHCP snoop: scan %u finished", scan->id);
+}
+
+static int cb_scan_deadline(uint32_t time, void *priv)
+{
+        dhcp_snoop_scan_t *scan = (dhcp_snoop_scan_t*)priv;
+
+        /* Offers which arrived right before the deadline are still evaluated */
+        receive_offers(scan);
+        finish_scan(scan);
+        return 0;
+}
+
+static void free_scan(dhcp_snoop_scan_t *scan)
+{
+        if (scan->sock_fd >= 0)
+                finish_scan(scan);
+
+        timer_destroy(&scan->deadline);
+        memset(scan, 0, sizeof(dhcp_snoop_scan_t));
+        scan->sock_fd = -1;
+}
+
+/* Returns free slot, or slot of the oldest finished scan whose result wasnt collected */
+static dhcp_snoop_scan_t *get_scan_slot()
+{
+        dhcp_snoop_scan_t *slot = NULL;
+
+        for (int i = 0; i < DHCP_SNOOP_MAX_SCANS; i++) {
+                if (!scans[i].id)
+                        return &scans[i];
+                if (scans[i].status != DHCP_SNOOP_SCAN_RUNNING && (!slot || scans[i].id < slot->id))
+                        slot = &scans[i];
+        }
+
+        if (slot)
+                free_scan(slot);
+        return slot;
 }
 
 static int create_dhcp_client_socket(dhcp_server_t *server) 
@@ -242,54 +301,130 @@ static int create_dhcp_client_socket(dhcp_server_t *server)
 		exit, LOG_CRITICAL, NULL, "Failed to set socket to non-blocking state");
 
         if_failed(bind(sock, (struct sockaddr *)&caddr, sizeof(caddr)), exit);
-exit:
+
         return sock;
+exit:
+        /* Half configured socket would receive nothing, scan fails instead */
+        if (sock >= 0)
+                close(sock);
+        return -1;
 }
 
-enum dhcp_snooper_status dhcp_snooper_perform_scan(dhcp_server_t *server, 
-                                                   const char *spoofed_mac,
-                                                   llist_t *server_whitelist,
-                                                   char **status_msg)
+int dhcp_snooper_start_scan(dhcp_server_t *server, const char *spoofed_mac, llist_t *server_whitelist)
 {
 #ifndef CONFIG_SECURITY_ENABLE_DHCP_SNOOPING
+        llist_destroy(&server_whitelist);
         return DHCP_SNOOP_DISABLED;
 #endif /* ifndef CONFIG_SECURITY_ENABLE_DHCP_SNOOPING */
 
         /*
-         * Send a dhcpdiscover, wait x seconds for response.
-         * If response is received, if there are whitelisted 
-         * dhcp server, check whether they answered, if not, 
-         * raise allert with information about the infringing server.
+         * Send a dhcpdiscover, collect responses for DHCP_SNOOP_SCAN_DURATION seconds.
+         * If response is received, if there are whitelisted dhcp server, check 
+         * whether they answered, if not, raise allert with information about 
+         * the infringing server.
          */
 
-        if (!server || !spoofed_mac || !status_msg)
-                return DHCP_SNOOP_ERROR;
-
         int rv = DHCP_SNOOP_ERROR;
-        uint32_t xid = 0;
+        struct epoll_event ev = {0};
+        dhcp_snoop_scan_t *scan = NULL;
 
-        if (*status_msg) {
-                free(*status_msg);
-        }
-        *status_msg = malloc(STATUS_MSG_LEN);
-        if_null_log(*status_msg, exit, LOG_ERROR, NULL, "Failed to allocate space for status msg");
-        memset(*status_msg, 0, STATUS_MSG_LEN);
+        if (!server || !spoofed_mac || !server->timers.wheel)
+                goto exit;
+
+        scan = get_scan_slot();
+        if_null_log(scan, exit, LOG_ERROR, NULL, "DHCP snoop: Too many scans are running");
 
-        int socket = create_dhcp_client_socket(server);
-        if_failed_log_n(socket, exit, LOG_ERROR, NULL, "Failed to create dhcp client socket");
+        scan->id = next_scan_id++;
+        scan->status = DHCP_SNOOP_SCAN_RUNNING;
+        scan->server = server;
+        scan->whitelist = server_whitelist;
+        server_whitelist = NULL;
 
-        if_failed_log(snoop_send_dhcp_discover(socket, spoofed_mac, &xid), exit, LOG_ERROR, NULL,
+        scan->sock_fd = create_dhcp_client_socket(server);
+        if_failed_log_n(scan->sock_fd, exit, LOG_ERROR, NULL, "Failed to create dhcp client socket");
+
+        ev.events = EPOLLIN;
+        ev.data.fd = scan->sock_fd;
+        if_failed_log_n(epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, scan->sock_fd, &ev), exit, LOG_ERROR, NULL,
+                      "DHCP snoop: Failed to register scan socket with epoll: %s", strerror(errno));
+
+        scan->deadline = timer_new(TIMER_ONCE, DHCP_SNOOP_SCAN_DURATION, true, cb_scan_deadline);
+        if_null(scan->deadline, exit);
+        if_failed(timer_wheel_attach(server->timers.wheel, scan->deadline, scan), exit);
+
+        uint32_t xid = 0;
+        if_failed_log(snoop_send_dhcp_discover(scan->sock_fd, spoofed_mac, &xid), exit, LOG_ERROR, NULL,
                       "DHCP spoofing: Failed to send fake DHCPDISCOVER message");
+        __atomic_store_n(&scan->xid, xid, __ATOMIC_RELEASE);
+
+        cclog(LOG_MSG, NULL, "DHCP snoop: started scan %u", scan->id);
+        rv = scan->id;
+exit:
+        if (rv < 0 && scan)
+                free_scan(scan);
+        llist_destroy(&server_whitelist);
+        return rv;
+}
+
+enum dhcp_snooper_status dhcp_snooper_scan_result(uint32_t id, char **status_msg)
+{
+#ifndef CONFIG_SECURITY_ENABLE_DHCP_SNOOPING
+        return DHCP_SNOOP_DISABLED;
+#endif /* ifndef CONFIG_SECURITY_ENABLE_DHCP_SNOOPING */
+
+        if (!id || !status_msg)
+                return DHCP_SNOOP_ERROR;
 
-        rv = listen_to_offers(socket, server_whitelist, *status_msg, xid);
-        close(socket);
+        int rv = DHCP_SNOOP_UNKNOWN_SCAN;
+
+        for (int i = 0; i < DHCP_SNOOP_MAX_SCANS; i++) {
+                dhcp_snoop_scan_t *scan = &scans[i];
+                if (scan->id != id)
+                        continue;
+
+                rv = scan->status;
+                if (rv == DHCP_SNOOP_SCAN_RUNNING)
+                        break;
+
+                if (*status_msg)
+                        free(*status_msg);
+                *status_msg = strdup(scan->status_msg);
+                if_null_log(*status_msg, exit, LOG_ERROR, NULL, "Failed to allocate space for status msg");
+                
+                free_scan(scan);
+                break;
+        }
 
 exit:
         return rv;
 }
 
-int dhcp_snooper_check_xid(uint32_t xid)
+bool dhcp_snooper_handle_fd(int fd)
 {
-        return (xid == xid_used_in_scan);
+        for (int i = 0; i < DHCP_SNOOP_MAX_SCANS; i++) {
+                if (scans[i].id && scans[i].sock_fd == fd) {
+                        receive_offers(&scans[i]);
+                        return true;
+                }
+        }
+
+        return false;
 }
 
+void dhcp_snooper_cleanup()
+{
+        for (int i = 0; i < DHCP_SNOOP_MAX_SCANS; i++) {
+                if (scans[i].id)
+                        free_scan(&scans[i]);
+        }
+}
+
+int dhcp_snooper_check_xid(uint32_t xid)
+{
+        for (int i = 0; i < DHCP_SNOOP_MAX_SCANS; i++) {
+                if (xid && __atomic_load_n(&scans[i].xid, __ATOMIC_ACQUIRE) == xid)
+                        return 1;
+        }
+
+        return 0;
+}
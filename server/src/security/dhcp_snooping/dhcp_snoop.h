@@ -3,6 +3,7 @@
 
 #include "../../dhcp_server.h"
 #include <limits.h>
+#include <stdbool.h>
 
 #ifdef CONFIG_SECURITY_ENABLE_DHCP_SNOOPING
 #undef CONFIG_SECURITY_ENABLE_DHCP_SNOOPING
@@ -11,20 +12,46 @@
 #define CONFIG_SECURITY_ENABLE_DHCP_SNOOPING
 #endif
 
+/* Number of scans which can run or wait for their results to be collected at once */
+#define DHCP_SNOOP_MAX_SCANS 4
+/* Duration of scan in seconds, offers received in this period are evaluated */
+#define DHCP_SNOOP_SCAN_DURATION 10
+
 enum dhcp_snooper_status {
     DHCP_SNOOP_DISABLED = INT_MIN,
 
+    DHCP_SNOOP_UNKNOWN_SCAN = -2,
     DHCP_SNOOP_ERROR = -1,
     DHCP_SNOOP_NO_THREAT = 0,
     DHCP_SNOOP_POTENTIAL_ROGUE = 1,
+    DHCP_SNOOP_SCAN_RUNNING = 2,
 };
 
-enum dhcp_snooper_status dhcp_snooper_perform_scan(dhcp_server_t *server, 
-                                                   const char *spoofed_mac,
-                                                   llist_t *server_whitelist,
-                                                   char **status_msg);
-
-/* Simple function to check xid of a message whether it matches a fake DHCPDISCOVER sent by the scan */
+/*
+ * Start a scan for rogue dhcp servers. Fake DHCPDISCOVER is sent from spoofed_mac and 
+ * offers are collected for DHCP_SNOOP_SCAN_DURATION seconds. Scan socket is registered 
+ * in the event loop of server and its deadline is scheduled on the server timing wheel, 
+ * so the scan doesnt block serving clients. Offers from servers in server_whitelist 
+ * (list of uint32_t server identifiers) are ignored, the scan takes ownership of the list.
+ *
+ * Returns id of the scan (greater than 0), or a negative dhcp_snooper_status on failure
+ */
+int dhcp_snooper_start_scan(dhcp_server_t *server, const char *spoofed_mac, llist_t *server_whitelist);
+
+/*
+ * Collect result of scan. Returns DHCP_SNOOP_SCAN_RUNNING if scan didnt finish yet. 
+ * Otherwise returns result of the scan, status_msg is set to allocated comma separated 
+ * description of threats (must be freed by caller) and the scan is forgotten
+ */
+enum dhcp_snooper_status dhcp_snooper_scan_result(uint32_t id, char **status_msg);
+
+/* Handle readable descriptor fd. Returns true if fd is a scan socket, false otherwise */
+bool dhcp_snooper_handle_fd(int fd);
+
+/* Stop all scans and free their resources, must be called before timing wheel of server is destroyed */
+void dhcp_snooper_cleanup();
+
+/* Simple function to check xid of a message whether it matches a fake DHCPDISCOVER sent by a scan */
 int dhcp_snooper_check_xid(uint32_t xid);
 
 #endif // !__DHCP_SNOOP_H__
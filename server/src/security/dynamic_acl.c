@@ -14,31 +14,16 @@ enum ACL_status dynamic_ACL_check(ACL_t *acl, uint8_t *chaddr, transaction_cache
         if (!acl->enabled)
                 return ACL_ALLOW;
 
-        /* Check for the number of transactions assosiated with the client */
-        int associated_transactions = 0;
-        for (int i = 0; i < tcache->size; i++) {
-                /* If the timer on transaction isnt running, its not a transaction in use */
-                if (tcache->transactions[i]->timer->is_running == false) {
-                        continue;
-                }
-                
-                dhcp_message_t *m = trans_get_index(tcache->transactions[i], 0);
-                if (!m) {
-                        continue;
-                }
-
-                if (memcmp(chaddr, m->chaddr, 6) == 0) {
-                        associated_transactions++;
-                }
-        }
+        enum ACL_status status = ACL_check_client(acl, chaddr);
 
-        /* Add the new mac address to the ACL list */
-        if (associated_transactions >= tcache->size / 2) {
+        /* Add the new mac address to the ACL list if it holds half of the cache */
+        if (status == ACL_ALLOW && trans_cache_client_transactions(tcache, chaddr) >= tcache->size / 2) {
                 char *mac = strdup(uint8_array_to_mac(chaddr));
                 llist_append(acl->entries, mac, true);
+                status = ACL_DENY;
         }
 
-        return ACL_check_client(acl, chaddr);
+        return status;
 }
 
 ACL_t *dynamic_ACL_new()
@@ -6,9 +6,9 @@
 #include "../transaction_cache.h"
 
 /**
- * Function checks for the number of transactions that are present in the transaction cache.
- * If half or more transactions have the same chaddr as the one provided, the client is 
- * added to the ACL list provided. 
+ * Function looks up the number of running transactions of the client in the transaction 
+ * cache (see trans_cache_client_transactions). If they take half or more of the cache, 
+ * the client is added to the ACL list provided. 
  *
  * The acl is supposed to be a blacklist. Return ACL_status based on the criteria of 
  * a blacklist.
@@ -0,0 +1,482 @@
+#include "xdp_filter.h"
+#include "../logging.h"
+#include "../RFC/RFC-2131.h"
+#include "../utils/llist.h"
+#include "../utils/xtoy.h"
+#include <arpa/inet.h>
+#include <cclog_macros.h>
+#include <errno.h>
+#include <linux/bpf.h>
+#include <linux/if_ether.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/* Offsets inside ethernet frame with IPv4 header without options */
+#define FRAME_ETH_TYPE          12
+#define FRAME_IP_VERSION_IHL    (ETH_HLEN + 0)
+#define FRAME_IP_PROTOCOL       (ETH_HLEN + 9)
+#define FRAME_UDP_DEST          (ETH_HLEN + 20 + 2)
+#define FRAME_CHADDR            (ETH_HLEN + 20 + 8 + 28)
+#define FRAME_MIN_LENGHT        (ETH_HLEN + 20 + 8 + 240)   // up to magic cookie
+
+/* Stack of the program */
+#define STACK_KEY       -8      // chaddr, zero padded to 8 bytes
+#define STACK_TAT       -16     // value of new rate map entry
+#define STACK_INDEX     -20     // index into stats map
+
+#define XDP_PROG_MAX_INSNS  128
+#define XDP_PROG_MAX_JUMPS  32
+
+/* Instruction encoding, same as the kernel uses for its own programs */
+#define INSN(c, d, s, o, i)     ((struct bpf_insn){.code = (c), .dst_reg = (d), .src_reg = (s), \
+                                                   .off = (o), .imm = (i)})
+#define MOV64_REG(d, s)         INSN(BPF_ALU64 | BPF_MOV | BPF_X, d, s, 0, 0)
+#define MOV64_IMM(d, i)         INSN(BPF_ALU64 | BPF_MOV | BPF_K, d, 0, 0, i)
+#define ALU64_REG(op, d, s)     INSN(BPF_ALU64 | (op) | BPF_X, d, s, 0, 0)
+#define ALU64_IMM(op, d, i)     INSN(BPF_ALU64 | (op) | BPF_K, d, 0, 0, i)
+#define LDX_MEM(sz, d, s, o)    INSN(BPF_LDX | (sz) | BPF_MEM, d, s, o, 0)
+#define STX_MEM(sz, d, s, o)    INSN(BPF_STX | (sz) | BPF_MEM, d, s, o, 0)
+#define ST_MEM(sz, d, o, i)     INSN(BPF_ST | (sz) | BPF_MEM, d, 0, o, i)
+#define ATOMIC_ADD(sz, d, s, o) INSN(BPF_STX | (sz) | BPF_ATOMIC, d, s, o, BPF_ADD)
+#define JMP_REG(op, d, s)       INSN(BPF_JMP | (op) | BPF_X, d, s, 0, 0)
+#define JMP_IMM(op, d, i)       INSN(BPF_JMP | (op) | BPF_K, d, 0, 0, i)
+#define JMP_A()                 INSN(BPF_JMP | BPF_JA, 0, 0, 0, 0)
+#define CALL(f)                 INSN(BPF_JMP | BPF_CALL, 0, 0, 0, f)
+#define EXIT()                  INSN(BPF_JMP | BPF_EXIT, 0, 0, 0, 0)
+
+enum xdp_prog_label {
+    L_PASS,
+    L_DROP,
+    L_DROP_ACL,
+    L_DROP_DACL,
+    L_DROP_RATE,
+    L_RATE_CHECK,
+    L_RATE_NEW,
+    L_COUNT,
+};
+
+/* Program being generated, jumps refer to labels which are resolved at the end */
+struct xdp_prog {
+    struct bpf_insn insns[XDP_PROG_MAX_INSNS];
+    uint32_t count;
+    int32_t labels[L_COUNT];
+    struct {
+        uint32_t insn;
+        enum xdp_prog_label label;
+    } jumps[XDP_PROG_MAX_JUMPS];
+    uint32_t jump_count;
+};
+
+enum xdp_acl_mode {
+    XDP_ACL_NONE,
+    XDP_ACL_BLACKLIST,
+    XDP_ACL_WHITELIST,
+};
+
+static long sys_bpf(int cmd, union bpf_attr *attr)
+{
+        return syscall(__NR_bpf, cmd, attr, sizeof(union bpf_attr));
+}
+
+static void emit(struct xdp_prog *p, struct bpf_insn insn)
+{
+        if (p->count < XDP_PROG_MAX_INSNS)
+                p->insns[p->count] = insn;
+        p->count++;
+}
+
+static void emit_jump(struct xdp_prog *p, struct bpf_insn insn, enum xdp_prog_label label)
+{
+        if (p->jump_count < XDP_PROG_MAX_JUMPS) {
+                p->jumps[p->jump_count].insn = p->count;
+                p->jumps[p->jump_count].label = label;
+        }
+        p->jump_count++;
+        emit(p, insn);
+}
+
+static void emit_label(struct xdp_prog *p, enum xdp_prog_label label)
+{
+        p->labels[label] = p->count;
+}
+
+/* 64 bit immediate load takes two instructions, src is BPF_PSEUDO_MAP_FD for map fds */
+static void emit_ld_imm64(struct xdp_prog *p, int reg, int src, uint64_t imm)
+{
+        emit(p, INSN(BPF_LD | BPF_DW | BPF_IMM, reg, src, 0, (uint32_t)imm));
+        emit(p, INSN(0, 0, 0, 0, (uint32_t)(imm >> 32)));
+}
+
+/* Set offsets of jumps, returns -1 if the program overflowed or uses undefined label */
+static int resolve_jumps(struct xdp_prog *p)
+{
+        if (p->count > XDP_PROG_MAX_INSNS || p->jump_count > XDP_PROG_MAX_JUMPS)
+                return -1;
+
+        for (uint32_t i = 0; i < p->jump_count; i++) {
+                int32_t target = p->labels[p->jumps[i].label];
+                if (target < 0)
+                        return -1;
+                p->insns[p->jumps[i].insn].off = target - p->jumps[i].insn - 1;
+        }
+
+        return 0;
+}
+
+/* Lookup key on stack in map, r0 holds pointer to value or NULL */
+static void emit_map_lookup(struct xdp_prog *p, int map_fd, int16_t key)
+{
+        emit_ld_imm64(p, BPF_REG_1, BPF_PSEUDO_MAP_FD, map_fd);
+        emit(p, MOV64_REG(BPF_REG_2, BPF_REG_10));
+        emit(p, ALU64_IMM(BPF_ADD, BPF_REG_2, key));
+        emit(p, CALL(BPF_FUNC_map_lookup_elem));
+}
+
+static int xdp_filter_generate(xdp_filter_t *xdp, enum xdp_acl_mode mode, struct xdp_prog *p)
+{
+        memset(p, 0, sizeof(struct xdp_prog));
+        for (int i = 0; i < L_COUNT; i++)
+                p->labels[i] = -1;
+
+        /* Only IPv4 UDP packets to server port are inspected, anything else passes */
+        emit(p, LDX_MEM(BPF_W, BPF_REG_2, BPF_REG_1, offsetof(struct xdp_md, data)));
+        emit(p, LDX_MEM(BPF_W, BPF_REG_3, BPF_REG_1, offsetof(struct xdp_md, data_end)));
+        emit(p, MOV64_REG(BPF_REG_4, BPF_REG_2));
+        emit(p, ALU64_IMM(BPF_ADD, BPF_REG_4, FRAME_MIN_LENGHT));
+        emit_jump(p, JMP_REG(BPF_JGT, BPF_REG_4, BPF_REG_3), L_PASS);
+        /* Packet bytes are loaded as they are, so constants are in network order too */
+        emit(p, LDX_MEM(BPF_H, BPF_REG_5, BPF_REG_2, FRAME_ETH_TYPE));
+        emit_jump(p, JMP_IMM(BPF_JNE, BPF_REG_5, htons(ETH_P_IP)), L_PASS);
+        emit(p, LDX_MEM(BPF_B, BPF_REG_5, BPF_REG_2, FRAME_IP_VERSION_IHL));
+        emit_jump(p, JMP_IMM(BPF_JNE, BPF_REG_5, 0x45), L_PASS);
+        emit(p, LDX_MEM(BPF_B, BPF_REG_5, BPF_REG_2, FRAME_IP_PROTOCOL));
+        emit_jump(p, JMP_IMM(BPF_JNE, BPF_REG_5, IPPROTO_UDP), L_PASS);
+        emit(p, LDX_MEM(BPF_H, BPF_REG_5, BPF_REG_2, FRAME_UDP_DEST));
+        emit_jump(p, JMP_IMM(BPF_JNE, BPF_REG_5, htons(DHCP_SERVER_PORT)), L_PASS);
+
+        /* Key of maps is chaddr padded by zeroes */
+        emit(p, ST_MEM(BPF_DW, BPF_REG_10, STACK_KEY, 0));
+        emit(p, LDX_MEM(BPF_W, BPF_REG_5, BPF_REG_2, FRAME_CHADDR));
+        emit(p, STX_MEM(BPF_W, BPF_REG_10, BPF_REG_5, STACK_KEY));
+        emit(p, LDX_MEM(BPF_H, BPF_REG_5, BPF_REG_2, FRAME_CHADDR + 4));
+        emit(p, STX_MEM(BPF_H, BPF_REG_10, BPF_REG_5, STACK_KEY + 4));
+
+        if (mode != XDP_ACL_NONE) {
+                emit_map_lookup(p, xdp->acl_fd, STACK_KEY);
+                emit_jump(p, JMP_IMM(mode == XDP_ACL_BLACKLIST ? BPF_JNE : BPF_JEQ, BPF_REG_0, 0),
+                          L_DROP_ACL);
+        }
+
+        emit_map_lookup(p, xdp->dacl_fd, STACK_KEY);
+        emit_jump(p, JMP_IMM(BPF_JNE, BPF_REG_0, 0), L_DROP_DACL);
+
+        if (xdp->rate) {
+                uint64_t interval = 1000000000ULL / xdp->rate;
+                uint64_t tolerance = (xdp->burst ? xdp->burst - 1 : 0) * interval;
+
+                /* r7 = entry of client, r8 = now */
+                emit_map_lookup(p, xdp->rate_fd, STACK_KEY);
+                emit(p, MOV64_REG(BPF_REG_7, BPF_REG_0));
+                emit(p, CALL(BPF_FUNC_ktime_get_ns));
+                emit(p, MOV64_REG(BPF_REG_8, BPF_REG_0));
+                emit_jump(p, JMP_IMM(BPF_JEQ, BPF_REG_7, 0), L_RATE_NEW);
+
+                /* Client is over rate if its next packet is expected later than bucket allows */
+                emit(p, LDX_MEM(BPF_DW, BPF_REG_1, BPF_REG_7, 0));
+                emit_jump(p, JMP_REG(BPF_JGE, BPF_REG_1, BPF_REG_8), L_RATE_CHECK);
+                emit(p, MOV64_REG(BPF_REG_1, BPF_REG_8));
+                emit_label(p, L_RATE_CHECK);
+                emit(p, MOV64_REG(BPF_REG_2, BPF_REG_1));
+                emit(p, ALU64_REG(BPF_SUB, BPF_REG_2, BPF_REG_8));
+                emit_ld_imm64(p, BPF_REG_3, 0, tolerance);
+                emit_jump(p, JMP_REG(BPF_JGT, BPF_REG_2, BPF_REG_3), L_DROP_RATE);
+                emit_ld_imm64(p, BPF_REG_3, 0, interval);
+                emit(p, ALU64_REG(BPF_ADD, BPF_REG_1, BPF_REG_3));
+                emit(p, STX_MEM(BPF_DW, BPF_REG_7, BPF_REG_1, 0));
+                emit_jump(p, JMP_A(), L_PASS);
+
+                /* First packet of client */
+                emit_label(p, L_RATE_NEW);
+                emit_ld_imm64(p, BPF_REG_3, 0, interval);
+                emit(p, MOV64_REG(BPF_REG_1, BPF_REG_8));
+                emit(p, ALU64_REG(BPF_ADD, BPF_REG_1, BPF_REG_3));
+                emit(p, STX_MEM(BPF_DW, BPF_REG_10, BPF_REG_1, STACK_TAT));
+                emit_ld_imm64(p, BPF_REG_1, BPF_PSEUDO_MAP_FD, xdp->rate_fd);
+                emit(p, MOV64_REG(BPF_REG_2, BPF_REG_10));
+                emit(p, ALU64_IMM(BPF_ADD, BPF_REG_2, STACK_KEY));
+                emit(p, MOV64_REG(BPF_REG_3, BPF_REG_10));
+                emit(p, ALU64_IMM(BPF_ADD, BPF_REG_3, STACK_TAT));
+                emit(p, MOV64_IMM(BPF_REG_4, BPF_ANY));
+                emit(p, CALL(BPF_FUNC_map_update_elem));
+        }
+
+        emit_label(p, L_PASS);
+        emit(p, MOV64_IMM(BPF_REG_0, XDP_PASS));
+        emit(p, EXIT());
+
+        /* Drops are counted in stats map, r9 = index of the counter */
+        if (mode != XDP_ACL_NONE) {
+                emit_label(p, L_DROP_ACL);
+                emit(p, MOV64_IMM(BPF_REG_9, XDP_FILTER_DROP_ACL));
+                emit_jump(p, JMP_A(), L_DROP);
+        }
+        emit_label(p, L_DROP_DACL);
+        emit(p, MOV64_IMM(BPF_REG_9, XDP_FILTER_DROP_DACL));
+        emit_jump(p, JMP_A(), L_DROP);
+        if (xdp->rate) {
+                emit_label(p, L_DROP_RATE);
+                emit(p, MOV64_IMM(BPF_REG_9, XDP_FILTER_DROP_RATE));
+        }
+
+        emit_label(p, L_DROP);
+        emit(p, STX_MEM(BPF_W, BPF_REG_10, BPF_REG_9, STACK_INDEX));
+        emit_map_lookup(p, xdp->stats_fd, STACK_INDEX);
+        emit(p, JMP_IMM(BPF_JEQ, BPF_REG_0, 0));
+        p->insns[p->count - 1].off = 2;
+        emit(p, MOV64_IMM(BPF_REG_1, 1));
+        emit(p, ATOMIC_ADD(BPF_DW, BPF_REG_0, BPF_REG_1, 0));
+        emit(p, MOV64_IMM(BPF_REG_0, XDP_DROP));
+        emit(p, EXIT());
+
+        return resolve_jumps(p);
+}
+
+static int map_create(const char *name, enum bpf_map_type type, uint32_t key_size, uint32_t value_size,
+                uint32_t max_entries, uint32_t flags)
+{
+        union bpf_attr attr;
+        memset(&attr, 0, sizeof(attr));
+
+        attr.map_type = type;
+        attr.key_size = key_size;
+        attr.value_size = value_size;
+        attr.max_entries = max_entries;
+        attr.map_flags = flags;
+        strncpy(attr.map_name, name, BPF_OBJ_NAME_LEN - 1);
+
+        int fd = sys_bpf(BPF_MAP_CREATE, &attr);
+        if (fd < 0)
+                cclog(LOG_ERROR, NULL, "Failed to create XDP map %s: %s", name, strerror(errno));
+
+        return fd;
+}
+
+static int prog_load(struct xdp_prog *p)
+{
+        union bpf_attr attr;
+        char *log = calloc(1, 65536);
+        memset(&attr, 0, sizeof(attr));
+
+        attr.prog_type = BPF_PROG_TYPE_XDP;
+        attr.insns = (uint64_t)(uintptr_t)p->insns;
+        attr.insn_cnt = p->count;
+        attr.license = (uint64_t)(uintptr_t)"GPL";
+        strncpy(attr.prog_name, "dhcp_filter", BPF_OBJ_NAME_LEN - 1);
+        if (log) {
+                attr.log_buf = (uint64_t)(uintptr_t)log;
+                attr.log_size = 65536;
+                attr.log_level = 1;
+        }
+
+        int fd = sys_bpf(BPF_PROG_LOAD, &attr);
+        if (fd < 0 && attr.log_level == 0)
+                cclog(LOG_ERROR, NULL, "Failed to load XDP program: %s", strerror(errno));
+        else if (fd < 0)
+                cclog(LOG_ERROR, NULL, "Failed to load XDP program: %s\n%.1024s", strerror(errno), log);
+
+        free(log);
+        return fd;
+}
+
+static void mac_to_key(const uint8_t mac[6], uint64_t *key)
+{
+        *key = 0;
+        memcpy(key, mac, 6);
+}
+
+xdp_filter_t *xdp_filter_new(const ACL_t *acl, uint32_t rate, uint32_t burst)
+{
+        struct xdp_prog *p = NULL;
+        xdp_filter_t *xdp = calloc(1, sizeof(xdp_filter_t));
+        if_null_log(xdp, error, LOG_ERROR, NULL, "Failed to allocate XDP filter");
+
+        xdp->prog_fd = xdp->acl_fd = xdp->dacl_fd = xdp->rate_fd = xdp->stats_fd = -1;
+        xdp->rate = rate;
+        xdp->burst = burst ? burst : 1;
+
+        xdp->acl_fd = map_create("dhcp_acl", BPF_MAP_TYPE_HASH, sizeof(uint64_t), sizeof(uint8_t),
+                                 XDP_FILTER_MAX_ACL_ENTRIES, BPF_F_NO_PREALLOC);
+        if_failed_n(xdp->acl_fd, error);
+        xdp->dacl_fd = map_create("dhcp_dacl", BPF_MAP_TYPE_HASH, sizeof(uint64_t), sizeof(uint8_t),
+                                  XDP_FILTER_MAX_ACL_ENTRIES, BPF_F_NO_PREALLOC);
+        if_failed_n(xdp->dacl_fd, error);
+        xdp->rate_fd = map_create("dhcp_rate", BPF_MAP_TYPE_LRU_HASH, sizeof(uint64_t), sizeof(uint64_t),
+                                  XDP_FILTER_MAX_CLIENTS, 0);
+        if_failed_n(xdp->rate_fd, error);
+        xdp->stats_fd = map_create("dhcp_stats", BPF_MAP_TYPE_ARRAY, sizeof(uint32_t), sizeof(uint64_t),
+                                   XDP_FILTER_DROP_COUNT, 0);
+        if_failed_n(xdp->stats_fd, error);
+
+        enum xdp_acl_mode mode = XDP_ACL_NONE;
+        if (acl && acl->enabled)
+                mode = acl->is_blacklist ? XDP_ACL_BLACKLIST : XDP_ACL_WHITELIST;
+
+        p = calloc(1, sizeof(struct xdp_prog));
+        if_null_log(p, error, LOG_ERROR, NULL, "Failed to allocate XDP program");
+        if_failed_log(xdp_filter_generate(xdp, mode, p), error, LOG_ERROR, NULL,
+                        "Failed to generate XDP program");
+
+        xdp->prog_fd = prog_load(p);
+        if_failed_n(xdp->prog_fd, error);
+
+        if (acl)
+                if_failed(xdp_filter_sync_acl(xdp, acl), error);
+
+        free(p);
+        return xdp;
+error:
+        free(p);
+        xdp_filter_destroy(&xdp);
+        return NULL;
+}
+
+int xdp_filter_attach(xdp_filter_t *xdp, const char *interface)
+{
+        int rv = -1;
+        if_null(xdp, exit);
+        if_null(interface, exit);
+        if_false_log((xdp->link_count < XDP_FILTER_MAX_LINKS), exit, LOG_ERROR, NULL,
+                        "XDP program is attached to too many interfaces");
+
+        unsigned int ifindex = if_nametoindex(interface);
+        if_false_log(ifindex, exit, LOG_ERROR, NULL, "Unknown interface %s", interface);
+
+        /* Kernel uses driver mode if the interface supports it, generic mode otherwise */
+        union bpf_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.link_create.prog_fd = xdp->prog_fd;
+        attr.link_create.target_ifindex = ifindex;
+        attr.link_create.attach_type = BPF_XDP;
+
+        int fd = sys_bpf(BPF_LINK_CREATE, &attr);
+        if_failed_log_n(fd, exit, LOG_WARN, NULL, "Failed to attach XDP program to %s: %s",
+                        interface, strerror(errno));
+
+        xdp->link_fds[xdp->link_count++] = fd;
+        cclog(LOG_MSG, NULL, "XDP filter attached to %s", interface);
+
+        rv = 0;
+exit:
+        return rv;
+}
+
+int xdp_filter_sync_acl(xdp_filter_t *xdp, const ACL_t *acl)
+{
+        if (!xdp || !acl)
+                return -1;
+
+        union bpf_attr attr;
+        uint64_t key, next;
+        uint8_t value = 1;
+        uint8_t mac[6];
+
+        /* Deleting the first key until there is none empties the map */
+        for (;;) {
+                memset(&attr, 0, sizeof(attr));
+                attr.map_fd = xdp->acl_fd;
+                attr.key = 0;
+                attr.next_key = (uint64_t)(uintptr_t)&next;
+                if (sys_bpf(BPF_MAP_GET_NEXT_KEY, &attr) < 0)
+                        break;
+
+                memset(&attr, 0, sizeof(attr));
+                attr.map_fd = xdp->acl_fd;
+                attr.key = (uint64_t)(uintptr_t)&next;
+                if (sys_bpf(BPF_MAP_DELETE_ELEM, &attr) < 0)
+                        break;
+        }
+
+        if (!acl->entries)
+                return 0;
+
+        llist_foreach(acl->entries, {
+                mac_to_uint8_array((const char*)node->data, mac);
+                mac_to_key(mac, &key);
+
+                memset(&attr, 0, sizeof(attr));
+                attr.map_fd = xdp->acl_fd;
+                attr.key = (uint64_t)(uintptr_t)&key;
+                attr.value = (uint64_t)(uintptr_t)&value;
+                attr.flags = BPF_ANY;
+                if (sys_bpf(BPF_MAP_UPDATE_ELEM, &attr) < 0) {
+                        cclog(LOG_WARN, NULL, "Failed to add ACL entry %s to XDP filter: %s",
+                                        (const char*)node->data, strerror(errno));
+                        return -1;
+                }
+        });
+
+        return 0;
+}
+
+int xdp_filter_deny(xdp_filter_t *xdp, const uint8_t chaddr[6])
+{
+        if (!xdp || !chaddr)
+                return -1;
+
+        union bpf_attr attr;
+        uint64_t key;
+        uint8_t value = 1;
+
+        mac_to_key(chaddr, &key);
+        memset(&attr, 0, sizeof(attr));
+        attr.map_fd = xdp->dacl_fd;
+        attr.key = (uint64_t)(uintptr_t)&key;
+        attr.value = (uint64_t)(uintptr_t)&value;
+        attr.flags = BPF_ANY;
+
+        return sys_bpf(BPF_MAP_UPDATE_ELEM, &attr) < 0 ? -1 : 0;
+}
+
+int xdp_filter_stats(xdp_filter_t *xdp, uint64_t drops[XDP_FILTER_DROP_COUNT])
+{
+        if (!xdp || !drops)
+                return -1;
+
+        union bpf_attr attr;
+
+        for (uint32_t i = 0; i < XDP_FILTER_DROP_COUNT; i++) {
+                memset(&attr, 0, sizeof(attr));
+                attr.map_fd = xdp->stats_fd;
+                attr.key = (uint64_t)(uintptr_t)&i;
+                attr.value = (uint64_t)(uintptr_t)&drops[i];
+                if (sys_bpf(BPF_MAP_LOOKUP_ELEM, &attr) < 0)
+                        return -1;
+        }
+
+        return 0;
+}
+
+void xdp_filter_destroy(xdp_filter_t **xdp)
+{
+        if (!xdp || !*xdp)
+                return;
+
+        xdp_filter_t *x = *xdp;
+
+        /* Closing the link detaches the program */
+        for (uint32_t i = 0; i < x->link_count; i++)
+                close(x->link_fds[i]);
+
+        int fds[] = {x->prog_fd, x->acl_fd, x->dacl_fd, x->rate_fd, x->stats_fd};
+        for (size_t i = 0; i < sizeof(fds) / sizeof(fds[0]); i++) {
+                if (fds[i] >= 0)
+                        close(fds[i]);
+        }
+
+        free(x);
+        *xdp = NULL;
+}
@@ -0,0 +1,73 @@
+#ifndef __XDP_FILTER_H__
+#define __XDP_FILTER_H__
+
+#include "acl.h"
+#include <stdint.h>
+
+/*
+ * XDP fast path of ACL enforcement and per client rate limiting.
+ * eBPF program is generated and loaded by the server itself (no compiler or libbpf
+ * needed) and attached to served interfaces, where it drops DHCP packets (IPv4 UDP
+ * to port 67) of denied or too chatty clients before the kernel allocates a socket
+ * buffer for them. Interfaces without driver support run it as generic XDP, e.g. veth.
+ *
+ * State lives in BPF maps owned by the server, keyed by client chaddr:
+ *  - acl:  entries of static ACL, program treats it as blacklist or whitelist like ACL_t
+ *  - dacl: clients denied by dynamic ACL
+ *  - rate: token bucket of every client, stored as theoretical arrival time of the
+ *          next packet (GCRA). LRU map, so forgotten clients make room for new ones
+ *  - stats: number of dropped packets, indexed by enum xdp_filter_drop
+ *
+ * Checks done by the program are repeated by the server in user space, so failure
+ * to load or attach it is not fatal.
+ */
+
+#define XDP_FILTER_MAX_ACL_ENTRIES      65536
+#define XDP_FILTER_MAX_CLIENTS          16384   // clients tracked by rate limiter
+#define XDP_FILTER_MAX_LINKS            16
+
+enum xdp_filter_drop {
+    XDP_FILTER_DROP_ACL = 0,
+    XDP_FILTER_DROP_DACL,
+    XDP_FILTER_DROP_RATE,
+    XDP_FILTER_DROP_COUNT,
+};
+
+typedef struct xdp_filter {
+    int prog_fd;
+    int acl_fd;
+    int dacl_fd;
+    int rate_fd;
+    int stats_fd;
+
+    int link_fds[XDP_FILTER_MAX_LINKS];  // program stays attached while its link is open
+    uint32_t link_count;
+
+    uint32_t rate;                      // packets per second per client, 0 if not limited
+    uint32_t burst;                     // packets a client can send at once
+} xdp_filter_t;
+
+/*
+ * Create maps and load program. ACL mode (disabled, blacklist or whitelist) is compiled
+ * into the program, acl can be NULL. rate is limit in packets per second of every client
+ * (0 disables rate limiting), burst number of packets allowed at once.
+ * Returns NULL on failure
+ */
+xdp_filter_t *xdp_filter_new(const ACL_t *acl, uint32_t rate, uint32_t burst);
+
+/* Attach program to interface. Returns 0 on success, -1 on failure */
+int xdp_filter_attach(xdp_filter_t *xdp, const char *interface);
+
+/* Replace content of acl map with entries of acl. Returns 0 on success, -1 on failure */
+int xdp_filter_sync_acl(xdp_filter_t *xdp, const ACL_t *acl);
+
+/* Add client to dacl map. Returns 0 on success, -1 on failure */
+int xdp_filter_deny(xdp_filter_t *xdp, const uint8_t chaddr[6]);
+
+/* Read drop counters into drops. Returns 0 on success, -1 on failure */
+int xdp_filter_stats(xdp_filter_t *xdp, uint64_t drops[XDP_FILTER_DROP_COUNT]);
+
+/* Detach program from every interface, free maps and program, set the pointer to NULL */
+void xdp_filter_destroy(xdp_filter_t **xdp);
+
+#endif // !__XDP_FILTER_H__
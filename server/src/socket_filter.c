@@ -0,0 +1,98 @@
+#include "socket_filter.h"
+#include "logging.h"
+#include "RFC/RFC-2131.h"
+#include "utils/llist.h"
+#include "utils/xtoy.h"
+#include <cclog_macros.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#define OFF(field) (SOCKET_FILTER_UDP_HLEN + (field))
+
+/* Offsets of fields inside BOOTP header */
+#define BOOTP_OPCODE    0
+#define BOOTP_CHADDR    28
+#define BOOTP_COOKIE    236
+
+#define ACCEPT 0xffffffff
+#define REJECT 0
+
+int socket_filter_build(const ACL_t *acl, struct sock_filter *code, uint32_t size)
+{
+        if (!code || size < SOCKET_FILTER_HEADER_INSNS + 1)
+                return -1;
+
+        struct sock_filter header[SOCKET_FILTER_HEADER_INSNS] = {
+                BPF_STMT(BPF_LD  | BPF_W   | BPF_LEN, 0),                        /* A = lenght */
+                BPF_JUMP(BPF_JMP | BPF_JGE | BPF_K, SOCKET_FILTER_MIN_LENGHT, 1, 0),
+                BPF_STMT(BPF_RET | BPF_K, REJECT),
+                BPF_JUMP(BPF_JMP | BPF_JGT | BPF_K, SOCKET_FILTER_MAX_LENGHT, 0, 1),
+                BPF_STMT(BPF_RET | BPF_K, REJECT),
+                BPF_STMT(BPF_LD  | BPF_B   | BPF_ABS, OFF(BOOTP_OPCODE)),       /* A = op */
+                BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, BOOTREQUEST, 1, 0),
+                BPF_STMT(BPF_RET | BPF_K, REJECT),
+                BPF_STMT(BPF_LD  | BPF_W   | BPF_ABS, OFF(BOOTP_COOKIE)),       /* A = magic cookie */
+                BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, MAGIC_COOKIE, 1, 0),
+                BPF_STMT(BPF_RET | BPF_K, REJECT),
+                BPF_STMT(BPF_LD  | BPF_W   | BPF_ABS, OFF(BOOTP_CHADDR)),       /* M[0] = chaddr[0..3] */
+                BPF_STMT(BPF_ST, 0),
+                BPF_STMT(BPF_LD  | BPF_H   | BPF_ABS, OFF(BOOTP_CHADDR + 4)),   /* M[1] = chaddr[4..5] */
+                BPF_STMT(BPF_ST, 1),
+        };
+        uint32_t n = SOCKET_FILTER_HEADER_INSNS;
+        memcpy(code, header, sizeof(header));
+
+        /* Whitelist cannot be enforced partially, so only blacklisted clients are rejected in kernel */
+        if (acl && acl->enabled && acl->is_blacklist && acl->entries) {
+                uint8_t mac[6];
+                uint32_t hi, lo;
+
+                llist_foreach(acl->entries, {
+                        if (n + SOCKET_FILTER_ACL_ENTRY_INSNS + 1 > size) {
+                                cclog(LOG_INFO, NULL, "Socket filter is full, remaining ACL entries "
+                                                "are checked by the server");
+                                break;
+                        }
+
+                        mac_to_uint8_array((const char*)node->data, mac);
+                        hi = ((uint32_t)mac[0] << 24) | ((uint32_t)mac[1] << 16) |
+                             ((uint32_t)mac[2] << 8) | mac[3];
+                        lo = ((uint32_t)mac[4] << 8) | mac[5];
+
+                        code[n++] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_MEM, 0);
+                        code[n++] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, hi, 0, 3);
+                        code[n++] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_MEM, 1);
+                        code[n++] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, lo, 0, 1);
+                        code[n++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, REJECT);
+                });
+        }
+
+        code[n++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, ACCEPT);
+
+        return n;
+}
+
+int socket_filter_attach(int fd, const ACL_t *acl)
+{
+        int rv = -1;
+        struct sock_filter *code = calloc(BPF_MAXINSNS, sizeof(struct sock_filter));
+        if_null_log(code, exit, LOG_ERROR, NULL, "Failed to allocate socket filter");
+
+        int len = socket_filter_build(acl, code, BPF_MAXINSNS);
+        if_failed_log_n(len, exit, LOG_ERROR, NULL, "Failed to build socket filter");
+
+        struct sock_fprog prog = {
+                .len = len,
+                .filter = code,
+        };
+
+        if_failed_log(setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog)), exit,
+                        LOG_WARN, NULL, "Failed to attach socket filter: %s", strerror(errno));
+
+        rv = 0;
+exit:
+        free(code);
+        return rv;
+}
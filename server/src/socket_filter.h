@@ -0,0 +1,33 @@
+#ifndef __SOCKET_FILTER_H__
+#define __SOCKET_FILTER_H__
+
+#include "security/acl.h"
+#include <linux/filter.h>
+#include <stdint.h>
+
+/*
+ * Classic BPF program attached to server sockets (SO_ATTACH_FILTER), so packets the
+ * server would drop anyway never leave the kernel. Program accepts only BOOTREQUEST
+ * packets with valid magic cookie and sane lenght. If ACL is an enabled blacklist,
+ * clients on it are rejected too (up to SOCKET_FILTER_MAX_ACL_ENTRIES of them, the rest
+ * is still checked by the server). Socket filter sees UDP header at offset 0.
+ */
+
+#define SOCKET_FILTER_UDP_HLEN          8
+#define SOCKET_FILTER_MIN_LENGHT        (SOCKET_FILTER_UDP_HLEN + 240)  // BOOTP header and magic cookie
+#define SOCKET_FILTER_MAX_LENGHT        1480                            // ethernet MTU without IPv4 header
+#define SOCKET_FILTER_HEADER_INSNS      15
+#define SOCKET_FILTER_ACL_ENTRY_INSNS   5
+#define SOCKET_FILTER_MAX_ACL_ENTRIES   ((BPF_MAXINSNS - SOCKET_FILTER_HEADER_INSNS - 1) / \
+                                         SOCKET_FILTER_ACL_ENTRY_INSNS)
+
+/*
+ * Build filter program into code of size instructions, acl can be NULL.
+ * Returns number of instructions of the program, -1 on failure
+ */
+int socket_filter_build(const ACL_t *acl, struct sock_filter *code, uint32_t size);
+
+/* Build filter program and attach it to socket fd, replacing previous one. Returns 0 on success */
+int socket_filter_attach(int fd, const ACL_t *acl);
+
+#endif // !__SOCKET_FILTER_H__
@@ -3,22 +3,120 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 
-struct timer *timer_new(enum timer_type type, uint32_t dtime, bool is_running, timer_cb_t cb)
+/* Seconds of monotonic clock, unlike time() it doesnt jump when system time is changed */
+static uint32_t timer_monotonic_time()
+{
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec;
+}
+
+/* Number of wheel ticks in seconds, timer expires after at least one tick */
+static uint64_t timer_wheel_ticks(timer_wheel_t *wheel, uint32_t seconds)
+{
+        uint64_t ticks = ((uint64_t)seconds * 1000 + wheel->resolution - 1) / wheel->resolution;
+
+        return ticks ? ticks : 1;
+}
+
+/* Put timer to slot according to its expiration, timer must not be in any slot */
+static void timer_wheel_place(timer_wheel_t *wheel, struct timer *t)
+{
+        uint64_t expire = t->_expire;
+        uint64_t delta = (expire > wheel->now) ? expire - wheel->now : 0;
+        int level = 0;
+
+        /* Timers beyond range of the wheel wait in the furthest slot and are cascaded again */
+        if (delta >= 1ULL << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS))
+                expire = wheel->now + (1ULL << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS)) - 1;
+        while (level < TIMER_WHEEL_LEVELS - 1 && delta >= 1ULL << (TIMER_WHEEL_BITS * (level + 1)))
+                level++;
+
+        struct timer **slot = &wheel->slots[level][(expire >> (TIMER_WHEEL_BITS * level)) & (TIMER_WHEEL_SLOTS - 1)];
+
+        t->_slot = slot;
+        t->_prev = NULL;
+        t->_next = *slot;
+        if (*slot)
+                (*slot)->_prev = t;
+        *slot = t;
+}
+
+static void timer_wheel_unlink(struct timer *t)
+{
+        if (t->_prev)
+                t->_prev->_next = t->_next;
+        else
+                *t->_slot = t->_next;
+        if (t->_next)
+                t->_next->_prev = t->_prev;
+
+        t->_slot = NULL;
+        t->_next = t->_prev = NULL;
+}
+
+/* Schedule timer to expire after seconds */
+static void timer_wheel_schedule(struct timer *t, uint32_t seconds)
+{
+        timer_wheel_t *wheel = t->_wheel;
+
+        if (t->_slot)
+                timer_wheel_unlink(t);
+        else
+                wheel->count++;
+
+        t->_expire = wheel->now + timer_wheel_ticks(wheel, seconds);
+        timer_wheel_place(wheel, t);
+}
+
+static void timer_wheel_cancel(struct timer *t)
+{
+        if (!t->_slot)
+                return;
+
+        timer_wheel_t *wheel = t->_wheel;
+        uint64_t remaining = (t->_expire > wheel->now) ? t->_expire - wheel->now : 0;
+
+        /* Keep rtime if no tick elapsed, so it isnt rounded up by every start and stop */
+        if (remaining < timer_wheel_ticks(wheel, t->rtime))
+                t->rtime = (remaining * wheel->resolution + 999) / 1000;
+        timer_wheel_unlink(t);
+        wheel->count--;
+}
+
+int timer_init(struct timer *t, enum timer_type type, uint32_t dtime, bool is_running, timer_cb_t cb)
 {
+        if (!t)
+                return -1;
+
         if_null_log_ng(cb, LOG_WARN, NULL, "Initialising a timer without callback. "
                         "This is valid operation, make sure it is also a desired one");
 
-        struct timer *t = malloc( sizeof(struct timer));       
-        if_null_log(t, error, LOG_ERROR, NULL, "Failed to allocate space for timer");
-
         t->type = type;
         t->dtime = dtime;
         t->rtime = dtime;
         t->is_running = is_running;
-        t->_ltime = time(NULL);
+        t->_ltime = timer_monotonic_time();
         t->cb = cb;
+        t->_wheel = NULL;
+        t->_slot = NULL;
+        t->_next = t->_prev = NULL;
+        t->_expire = 0;
+        t->_priv = NULL;
+
+        return 0;
+}
+
+struct timer *timer_new(enum timer_type type, uint32_t dtime, bool is_running, timer_cb_t cb)
+{
+        struct timer *t = malloc( sizeof(struct timer));       
+        if_null_log(t, error, LOG_ERROR, NULL, "Failed to allocate space for timer");
+
+        timer_init(t, type, dtime, is_running, cb);
 
         return t;
 error:
@@ -34,9 +132,12 @@ int timer_update(struct timer *t, void *priv)
         if_false(t->is_running, exit);
 
         rv = TIMER_NOCB;
+        /* Timers attached to wheel are updated by the wheel */
+        if (t->_wheel)
+                goto exit;
 
         /* Calculate time difference for the timer */
-        uint32_t current_time = time(NULL);
+        uint32_t current_time = timer_monotonic_time();
         uint32_t time_difference = current_time - t->_ltime;
         /* If no time difference, no need to update */
         if_false(time_difference, exit);
@@ -52,7 +153,7 @@ int timer_update(struct timer *t, void *priv)
                 rv = TIMER_ERROR;
                 if_null_log(t->cb, exit, LOG_WARN, NULL, "Timer expired but callback is null!");
 
-                rv = t->cb(current_time, priv);
+                rv = t->cb(time(NULL), priv);
         } else {
                 /* Update the remaining time */
                 t->rtime -= time_difference;
@@ -69,7 +170,9 @@ int timer_start(struct timer *t)
                 return -1;
 
         t->is_running = true;
-        t->_ltime = time(NULL);
+        t->_ltime = timer_monotonic_time();
+        if (t->_wheel)
+                timer_wheel_schedule(t, t->rtime);
         return 0;
 }
 
@@ -79,6 +182,8 @@ int timer_stop(struct timer *t)
                 return -1;
 
         t->is_running = false;
+        if (t->_wheel)
+                timer_wheel_cancel(t);
         return 0;
 }
 
@@ -88,11 +193,22 @@ int timer_reset(struct timer *t)
                 return -1;
 
         t->is_running = true;
-        t->_ltime = time(NULL);
+        t->_ltime = timer_monotonic_time();
         t->rtime = t->dtime;
+        if (t->_wheel)
+                timer_wheel_schedule(t, t->rtime);
 
         return 0;
- 
+}
+
+void timer_detach(struct timer *t)
+{
+        if (!t || !t->_wheel)
+                return;
+
+        timer_wheel_cancel(t);
+        t->_wheel = NULL;
+        t->_priv = NULL;
 }
 
 void timer_destroy(struct timer **t)
@@ -100,7 +216,123 @@ void timer_destroy(struct timer **t)
         if (!t || !*t)
                 return;
 
+        timer_detach(*t);
+
         free(*t);
         *t = NULL;
 }
 
+timer_wheel_t *timer_wheel_new(uint32_t resolution)
+{
+        if_false_log(resolution, error, LOG_ERROR, NULL, "Timing wheel resolution cannot be 0");
+
+        timer_wheel_t *wheel = calloc(1, sizeof(timer_wheel_t));
+        if_null_log(wheel, error, LOG_ERROR, NULL, "Failed to allocate space for timing wheel");
+
+        wheel->resolution = resolution;
+
+        return wheel;
+error:
+        return NULL;
+}
+
+int timer_wheel_attach(timer_wheel_t *wheel, struct timer *t, void *priv)
+{
+        if (!wheel || !t)
+                return -1;
+
+        if (t->_wheel)
+                timer_wheel_cancel(t);
+
+        t->_wheel = wheel;
+        t->_priv = priv;
+        if (t->is_running)
+                timer_wheel_schedule(t, t->rtime);
+
+        return 0;
+}
+
+/* Move timers of slot to lower levels */
+static void timer_wheel_cascade(timer_wheel_t *wheel, int level)
+{
+        int index = (wheel->now >> (TIMER_WHEEL_BITS * level)) & (TIMER_WHEEL_SLOTS - 1);
+        struct timer *t = wheel->slots[level][index];
+        struct timer *next;
+
+        /* Timer beyond range of wheel can be placed to the same slot again, so slot is detached first */
+        wheel->slots[level][index] = NULL;
+        for (; t; t = next) {
+                next = t->_next;
+                timer_wheel_place(wheel, t);
+                wheel->stats.cascaded++;
+        }
+
+        if (index == 0 && level < TIMER_WHEEL_LEVELS - 1)
+                timer_wheel_cascade(wheel, level + 1);
+}
+
+int timer_wheel_advance(timer_wheel_t *wheel, uint64_t ticks)
+{
+        if (!wheel)
+                return -1;
+
+        int expired = 0;
+        struct timer *t;
+        struct timer **slot;
+
+        for (; ticks > 0; ticks--) {
+                /* Nothing can expire, skip the remaining ticks */
+                if (!wheel->count) {
+                        wheel->now += ticks;
+                        break;
+                }
+
+                wheel->now++;
+                if ((wheel->now & (TIMER_WHEEL_SLOTS - 1)) == 0)
+                        timer_wheel_cascade(wheel, 1);
+
+                /* 
+                 * Callback can stop or start other timers including the ones in this slot, 
+                 * so timers are taken one by one. Restarted timers never land in this slot
+                 */
+                slot = &wheel->slots[0][wheel->now & (TIMER_WHEEL_SLOTS - 1)];
+                while ((t = *slot)) {
+                        timer_wheel_unlink(t);
+                        wheel->count--;
+                        wheel->stats.expired++;
+                        expired++;
+
+                        t->rtime = t->dtime;
+                        t->is_running = (t->type == TIMER_REPEAT) ? true : false;
+                        if (t->is_running)
+                                timer_wheel_schedule(t, t->dtime);
+
+                        if (t->cb)
+                                t->cb(time(NULL), t->_priv);
+                        else
+                                cclog(LOG_WARN, NULL, "Timer expired but callback is null!");
+                }
+        }
+
+        return expired;
+}
+
+void timer_wheel_destroy(timer_wheel_t **wheel)
+{
+        if (!wheel || !*wheel)
+                return;
+
+        struct timer *t;
+        for (int level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+                for (int i = 0; i < TIMER_WHEEL_SLOTS; i++) {
+                        while ((t = (*wheel)->slots[level][i])) {
+                                timer_wheel_unlink(t);
+                                t->_wheel = NULL;
+                        }
+                }
+        }
+
+        free(*wheel);
+        *wheel = NULL;
+}
+
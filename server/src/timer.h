@@ -38,6 +38,10 @@ typedef int (*timer_cb_t)(uint32_t call_time, void *priv);
  *
  *  timer_cb_t *cb: pointer to a callback function the timer will call once it 
  *      reaches zero.
+ *
+ * Timer can be attached to a timing wheel (see timer_wheel_t). Such timer is not 
+ * updated by timer_update, the wheel calls its callback when it expires. rtime of 
+ * attached timer is only updated when the timer is stopped.
  */ 
 struct timer {
     enum timer_type type;
@@ -48,11 +52,50 @@ struct timer {
     uint32_t _ltime;
 
     timer_cb_t cb;
+
+    /* Timing wheel membership, should not be accessed from outside */
+    struct timer_wheel *_wheel;     // wheel the timer is attached to, NULL if not attached
+    struct timer **_slot;           // wheel slot holding the timer, NULL if not scheduled
+    struct timer *_next;
+    struct timer *_prev;
+    uint64_t _expire;               // wheel tick at which the timer expires
+    void *_priv;                    // priv argument of callback
 };
 
+/* Timing wheel has 4 levels of 64 slots, covering 2^24 ticks. Later timers are cascaded again */
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_LEVELS 4
+
+/*
+ * Hierarchical timing wheel. Scheduling and cancelling timer is O(1), advancing 
+ * the wheel costs one step per tick plus work proportional to expiring timers, 
+ * regardless of the number of scheduled timers. Level 0 slots hold timers expiring 
+ * in the next 64 ticks, every higher level covers 64 times longer period and its 
+ * slots are cascaded to lower levels when the wheel reaches them.
+ *
+ * The wheel has no clock of its own, it is advanced by number of elapsed ticks of 
+ * resolution miliseconds (e.g. expirations read from a timerfd), so wall clock 
+ * changes dont fire or delay timers.
+ */
+typedef struct timer_wheel {
+    uint64_t now;                   // number of ticks the wheel was advanced by
+    uint32_t resolution;            // length of one tick in miliseconds
+    uint32_t count;                 // number of scheduled timers
+    struct timer *slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+
+    struct {
+        uint64_t expired;           // number of expired timers
+        uint64_t cascaded;          // number of timers moved to lower level
+    } stats;
+} timer_wheel_t;
+
 /* Allocates new timer */
 struct timer *timer_new(enum timer_type type, uint32_t dtime, bool is_running, timer_cb_t cb);
 
+/* Same as timer_new, but initialises timer embedded in another structure. Returns 0 on success */
+int timer_init(struct timer *t, enum timer_type type, uint32_t dtime, bool is_running, timer_cb_t cb);
+
 /* 
  * Function will update the timer according to the time it has stored in its 
  * _ltime variable. If the rtime will be <= 0 after update, the timer cb will be 
@@ -80,8 +123,32 @@ int timer_stop(struct timer *t);
  */
 int timer_reset(struct timer *t);
 
-/* Destroys the allocated timer structure */
+/* Removes timer from wheel it is attached to, has to be called before embedded timer is freed */
+void timer_detach(struct timer *t);
+
+/* Destroys the allocated timer structure, timer attached to wheel is removed from it */
 void timer_destroy(struct timer **t);
 
+/* Allocates new timing wheel with tick of resolution miliseconds */
+timer_wheel_t *timer_wheel_new(uint32_t resolution);
+
+/* 
+ * Attach timer to wheel, priv is passed to its callback when it expires. 
+ * If the timer is running, it is scheduled to expire after rtime seconds 
+ */
+int timer_wheel_attach(timer_wheel_t *wheel, struct timer *t, void *priv);
+
+/* 
+ * Advance wheel by ticks and call callbacks of expired timers. Callbacks are 
+ * called with current wall clock time as call_time. Returns number of expired timers
+ */
+int timer_wheel_advance(timer_wheel_t *wheel, uint64_t ticks);
+
+/* 
+ * Destroys the wheel. Scheduled timers are detached, timers which are attached 
+ * but not running must be destroyed before the wheel 
+ */
+void timer_wheel_destroy(timer_wheel_t **wheel);
+
 #endif // !__TIMER_H__
 
@@ -1,39 +1,46 @@
 #include "transaction.h"
 #include "RFC/RFC-2131.h"
 #include "allocator.h"
+#include "lease.h"
 #include "logging.h"
 #include "timer.h"
-#include "timer_args.h"
+#include "dhcp_server.h"
 #include "transaction_cache.h"
-#include "utils/llist.h"
+#include "message_slab.h"
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 
+/* On timeout, function expires transaction, see trans_expire */
+static int trans_timer_cb_clear(uint32_t time, void *priv)
+{
+        return trans_expire((transaction_t*)priv);
+}
+
 /*
- * On timeout, function clears transaction. 
  * In case a dhcpoffer message was sent during the transaction, but no requests,
  * e.g. clients didnt take the offer, returns the offered address back to 
- * address pool
+ * address pool. Address offered from existing lease of the client stays allocated
  */
-static int trans_timer_cb_clear(uint32_t time, void *priv)
+int trans_expire(transaction_t *trans)
 {
         int rv = -1;
 
-        if_null(priv, exit);
-        trans_update_args_t *args = (trans_update_args_t*)priv;
-        if_null(args, exit);
-        transaction_t *trans = args->server->trans_cache->transactions[args->index];
-        if_null(args, exit);
+        if_null(trans, exit);
 
         dhcp_message_t *offer = trans_search_for(trans, DHCP_OFFER);
         /* Check if transaction has offer that wasnt accepted (acknowledged) */
-        if (offer && !trans_search_for(trans, DHCP_ACK)) {
-                allocator_release_address(args->server->allocator, offer->yiaddr);
+        if (trans->server && offer && !trans_search_for(trans, DHCP_ACK)) {
+                lease_t lease;
+                if (lease_find_address(&lease, dhcp_message_yiaddr(offer)) != LEASE_OK)
+                        allocator_release_address(trans->server->allocator, dhcp_message_yiaddr(offer));
         }
 
-        trans_clear(trans);
+        if (trans->cache)
+                trans_cache_release(trans->cache, trans);
+        else
+                trans_clear(trans);
 
         rv = 0;
 exit:
@@ -45,25 +52,38 @@ transaction_t *trans_new(uint32_t time)
         transaction_t *t = calloc(1, sizeof(transaction_t));
         if_null(t, error);
         
-        t->messages_ll = llist_new();
-        if_null(t, error);
-        t->timer = timer_new(TIMER_ONCE, time, false, trans_timer_cb_clear);
-        if_null(t->timer, error);
-
-        trans_clear(t);
+        if_failed_n(trans_init(t, time), error);
 
         return t;
 error:
+        free(t);
         return NULL;
 }
 
+int trans_init(transaction_t *transaction, uint32_t time)
+{
+        if (!transaction)
+                return -1;
+
+        memset(transaction, 0, sizeof(transaction_t));
+        return timer_init(&transaction->timer, TIMER_ONCE, time, false, trans_timer_cb_clear);
+}
+
+void trans_uninit(transaction_t *transaction)
+{
+        if (!transaction)
+                return;
+
+        trans_clear(transaction);
+        timer_detach(&transaction->timer);
+}
+
 void trans_destroy(transaction_t **transaction)
 {
         if (!transaction || ! (*transaction))
                 return;
 
-        llist_destroy(&((*transaction)->messages_ll));
-        timer_destroy(&((*transaction)->timer));
+        trans_uninit(*transaction);
 
         free(*transaction);
         *transaction = NULL;
@@ -71,22 +91,24 @@ void trans_destroy(transaction_t **transaction)
 
 void trans_clear(transaction_t *transaction)
 {
-        if (!transaction || !transaction->messages_ll)
+        if (!transaction)
                 return;
 
+        for (uint8_t i = 0; i < transaction->num_of_messages; i++)
+                dhcp_message_unref(&transaction->messages[i]);
+
         transaction->num_of_messages = 0;
         transaction->transaction_begin = 0;
         transaction->xid = 0;
-        llist_clear(&(*transaction->messages_ll));
 
         /* Reset and stop the timer if it is running */
-        if (transaction->timer->is_running) {
-                timer_reset(transaction->timer);
-                timer_stop(transaction->timer);
+        if (transaction->timer.is_running) {
+                timer_reset(&transaction->timer);
+                timer_stop(&transaction->timer);
         }
 }
 
-int trans_add(transaction_t *transaction, const dhcp_message_t *message)
+int trans_add(transaction_t *transaction, dhcp_message_t *message)
 {
         if (!transaction || !message)
                 return -1;
@@ -98,23 +120,19 @@ int trans_add(transaction_t *transaction, const dhcp_message_t *message)
                         "Cannot add to transaction, xid mismatch");
         }
 
-        dhcp_message_t *message_copy = malloc(sizeof(dhcp_message_t));
-        if_null_log(message_copy, exit, LOG_ERROR, NULL, "Cannot allocated dhcp_message_t");
-
-        memcpy(message_copy, message, sizeof(dhcp_message_t));
+        if_true_log((transaction->num_of_messages == TRANS_MAX_MESSAGES), exit, LOG_WARN, NULL,
+                        "Cannot add to transaction %x, too many messages", message->xid);
 
         if (transaction->num_of_messages == 0) {
                 transaction->xid = message->xid;
                 transaction->transaction_begin = time(NULL);
         }
 
-        if_failed_log(llist_append(transaction->messages_ll, message_copy, true), exit, LOG_ERROR,
-                        NULL, "Failed to append message to transaction");
-        transaction->num_of_messages += 1;
+        transaction->messages[transaction->num_of_messages++] = dhcp_message_ref(message);
 
         /* When we add first message, start transaction timer */
         if (transaction->num_of_messages == 1) 
-                timer_start(transaction->timer);
+                timer_start(&transaction->timer);
 
         rv = 0;
 exit:
@@ -123,67 +141,43 @@ exit:
 
 dhcp_message_t *trans_get_index(transaction_t *transaction, uint8_t index)
 {
-        if (!transaction)
-                goto error;
-
-        llnode_t *node = llist_get_index(transaction->messages_ll, index);
-        if_null(node, error);
+        if (!transaction || index >= transaction->num_of_messages)
+                return NULL;
 
-        return (dhcp_message_t*)node->data;
-error:
-        return NULL;
+        return transaction->messages[index];
 }
 
 dhcp_message_t *trans_search_for(transaction_t *transaction, enum dhcp_message_type type)
 {
         if (!transaction)
-                goto error;
+                return NULL;
 
-        dhcp_message_t *message = NULL;
-        llist_foreach(transaction->messages_ll, {
-                message = (dhcp_message_t*)node->data;
-
-                if (message->type == type)
-                        return message;
-        })
+        for (uint8_t i = 0; i < transaction->num_of_messages; i++) {
+                if (transaction->messages[i]->type == type)
+                        return transaction->messages[i];
+        }
 
-error:
         return NULL;
 }
 
 dhcp_message_t *trans_search_for_last(transaction_t *transaction, enum dhcp_message_type type)
 {
         if (!transaction)
-                goto error;
-
-        /* Because of implementation of llist, we cannot itterate from the back. 
-         * So we need to track the last message that is equal to the type we 
-         * desire and always update it when newer message is encountered
-         */
-        dhcp_message_t *message = NULL;
-        dhcp_message_t *last = NULL;
-
-        llist_foreach(transaction->messages_ll, {
-                message = (dhcp_message_t*)node->data;
+                return NULL;
 
-                if (message->type == type)
-                        last = message;
-        })
+        for (uint8_t i = transaction->num_of_messages; i > 0; i--) {
+                if (transaction->messages[i - 1]->type == type)
+                        return transaction->messages[i - 1];
+        }
 
-        return last;
-error:
         return NULL;
 }
 
-int trans_update_timer(void *a)
+int trans_schedule_on(transaction_t *transaction, timer_wheel_t *wheel, struct dhcp_server *server)
 {
-        if (!a)
+        if (!transaction)
                 return -1;
 
-        trans_update_args_t *args = (trans_update_args_t*)a;
-
-        transaction_t *t = args->server->trans_cache->transactions[args->index];
-
-        return timer_update(t->timer, args);
+        transaction->server = server;
+        return timer_wheel_attach(wheel, &transaction->timer, transaction);
 }
-
@@ -2,30 +2,50 @@
 #define __TRANSACTION_H__
 
 #include "RFC/RFC-2131.h"
-#include "utils/llist.h"
 #include "dhcp_packet.h"
 #include "timer.h"
 #include <stdint.h>
 
+/* Maximum number of messages in one transaction, e.g. DORA with retransmissions */
+#define TRANS_MAX_MESSAGES 16
+
 typedef struct transaction {
     uint32_t transaction_begin;
     uint32_t xid;
     uint8_t num_of_messages;
-    llist_t *messages_ll;
-    struct timer *timer;
+    /* References to messages in order in which they were added */
+    dhcp_message_t *messages[TRANS_MAX_MESSAGES];
+    struct timer timer;
+    struct dhcp_server *server;     // server owning the cache, offered addresses are returned to its allocator
+
+    /* Membership in transaction cache, see transaction_cache.h */
+    struct transaction_cache *cache; // cache holding the transaction, NULL if allocated by trans_new()
+    uint32_t slot;                  // slot number in cache
+    bool finished;                  // server acknowledged or refused the client
+    struct transaction *older;      // neighbours in list of pending or finished transactions
+    struct transaction *newer;
 } transaction_t;
 
 /* Allocate space for a new transaction */
 transaction_t *trans_new(uint32_t time);
 
+/* Initialise transaction embedded in another structure, e.g. slot of transaction cache */
+int trans_init(transaction_t *transaction, uint32_t time);
+
+/* Clear transaction initialised by trans_init and detach its timer, does NOT free from memory */
+void trans_uninit(transaction_t *transaction);
+
 /* Free transaction from memory */
 void trans_destroy(transaction_t **transaction);
 
-/* Clears data from transaction, does NOT free from memory */
+/* Clears data from transaction and drops its message references, does NOT free from memory */
 void trans_clear(transaction_t *transaction);
 
-/* Add message to transaction, */
-int trans_add(transaction_t *transaction, const dhcp_message_t *message);
+/* 
+ * Add message to transaction. Message is not copied, transaction takes reference 
+ * to it (see message_slab.h), so it must not be modified afterwards
+ */
+int trans_add(transaction_t *transaction, dhcp_message_t *message);
 
 /* Retrieve a message with specific index. 
  * Example, if the transaction has DORA messages.
@@ -41,10 +61,17 @@ dhcp_message_t *trans_search_for(transaction_t *transaction, enum dhcp_message_t
 dhcp_message_t *trans_search_for_last(transaction_t *transaction, enum dhcp_message_type type);
 
 /*
- * The pointer MUST point to trans_update_args_t. Reason for void* is infringement 
- * of C syntax rules and recursive includes 
+ * Release address offered in transaction if the client did not get acknowledged 
+ * and clear the transaction (returning its slot to cache). Called when transaction 
+ * timer expires or transaction is evicted from cache
+ */
+int trans_expire(transaction_t *transaction);
+
+/* 
+ * Attach transaction timer to wheel, transaction is cleared by the wheel once 
+ * it expires. Server can be NULL, then offered addresses are not released 
  */
-int trans_update_timer(void *transaction);
+int trans_schedule_on(transaction_t *transaction, timer_wheel_t *wheel, struct dhcp_server *server);
 
 #endif // !__TRANSACTION_H__
 
@@ -2,42 +2,298 @@
 #include "logging.h"
 #include "transaction.h"
 #include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 #include <time.h>
 
-transaction_cache_t *trans_cache_new(int size, uint32_t time)
+static uint32_t cache_hash(const transaction_cache_t *cache, uint32_t xid)
 {
-        transaction_cache_t *cache = calloc(1, sizeof(transaction_cache_t));
-        if_null_log(cache, error, LOG_ERROR, NULL, "Failed to allocate transaction cache");
+        /* Fibonacci hashing, upper bits of product depend on all bits of xid */
+        return (uint32_t)(xid * 2654435769U) >> (32 - cache->index_bits);
+}
+
+/* Returns position of xid in index, or of the empty entry where it would be inserted */
+static uint32_t cache_index_find(const transaction_cache_t *cache, uint32_t xid)
+{
+        uint32_t mask = (1U << cache->index_bits) - 1;
+        uint32_t pos = cache_hash(cache, xid);
+
+        while (cache->index[pos] && trans_cache_slot(cache, cache->index[pos] - 1)->xid != xid)
+                pos = (pos + 1) & mask;
+
+        return pos;
+}
+
+/* Remove entry on pos, following entries of its probe sequence are shifted back */
+static void cache_index_remove(transaction_cache_t *cache, uint32_t pos)
+{
+        uint32_t mask = (1U << cache->index_bits) - 1;
+        uint32_t next = pos;
+
+        for (;;) {
+                cache->index[pos] = 0;
+                for (;;) {
+                        next = (next + 1) & mask;
+                        if (!cache->index[next])
+                                return;
+
+                        /* Entry can fill the hole only if its home is not in (pos, next] */
+                        uint32_t home = cache_hash(cache, trans_cache_slot(cache, cache->index[next] - 1)->xid);
+                        if (((next - home) & mask) >= ((next - pos) & mask))
+                                break;
+                }
+                cache->index[pos] = cache->index[next];
+                pos = next;
+        }
+}
+
+static uint32_t client_hash(const transaction_cache_t *cache, const uint8_t *chaddr)
+{
+        uint64_t key = 0;
+        memcpy(&key, chaddr, 6);
+        return (uint32_t)((key * 11400714819323198485ULL) >> (64 - cache->index_bits));
+}
+
+/* Returns position of client in client index, or of the empty entry where it would be inserted */
+static uint32_t cache_client_find(const transaction_cache_t *cache, const uint8_t *chaddr)
+{
+        uint32_t mask = (1U << cache->index_bits) - 1;
+        uint32_t pos = client_hash(cache, chaddr);
+
+        while (cache->clients[pos].count && memcmp(cache->clients[pos].chaddr, chaddr, 6) != 0)
+                pos = (pos + 1) & mask;
+
+        return pos;
+}
+
+static void cache_client_add(transaction_cache_t *cache, const uint8_t *chaddr)
+{
+        struct trans_cache_client *c = &cache->clients[cache_client_find(cache, chaddr)];
+
+        if (!c->count)
+                memcpy(c->chaddr, chaddr, 6);
+        c->count++;
+}
+
+/* Decrement transactions of client, entry without transactions is removed like in cache_index_remove */
+static void cache_client_remove(transaction_cache_t *cache, const uint8_t *chaddr)
+{
+        uint32_t mask = (1U << cache->index_bits) - 1;
+        uint32_t pos = cache_client_find(cache, chaddr);
+        uint32_t next = pos;
+
+        if (!cache->clients[pos].count || --cache->clients[pos].count)
+                return;
 
-        cache->size = size;
-        cache->transactions = malloc(sizeof(transaction_t*) * cache->size);
-        if_null_log(cache->transactions, error, LOG_ERROR, NULL, "Failed to allocate transaction cache");
+        for (;;) {
+                for (;;) {
+                        next = (next + 1) & mask;
+                        if (!cache->clients[next].count)
+                                return;
+
+                        uint32_t home = client_hash(cache, cache->clients[next].chaddr);
+                        if (((next - home) & mask) >= ((next - pos) & mask))
+                                break;
+                }
+                cache->clients[pos] = cache->clients[next];
+                cache->clients[next].count = 0;
+                pos = next;
+        }
+}
+
+/* 
+ * Allocate xid and client index of at least twice the size entries and insert running 
+ * transactions into them. Clients are never more than transactions, so neither gets full
+ */
+static int cache_index_build(transaction_cache_t *cache)
+{
+        uint32_t bits = 1;
+        while ((1U << bits) < 2 * cache->size)
+                bits++;
+
+        uint32_t *index = calloc(1U << bits, sizeof(uint32_t));
+        struct trans_cache_client *clients = calloc(1U << bits, sizeof(struct trans_cache_client));
+        if (!index || !clients) {
+                cclog(LOG_ERROR, NULL, "Failed to allocate transaction cache index");
+                free(index);
+                free(clients);
+                return -1;
+        }
+
+        free(cache->index);
+        free(cache->clients);
+        cache->index = index;
+        cache->clients = clients;
+        cache->index_bits = bits;
 
         for (uint32_t i = 0; i < cache->size; i++) {
-                cache->transactions[i] = trans_new(time);
-                if_null_log(cache->transactions[i], error, LOG_ERROR, NULL, 
-                        "Failed to allocate transaction %u/%u in cache", i, cache->size);
+                transaction_t *t = trans_cache_slot(cache, i);
+                if (!t->num_of_messages)
+                        continue;
+
+                cache->index[cache_index_find(cache, t->xid)] = i + 1;
+                cache_client_add(cache, trans_get_index(t, 0)->chaddr);
         }
 
+        return 0;
+}
+
+static void cache_list_append(transaction_cache_t *cache, transaction_t *t)
+{
+        struct trans_cache_list *list = t->finished ? &cache->finished : &cache->pending;
+
+        t->older = list->newest;
+        t->newer = NULL;
+        if (list->newest)
+                list->newest->newer = t;
+        else
+                list->oldest = t;
+        list->newest = t;
+}
+
+static void cache_list_remove(transaction_cache_t *cache, transaction_t *t)
+{
+        struct trans_cache_list *list = t->finished ? &cache->finished : &cache->pending;
+
+        if (t->older)
+                t->older->newer = t->newer;
+        else
+                list->oldest = t->newer;
+
+        if (t->newer)
+                t->newer->older = t->older;
+        else
+                list->newest = t->older;
+
+        t->older = t->newer = NULL;
+}
+
+/* Initialise slots from..to and put them on free stack, from is on top */
+static void cache_init_slots(transaction_cache_t *cache, uint32_t from, uint32_t to)
+{
+        for (uint32_t i = to; i > from; i--) {
+                transaction_t *t = trans_cache_slot(cache, i - 1);
+                trans_init(t, cache->duration);
+                t->cache = cache;
+                t->slot = i - 1;
+                if (cache->wheel)
+                        trans_schedule_on(t, cache->wheel, cache->server);
+                cache->free_slots[cache->free_count++] = i - 1;
+        }
+}
+
+/* Add chunk of slots. Returns 0 on success, -1 if cache cannot grow */
+static int cache_grow(transaction_cache_t *cache)
+{
+        uint32_t last = cache->chunk_count - 1;
+        uint32_t full = (last == 0) ? cache->min_size : cache->min_size << last;
+
+        /* Next chunk starts where the last one would end if it were whole */
+        if (cache->size >= cache->max_size || cache->size != full ||
+            cache->chunk_count == TRANS_CACHE_MAX_CHUNKS)
+                return -1;
+
+        uint32_t slots = cache->size;
+        if (slots > cache->max_size - cache->size)
+                slots = cache->max_size - cache->size;
+
+        transaction_t *chunk = calloc(slots, sizeof(transaction_t));
+        uint32_t *free_slots = realloc(cache->free_slots, sizeof(uint32_t) * (cache->size + slots));
+        if (!chunk || !free_slots) {
+                cclog(LOG_ERROR, NULL, "Failed to grow transaction cache to %u slots", cache->size + slots);
+                free(chunk);
+                if (free_slots)
+                        cache->free_slots = free_slots;
+                return -1;
+        }
+        cache->free_slots = free_slots;
+
+        cache->chunks[cache->chunk_count] = chunk;
+        cache->chunk_used[cache->chunk_count] = 0;
+        cache->chunk_count++;
+        cache->size += slots;
+        cache_init_slots(cache, cache->size - slots, cache->size);
+
+        if (cache_index_build(cache) < 0) {
+                /* Old index stays, it is too small for new slots, so they are given back */
+                cache->free_count -= slots;
+                cache->size -= slots;
+                cache->chunk_count--;
+                for (uint32_t i = 0; i < slots; i++)
+                        trans_uninit(&chunk[i]);
+                free(chunk);
+                return -1;
+        }
+
+        cache->stats.grown++;
+        cclog(LOG_INFO, NULL, "Transaction cache grown to %u slots", cache->size);
+        return 0;
+}
+
+/* Expire the oldest pending transaction, or finished one if none is pending. Returns 0 on success */
+static int cache_evict(transaction_cache_t *cache)
+{
+        transaction_t *victim = cache->pending.oldest ? cache->pending.oldest : cache->finished.oldest;
+        if (!victim)
+                return -1;
+
+        cclog(LOG_INFO, NULL, "Transaction cache is full, evicting transaction %x", victim->xid);
+        cache->stats.evicted++;
+        return trans_expire(victim);
+}
+
+transaction_cache_t *trans_cache_new(int size, uint32_t time)
+{
+        transaction_cache_t *cache = NULL;
+        if_false_log((size > 0), error, LOG_ERROR, NULL, "Invalid transaction cache size %d", size);
+
+        cache = calloc(1, sizeof(transaction_cache_t));
+        if_null_log(cache, error, LOG_ERROR, NULL, "Failed to allocate transaction cache");
+
+        cache->size = cache->min_size = cache->max_size = size;
+        cache->duration = time;
+        cache->chunk_count = 1;
+        cache->chunks[0] = calloc(cache->size, sizeof(transaction_t));
+        cache->free_slots = malloc(sizeof(uint32_t) * cache->size);
+        if (!cache->chunks[0] || !cache->free_slots || cache_index_build(cache) < 0) {
+                cclog(LOG_ERROR, NULL, "Failed to allocate transaction cache");
+                goto error;
+        }
+
+        cache_init_slots(cache, 0, cache->size);
+
         cclog(LOG_MSG, NULL, "Initialised transaction cache of size %u", cache->size);
 
         return cache;
 error:
+        if (cache) {
+                free(cache->chunks[0]);
+                free(cache->index);
+                free(cache->clients);
+                free(cache->free_slots);
+        }
+        free(cache);
         return NULL;
 }
 
-static transaction_t* cache_get_next_transaction(transaction_cache_t *cache)
+void trans_cache_set_memory_limit(transaction_cache_t *cache, size_t bytes)
 {
         if (!cache)
-                goto error;
+                return;
 
-        for (int i = 0; i < cache->size; i++) {
-                if (!cache->transactions[i]->timer->is_running)
-                        return cache->transactions[i];
-        }
+        size_t slots = bytes / TRANS_CACHE_SLOT_BYTES;
+        cache->max_size = (slots > UINT32_MAX / 2) ? UINT32_MAX / 2 : slots;
+        if (cache->max_size < cache->min_size)
+                cache->max_size = cache->min_size;
+}
 
-error:
-        return NULL;
+size_t trans_cache_memory(const transaction_cache_t *cache)
+{
+        if (!cache)
+                return 0;
+
+        return (size_t)cache->size * (sizeof(transaction_t) + sizeof(uint32_t)) +
+               ((sizeof(uint32_t) + sizeof(struct trans_cache_client)) << cache->index_bits);
 }
 
 int trans_cache_add_message(transaction_cache_t *cache, dhcp_message_t *message)
@@ -46,45 +302,80 @@ int trans_cache_add_message(transaction_cache_t *cache, dhcp_message_t *message)
                 return -1;
 
         int rv = -1;
-        
+        transaction_t *transaction;
+        bool finished = (message->type == DHCP_ACK || message->type == DHCP_NAK);
+
         message->time = time(NULL);
-        transaction_t *transaction = trans_cache_retrieve_transaction(cache, message->xid);
-        if (!transaction) {
-                // No transaction, get next transaction
-                transaction = cache_get_next_transaction(cache);
-                if_null_log(transaction, exit, LOG_WARN, NULL, 
-                        "Out of space in transaction cache! Consider increasing cache space");
-                trans_clear(transaction);
-        } 
-        
-        rv = trans_add(transaction, message);
+        uint32_t pos = cache_index_find(cache, message->xid);
+        if (cache->index[pos]) {
+                transaction = trans_cache_slot(cache, cache->index[pos] - 1);
+                if_failed_n(trans_add(transaction, message), exit);
+
+                if (finished && !transaction->finished) {
+                        cache_list_remove(cache, transaction);
+                        transaction->finished = true;
+                        cache_list_append(cache, transaction);
+                }
+                rv = 0;
+                goto exit;
+        }
+
+        // No transaction, get next transaction
+        if (!cache->free_count && cache_grow(cache) < 0 && cache_evict(cache) < 0) {
+                cclog(LOG_WARN, NULL, "Out of space in transaction cache! Consider increasing cache space");
+                cache->stats.dropped++;
+                goto exit;
+        }
+
+        /* Growing and evicting changes the index */
+        pos = cache_index_find(cache, message->xid);
+        uint32_t slot = cache->free_slots[--cache->free_count];
+        transaction = trans_cache_slot(cache, slot);
+        if (trans_add(transaction, message) < 0) {
+                cache->free_slots[cache->free_count++] = slot;
+                goto exit;
+        }
+        cache->index[pos] = slot + 1;
+        cache_client_add(cache, message->chaddr);
+        cache->chunk_used[trans_cache_chunk_of(cache, slot)]++;
+        transaction->finished = finished;
+        cache_list_append(cache, transaction);
+
+        if (trans_cache_in_use(cache) > cache->stats.max_in_use)
+                cache->stats.max_in_use = trans_cache_in_use(cache);
+
+        rv = 0;
 exit:
         return rv;
 }
 
+uint32_t trans_cache_client_transactions(const transaction_cache_t *cache, const uint8_t *chaddr)
+{
+        if (!cache || !chaddr)
+                return 0;
+
+        return cache->clients[cache_client_find(cache, chaddr)].count;
+}
+
 /* Retrieve transaction with specified xid */
 transaction_t *trans_cache_retrieve_transaction(transaction_cache_t *cache, uint32_t xid)
 {
         if (!cache)
                 return NULL;
 
-        for (uint32_t i = 0; i < cache->size; i++) {
-                if (cache->transactions[i]->xid == xid)
-                        return cache->transactions[i];
-        }
-
-        return NULL;
+        uint32_t pos = cache_index_find(cache, xid);
+        return cache->index[pos] ? trans_cache_slot(cache, cache->index[pos] - 1) : NULL;
 }
 
 /* Retrieve first message of type from transaction in cache */
-dhcp_message_t *trans_cache_retrieve_message(transaction_cache_t *cache, 
+dhcp_message_t *trans_cache_retrieve_message(transaction_cache_t *cache,
         uint32_t xid, enum dhcp_message_type type)
 {
         return trans_search_for(trans_cache_retrieve_transaction(cache, xid), type);
 }
 
 /* Retrieve last message of type from transaction in cache */
-dhcp_message_t *trans_cache_retrieve_message_last(transaction_cache_t *cache, 
+dhcp_message_t *trans_cache_retrieve_message_last(transaction_cache_t *cache,
         uint32_t xid, enum dhcp_message_type type)
 {
         return trans_search_for_last(trans_cache_retrieve_transaction(cache, xid), type);
@@ -97,6 +388,58 @@ dhcp_message_t *trans_cache_retrieve_message_index(transaction_cache_t *cache, u
         return trans_get_index(trans_cache_retrieve_transaction(cache, xid), index);
 }
 
+void trans_cache_release(transaction_cache_t *cache, transaction_t *transaction)
+{
+        if (!cache || !transaction)
+                return;
+
+        uint32_t pos = cache_index_find(cache, transaction->xid);
+
+        /* Slot is on free stack already if transaction is not in index */
+        if (cache->index[pos] == transaction->slot + 1) {
+                cache_index_remove(cache, pos);
+                cache_client_remove(cache, trans_get_index(transaction, 0)->chaddr);
+                cache_list_remove(cache, transaction);
+                cache->chunk_used[trans_cache_chunk_of(cache, transaction->slot)]--;
+                cache->free_slots[cache->free_count++] = transaction->slot;
+        }
+
+        trans_clear(transaction);
+}
+
+int trans_cache_shrink(transaction_cache_t *cache)
+{
+        if (!cache || cache->chunk_count == 1)
+                return 0;
+
+        uint32_t last = cache->chunk_count - 1;
+        uint32_t start = cache->min_size << (last - 1);
+        if (cache->chunk_used[last] || trans_cache_in_use(cache) > start / 2)
+                return 0;
+
+        /* Only slots of the remaining chunks stay on free stack */
+        uint32_t count = 0;
+        for (uint32_t i = 0; i < cache->free_count; i++) {
+                if (cache->free_slots[i] < start)
+                        cache->free_slots[count++] = cache->free_slots[i];
+        }
+        cache->free_count = count;
+
+        for (uint32_t i = start; i < cache->size; i++)
+                trans_uninit(trans_cache_slot(cache, i));
+        free(cache->chunks[last]);
+        cache->chunks[last] = NULL;
+        cache->chunk_count--;
+        cache->size = start;
+
+        /* Smaller index is only an optimisation, the old one keeps working */
+        cache_index_build(cache);
+
+        cache->stats.shrunk++;
+        cclog(LOG_INFO, NULL, "Transaction cache shrunk to %u slots", cache->size);
+        return 1;
+}
+
 /* Clear all transactions from cache */
 int trans_cache_purge(transaction_cache_t *cache)
 {
@@ -104,7 +447,34 @@ int trans_cache_purge(transaction_cache_t *cache)
                 return -1;
 
         for (uint32_t i = 0; i < cache->size; i++) {
-                trans_clear(cache->transactions[i]);
+                transaction_t *t = trans_cache_slot(cache, i);
+                trans_clear(t);
+                t->finished = false;
+                t->older = t->newer = NULL;
+        }
+        memset(cache->index, 0, sizeof(uint32_t) << cache->index_bits);
+        memset(cache->clients, 0, sizeof(struct trans_cache_client) << cache->index_bits);
+        memset(cache->chunk_used, 0, sizeof(cache->chunk_used));
+        memset(&cache->pending, 0, sizeof(cache->pending));
+        memset(&cache->finished, 0, sizeof(cache->finished));
+
+        cache->free_count = 0;
+        for (uint32_t i = cache->size; i > 0; i--)
+                cache->free_slots[cache->free_count++] = i - 1;
+
+        return 0;
+}
+
+int trans_cache_schedule_on(transaction_cache_t *cache, timer_wheel_t *wheel, struct dhcp_server *server)
+{
+        if (!cache || !wheel)
+                return -1;
+
+        cache->wheel = wheel;
+        cache->server = server;
+        for (uint32_t i = 0; i < cache->size; i++) {
+                if (trans_schedule_on(trans_cache_slot(cache, i), wheel, server) < 0)
+                        return -1;
         }
 
         return 0;
@@ -115,8 +485,14 @@ void trans_cache_destroy(transaction_cache_t **cache)
         if (!cache || ! *cache)
                 return;
 
-        trans_cache_purge(*cache);
+        /* Transaction timers may be attached to wheel, so they are detached with the cache */
+        for (uint32_t i = 0; i < (*cache)->size; i++)
+                trans_uninit(trans_cache_slot(*cache, i));
+        for (uint32_t i = 0; i < (*cache)->chunk_count; i++)
+                free((*cache)->chunks[i]);
+        free((*cache)->index);
+        free((*cache)->clients);
+        free((*cache)->free_slots);
         free(*cache);
         *cache = NULL;
 }
-
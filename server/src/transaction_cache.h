@@ -4,32 +4,122 @@
 #include "RFC/RFC-2131.h"
 #include "dhcp_packet.h"
 #include "transaction.h"
+#include <stddef.h>
 #include <stdint.h>
 
 #define TRANSACTION_CACHE_DEFAULT_SIZE 15
+#define TRANS_CACHE_MAX_CHUNKS 32
 
 /*
  * Wrapper structure to hold transaction data.
- * The transaction cache is an array of transactions, preallocated 
- * during initialisation of server. It holds all currently active and 
- * past transaction up to <size> of transactions. 
- * _offset is used to tell which transaction is the newest, so that any new 
- * transactions will be stored after the newest one in case it is needed.
- * When _offset reaches size, it will overflow back to 0
+ * The transaction cache is an array of transaction slots, preallocated during 
+ * initialisation of server together with their timers. Running transactions are 
+ * found by xid in index, an open addressing hash table (linear probing) of slot 
+ * numbers, unused slots are kept on free stack. Looking up, starting and expiring 
+ * a transaction is O(1) regardless of cache size.
+ *
+ * Cache is elastic. When it is full, it grows up to max_size slots (see 
+ * trans_cache_set_memory_limit), then it evicts the oldest pending transaction 
+ * (e.g. DISCOVER with unanswered OFFER, whose address is returned to pool) or the 
+ * oldest finished one. Slots never move since timers of transactions are linked in 
+ * timing wheel, so the array is split to chunks. Chunk 0 holds min_size slots, every 
+ * next chunk as many as all chunks before it, so the cache doubles when it grows. 
+ * Last chunk is shorter if memory limit does not allow whole one. Idle cache gives 
+ * its chunks back, see trans_cache_shrink.
  */
+/* Entry of client index, number of running transactions of client with chaddr */
+struct trans_cache_client {
+    uint8_t chaddr[6];
+    uint32_t count;                 // 0 if entry is empty
+};
+
+/* Bytes taken by one slot: transaction, free stack entry and up to 4 entries of xid and client index */
+#define TRANS_CACHE_SLOT_BYTES \
+    (sizeof(transaction_t) + sizeof(uint32_t) + 4 * (sizeof(uint32_t) + sizeof(struct trans_cache_client)))
+
 typedef struct transaction_cache {
-    transaction_t **transactions;
-    uint32_t size;
+    transaction_t *chunks[TRANS_CACHE_MAX_CHUNKS];
+    uint32_t chunk_used[TRANS_CACHE_MAX_CHUNKS];    // number of running transactions in chunk
+    uint32_t chunk_count;
+    uint32_t size;                  // number of slots in all chunks
+    uint32_t min_size;              // slots allocated on initialisation, cache never shrinks below
+    uint32_t max_size;              // slots allowed by memory limit
+    uint32_t duration;              // lifetime of transactions in seconds
+
+    uint32_t *index;                // slot number + 1 of transaction with hashed xid, 0 if empty
+    uint32_t index_bits;            // index has 2^index_bits entries, at least twice the size
+    struct trans_cache_client *clients; // running transactions by chaddr of their first message, 2^index_bits entries
+
+    uint32_t *free_slots;           // stack of unused slots, slot 0 on top after initialisation
+    uint32_t free_count;
+
+    /* Running transactions from the oldest, finished ones were acknowledged or refused */
+    struct trans_cache_list {
+        transaction_t *oldest;
+        transaction_t *newest;
+    } pending, finished;
+
+    /* Timers of slots added by growing are attached to the wheel, see trans_cache_schedule_on */
+    timer_wheel_t *wheel;
+    struct dhcp_server *server;
+
+    struct {
+        uint32_t max_in_use;
+        uint64_t grown;             // number of chunks added
+        uint64_t shrunk;            // number of chunks freed
+        uint64_t evicted;           // transactions removed before they expired to make room
+        uint64_t dropped;           // messages not cached because there was no room
+    } stats;
 } transaction_cache_t;
 
+/* Returns chunk holding slot */
+static inline uint32_t trans_cache_chunk_of(const transaction_cache_t *cache, uint32_t slot)
+{
+        return (slot < cache->min_size) ? 0 : 32 - __builtin_clz(slot / cache->min_size);
+}
+
+/* Returns transaction in slot, slot must be lower than cache size */
+static inline transaction_t *trans_cache_slot(const transaction_cache_t *cache, uint32_t slot)
+{
+        uint32_t chunk = trans_cache_chunk_of(cache, slot);
+        if (chunk == 0)
+                return &cache->chunks[0][slot];
+
+        return &cache->chunks[chunk][slot - (cache->min_size << (chunk - 1))];
+}
+
+/* Returns number of running transactions */
+static inline uint32_t trans_cache_in_use(const transaction_cache_t *cache)
+{
+        return cache->size - cache->free_count;
+}
+
 /* 
- * Initialise a transaction_cache. The cache pointer MUST be NULL 
- * Returns 0 on success and -1 on failure
+ * Initialise a transaction_cache of size slots, transactions last time seconds.
+ * Cache does not grow until memory limit is set. Returns NULL on failure
  */
 transaction_cache_t *trans_cache_new(int size, uint32_t time);
 
+/* 
+ * Allow cache to grow while its slots, free stack and indexes take at most bytes. 
+ * Cache does not shrink below its initial size regardless of the limit
+ */
+void trans_cache_set_memory_limit(transaction_cache_t *cache, size_t bytes);
+
+/* Returns number of bytes taken by slots, free stack and indexes of cache */
+size_t trans_cache_memory(const transaction_cache_t *cache);
+
+/*
+ * Free the last chunk if no transaction runs in it and the cache would stay at most 
+ * half full. Called periodically, shrinks by one chunk. Returns 1 if chunk was freed
+ */
+int trans_cache_shrink(transaction_cache_t *cache);
+
 int trans_cache_add_message(transaction_cache_t *cache, dhcp_message_t *message);
 
+/* Returns number of running transactions of client with hardware address chaddr */
+uint32_t trans_cache_client_transactions(const transaction_cache_t *cache, const uint8_t *chaddr);
+
 /* Retrieve transaction with specified xid */
 transaction_t *trans_cache_retrieve_transaction(transaction_cache_t *cache, uint32_t xid);
 
@@ -45,6 +135,12 @@ dhcp_message_t *trans_cache_retrieve_message_last(transaction_cache_t *cache,
 dhcp_message_t *trans_cache_retrieve_message_index(transaction_cache_t *cache, uint32_t xid,
         uint32_t index);
 
+/* Clear transaction and return its slot to cache, called when transaction expires */
+void trans_cache_release(transaction_cache_t *cache, transaction_t *transaction);
+
+/* Attach timers of all transactions to wheel, see trans_schedule_on */
+int trans_cache_schedule_on(transaction_cache_t *cache, timer_wheel_t *wheel, struct dhcp_server *server);
+
 /* Remove all transactions from cache */
 int trans_cache_purge(transaction_cache_t *cache);
 
@@ -0,0 +1,506 @@
+#ifdef CONFIG_IO_URING
+
+#include "uring.h"
+#include "logging.h"
+#include <cclog_macros.h>
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define URING_MAX_SIZE 4096
+#define URING_BUF_GROUP 0
+
+/* user_data of completions, send slot is stored in the lower bits */
+#define URING_TAG_RECV (1ULL << 63)
+#define URING_TAG_SEND (1ULL << 62)
+#define URING_TAG_MASK (URING_TAG_RECV | URING_TAG_SEND)
+
+static int uring_setup(uint32_t entries, struct io_uring_params *p)
+{
+        return (int) syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int uring_enter(int fd, uint32_t to_submit, uint32_t min_complete, uint32_t flags)
+{
+        return (int) syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int uring_register(int fd, uint32_t opcode, void *arg, uint32_t nr_args)
+{
+        return (int) syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static uint32_t round_up_pow2(uint32_t n)
+{
+        uint32_t p = 1;
+        while (p < n)
+                p <<= 1;
+        return p;
+}
+
+static int uring_map_rings(uring_t *ring, struct io_uring_params *p)
+{
+        ring->sq_len = p->sq_off.array + p->sq_entries * sizeof(unsigned);
+        ring->cq_len = p->cq_off.cqes + p->cq_entries * sizeof(struct io_uring_cqe);
+        ring->sqes_len = p->sq_entries * sizeof(struct io_uring_sqe);
+
+        if (p->features & IORING_FEAT_SINGLE_MMAP) {
+                if (ring->cq_len > ring->sq_len)
+                        ring->sq_len = ring->cq_len;
+                ring->cq_len = ring->sq_len;
+        }
+
+        ring->sq_ptr = mmap(NULL, ring->sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        ring->ring_fd, IORING_OFF_SQ_RING);
+        if (ring->sq_ptr == MAP_FAILED) {
+                ring->sq_ptr = NULL;
+                return -1;
+        }
+
+        if (p->features & IORING_FEAT_SINGLE_MMAP) {
+                ring->cq_ptr = ring->sq_ptr;
+        } else {
+                ring->cq_ptr = mmap(NULL, ring->cq_len, PROT_READ | PROT_WRITE,
+                                MAP_SHARED | MAP_POPULATE, ring->ring_fd, IORING_OFF_CQ_RING);
+                if (ring->cq_ptr == MAP_FAILED) {
+                        ring->cq_ptr = NULL;
+                        return -1;
+                }
+        }
+
+        ring->sq.sqes = mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        ring->ring_fd, IORING_OFF_SQES);
+        if (ring->sq.sqes == MAP_FAILED) {
+                ring->sq.sqes = NULL;
+                return -1;
+        }
+
+        uint8_t *sq = ring->sq_ptr;
+        ring->sq.head = (unsigned*)(sq + p->sq_off.head);
+        ring->sq.tail = (unsigned*)(sq + p->sq_off.tail);
+        ring->sq.ring_mask = (unsigned*)(sq + p->sq_off.ring_mask);
+        ring->sq.ring_entries = (unsigned*)(sq + p->sq_off.ring_entries);
+        ring->sq.array = (unsigned*)(sq + p->sq_off.array);
+        ring->sq.local_tail = ring->sq.submitted = *ring->sq.tail;
+
+        uint8_t *cq = ring->cq_ptr;
+        ring->cq.head = (unsigned*)(cq + p->cq_off.head);
+        ring->cq.tail = (unsigned*)(cq + p->cq_off.tail);
+        ring->cq.ring_mask = (unsigned*)(cq + p->cq_off.ring_mask);
+        ring->cq.cqes = (struct io_uring_cqe*)(cq + p->cq_off.cqes);
+
+        return 0;
+}
+
+/* Publish prepared entries and pass them to kernel */
+static int uring_submit(uring_t *ring)
+{
+        uint32_t to_submit = ring->sq.local_tail - ring->sq.submitted;
+        if (to_submit == 0)
+                return 0;
+
+        __atomic_store_n(ring->sq.tail, ring->sq.local_tail, __ATOMIC_RELEASE);
+
+        int rv;
+        do {
+                rv = uring_enter(ring->ring_fd, to_submit, 0, 0);
+        } while (rv < 0 && errno == EINTR);
+
+        if_failed_log_n(rv, exit, LOG_ERROR, NULL, "Failed to submit io_uring operations: %s",
+                        strerror(errno));
+
+        ring->stats.submits++;
+        ring->sq.submitted += rv;
+        rv = 0;
+exit:
+        return rv;
+}
+
+static struct io_uring_sqe *uring_get_sqe(uring_t *ring)
+{
+        unsigned head = __atomic_load_n(ring->sq.head, __ATOMIC_ACQUIRE);
+
+        /* Submission queue is full, hand the prepared entries to kernel first */
+        if (ring->sq.local_tail - head >= *ring->sq.ring_entries) {
+                if (uring_submit(ring) < 0)
+                        return NULL;
+                head = __atomic_load_n(ring->sq.head, __ATOMIC_ACQUIRE);
+                if (ring->sq.local_tail - head >= *ring->sq.ring_entries)
+                        return NULL;
+        }
+
+        unsigned idx = ring->sq.local_tail & *ring->sq.ring_mask;
+        struct io_uring_sqe *sqe = &ring->sq.sqes[idx];
+        memset(sqe, 0, sizeof(struct io_uring_sqe));
+        ring->sq.array[idx] = idx;
+        ring->sq.local_tail++;
+
+        return sqe;
+}
+
+/* Give buffer bid back to kernel, visible after uring_publish_buffers */
+static void uring_provide_buffer(uring_t *ring, uint16_t bid)
+{
+        struct io_uring_buf *buf = &ring->buf_ring->bufs[ring->buf_tail & (ring->nbufs - 1)];
+        buf->addr = (uint64_t)(uintptr_t)ring->rx_messages[bid]->packet;
+        buf->len = sizeof(dhcp_packet_t);
+        buf->bid = bid;
+        ring->buf_tail++;
+}
+
+static void uring_publish_buffers(uring_t *ring)
+{
+        __atomic_store_n(&ring->buf_ring->tail, ring->buf_tail, __ATOMIC_RELEASE);
+}
+
+static int uring_arm_recv(uring_t *ring)
+{
+        struct io_uring_sqe *sqe = uring_get_sqe(ring);
+        if (!sqe)
+                return -1;
+
+        sqe->opcode = IORING_OP_RECV;
+        sqe->fd = ring->sock_fd;
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = URING_BUF_GROUP;
+        sqe->user_data = URING_TAG_RECV;
+
+        ring->recv_armed = true;
+        return 0;
+}
+
+uring_t *uring_new(int sock_fd, uint32_t size, message_slab_t *slab)
+{
+        uring_t *ring = NULL;
+        struct io_uring_params params = {0};
+
+        if (size == 0 || size > URING_MAX_SIZE) {
+                cclog(LOG_ERROR, NULL, "Invalid io_uring size %u (allowed 1 - %u)",
+                                size, URING_MAX_SIZE);
+                goto error;
+        }
+
+        ring = calloc(1, sizeof(uring_t));
+        if_null_log(ring, error, LOG_ERROR, NULL, "Failed to allocate io_uring");
+        ring->ring_fd = ring->event_fd = -1;
+        ring->sock_fd = sock_fd;
+        ring->slab = slab;
+
+        /* 
+         * Buffer ring must have power of 2 entries, one sqe per send slot and receive.
+         * Send slots cover replies of one dispatch and sends of previous one still in flight
+         */
+        ring->nbufs = round_up_pow2(size);
+        ring->tx_size = 2 * size;
+        ring->stash_size = ring->nbufs + 1;
+
+        ring->ring_fd = uring_setup(round_up_pow2(ring->tx_size + 1), &params);
+        if_failed_log_n(ring->ring_fd, error, LOG_WARN, NULL, "Failed to set up io_uring: %s",
+                        strerror(errno));
+        if_failed_log(uring_map_rings(ring, &params), error, LOG_ERROR, NULL,
+                        "Failed to map io_uring: %s", strerror(errno));
+
+        ring->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if_failed_log_n(ring->event_fd, error, LOG_ERROR, NULL, "Failed to create eventfd: %s",
+                        strerror(errno));
+        if_failed_log(uring_register(ring->ring_fd, IORING_REGISTER_EVENTFD, &ring->event_fd, 1),
+                        error, LOG_ERROR, NULL, "Failed to register io_uring eventfd: %s",
+                        strerror(errno));
+
+        ring->rx_messages = calloc(ring->nbufs, sizeof(dhcp_message_t*));
+        ring->stash = calloc(ring->stash_size, sizeof(struct io_uring_cqe));
+        ring->tx_free = calloc(ring->tx_size, sizeof(uint32_t));
+        ring->tx_packets = calloc(ring->tx_size, sizeof(dhcp_packet_t));
+        ring->tx_addr = calloc(ring->tx_size, sizeof(struct sockaddr_in));
+        ring->tx_msg = calloc(ring->tx_size, sizeof(struct msghdr));
+        ring->tx_iov = calloc(ring->tx_size, sizeof(struct iovec));
+        if (!ring->rx_messages || !ring->stash || !ring->tx_free || !ring->tx_packets ||
+            !ring->tx_addr || !ring->tx_msg || !ring->tx_iov) {
+                cclog(LOG_ERROR, NULL, "Failed to allocate io_uring buffers");
+                goto error;
+        }
+
+        for (uint32_t i = 0; i < ring->nbufs; i++) {
+                ring->rx_messages[i] = message_slab_alloc(slab);
+                if_null(ring->rx_messages[i], error);
+        }
+
+        /* Headers point to the same buffers for whole lifetime of ring */
+        for (uint32_t i = 0; i < ring->tx_size; i++) {
+                ring->tx_iov[i].iov_base = &ring->tx_packets[i];
+                ring->tx_msg[i].msg_iov = &ring->tx_iov[i];
+                ring->tx_msg[i].msg_iovlen = 1;
+                ring->tx_msg[i].msg_name = &ring->tx_addr[i];
+                ring->tx_msg[i].msg_namelen = sizeof(struct sockaddr_in);
+                ring->tx_free[i] = ring->tx_size - 1 - i;
+        }
+        ring->tx_free_count = ring->tx_size;
+
+        /* Register receive buffers as provided buffer ring */
+        ring->buf_ring_len = ring->nbufs * sizeof(struct io_uring_buf);
+        ring->buf_ring = mmap(NULL, ring->buf_ring_len, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (ring->buf_ring == MAP_FAILED) {
+                ring->buf_ring = NULL;
+                cclog(LOG_ERROR, NULL, "Failed to allocate io_uring buffer ring: %s", strerror(errno));
+                goto error;
+        }
+
+        struct io_uring_buf_reg reg = {
+                .ring_addr = (uint64_t)(uintptr_t)ring->buf_ring,
+                .ring_entries = ring->nbufs,
+                .bgid = URING_BUF_GROUP,
+        };
+        if_failed_log(uring_register(ring->ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1), error,
+                        LOG_WARN, NULL, "Failed to register io_uring buffer ring: %s",
+                        strerror(errno));
+
+        for (uint32_t i = 0; i < ring->nbufs; i++)
+                uring_provide_buffer(ring, i);
+        uring_publish_buffers(ring);
+
+        if_failed(uring_arm_recv(ring), error);
+        if_failed(uring_submit(ring), error);
+
+        cclog(LOG_MSG, NULL, "Initialised io_uring with %u receive buffers and %u send slots",
+                        ring->nbufs, ring->tx_size);
+
+        return ring;
+error:
+        uring_destroy(&ring);
+        return NULL;
+}
+
+/* Release send slot of completed send */
+static void uring_complete_send(uring_t *ring, const struct io_uring_cqe *cqe)
+{
+        if (cqe->res < 0) {
+                cclog(LOG_ERROR, NULL, "Failed to send dhcp packet: %s", strerror(-cqe->res));
+                ring->stats.tx_dropped++;
+        } else {
+                ring->stats.tx_packets++;
+        }
+        ring->tx_free[ring->tx_free_count++] = cqe->user_data & ~URING_TAG_MASK;
+}
+
+/* Handle one completion, returns 1 if a datagram was passed to cb */
+static int uring_complete(uring_t *ring, const struct io_uring_cqe *cqe, uring_rx_cb cb, void *priv)
+{
+        if (cqe->user_data & URING_TAG_SEND) {
+                uring_complete_send(ring, cqe);
+                return 0;
+        }
+
+        if (!(cqe->flags & IORING_CQE_F_MORE))
+                ring->recv_armed = false;
+
+        if (cqe->res < 0) {
+                if (cqe->res == -ENOBUFS)
+                        ring->stats.rx_nobufs++;
+                else
+                        cclog(LOG_WARN, NULL, "Failed to receive dhcp packet: %s",
+                                        strerror(-cqe->res));
+                return 0;
+        }
+
+        if (!(cqe->flags & IORING_CQE_F_BUFFER))
+                return 0;
+
+        uint16_t bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+        dhcp_message_t *message = ring->rx_messages[bid];
+        size_t len = cqe->res;
+
+        /* Short datagrams must not leave options of previous packet in the buffer */
+        message->packet_lenght = len;
+        if (len < sizeof(dhcp_packet_t))
+                memset((uint8_t*)message->packet + len, 0, sizeof(dhcp_packet_t) - len);
+
+        ring->stats.rx_packets++;
+        if (cb)
+                cb(priv, message, len);
+
+        /* Message kept by transaction must not be overwritten by kernel */
+        if (!dhcp_message_can_receive(message)) {
+                dhcp_message_t *fresh = message_slab_alloc(ring->slab);
+                if (!fresh) {
+                        /* Buffer stays out of the ring, receive continues with the rest */
+                        cclog(LOG_ERROR, NULL, "Failed to allocate message for io_uring buffer %u", bid);
+                        return 1;
+                }
+                dhcp_message_unref(&ring->rx_messages[bid]);
+                ring->rx_messages[bid] = fresh;
+        }
+
+        uring_provide_buffer(ring, bid);
+        return 1;
+}
+
+int uring_receive(uring_t *ring, uring_rx_cb cb, void *priv)
+{
+        if (!ring)
+                return -1;
+
+        int received = 0;
+
+        /* Sends queued since last call are submitted first, so their slots are reaped now */
+        if (uring_submit(ring) < 0)
+                return -1;
+
+        /* Slots cannot be reclaimed while completions are iterated, see uring_reclaim_slot */
+        ring->reaping = true;
+
+        /* Completions set aside by uring_reclaim_slot come before the ones still in queue */
+        for (uint32_t i = 0; i < ring->stash_count; i++)
+                received += uring_complete(ring, &ring->stash[i], cb, priv);
+        ring->stash_count = 0;
+
+        unsigned head = *ring->cq.head;
+        unsigned tail = __atomic_load_n(ring->cq.tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; head++)
+                received += uring_complete(ring, &ring->cq.cqes[head & *ring->cq.ring_mask], cb, priv);
+
+        __atomic_store_n(ring->cq.head, head, __ATOMIC_RELEASE);
+        ring->reaping = false;
+        uring_publish_buffers(ring);
+
+        if (!ring->recv_armed) {
+                ring->stats.rx_rearms++;
+                if_failed_log(uring_arm_recv(ring), exit, LOG_ERROR, NULL,
+                                "Failed to rearm io_uring receive");
+        }
+exit:
+        if (uring_flush(ring) < 0)
+                return -1;
+
+        return received;
+}
+
+/*
+ * Wait for at least one send completion so that a send slot is released. Completions
+ * of received datagrams are moved to stash, uring_receive handles them later in order.
+ * Must not be called while uring_receive iterates completions, their head is not
+ * stored yet
+ */
+static int uring_reclaim_slot(uring_t *ring)
+{
+        if (ring->reaping) {
+                cclog(LOG_WARN, NULL, "No free io_uring send slot");
+                return -1;
+        }
+
+        while (ring->tx_free_count == 0) {
+                if (uring_submit(ring) < 0)
+                        return -1;
+
+                int rv = uring_enter(ring->ring_fd, 0, 1, IORING_ENTER_GETEVENTS);
+                if (rv < 0 && errno != EINTR)
+                        return -1;
+
+                unsigned head = *ring->cq.head;
+                unsigned tail = __atomic_load_n(ring->cq.tail, __ATOMIC_ACQUIRE);
+                for (; head != tail; head++) {
+                        struct io_uring_cqe *cqe = &ring->cq.cqes[head & *ring->cq.ring_mask];
+                        if (cqe->user_data & URING_TAG_SEND) {
+                                uring_complete_send(ring, cqe);
+                                continue;
+                        }
+
+                        if (ring->stash_count == ring->stash_size)
+                                break;
+                        ring->stash[ring->stash_count++] = *cqe;
+                }
+                __atomic_store_n(ring->cq.head, head, __ATOMIC_RELEASE);
+
+                if (head != tail && ring->tx_free_count == 0) {
+                        cclog(LOG_WARN, NULL, "No free io_uring send slot");
+                        return -1;
+                }
+        }
+
+        return 0;
+}
+
+int uring_queue_send(uring_t *ring, const dhcp_packet_t *packet, size_t len,
+        const struct sockaddr_in *addr)
+{
+        if (!ring || !packet || !addr || len > sizeof(dhcp_packet_t))
+                return -1;
+
+        if (ring->tx_free_count == 0 && uring_reclaim_slot(ring) < 0) {
+                ring->stats.tx_dropped++;
+                return -1;
+        }
+
+        struct io_uring_sqe *sqe = uring_get_sqe(ring);
+        if (!sqe) {
+                ring->stats.tx_dropped++;
+                return -1;
+        }
+
+        uint32_t slot = ring->tx_free[--ring->tx_free_count];
+        memcpy(&ring->tx_packets[slot], packet, len);
+        memcpy(&ring->tx_addr[slot], addr, sizeof(struct sockaddr_in));
+        ring->tx_iov[slot].iov_len = len;
+
+        sqe->opcode = IORING_OP_SENDMSG;
+        sqe->fd = ring->sock_fd;
+        sqe->addr = (uint64_t)(uintptr_t)&ring->tx_msg[slot];
+        sqe->len = 1;
+        sqe->user_data = URING_TAG_SEND | slot;
+
+        return 0;
+}
+
+int uring_flush(uring_t *ring)
+{
+        if (!ring)
+                return -1;
+
+        return uring_submit(ring);
+}
+
+void uring_destroy(uring_t **ring)
+{
+        if (!ring || !*ring)
+                return;
+
+        uring_t *r = *ring;
+
+        /* Closing ring cancels pending operations, buffers are freed after that */
+        if (r->sq.sqes)
+                munmap(r->sq.sqes, r->sqes_len);
+        if (r->cq_ptr && r->cq_ptr != r->sq_ptr)
+                munmap(r->cq_ptr, r->cq_len);
+        if (r->sq_ptr)
+                munmap(r->sq_ptr, r->sq_len);
+        if (r->ring_fd >= 0)
+                close(r->ring_fd);
+        if (r->event_fd >= 0)
+                close(r->event_fd);
+        if (r->buf_ring)
+                munmap(r->buf_ring, r->buf_ring_len);
+
+        if (r->rx_messages) {
+                for (uint32_t i = 0; i < r->nbufs; i++) {
+                        dhcp_message_unref(&r->rx_messages[i]);
+                }
+        }
+
+        free(r->rx_messages);
+        free(r->stash);
+        free(r->tx_free);
+        free(r->tx_packets);
+        free(r->tx_addr);
+        free(r->tx_msg);
+        free(r->tx_iov);
+        free(r);
+        *ring = NULL;
+}
+
+#endif // CONFIG_IO_URING
@@ -0,0 +1,118 @@
+#ifndef __URING_H__
+#define __URING_H__
+
+#include "dhcp_packet.h"
+#include "message_slab.h"
+#include <netinet/in.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+/*
+ * io_uring backend for dhcp server socket. Compiled only with CONFIG_IO_URING
+ * (make IO_URING=y), uses raw io_uring syscalls so no additional library is needed.
+ *
+ * Datagrams are received by single multishot recv operation into provided buffer
+ * ring. Each buffer is packet of dhcp message from message slab, so the received 
+ * packet can be parsed without copying. Message still referenced after the callback 
+ * is replaced by a new one before its buffer is given back to kernel. Replies are copied into tx slots and submitted
+ * together by uring_flush with one io_uring_enter call. There are twice as many tx slots as
+ * receive buffers, so replies of one batch fit while the previous batch is still being sent.
+ * Completions are signalled on event_fd, which is waited on by server epoll loop.
+ */
+
+/* Callback for every received datagram. Message is valid only during the call */
+typedef void (*uring_rx_cb)(void *priv, dhcp_message_t *message, size_t len);
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+struct io_uring_buf_ring;
+
+typedef struct uring {
+    int ring_fd;
+    int event_fd;
+    int sock_fd;
+
+    struct {
+        unsigned *head;
+        unsigned *tail;
+        unsigned *ring_mask;
+        unsigned *ring_entries;
+        unsigned *array;
+        struct io_uring_sqe *sqes;
+        unsigned local_tail;        // tail of prepared entries, published on submit
+        unsigned submitted;         // tail already passed to kernel
+    } sq;
+
+    struct {
+        unsigned *head;
+        unsigned *tail;
+        unsigned *ring_mask;
+        struct io_uring_cqe *cqes;
+    } cq;
+
+    void *sq_ptr;
+    void *cq_ptr;
+    size_t sq_len;
+    size_t cq_len;
+    size_t sqes_len;
+
+    /* Provided buffer ring, buffer n is packet of rx_messages[n] */
+    struct io_uring_buf_ring *buf_ring;
+    size_t buf_ring_len;
+    uint32_t nbufs;
+    uint16_t buf_tail;
+    dhcp_message_t **rx_messages;
+    message_slab_t *slab;
+    bool recv_armed;
+
+    /* Receive completions reaped while waiting for a send slot, handled by uring_receive */
+    struct io_uring_cqe *stash;
+    uint32_t stash_size;
+    uint32_t stash_count;
+    bool reaping;               // uring_receive is iterating completions
+
+    /* Send slots, slot is free again when its completion is reaped */
+    uint32_t tx_size;
+    uint32_t tx_free_count;
+    uint32_t *tx_free;
+    dhcp_packet_t *tx_packets;
+    struct sockaddr_in *tx_addr;
+    struct msghdr *tx_msg;
+    struct iovec *tx_iov;
+
+    struct {
+        uint64_t rx_packets;
+        uint64_t rx_rearms;         // multishot recv had to be submitted again
+        uint64_t rx_nobufs;         // datagrams dropped because all buffers were in use
+        uint64_t tx_packets;
+        uint64_t tx_dropped;
+        uint64_t submits;           // number of io_uring_enter calls
+    } stats;
+} uring_t;
+
+/*
+ * Create ring for socket sock_fd with size receive buffers and 2 * size send slots.
+ * Receive buffers are messages from slab (can be NULL).
+ * Returns NULL if io_uring is not supported by kernel or on error
+ */
+uring_t *uring_new(int sock_fd, uint32_t size, message_slab_t *slab);
+
+/*
+ * Reap all completions, calls cb for every received datagram and rearms receive
+ * when needed. Returns number of received datagrams or -1 on error
+ */
+int uring_receive(uring_t *ring, uring_rx_cb cb, void *priv);
+
+/* Copy packet into send slot and prepare its submission. Returns 0 on success, -1 on failure */
+int uring_queue_send(uring_t *ring, const dhcp_packet_t *packet, size_t len,
+        const struct sockaddr_in *addr);
+
+/* Submit all prepared operations with a single syscall. Returns 0 on success, -1 on failure */
+int uring_flush(uring_t *ring);
+
+void uring_destroy(uring_t **ring);
+
+#endif // !__URING_H__
@@ -43,9 +43,8 @@ void llist_clear(llist_t *list);
  * llnode_t *node is type and identificator of the variable to work with 
  */
 #define llist_foreach(LLIST, CODE){\
-    size_t _i;                                                                                     \
     llnode_t *node;                                                                                \
-    for (_i = 0, node = llist_get_index(LLIST, 0); node; node = llist_get_index(LLIST, ++_i)) {    \
+    for (node = llist_get_index(LLIST, 0); node; node = node->next) {                              \
         CODE                                                                                       \
     }}
 
@@ -3,10 +3,9 @@
 #include <stdio.h>
 #include <string.h>
 
-const char* uint32_to_ipv4_address(uint32_t a)
+char *uint32_to_ipv4_address_r(uint32_t a, char *buf, size_t len)
 {
-        static char buf[16];
-        snprintf(buf, 16, "%u.%u.%u.%u",
+        snprintf(buf, len, "%u.%u.%u.%u",
                         (a >> 24) & 0xff,
                         (a >> 16) &0xff,
                         (a >> 8) & 0xff,
@@ -14,6 +13,12 @@ const char* uint32_to_ipv4_address(uint32_t a)
         return buf;
 }
 
+const char* uint32_to_ipv4_address(uint32_t a)
+{
+        static __thread char buf[IPV4_ADDRESS_STRLEN];
+        return uint32_to_ipv4_address_r(a, buf, IPV4_ADDRESS_STRLEN);
+}
+
 uint32_t ipv4_address_to_uint32(const char *s)
 {
         uint32_t a, b, c, d;
@@ -23,18 +28,22 @@ uint32_t ipv4_address_to_uint32(const char *s)
         return (a << 24) | (b << 16) | (c << 8) | d;
 }
 
-const char *uint8_array_to_mac(uint8_t mac[])
+char *uint8_array_to_mac_r(const uint8_t mac[], char *buf, size_t len)
 {
-        static char buf[18];
-        snprintf(buf, 18, "%02x:%02x:%02x:%02x:%02x:%02x", 
+        snprintf(buf, len, "%02x:%02x:%02x:%02x:%02x:%02x", 
                         mac[0],mac[1],mac[2],mac[3],mac[4],mac[5]);
 
         return buf;
 }
 
+const char *uint8_array_to_mac(uint8_t mac[])
+{
+        static __thread char buf[MAC_ADDRESS_STRLEN];
+        return uint8_array_to_mac_r(mac, buf, MAC_ADDRESS_STRLEN);
+}
+
 void mac_to_uint8_array(const char *mac, uint8_t array[])
 {
         sscanf(mac, "%02hhx:%02hhx:%02hhx:%02hhx:%02hhx:%02hhx",
                 &array[0], &array[1], &array[2], &array[3], &array[4], &array[5]);
 }
-
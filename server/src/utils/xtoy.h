@@ -1,21 +1,33 @@
 #ifndef __XTOY_H__
 #define __XTOY_H__
 
+#include <stddef.h>
 #include <stdint.h>
 
+/* Buffer sizes needed by reentrant conversion functions, including terminating null byte */
+#define IPV4_ADDRESS_STRLEN 16
+#define MAC_ADDRESS_STRLEN 18
+
 /**
  * Convert uint32_t to string representation of ipv4 address.
- * Uses static buffer, therefore if you need to use the value, use strdup()
+ * Uses thread local buffer, therefore if you need to use the value, use strdup()
  * or make sure you are not using this function before using the value.
+ * When more than one address is needed at once, use uint32_to_ipv4_address_r
  */
 const char* uint32_to_ipv4_address(uint32_t a);
 
+/* Reentrant version of uint32_to_ipv4_address, stores result in buf and returns it */
+char *uint32_to_ipv4_address_r(uint32_t a, char *buf, size_t len);
+
 uint32_t ipv4_address_to_uint32(const char *s);
 
 /* Convert uint8 array of size 6 to string mac and vice versa */
 void mac_to_uint8_array(const char *mac, uint8_t array[]);
 
+/* Uses thread local buffer, same rules as for uint32_to_ipv4_address apply */
 const char *uint8_array_to_mac(uint8_t mac[]);
 
-#endif // !__XTOY_H__
+/* Reentrant version of uint8_array_to_mac, stores result in buf and returns it */
+char *uint8_array_to_mac_r(const uint8_t mac[], char *buf, size_t len);
 
+#endif // !__XTOY_H__
@@ -5,8 +5,10 @@
 #include <address_pool.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <utils/xtoy.h>
 #include <RFC/RFC-2132.h>
+#include <pthread.h>
 
 static address_allocator_t *a;
 
@@ -294,6 +296,43 @@ TEST test_get_pool_by_address()
         PASS();
 }
 
+TEST test_allocator_request_address_on_interface()
+{
+        address_allocator_t *allocator = address_allocator_new();
+        ASSERT_NEQ(allocator, NULL);
+
+        address_pool_t *eth0 = address_pool_new_str("eth0_pool", "10.0.0.1", "10.0.0.2", "255.255.255.0");
+        address_pool_t *eth1 = address_pool_new_str("eth1_pool", "10.0.1.1", "10.0.1.2", "255.255.255.0");
+        ASSERT_NEQ(eth0, NULL);
+        ASSERT_NEQ(eth1, NULL);
+        eth0->interface = strdup("eth0");
+        eth1->interface = strdup("eth1");
+        ASSERT_EQ(ALLOCATOR_OK, allocator_add_pool(allocator, eth0));
+        ASSERT_EQ(ALLOCATOR_OK, allocator_add_pool(allocator, eth1));
+
+        ASSERT(address_pool_is_served_on(eth0, "eth0"));
+        ASSERT_FALSE(address_pool_is_served_on(eth0, "eth1"));
+        ASSERT(address_pool_is_served_on(eth0, NULL));
+
+        /* Pools of other interfaces are never used, even if pool of interface is depleted */
+        uint32_t addr = 0;
+        ASSERT_EQ(ALLOCATOR_OK, allocator_request_address_on_interface(allocator, "eth1", NULL, &addr));
+        ASSERT_EQ(ipv4_address_to_uint32("10.0.1.1"), addr);
+        ASSERT_EQ(ALLOCATOR_OK, allocator_request_address_on_interface(allocator, "eth1", NULL, &addr));
+        ASSERT_EQ(ipv4_address_to_uint32("10.0.1.2"), addr);
+        ASSERT_EQ(ALLOCATOR_POOL_DEPLETED, allocator_request_address_on_interface(allocator, "eth1", NULL, &addr));
+        ASSERT_EQ(ALLOCATOR_POOL_DEPLETED, allocator_request_address_on_interface(allocator, "eth2", NULL, &addr));
+
+        /* Pool without interface is offered everywhere */
+        address_pool_t *any = address_pool_new_str("any_pool", "10.0.2.1", "10.0.2.2", "255.255.255.0");
+        ASSERT_EQ(ALLOCATOR_OK, allocator_add_pool(allocator, any));
+        ASSERT_EQ(ALLOCATOR_OK, allocator_request_address_on_interface(allocator, "eth2", NULL, &addr));
+        ASSERT_EQ(ipv4_address_to_uint32("10.0.2.1"), addr);
+
+        allocator_destroy(&allocator);
+        PASS();
+}
+
 TEST test_allocaotr_address_pool_not_starting_with_8_multiplicier_address()
 {
         address_allocator_t *allocator = address_allocator_new();
@@ -317,6 +356,110 @@ TEST test_allocaotr_address_pool_not_starting_with_8_multiplicier_address()
         PASS();
 }
 
+#define CONCURRENT_THREADS 4
+#define CONCURRENT_REQUESTS 50
+
+struct concurrent_request_args {
+        address_allocator_t *allocator;
+        uint32_t results[CONCURRENT_REQUESTS];
+};
+
+static void *concurrent_request_thread(void *priv)
+{
+        struct concurrent_request_args *args = (struct concurrent_request_args*)priv;
+
+        for (int i = 0; i < CONCURRENT_REQUESTS; i++) {
+                if (allocator_request_any_address(args->allocator, &args->results[i]) != ALLOCATOR_OK)
+                        args->results[i] = 0;
+        }
+
+        return NULL;
+}
+
+TEST test_allocator_concurrent_requests()
+{
+        address_allocator_t *allocator = address_allocator_new();
+        ASSERT_NEQ(allocator, NULL);
+        ASSERT_EQ(ALLOCATOR_OK, allocator_add_pool(allocator, address_pool_new_str("pool", "192.168.50.1", "192.168.50.253", "255.255.255.0")));
+
+        static struct concurrent_request_args args[CONCURRENT_THREADS];
+        pthread_t threads[CONCURRENT_THREADS];
+
+        for (int i = 0; i < CONCURRENT_THREADS; i++) {
+                args[i].allocator = allocator;
+                ASSERT_EQ(0, pthread_create(&threads[i], NULL, concurrent_request_thread, &args[i]));
+        }
+        for (int i = 0; i < CONCURRENT_THREADS; i++)
+                pthread_join(threads[i], NULL);
+
+        /* Every request must have received different address */
+        for (int t1 = 0; t1 < CONCURRENT_THREADS; t1++) {
+                for (int i = 0; i < CONCURRENT_REQUESTS; i++) {
+                        ASSERT_NEQ(0, args[t1].results[i]);
+                        for (int t2 = t1; t2 < CONCURRENT_THREADS; t2++) {
+                                for (int j = (t1 == t2) ? i + 1 : 0; j < CONCURRENT_REQUESTS; j++)
+                                        ASSERT_NEQ(args[t1].results[i], args[t2].results[j]);
+                        }
+                }
+        }
+
+        address_pool_t *p = allocator_get_pool_by_name(allocator, "pool");
+        ASSERT_EQ(253 - CONCURRENT_THREADS * CONCURRENT_REQUESTS, p->available_addresses);
+
+        allocator_destroy(&allocator);
+        PASS();
+}
+
+TEST test_get_pool_with_many_and_overlapping_pools()
+{
+        address_allocator_t *allocator = address_allocator_new();
+        ASSERT_NEQ(allocator, NULL);
+
+        /* Pools 10.0.<i>.10 - 10.0.<i>.100 are added in reverse order */
+        char name[32];
+        char start[32];
+        char end[32];
+        for (int i = 255; i >= 0; i--) {
+                snprintf(name, sizeof(name), "pool%d", i);
+                snprintf(start, sizeof(start), "10.0.%d.10", i);
+                snprintf(end, sizeof(end), "10.0.%d.100", i);
+                ASSERT_EQ(ALLOCATOR_OK, allocator_add_pool(allocator, address_pool_new_str(name, start, end, "255.255.0.0")));
+        }
+        ASSERT_EQ(256, allocator->pool_count);
+        ASSERT_EQ(256, allocator->pool_range_count);
+
+        for (int i = 0; i < 256; i++) {
+                snprintf(name, sizeof(name), "pool%d", i);
+                address_pool_t *p = allocator_get_pool_by_name(allocator, name);
+                ASSERT_NEQ(NULL, p);
+                ASSERT_STR_EQ(name, p->name);
+                ASSERT_EQ(p, allocator_get_pool_by_address(allocator, p->start_address));
+                ASSERT_EQ(p, allocator_get_pool_by_address(allocator, p->end_address));
+                ASSERT_EQ(NULL, allocator_get_pool_by_address(allocator, p->start_address - 1));
+                ASSERT_EQ(NULL, allocator_get_pool_by_address(allocator, p->end_address + 1));
+        }
+        ASSERT_EQ(NULL, allocator_get_pool_by_name(allocator, "pool256"));
+
+        /* Addresses already served by another pool stay with it */
+        ASSERT_EQ(ALLOCATOR_OK, allocator_add_pool(allocator, 
+                                address_pool_new_str("wide", "10.0.1.50", "10.0.3.50", "255.255.0.0")));
+        address_pool_t *wide = allocator_get_pool_by_name(allocator, "wide");
+        ASSERT_NEQ(NULL, wide);
+        ASSERT_EQ(allocator_get_pool_by_name(allocator, "pool1"), 
+                  allocator_get_pool_by_address(allocator, ipv4_address_to_uint32("10.0.1.50")));
+        ASSERT_EQ(wide, allocator_get_pool_by_address(allocator, ipv4_address_to_uint32("10.0.1.101")));
+        ASSERT_EQ(wide, allocator_get_pool_by_address(allocator, ipv4_address_to_uint32("10.0.2.9")));
+        ASSERT_EQ(allocator_get_pool_by_name(allocator, "pool2"), 
+                  allocator_get_pool_by_address(allocator, ipv4_address_to_uint32("10.0.2.10")));
+        ASSERT_EQ(wide, allocator_get_pool_by_address(allocator, ipv4_address_to_uint32("10.0.3.9")));
+        ASSERT_EQ(allocator_get_pool_by_name(allocator, "pool3"), 
+                  allocator_get_pool_by_address(allocator, ipv4_address_to_uint32("10.0.3.50")));
+        ASSERT_EQ(NULL, allocator_get_pool_by_address(allocator, ipv4_address_to_uint32("10.0.4.9")));
+
+        allocator_destroy(&allocator);
+        PASS();
+}
+
 SUITE(allocator)
 {
         a = address_allocator_new();
@@ -346,7 +489,10 @@ SUITE(allocator)
         RUN_TEST(test_release_address_not_in_use);
         RUN_TEST(test_get_pool_by_name);
         RUN_TEST(test_get_pool_by_address);
+        RUN_TEST(test_get_pool_with_many_and_overlapping_pools);
+        RUN_TEST(test_allocator_request_address_on_interface);
         RUN_TEST(test_allocaotr_address_pool_not_starting_with_8_multiplicier_address);
+        RUN_TEST(test_allocator_concurrent_requests);
 
         if (a)
                 allocator_destroy(&a);
@@ -81,9 +81,11 @@ TEST test_config_parse_valid_arguments()
                 "--transaction-duration", "32",
                 "--lease-expiration-check", "50",
                 "--log", "3",
+                "--batch-size", "64",
                 "--pool", "192.168.0.5:192.168.0.10:255.255.255.0",
                 "--option", "12:5:Hello",
                 "--db-disable",
+                "--unicast-enable",
                 NULL // Null-terminate the array
         };
 
@@ -93,7 +95,9 @@ TEST test_config_parse_valid_arguments()
         ASSERT_EQ(32, server.config.trans_duration);
         ASSERT_EQ(50, server.config.lease_expiration_check);
         ASSERT_EQ(3,  server.config.log_verbosity);
+        ASSERT_EQ(64, server.config.batch_size);
         ASSERT_EQ(false, server.config.db_enable);
+        ASSERT_EQ(true, server.config.unicast_enable);
         address_pool_t *pool = allocator_get_pool_by_name(server.allocator, "pool");
         ASSERT_NEQ(NULL, pool);
         ASSERT_EQ(ipv4_address_to_uint32("192.168.0.5"), pool->start_address);
@@ -260,6 +264,41 @@ TEST test_config_interface_in_cli_arguments()
         PASS();
 }
 
+TEST test_config_multiple_interfaces()
+{
+        dhcp_server_t server = {0};
+        ASSERT_EQ(0, init_allocator(&server));
+
+        reset_getopt();
+        char *arguments[] = {
+                "./dhcps",
+                "--interface", "lo",
+                NULL // Null-terminate the array
+        };
+        strcpy(server.config.config_path, "./test/config_sample_interfaces.json");
+
+        ASSERT_EQ(0 , config_parse_arguments(&server, ARGC, arguments));
+        ASSERT_EQ(0, config_load_configuration(&server));
+
+        /* Duplicates, primary interface and invalid names are skipped */
+        ASSERT_EQ(2, server.config.interface_count);
+        ASSERT_STR_EQ("eth1", server.config.interfaces[0]);
+        ASSERT_STR_EQ("eth2", server.config.interfaces[1]);
+
+        address_pool_t *pool = allocator_get_pool_by_name(server.allocator, "eth1_pool");
+        ASSERT_NEQ(NULL, pool);
+        ASSERT_STR_EQ("eth1", pool->interface);
+        ASSERT(address_pool_is_served_on(pool, "eth1"));
+        ASSERT_FALSE(address_pool_is_served_on(pool, "lo"));
+
+        pool = allocator_get_pool_by_name(server.allocator, "any_pool");
+        ASSERT_NEQ(NULL, pool);
+        ASSERT_EQ(NULL, pool->interface);
+        ASSERT(address_pool_is_served_on(pool, "eth2"));
+
+        PASS();
+}
+
 TEST test_config_default_configuration_only_flag()
 {
         dhcp_server_t server = {0};
@@ -300,6 +339,8 @@ TEST test_config_default_configuration()
         ASSERT_EQ(CONFIG_DEFAULT_CACHE_SIZE, server.config.cache_size);
         ASSERT_EQ(CONFIG_DEFAULT_TRANS_DURATION, server.config.trans_duration);
         ASSERT_EQ(CONFIG_DEFAULT_LOG_VERBOSITY, server.config.log_verbosity);
+        ASSERT_EQ(CONFIG_DEFAULT_BATCH_SIZE, server.config.batch_size);
+        ASSERT_EQ(CONFIG_DEFAULT_UNICAST_ENABLE, server.config.unicast_enable);
         address_pool_t *pool = allocator_get_pool_by_name(server.allocator, CONFIG_DEFAULT_POOL_NAME);
         ASSERT_NEQ(NULL, pool);
         ASSERT_EQ(ipv4_address_to_uint32(CONFIG_DEFAULT_POOL_START), pool->start_address);
@@ -319,6 +360,7 @@ SUITE(config)
         RUN_TEST(test_config_file_ok_but_pools_and_options_bad);
         RUN_TEST(test_config_missing_interface);
         RUN_TEST(test_config_interface_in_cli_arguments);
+        RUN_TEST(test_config_multiple_interfaces);
         RUN_TEST(test_config_default_configuration_only_flag);
         RUN_TEST(test_config_default_configuration);
 }
@@ -12,6 +12,7 @@
 #include <address_pool.h>
 
 static dhcp_server_t server = {0};
+static dhcp_interface_t iface = {0};
 
 
 static void setup() {
@@ -19,7 +20,9 @@ static void setup() {
         address_pool_t *p = address_pool_new_str("test", "192.168.1.1", "192.168.1.254", "255.255.255.0");
         allocator_add_pool(server.allocator, p);
 
-        server.sock_fd = open("/dev/null", O_RDWR);
+        iface.sock_fd = open("/dev/null", O_RDWR);
+        server.interfaces = &iface;
+        server.interface_count = 1;
 }
 
 static void dhcprelease_setup() {
@@ -45,8 +48,9 @@ TEST dhcp_release_non_existent_lease() {
                 PASS();
         }
 
-        dhcp_message_t m = {0};
-        m.ciaddr = ipv4_address_to_uint32("192.168.1.111");
+        dhcp_packet_t packet = {0};
+        dhcp_message_t m = {.packet = &packet};
+        dhcp_message_set_ciaddr(&m, ipv4_address_to_uint32("192.168.1.111"));
 
         ASSERT_EQ(-1, message_dhcprelease_handle(&server, &m));
 
@@ -58,21 +62,24 @@ TEST dhcp_release_test_valid() {
         if (strcmp("./test/test_leases/", LEASE_PATH_PREFIX) != 0) {
                 PASS();
         }
-        dhcp_message_t m = {0};
-        m.ciaddr = ipv4_address_to_uint32("192.168.1.10");
+        dhcp_packet_t packet = {0};
+        dhcp_message_t m = {.packet = &packet};
+        dhcp_message_set_ciaddr(&m, ipv4_address_to_uint32("192.168.1.10"));
 
         address_pool_t *p = (address_pool_t*)(server.allocator->address_pools->first->data);
         ASSERT_EQ(253, p->available_addresses);
-        ASSERT_EQ(0b00000010, p->leases_bm[1]);
+        ASSERT_EQ(0b00000010ULL << 8, p->leases_bm[0]);
         ASSERT_EQ(0, message_dhcprelease_handle(&server, &m));
         ASSERT_EQ(254, p->available_addresses);
-        ASSERT_EQ(0, p->leases_bm[1]);
+        ASSERT_EQ(0, p->leases_bm[0]);
 
         PASS();
 }
 
 static void dhcprelease_cleanup() {
         // remove(LEASE_PATH_PREFIX "/test.lease");
+        lease_remove_address_pool(ipv4_address_to_uint32("192.168.1.10"), "test");
+        lease_index_clear();
 }
 
 static void cleanup()
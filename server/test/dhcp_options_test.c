@@ -331,6 +331,133 @@ TEST test_dhcp_option_copy()
         PASS();
 }
 
+TEST test_option_view_lookup()
+{
+        dhcp_option_view_t view;
+        uint32_t value;
+        uint8_t lenght;
+
+        ASSERT_EQ(0, dhcp_option_view_parse(&view, raw_dhcp_options));
+
+        ASSERT_EQ(0, dhcp_option_view_number(&view, raw_dhcp_options, DHCP_OPTION_DHCP_MESSAGE_TYPE, &value));
+        ASSERT_EQ(3, value);
+        ASSERT_EQ(0, dhcp_option_view_number(&view, raw_dhcp_options, 0x32, &value));
+        ASSERT_EQ(0x70605040, value);
+        ASSERT_EQ(0, dhcp_option_view_number(&view, raw_dhcp_options, 0x33, &value));
+        ASSERT_EQ(86400, value);
+
+        const uint8_t *v = dhcp_option_view_get(&view, raw_dhcp_options, 0x0c, &lenght);
+        ASSERT_NEQ(NULL, v);
+        ASSERT_EQ(8, lenght);
+        ASSERT_MEM_EQ("MyDevice", v, lenght);
+        /* Value points into raw options, nothing is copied */
+        ASSERT_EQ(raw_dhcp_options + 26, v);
+
+        v = dhcp_option_view_get(&view, raw_dhcp_options, 0x37, &lenght);
+        ASSERT_NEQ(NULL, v);
+        ASSERT_EQ(3, lenght);
+        ASSERT_MEM_EQ(((uint8_t[]){0x32, 0x1f, 0x0c}), v, lenght);
+        /* Binary option longer than 4 bytes is not a number */
+        ASSERT_EQ(-1, dhcp_option_view_number(&view, raw_dhcp_options, 0x0c, &value));
+
+        ASSERT_FALSE(dhcp_option_view_has(&view, DHCP_OPTION_SERVER_IDENTIFIER));
+        ASSERT_EQ(NULL, dhcp_option_view_get(&view, raw_dhcp_options, DHCP_OPTION_SERVER_IDENTIFIER, &lenght));
+        ASSERT_EQ(-1, dhcp_option_view_number(&view, raw_dhcp_options, DHCP_OPTION_SERVER_IDENTIFIER, &value));
+        ASSERT_FALSE(dhcp_option_view_has(&view, DHCP_OPTION_END));
+        PASS();
+}
+
+TEST test_option_view_tags_across_bitmap()
+{
+        dhcp_option_view_t view;
+        uint8_t raw[DHCP_PACKET_OPTIONS_SIZE] = {0};
+        uint8_t lenght;
+        uint32_t value;
+
+        /* Tags out of order, in every word of the bitmap */
+        uint8_t options[] = {0xfa, 0x01, 0x04, 0x41, 0x01, 0x02, 0x01, 0x01, 0x01, 
+                             0x82, 0x02, 0x03, 0x03, 0x40, 0x01, 0x05, 0xff};
+        memcpy(raw, options, sizeof(options));
+        ASSERT_EQ(0, dhcp_option_view_parse(&view, raw));
+
+        uint8_t tags[] = {0x01, 0x40, 0x41, 0x82, 0xfa};
+        uint32_t values[] = {1, 5, 2, 0x0303, 4};
+        for (int i = 0; i < 5; i++) {
+                ASSERT_EQ(0, dhcp_option_view_number(&view, raw, tags[i], &value));
+                ASSERT_EQ(values[i], value);
+        }
+        ASSERT_FALSE(dhcp_option_view_has(&view, 0x3f));
+        ASSERT_FALSE(dhcp_option_view_has(&view, 0x81));
+        ASSERT_FALSE(dhcp_option_view_has(&view, 0xfb));
+
+        /* DHCP_OPTION_VIEW_SIZE distinct tags fit, repeated tags do not take a slot */
+        memset(raw, 0, sizeof(raw));
+        for (int i = 0; i < DHCP_OPTION_VIEW_SIZE; i++) {
+                raw[i * 2] = i + 1;
+                raw[i * 2 + 1] = 0;
+        }
+        raw[DHCP_OPTION_VIEW_SIZE * 2] = 1;
+        raw[DHCP_OPTION_VIEW_SIZE * 2 + 2] = DHCP_OPTION_END;
+        ASSERT_EQ(0, dhcp_option_view_parse(&view, raw));
+        ASSERT_EQ(raw + DHCP_OPTION_VIEW_SIZE * 2, 
+                  dhcp_option_view_get(&view, raw, DHCP_OPTION_VIEW_SIZE, &lenght));
+        ASSERT_EQ(0, lenght);
+
+        /* More distinct tags are rejected, e.g. relay agent option behind junk tags */
+        raw[DHCP_OPTION_VIEW_SIZE * 2] = DHCP_OPTION_DHCP_AGENT_OPTIONS;
+        ASSERT_EQ(-1, dhcp_option_view_parse(&view, raw));
+        ASSERT_FALSE(dhcp_option_view_has(&view, DHCP_OPTION_DHCP_AGENT_OPTIONS));
+        PASS();
+}
+
+TEST test_option_view_pad_duplicate_and_truncated()
+{
+        dhcp_option_view_t view;
+        uint8_t raw[DHCP_PACKET_OPTIONS_SIZE] = {0};
+        uint8_t lenght;
+        uint32_t value;
+
+        /* Only pad bytes, parsing must terminate */
+        ASSERT_EQ(0, dhcp_option_view_parse(&view, raw));
+        ASSERT_FALSE(dhcp_option_view_has(&view, DHCP_OPTION_DHCP_MESSAGE_TYPE));
+
+        /* Pads between options, first occurence of duplicate option is used, options after END are ignored */
+        uint8_t options[] = {0x00, 0x00, 0x35, 0x01, 0x01, 0x00, 0x35, 0x01, 0x03, 
+                             0x3d, 0x00, 0xff, 0x36, 0x04, 0x01, 0x02, 0x03, 0x04};
+        memcpy(raw, options, sizeof(options));
+        ASSERT_EQ(0, dhcp_option_view_parse(&view, raw));
+        ASSERT_EQ(0, dhcp_option_view_number(&view, raw, DHCP_OPTION_DHCP_MESSAGE_TYPE, &value));
+        ASSERT_EQ(1, value);
+        ASSERT(dhcp_option_view_has(&view, DHCP_OPTION_CLIENT_IDENTIFIER));
+        ASSERT_NEQ(NULL, dhcp_option_view_get(&view, raw, DHCP_OPTION_CLIENT_IDENTIFIER, &lenght));
+        ASSERT_EQ(0, lenght);
+        ASSERT_FALSE(dhcp_option_view_has(&view, DHCP_OPTION_SERVER_IDENTIFIER));
+
+        /* Option running past the end of options field is rejected */
+        memset(raw, 0, sizeof(raw));
+        raw[DHCP_PACKET_OPTIONS_SIZE - 3] = DHCP_OPTION_HOST_NAME;
+        raw[DHCP_PACKET_OPTIONS_SIZE - 2] = 2;
+        ASSERT_EQ(-1, dhcp_option_view_parse(&view, raw));
+        raw[DHCP_PACKET_OPTIONS_SIZE - 2] = 1;
+        ASSERT_EQ(0, dhcp_option_view_parse(&view, raw));
+        ASSERT(dhcp_option_view_has(&view, DHCP_OPTION_HOST_NAME));
+
+        /* Tag without lenght byte */
+        uint8_t lone_tag[DHCP_PACKET_OPTIONS_SIZE] = {0};
+        lone_tag[DHCP_PACKET_OPTIONS_SIZE - 1] = DHCP_OPTION_HOST_NAME;
+        ASSERT_EQ(-1, dhcp_option_view_parse(&view, lone_tag));
+
+        /* Linked list parser shares the bounds checks and does not loop on pads */
+        llist_t *options_list = llist_new();
+        ASSERT_EQ(0, dhcp_option_parse(options_list, raw));
+        ASSERT_NEQ(NULL, dhcp_option_retrieve(options_list, DHCP_OPTION_HOST_NAME));
+        dhcp_option_clear_list(options_list);
+        raw[DHCP_PACKET_OPTIONS_SIZE - 2] = 2;
+        ASSERT_EQ(-1, dhcp_option_parse(options_list, raw));
+        dhcp_option_destroy_list(&options_list);
+        PASS();
+}
+
 SUITE(dhcp_options)
 {
         memset(raw_dhcp_options, 0, sizeof(dhcp_options));
@@ -366,5 +493,8 @@ SUITE(dhcp_options)
         RUN_TEST(test_parsed_option_numeric_with_multiple_bytes);
         RUN_TEST(test_parsed_option_ip_trailing_and_leading_zeros);
         RUN_TEST(test_duplicite_option);
+        RUN_TEST(test_option_view_lookup);
+        RUN_TEST(test_option_view_tags_across_bitmap);
+        RUN_TEST(test_option_view_pad_duplicate_and_truncated);
 }
 
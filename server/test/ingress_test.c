@@ -0,0 +1,172 @@
+#include "greatest.h"
+#include "tests.h"
+#include <ingress.h>
+#include <message_slab.h>
+#include <RFC/RFC-2131.h>
+#include <RFC/RFC-2132.h>
+#include <arpa/inet.h>
+#include <stdint.h>
+#include <string.h>
+
+/* Fill raw packet of message with BOOTREQUEST of type, options are preceded by pad bytes */
+static dhcp_message_t *make_request(message_slab_t *slab, uint8_t type, uint32_t ciaddr)
+{
+        dhcp_message_t *m = message_slab_alloc(slab);
+        if (!m)
+                return NULL;
+
+        m->packet->opcode = BOOTREQUEST;
+        m->packet->ciaddr = htonl(ciaddr);
+        uint8_t options[] = {DHCP_OPTION_PAD, DHCP_OPTION_PAD,
+                             DHCP_OPTION_HOST_NAME, 3, 'a', 'b', 'c',
+                             DHCP_OPTION_DHCP_MESSAGE_TYPE, 1, type,
+                             DHCP_OPTION_END};
+        memcpy(m->packet->options, options, sizeof(options));
+
+        return m;
+}
+
+TEST test_ingress_classify()
+{
+        message_slab_t *slab = message_slab_new(8, 8);
+        ASSERT_NEQ(NULL, slab);
+
+        dhcp_message_t *discover = make_request(slab, DHCP_DISCOVER, 0);
+        dhcp_message_t *select = make_request(slab, DHCP_REQUEST, 0);
+        dhcp_message_t *renew = make_request(slab, DHCP_REQUEST, 0xc0a80005);
+        dhcp_message_t *release = make_request(slab, DHCP_RELEASE, 0xc0a80005);
+        dhcp_message_t *inform = make_request(slab, DHCP_INFORM, 0xc0a80005);
+        dhcp_message_t *reply = make_request(slab, DHCP_OFFER, 0);
+        dhcp_message_t *empty = message_slab_alloc(slab);
+        reply->packet->opcode = BOOTREPLY;
+
+        ASSERT_EQ(INGRESS_PRIO_LOW, ingress_classify(discover->packet));
+        ASSERT_EQ(INGRESS_PRIO_NORMAL, ingress_classify(select->packet));
+        ASSERT_EQ(INGRESS_PRIO_HIGH, ingress_classify(renew->packet));
+        ASSERT_EQ(INGRESS_PRIO_HIGH, ingress_classify(release->packet));
+        ASSERT_EQ(INGRESS_PRIO_NORMAL, ingress_classify(inform->packet));
+        ASSERT_EQ(INGRESS_PRIO_LOW, ingress_classify(reply->packet));
+        /* Packet of only pad bytes has no type */
+        ASSERT_EQ(INGRESS_PRIO_LOW, ingress_classify(empty->packet));
+
+        /* Option lenght running past end of packet must not be followed */
+        memset(empty->packet->options, 0, sizeof(empty->packet->options));
+        empty->packet->opcode = BOOTREQUEST;
+        empty->packet->options[sizeof(empty->packet->options) - 2] = DHCP_OPTION_HOST_NAME;
+        empty->packet->options[sizeof(empty->packet->options) - 1] = 255;
+        ASSERT_EQ(INGRESS_PRIO_LOW, ingress_classify(empty->packet));
+
+        dhcp_message_unref(&discover);
+        dhcp_message_unref(&select);
+        dhcp_message_unref(&renew);
+        dhcp_message_unref(&release);
+        dhcp_message_unref(&inform);
+        dhcp_message_unref(&reply);
+        dhcp_message_unref(&empty);
+        ASSERT_EQ(8, slab->free_count);
+        message_slab_destroy(&slab);
+        PASS();
+}
+
+TEST test_ingress_priority_order()
+{
+        message_slab_t *slab = message_slab_new(8, 8);
+        ingress_t *in = ingress_new(8);
+        ASSERT_NEQ(NULL, slab);
+        ASSERT_NEQ(NULL, in);
+        ASSERT_EQ(NULL, ingress_new(0));
+
+        dhcp_message_t *discover1 = make_request(slab, DHCP_DISCOVER, 0);
+        dhcp_message_t *discover2 = make_request(slab, DHCP_DISCOVER, 0);
+        dhcp_message_t *select = make_request(slab, DHCP_REQUEST, 0);
+        dhcp_message_t *renew = make_request(slab, DHCP_REQUEST, 0xc0a80005);
+
+        ASSERT_EQ(0, ingress_push(in, discover1, NULL));
+        ASSERT_EQ(0, ingress_push(in, select, NULL));
+        ASSERT_EQ(0, ingress_push(in, discover2, NULL));
+        ASSERT_EQ(0, ingress_push(in, renew, NULL));
+        ASSERT_EQ(4, ingress_count(in));
+        /* Ingress holds its own reference */
+        ASSERT_EQ(2, renew->refs);
+
+        /* Highest priority first, arrival order within priority */
+        dhcp_message_t *expected[] = {renew, select, discover1, discover2};
+        ingress_entry_t e;
+        for (int i = 0; i < 4; i++) {
+                ASSERT(ingress_pop(in, &e));
+                ASSERT_EQ(expected[i], e.message);
+                dhcp_message_unref(&e.message);
+        }
+        ASSERT_FALSE(ingress_pop(in, &e));
+        ASSERT_EQ(0, ingress_count(in));
+        ASSERT_EQ(1, renew->refs);
+        ASSERT_EQ(1, in->stats.enqueued[INGRESS_PRIO_HIGH]);
+        ASSERT_EQ(1, in->stats.enqueued[INGRESS_PRIO_NORMAL]);
+        ASSERT_EQ(2, in->stats.enqueued[INGRESS_PRIO_LOW]);
+        ASSERT_EQ(2, in->stats.max_depth[INGRESS_PRIO_LOW]);
+
+        dhcp_message_unref(&discover1);
+        dhcp_message_unref(&discover2);
+        dhcp_message_unref(&select);
+        dhcp_message_unref(&renew);
+        ingress_destroy(&in);
+        ASSERT_EQ(NULL, in);
+        ASSERT_EQ(8, slab->free_count);
+        message_slab_destroy(&slab);
+        PASS();
+}
+
+TEST test_ingress_overload_sheds_low_priority()
+{
+        message_slab_t *slab = message_slab_new(4, 4);
+        ingress_t *in = ingress_new(4);
+        ASSERT_NEQ(NULL, slab);
+        ASSERT_NEQ(NULL, in);
+
+        dhcp_message_t *discover = make_request(slab, DHCP_DISCOVER, 0);
+        dhcp_message_t *renew = make_request(slab, DHCP_REQUEST, 0xc0a80005);
+
+        /* Low priority queue is bounded */
+        for (int i = 0; i < 4; i++)
+                ASSERT_EQ(0, ingress_push(in, discover, NULL));
+        ASSERT_EQ(-1, ingress_push(in, discover, NULL));
+        ASSERT_EQ(1, in->stats.dropped[INGRESS_PRIO_LOW]);
+
+        /* Full low queue does not affect lease holders */
+        ASSERT_EQ(0, ingress_push(in, renew, NULL));
+        ASSERT_EQ(0, ingress_push(in, renew, NULL));
+
+        /* Backlog of lease holders sheds new clients even with space in their queue */
+        ingress_entry_t e;
+        while (ingress_pop(in, &e))
+                dhcp_message_unref(&e.message);
+        ASSERT_EQ(0, ingress_push(in, renew, NULL));
+        ASSERT_EQ(0, ingress_push(in, renew, NULL));
+        ASSERT_EQ(-1, ingress_push(in, discover, NULL));
+        ASSERT_EQ(1, in->stats.shed);
+        ASSERT_EQ(1, in->stats.dropped[INGRESS_PRIO_LOW]);
+
+        /* Lease holders are dropped only when their own queue is full */
+        ASSERT_EQ(0, ingress_push(in, renew, NULL));
+        ASSERT_EQ(0, ingress_push(in, renew, NULL));
+        ASSERT_EQ(-1, ingress_push(in, renew, NULL));
+        ASSERT_EQ(1, in->stats.dropped[INGRESS_PRIO_HIGH]);
+        ASSERT_EQ(4, in->stats.max_depth[INGRESS_PRIO_HIGH]);
+
+        /* Destroying ingress drops references of queued messages */
+        ingress_destroy(&in);
+        ASSERT_EQ(1, renew->refs);
+        ASSERT_EQ(1, discover->refs);
+        dhcp_message_unref(&discover);
+        dhcp_message_unref(&renew);
+        ASSERT_EQ(4, slab->free_count);
+        message_slab_destroy(&slab);
+        PASS();
+}
+
+SUITE(ingress)
+{
+        RUN_TEST(test_ingress_classify);
+        RUN_TEST(test_ingress_priority_order);
+        RUN_TEST(test_ingress_overload_sheds_low_priority);
+}
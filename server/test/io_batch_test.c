@@ -0,0 +1,93 @@
+#define _GNU_SOURCE
+#include "greatest.h"
+#include "tests.h"
+#include <io_batch.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+TEST test_io_batch_new_and_destroy()
+{
+        io_batch_t *b = io_batch_new(16, NULL);
+        ASSERT_NEQ(NULL, b);
+        ASSERT_EQ(16, b->size);
+        ASSERT_EQ(0, b->tx_count);
+        for (int i = 0; i < 16; i++)
+                ASSERT_NEQ(NULL, b->rx_messages[i]);
+
+        io_batch_destroy(&b);
+        ASSERT_EQ(NULL, b);
+
+        ASSERT_EQ(NULL, io_batch_new(0, NULL));
+        ASSERT_EQ(NULL, io_batch_new(IO_BATCH_MAX_SIZE + 1, NULL));
+
+        PASS();
+}
+
+TEST test_io_batch_receive_empty_socket()
+{
+        struct sockaddr_in addr;
+        int fd = open_loopback_socket(&addr);
+        if (fd < 0)
+                SKIP();
+
+        io_batch_t *b = io_batch_new(4, NULL);
+        ASSERT_NEQ(NULL, b);
+        ASSERT_EQ(0, io_batch_receive(b, fd));
+        ASSERT_EQ(0, b->stats.rx_calls);
+
+        io_batch_destroy(&b);
+        close(fd);
+        PASS();
+}
+
+TEST test_io_batch_send_and_receive()
+{
+        struct sockaddr_in rx_addr, tx_addr;
+        int rx_fd = open_loopback_socket(&rx_addr);
+        int tx_fd = open_loopback_socket(&tx_addr);
+        if (rx_fd < 0 || tx_fd < 0)
+                SKIP();
+
+        io_batch_t *tx = io_batch_new(4, NULL);
+        io_batch_t *rx = io_batch_new(8, NULL);
+        ASSERT_NEQ(NULL, tx);
+        ASSERT_NEQ(NULL, rx);
+
+        /* 6 packets with batch of 4 forces one flush from io_batch_queue */
+        dhcp_packet_t p = {0};
+        for (uint32_t i = 0; i < 6; i++) {
+                p.xid = htonl(0x1000 + i);
+                ASSERT_EQ(0, io_batch_queue(tx, tx_fd, &p, sizeof(dhcp_packet_t), &rx_addr));
+        }
+        ASSERT_EQ(2, tx->tx_count);
+        ASSERT_EQ(2, io_batch_flush(tx, tx_fd));
+        ASSERT_EQ(0, tx->tx_count);
+        ASSERT_EQ(6, tx->stats.tx_packets);
+        ASSERT_EQ(0, tx->stats.tx_dropped);
+
+        ASSERT_EQ(6, io_batch_receive(rx, rx_fd));
+        for (uint32_t i = 0; i < 6; i++) {
+                ASSERT_EQ(sizeof(dhcp_packet_t), rx->rx_hdr[i].msg_len);
+                ASSERT_EQ(0x1000 + i, ntohl(rx->rx_messages[i]->packet->xid));
+        }
+        ASSERT_EQ(1, rx->stats.rx_calls);
+        ASSERT_EQ(6, rx->stats.rx_packets);
+        ASSERT_EQ(6, rx->stats.rx_max_batch);
+
+        io_batch_destroy(&tx);
+        io_batch_destroy(&rx);
+        close(rx_fd);
+        close(tx_fd);
+        PASS();
+}
+
+SUITE(io_batch)
+{
+        RUN_TEST(test_io_batch_new_and_destroy);
+        RUN_TEST(test_io_batch_receive_empty_socket);
+        RUN_TEST(test_io_batch_send_and_receive);
+}
@@ -310,6 +310,72 @@ TEST test_load_leases_from_persistant_database_multiple_pools()
         PASS();
 }
 
+TEST test_find_lease_by_client()
+{
+        if (lease_path_ok < 0)
+                SKIP();
+
+        uint8_t mac1[] = {0x02, 0x00, 0x00, 0x00, 0x00, 0x01};
+        uint8_t mac2[] = {0x02, 0x00, 0x00, 0x00, 0x00, 0x02};
+        uint8_t mac3[] = {0x02, 0x00, 0x00, 0x00, 0x00, 0x03};
+        uint8_t id[] = {0x01, 0xde, 0xad, 0xbe, 0xef};
+        uint8_t other_id[] = {0x01, 0xca, 0xfe};
+
+        lease_t l = {
+                .subnet  = ipv4_address_to_uint32("255.255.255.0"),
+                .lease_start = 100,
+                .lease_expire = 1000,
+                .pool_name = "index_pool",
+        };
+
+        /* Lease without client identifier, lease with one and lease of other client */
+        l.address = ipv4_address_to_uint32("192.168.5.50");
+        memcpy(l.client_mac_address, mac1, 6);
+        ASSERT_EQ(LEASE_OK, lease_add(&l));
+        l.address = ipv4_address_to_uint32("192.168.5.51");
+        memcpy(l.client_id, id, sizeof(id));
+        l.client_id_lenght = sizeof(id);
+        ASSERT_EQ(LEASE_OK, lease_add(&l));
+        l.address = ipv4_address_to_uint32("192.168.5.52");
+        memcpy(l.client_mac_address, mac2, 6);
+        l.client_id_lenght = 0;
+        ASSERT_EQ(LEASE_OK, lease_add(&l));
+
+        lease_t found = {0};
+        ASSERT_EQ(LEASE_OK, lease_find_address(&found, ipv4_address_to_uint32("192.168.5.51")));
+        ASSERT_EQ(sizeof(id), found.client_id_lenght);
+        ASSERT_MEM_EQ(id, found.client_id, sizeof(id));
+        ASSERT_STR_EQ("index_pool", found.pool_name);
+
+        /* Client identifier is stored in .lease file */
+        memset(&found, 0, sizeof(found));
+        ASSERT_EQ(LEASE_OK, lease_retrieve(&found, ipv4_address_to_uint32("192.168.5.51"), "index_pool"));
+        ASSERT_EQ(sizeof(id), found.client_id_lenght);
+        ASSERT_MEM_EQ(id, found.client_id, sizeof(id));
+
+        /* Newest lease of chaddr wins, identifier wins over chaddr */
+        ASSERT_EQ(LEASE_OK, lease_find_client(&found, mac1, NULL, 0));
+        ASSERT_EQ(ipv4_address_to_uint32("192.168.5.51"), found.address);
+        ASSERT_EQ(LEASE_OK, lease_find_client(&found, mac3, id, sizeof(id)));
+        ASSERT_EQ(ipv4_address_to_uint32("192.168.5.51"), found.address);
+        ASSERT_EQ(LEASE_OK, lease_find_client(&found, mac1, other_id, sizeof(other_id)));
+        ASSERT_EQ(ipv4_address_to_uint32("192.168.5.50"), found.address);
+        ASSERT_FALSE(lease_belongs_to_client(&found, mac2, NULL, 0));
+        ASSERT_EQ(LEASE_DOESNT_EXITS, lease_find_client(&found, mac3, other_id, sizeof(other_id)));
+
+        ASSERT_EQ(LEASE_OK, lease_remove_address_pool(ipv4_address_to_uint32("192.168.5.51"), "index_pool"));
+        ASSERT_EQ(LEASE_DOESNT_EXITS, lease_find_address(&found, ipv4_address_to_uint32("192.168.5.51")));
+        ASSERT_EQ(LEASE_OK, lease_find_client(&found, mac1, id, sizeof(id)));
+        ASSERT_EQ(ipv4_address_to_uint32("192.168.5.50"), found.address);
+
+        ASSERT_EQ(LEASE_OK, lease_remove_address_pool(ipv4_address_to_uint32("192.168.5.50"), "index_pool"));
+        ASSERT_EQ(LEASE_OK, lease_remove_address_pool(ipv4_address_to_uint32("192.168.5.52"), "index_pool"));
+        ASSERT_EQ(LEASE_DOESNT_EXITS, lease_find_client(&found, mac1, NULL, 0));
+        ASSERT_EQ(LEASE_DOESNT_EXITS, lease_find_client(&found, mac2, id, sizeof(id)));
+
+        PASS();
+}
+
 SUITE(lease)
 {
         RUN_TEST(test_undef_lease_path_for_testing);
@@ -322,7 +388,10 @@ SUITE(lease)
         RUN_TEST(test_retrieve_non_existent);
         RUN_TEST(test_lease_expiration);
         RUN_TEST(test_remove_lease);
+        RUN_TEST(test_find_lease_by_client);
         RUN_TEST(test_load_leases_from_persistant_database_one_pool);
         RUN_TEST(test_load_leases_from_persistant_database_multiple_pools);
+
+        lease_index_clear();
 }
 
@@ -33,6 +33,13 @@ int main(int argc, char *argv[])
         RUN_SUITE(timer); // this suite takes some time to run, no need to run it always
         RUN_SUITE(config);
         RUN_SUITE(security);
+        RUN_SUITE(io_batch);
+        RUN_SUITE(uring);
+        RUN_SUITE(raw_tx);
+        RUN_SUITE(ingress);
+        RUN_SUITE(option_cache);
+        RUN_SUITE(socket_filter);
+        RUN_SUITE(xdp_filter);
 
         cclogger_uninit();
 
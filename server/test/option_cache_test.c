@@ -0,0 +1,219 @@
+#include "greatest.h"
+#include "tests.h"
+#include <option_cache.h>
+#include <allocator.h>
+#include <address_pool.h>
+#include <dhcp_options.h>
+#include <dhcp_packet.h>
+#include <utils/xtoy.h>
+#include <RFC/RFC-2131.h>
+#include <RFC/RFC-2132.h>
+#include <stdint.h>
+#include <string.h>
+
+static const uint8_t required[]    = {51, 54, 0};
+static const uint8_t blacklisted[] = {50, 55, 61, 57, 0};
+
+static address_allocator_t *make_allocator()
+{
+        address_allocator_t *a = address_allocator_new();
+        if (!a)
+                return NULL;
+
+        uint32_t lease_time = 3600;
+        uint32_t server_id = ipv4_address_to_uint32("192.168.1.1");
+        uint32_t mask = ipv4_address_to_uint32("255.255.255.0");
+        uint32_t router = ipv4_address_to_uint32("192.168.1.254");
+        allocator_add_dhcp_option(a, dhcp_option_new_values(DHCP_OPTION_IP_ADDRESS_LEASE_TIME, 4, &lease_time));
+        allocator_add_dhcp_option(a, dhcp_option_new_values(DHCP_OPTION_SERVER_IDENTIFIER, 4, &server_id));
+        allocator_add_dhcp_option(a, dhcp_option_new_values(DHCP_OPTION_SUBNET_MASK, 4, &mask));
+        allocator_add_dhcp_option(a, dhcp_option_new_values(DHCP_OPTION_ROUTER, 4, &router));
+
+        allocator_add_pool(a, address_pool_new_str("first", "192.168.1.10", "192.168.1.100", "255.255.255.0"));
+        address_pool_t *second = address_pool_new_str("second", "192.168.2.10", "192.168.2.100",
+                                                      "255.255.255.0");
+        router = ipv4_address_to_uint32("192.168.2.254");
+        dhcp_option_add(second->dhcp_option_override,
+                        dhcp_option_new_values(DHCP_OPTION_ROUTER, 4, &router));
+        allocator_add_pool(a, second);
+
+        return a;
+}
+
+/* Serialize options the way handlers do without the cache */
+static int build_uncached(address_allocator_t *a, address_pool_t *pool, const uint8_t *prl,
+                uint8_t prl_lenght, uint32_t server_id, uint8_t raw[DHCP_PACKET_OPTIONS_SIZE])
+{
+        uint8_t requested[256] = {0};
+        memcpy(requested, prl, prl_lenght);
+
+        llist_t *options = llist_new();
+        int rv = dhcp_option_build_required_options(options, requested, (uint8_t*)required,
+                        (uint8_t*)blacklisted, a->default_options, pool->dhcp_option_override, DHCP_OFFER);
+        dhcp_option_t *o54 = dhcp_option_retrieve(options, DHCP_OPTION_SERVER_IDENTIFIER);
+        if (o54)
+                o54->value.ip = server_id;
+        if (rv == 0)
+                rv = dhcp_options_serialize(options, raw);
+
+        dhcp_option_destroy_list(&options);
+        return rv;
+}
+
+TEST test_option_cache_matches_uncached_options()
+{
+        address_allocator_t *a = make_allocator();
+        option_cache_t *cache = option_cache_new(OPTION_CACHE_SIZE);
+        ASSERT_NEQ(NULL, a);
+        ASSERT_NEQ(NULL, cache);
+        ASSERT_EQ(NULL, option_cache_new(0));
+
+        address_pool_t *pool = allocator_get_pool_by_name(a, "first");
+        uint8_t prl[] = {DHCP_OPTION_SUBNET_MASK, DHCP_OPTION_ROUTER, DHCP_OPTION_HOST_NAME};
+        uint32_t server_id = ipv4_address_to_uint32("10.0.0.1");
+        uint8_t expected[DHCP_PACKET_OPTIONS_SIZE] = {0};
+        ASSERT_EQ(0, build_uncached(a, pool, prl, sizeof(prl), server_id, expected));
+
+        dhcp_message_t *m = dhcp_message_new();
+        ASSERT_NEQ(NULL, m);
+
+        /* Miss builds the block, hit copies it, both produce the same packet */
+        for (int i = 0; i < 2; i++) {
+                memset(m->packet->options, 0, sizeof(m->packet->options));
+                ASSERT_EQ(0, option_cache_fill(cache, a, pool, m, DHCP_OFFER, prl, sizeof(prl),
+                                        required, blacklisted, server_id));
+                ASSERT_MEM_EQ(expected, m->packet->options, m->work->options_prebuilt + 1);
+                ASSERT_EQ(DHCP_OPTION_END, m->packet->options[m->work->options_prebuilt]);
+        }
+        ASSERT_EQ(1, cache->stats.misses);
+        ASSERT_EQ(1, cache->stats.hits);
+
+        /* Server identifier of the interface is patched into cached block */
+        server_id = ipv4_address_to_uint32("10.0.0.2");
+        ASSERT_EQ(0, build_uncached(a, pool, prl, sizeof(prl), server_id, expected));
+        ASSERT_EQ(0, option_cache_fill(cache, a, pool, m, DHCP_OFFER, prl, sizeof(prl),
+                                required, blacklisted, server_id));
+        ASSERT_MEM_EQ(expected, m->packet->options, m->work->options_prebuilt + 1);
+        ASSERT_EQ(2, cache->stats.hits);
+
+        /* Options of message list follow the block */
+        uint8_t o61[] = {1, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff};
+        dhcp_option_add(m->work->dhcp_options, dhcp_option_new_values(DHCP_OPTION_CLIENT_IDENTIFIER,
+                                sizeof(o61), o61));
+        dhcp_message_set_cookie(m, MAGIC_COOKIE);
+        ASSERT_EQ(0, dhcp_packet_build(m));
+        ASSERT_MEM_EQ(expected, m->packet->options, m->work->options_prebuilt);
+        ASSERT_EQ(DHCP_OPTION_CLIENT_IDENTIFIER, m->packet->options[m->work->options_prebuilt]);
+        ASSERT_EQ(DHCP_OPTION_END, m->packet->options[m->work->options_prebuilt + 2 + sizeof(o61)]);
+
+        dhcp_message_destroy(&m);
+        option_cache_destroy(&cache);
+        ASSERT_EQ(NULL, cache);
+        allocator_destroy(&a);
+        PASS();
+}
+
+TEST test_option_cache_key()
+{
+        address_allocator_t *a = make_allocator();
+        option_cache_t *cache = option_cache_new(OPTION_CACHE_SIZE);
+        dhcp_message_t *m = dhcp_message_new();
+        ASSERT_NEQ(NULL, a);
+        ASSERT_NEQ(NULL, cache);
+        ASSERT_NEQ(NULL, m);
+
+        address_pool_t *first = allocator_get_pool_by_name(a, "first");
+        address_pool_t *second = allocator_get_pool_by_name(a, "second");
+        uint8_t prl[] = {DHCP_OPTION_SUBNET_MASK, DHCP_OPTION_ROUTER};
+        uint8_t expected[DHCP_PACKET_OPTIONS_SIZE] = {0};
+
+        /* Pool, message type and parameter request list are part of the key */
+        struct {
+                address_pool_t *pool;
+                enum dhcp_message_type type;
+                uint8_t prl_lenght;
+        } keys[] = {
+                {first, DHCP_OFFER, sizeof(prl)},
+                {second, DHCP_OFFER, sizeof(prl)},
+                {first, DHCP_ACK, sizeof(prl)},
+                {first, DHCP_OFFER, 1},
+                {first, DHCP_OFFER, 0},
+        };
+        for (int i = 0; i < 5; i++) {
+                ASSERT_EQ(0, option_cache_fill(cache, a, keys[i].pool, m, keys[i].type, prl,
+                                        keys[i].prl_lenght, required, blacklisted, 0));
+                ASSERT_EQ(i + 1, cache->stats.misses);
+                ASSERT_EQ(0, option_cache_fill(cache, a, keys[i].pool, m, keys[i].type, prl,
+                                        keys[i].prl_lenght, required, blacklisted, 0));
+                ASSERT_EQ(i + 1, cache->stats.hits);
+        }
+
+        /* Pool overrides are used */
+        ASSERT_EQ(0, option_cache_fill(cache, a, second, m, DHCP_OFFER, prl, sizeof(prl),
+                                required, blacklisted, 0));
+        ASSERT_EQ(0, build_uncached(a, second, prl, sizeof(prl), 0, expected));
+        ASSERT_MEM_EQ(expected, m->packet->options, m->work->options_prebuilt + 1);
+
+        /* Missing required option fails, nothing is cached */
+        static const uint8_t required_dns[] = {DHCP_OPTION_DOMAIN_NAME_SERVERS, 0};
+        uint64_t hits = cache->stats.hits;
+        ASSERT_EQ(-1, option_cache_fill(cache, a, first, m, DHCP_OFFER, prl, 1,
+                                required_dns, blacklisted, 0));
+        ASSERT_EQ(-1, option_cache_fill(cache, a, first, m, DHCP_OFFER, prl, 1,
+                                required_dns, blacklisted, 0));
+        ASSERT_EQ(hits, cache->stats.hits);
+
+        dhcp_message_destroy(&m);
+        option_cache_destroy(&cache);
+        allocator_destroy(&a);
+        PASS();
+}
+
+TEST test_option_cache_invalidated_by_option_change()
+{
+        address_allocator_t *a = make_allocator();
+        option_cache_t *cache = option_cache_new(OPTION_CACHE_SIZE);
+        dhcp_message_t *m = dhcp_message_new();
+        ASSERT_NEQ(NULL, a);
+        ASSERT_NEQ(NULL, cache);
+        ASSERT_NEQ(NULL, m);
+
+        address_pool_t *pool = allocator_get_pool_by_name(a, "first");
+        uint8_t prl[] = {DHCP_OPTION_SUBNET_MASK, DHCP_OPTION_ROUTER};
+        uint8_t expected[DHCP_PACKET_OPTIONS_SIZE] = {0};
+
+        ASSERT_EQ(0, option_cache_fill(cache, a, pool, m, DHCP_OFFER, prl, sizeof(prl),
+                                required, blacklisted, 0));
+
+        uint32_t lease_time = 7200;
+        ASSERT_EQ(ALLOCATOR_OK, allocator_change_dhcp_option(a, DHCP_OPTION_IP_ADDRESS_LEASE_TIME,
+                                &lease_time, 4));
+        ASSERT_EQ(0, option_cache_fill(cache, a, pool, m, DHCP_OFFER, prl, sizeof(prl),
+                                required, blacklisted, 0));
+        ASSERT_EQ(1, cache->stats.stale);
+        ASSERT_EQ(2, cache->stats.misses);
+        ASSERT_EQ(0, build_uncached(a, pool, prl, sizeof(prl), 0, expected));
+        ASSERT_MEM_EQ(expected, m->packet->options, m->work->options_prebuilt + 1);
+
+        /* Direct change of pool options has to be announced */
+        uint32_t router = ipv4_address_to_uint32("192.168.1.253");
+        dhcp_option_add(pool->dhcp_option_override, dhcp_option_new_values(DHCP_OPTION_ROUTER, 4, &router));
+        allocator_options_changed(a);
+        ASSERT_EQ(0, option_cache_fill(cache, a, pool, m, DHCP_OFFER, prl, sizeof(prl),
+                                required, blacklisted, 0));
+        ASSERT_EQ(2, cache->stats.stale);
+        ASSERT_EQ(0, build_uncached(a, pool, prl, sizeof(prl), 0, expected));
+        ASSERT_MEM_EQ(expected, m->packet->options, m->work->options_prebuilt + 1);
+
+        dhcp_message_destroy(&m);
+        option_cache_destroy(&cache);
+        allocator_destroy(&a);
+        PASS();
+}
+
+SUITE(option_cache)
+{
+        RUN_TEST(test_option_cache_matches_uncached_options);
+        RUN_TEST(test_option_cache_key);
+        RUN_TEST(test_option_cache_invalidated_by_option_change);
+}
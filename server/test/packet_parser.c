@@ -36,7 +36,7 @@ TEST packet_parse_to_message()
                 printf("Failed to open ./test/packet_samples/discover.packet %s , skipping...", strerror(errno));
                 SKIP();
         }
-        if (read(fd, &m->packet, 576) < 0) {
+        if (read(fd, m->packet, 576) < 0) {
                 printf("Failed to read ./test/packet_samples/discover.packet %s , skipping...", strerror(errno));
                 SKIP();
         }
@@ -44,48 +44,56 @@ TEST packet_parse_to_message()
         /* actuall start of test */
         ASSERT_EQ(0, dhcp_packet_parse(m));
 
-        ASSERT_EQ(1, m->opcode);
-        ASSERT_EQ(1, m->htype);
-        ASSERT_EQ(6, m->hlen);
-        ASSERT_EQ(0, m->hops);
+        ASSERT_EQ(1, m->packet->opcode);
+        ASSERT_EQ(1, m->packet->htype);
+        ASSERT_EQ(6, m->packet->hlen);
+        ASSERT_EQ(0, m->packet->hops);
 
         ASSERT_EQ(0x7db596bf, m->xid);
-        ASSERT_EQ(0, m->secs);
-        ASSERT_EQ(0, m->flags);
+        ASSERT_EQ(0, dhcp_message_secs(m));
+        ASSERT_EQ(0, dhcp_message_flags(m));
 
-        ASSERT_EQ(0, m->ciaddr);
-        ASSERT_EQ(0, m->yiaddr);
-        ASSERT_EQ(0, m->siaddr);
-        ASSERT_EQ(0, m->giaddr);
+        ASSERT_EQ(0, dhcp_message_ciaddr(m));
+        ASSERT_EQ(0, dhcp_message_yiaddr(m));
+        ASSERT_EQ(0, dhcp_message_siaddr(m));
+        ASSERT_EQ(0, dhcp_message_giaddr(m));
 
         uint8_t reference_mac[] = {0xb8, 0x27, 0xeb, 0xb8, 0x84, 0xc7};
         ASSERT_MEM_EQ(reference_mac, m->chaddr, 6);
 
         uint8_t blank_memory[1000];
         memset(blank_memory, 0, 1000);
-        ASSERT_MEM_EQ(blank_memory, m->sname, 64);
-        ASSERT_MEM_EQ(blank_memory, m->filename, 128);
+        ASSERT_MEM_EQ(blank_memory, m->packet->sname, 64);
+        ASSERT_MEM_EQ(blank_memory, m->packet->filename, 128);
 
-        ASSERT_EQ(MAGIC_COOKIE, m->cookie);
+        ASSERT_EQ(MAGIC_COOKIE, dhcp_message_cookie(m));
 
-        dhcp_option_t *o = dhcp_option_retrieve(m->dhcp_options, DHCP_OPTION_DHCP_MESSAGE_TYPE);
-        ASSERT_NEQ(NULL, o);
-        ASSERT_EQ(1, o->value.number);
+        uint32_t type;
+        ASSERT_EQ(0, dhcp_message_option_number(m, DHCP_OPTION_DHCP_MESSAGE_TYPE, &type));
+        ASSERT_EQ(1, type);
+        ASSERT_EQ(DHCP_DISCOVER, m->type);
+        /* Received options are only indexed, nothing is allocated */
+        ASSERT_EQ(NULL, m->work->dhcp_options->first);
         
-        o = dhcp_option_retrieve(m->dhcp_options, DHCP_OPTION_HOST_NAME);
+        uint8_t lenght;
+        const uint8_t *o = dhcp_message_option(m, DHCP_OPTION_HOST_NAME, &lenght);
         ASSERT_NEQ(NULL, o);
-        ASSERT_EQ(11, o->lenght);
-        ASSERT_STR_EQ("raspberrypi", o->value.string);
+        ASSERT_EQ(11, lenght);
+        ASSERT_MEM_EQ("raspberrypi", o, lenght);
         
-        o = dhcp_option_retrieve(m->dhcp_options, DHCP_OPTION_CLIENT_IDENTIFIER);
+        o = dhcp_message_option(m, DHCP_OPTION_CLIENT_IDENTIFIER, &lenght);
         ASSERT_NEQ(NULL, o);
         uint8_t client_id_reference[] = {0x01, 0xb8, 0x27, 0xeb, 0xb8, 0x84, 0xc7};
-        ASSERT_MEM_EQ(client_id_reference, o->value.binary_data, o->lenght);
+        ASSERT_EQ(sizeof(client_id_reference), lenght);
+        ASSERT_MEM_EQ(client_id_reference, o, lenght);
 
-        o = dhcp_option_retrieve(m->dhcp_options, DHCP_OPTION_PARAMETER_REQUEST_LIST);
+        o = dhcp_message_option(m, DHCP_OPTION_PARAMETER_REQUEST_LIST, &lenght);
         ASSERT_NEQ(NULL, o);
         uint8_t requested_parameters_reference[] = {1, 121, 33, 3, 6, 12, 15, 26, 28, 51, 54, 58, 59, 119};
-        ASSERT_MEM_EQ(requested_parameters_reference, o->value.binary_data, o->lenght);
+        ASSERT_EQ(sizeof(requested_parameters_reference), lenght);
+        ASSERT_MEM_EQ(requested_parameters_reference, o, lenght);
+
+        ASSERT_EQ(NULL, dhcp_message_option(m, DHCP_OPTION_SERVER_IDENTIFIER, &lenght));
         
         close(fd);
         PASS();
@@ -93,36 +101,43 @@ TEST packet_parse_to_message()
 
 TEST packet_build_packet()
 {
-        uint8_t zeroed_packet[sizeof(dhcp_packet_t)];
-        memset(zeroed_packet, 0, sizeof(dhcp_packet_t));
-        memset(&m->packet, 0, sizeof(dhcp_packet_t));
-        ASSERT_MEM_EQ(zeroed_packet, &m->packet, sizeof(dhcp_packet_t));
+        uint8_t zeroed_options[DHCP_PACKET_OPTIONS_SIZE];
+        memset(zeroed_options, 0, sizeof(zeroed_options));
+
+        /* Options of received packet are only indexed, list is needed to build the packet again */
+        ASSERT_EQ(0, dhcp_option_parse(m->work->dhcp_options, m->packet->options));
+
+        /* Rest of the header stays in packet, parsed fields and options are written back by build */
+        m->packet->xid = 0;
+        memset(m->packet->chaddr, 0, sizeof(m->packet->chaddr));
+        memset(m->packet->options, 0, sizeof(m->packet->options));
+        ASSERT_MEM_EQ(zeroed_options, m->packet->options, sizeof(zeroed_options));
 
         ASSERT_EQ(0, dhcp_packet_build(m));
 
-        ASSERT_EQ(1, m->packet.opcode);
-        ASSERT_EQ(1, m->packet.htype);
-        ASSERT_EQ(6, m->packet.hlen);
-        ASSERT_EQ(0, m->packet.hops);
+        ASSERT_EQ(1, m->packet->opcode);
+        ASSERT_EQ(1, m->packet->htype);
+        ASSERT_EQ(6, m->packet->hlen);
+        ASSERT_EQ(0, m->packet->hops);
 
-        ASSERT_EQ(0x7db596bf, m->xid);
-        ASSERT_EQ(0, m->packet.secs);
-        ASSERT_EQ(0, m->packet.flags);
+        ASSERT_EQ(0x7db596bf, ntohl(m->packet->xid));
+        ASSERT_EQ(0, m->packet->secs);
+        ASSERT_EQ(0, m->packet->flags);
 
-        ASSERT_EQ(0, m->packet.ciaddr);
-        ASSERT_EQ(0, m->packet.yiaddr);
-        ASSERT_EQ(0, m->packet.siaddr);
-        ASSERT_EQ(0, m->packet.giaddr);
+        ASSERT_EQ(0, m->packet->ciaddr);
+        ASSERT_EQ(0, m->packet->yiaddr);
+        ASSERT_EQ(0, m->packet->siaddr);
+        ASSERT_EQ(0, m->packet->giaddr);
 
         uint8_t reference_mac[] = {0xb8, 0x27, 0xeb, 0xb8, 0x84, 0xc7};
-        ASSERT_MEM_EQ(reference_mac, m->packet.chaddr, 6);
+        ASSERT_MEM_EQ(reference_mac, m->packet->chaddr, 6);
 
         uint8_t blank_memory[1000];
         memset(blank_memory, 0, 1000);
-        ASSERT_MEM_EQ(blank_memory, m->packet.sname, 64);
-        ASSERT_MEM_EQ(blank_memory, m->packet.filename, 128);
+        ASSERT_MEM_EQ(blank_memory, m->packet->sname, 64);
+        ASSERT_MEM_EQ(blank_memory, m->packet->filename, 128);
 
-        ASSERT_EQ(MAGIC_COOKIE, ntohl(m->packet.cookie));
+        ASSERT_EQ(MAGIC_COOKIE, ntohl(m->packet->cookie));
 
         uint8_t reference_options[] = {
                 0x35, 0x01, 0x01, 0x3D, 0x07, 0x01, 0xB8, 0x27, 0xEB, 0xB8, 0x84, 0xC7, 0x50, 0x00, 0x74, 0x01,
@@ -131,16 +146,161 @@ TEST packet_build_packet()
                 0x33, 0x36, 0x3A, 0x3B, 0x77, 0xFF
         };
 
-        ASSERT_MEM_EQ(reference_options, m->packet.options, sizeof(reference_options));
+        ASSERT_MEM_EQ(reference_options, m->packet->options, sizeof(reference_options));
         
         dhcp_message_destroy(&m);
         PASS();
 }
 
+TEST packet_peek_type()
+{
+        dhcp_packet_t p;
+        memset(&p, 0, sizeof(p));
+
+        /* Packet of only pad bytes has no type */
+        ASSERT_EQ(-1, dhcp_packet_peek_type(&p));
+        ASSERT_EQ(-1, dhcp_packet_peek_type(NULL));
+
+        uint8_t options[] = {DHCP_OPTION_PAD, DHCP_OPTION_HOST_NAME, 2, 'h', 'i',
+                             DHCP_OPTION_DHCP_MESSAGE_TYPE, 1, DHCP_REQUEST, DHCP_OPTION_END};
+        memcpy(p.options, options, sizeof(options));
+        ASSERT_EQ(DHCP_REQUEST, dhcp_packet_peek_type(&p));
+
+        /* Options after END are not read */
+        p.options[5] = DHCP_OPTION_END;
+        ASSERT_EQ(-1, dhcp_packet_peek_type(&p));
+
+        /* Option lenght running past end of packet must not be followed */
+        memset(p.options, 0, sizeof(p.options));
+        p.options[sizeof(p.options) - 2] = DHCP_OPTION_HOST_NAME;
+        p.options[sizeof(p.options) - 1] = 255;
+        ASSERT_EQ(-1, dhcp_packet_peek_type(&p));
+
+        PASS();
+}
+
+/* Reply with message type and options of 100 bytes with tags from tags, options field filled by garbage */
+static dhcp_message_t *make_reply(const uint8_t *tags, int count)
+{
+        uint8_t type = DHCP_OFFER;
+        uint8_t value[100];
+        memset(value, 'a', sizeof(value));
+
+        dhcp_message_t *reply = dhcp_message_new();
+        if (!reply)
+                return NULL;
+
+        reply->packet->opcode = BOOTREPLY;
+        dhcp_message_set_cookie(reply, MAGIC_COOKIE);
+        memset(reply->packet->options, 0xee, sizeof(reply->packet->options));
+        dhcp_option_add(reply->work->dhcp_options, dhcp_option_new_values(DHCP_OPTION_DHCP_MESSAGE_TYPE, 1, &type));
+        for (int i = 0; i < count; i++)
+                dhcp_option_add(reply->work->dhcp_options, dhcp_option_new_values(tags[i], sizeof(value), value));
+
+        return reply;
+}
+
+TEST packet_build_lenght()
+{
+        /* Short reply is padded to BOOTP minimum by zeroes */
+        dhcp_message_t *reply = make_reply(NULL, 0);
+        ASSERT_NEQ(NULL, reply);
+        ASSERT_EQ(0, dhcp_packet_build(reply));
+        ASSERT_EQ(DHCP_PACKET_MIN_SIZE, reply->packet_lenght);
+        ASSERT_EQ(DHCP_PACKET_MIN_SIZE, dhcp_message_lenght(reply));
+
+        uint8_t reference_options[DHCP_PACKET_MIN_SIZE - DHCP_PACKET_HEADER_SIZE] = {
+                DHCP_OPTION_DHCP_MESSAGE_TYPE, 1, DHCP_OFFER, DHCP_OPTION_END
+        };
+        ASSERT_MEM_EQ(reference_options, reply->packet->options, sizeof(reference_options));
+        dhcp_message_destroy(&reply);
+
+        /* Longer reply is sent up to END */
+        uint8_t tags[] = {DHCP_OPTION_HOST_NAME, DHCP_OPTION_DOMAIN_NAME};
+        reply = make_reply(tags, 2);
+        ASSERT_NEQ(NULL, reply);
+        ASSERT_EQ(0, dhcp_packet_build(reply));
+        ASSERT_EQ(DHCP_PACKET_HEADER_SIZE + 3 + 2 * 102 + 1, reply->packet_lenght);
+        ASSERT_EQ(DHCP_OPTION_END, reply->packet->options[3 + 2 * 102]);
+        dhcp_message_destroy(&reply);
+
+        PASS();
+}
+
+TEST packet_build_max_message_size()
+{
+        dhcp_message_t *request = dhcp_message_new();
+        ASSERT_NEQ(NULL, request);
+
+        /* Client without option 57 accepts 576 bytes, limit cannot be lower */
+        ASSERT_EQ(DHCP_MIN_MAX_MESSAGE_SIZE, dhcp_message_max_size(request));
+        uint8_t options[] = {DHCP_OPTION_MAX_DHCP_MESSAGE_SIZE, 2, 0x05, 0xc0, DHCP_OPTION_END};
+        memcpy(request->packet->options, options, sizeof(options));
+        ASSERT_EQ(0, dhcp_option_view_parse(&request->work->options, request->packet->options));
+        ASSERT_EQ(1472, dhcp_message_max_size(request));
+        request->packet->options[2] = 0x01;
+        ASSERT_EQ(0, dhcp_option_view_parse(&request->work->options, request->packet->options));
+        ASSERT_EQ(DHCP_MIN_MAX_MESSAGE_SIZE, dhcp_message_max_size(request));
+        dhcp_message_destroy(&request);
+
+        /* 309 bytes of options fit only into larger message */
+        uint8_t tags[] = {DHCP_OPTION_HOST_NAME, DHCP_OPTION_DOMAIN_NAME, DHCP_OPTION_VENDOR_SPECIFIC_INFO};
+        dhcp_message_t *reply = make_reply(tags, 3);
+        ASSERT_NEQ(NULL, reply);
+        reply->work->max_message_size = 1472;
+        ASSERT_EQ(0, dhcp_packet_build(reply));
+        ASSERT_EQ(DHCP_PACKET_HEADER_SIZE + 3 + 3 * 102 + 1, reply->packet_lenght);
+        ASSERT_EQ(DHCP_OPTION_VENDOR_SPECIFIC_INFO, reply->packet->options[3 + 2 * 102]);
+        dhcp_message_destroy(&reply);
+
+        PASS();
+}
+
+TEST packet_build_overload()
+{
+        uint8_t blank_memory[64];
+        memset(blank_memory, 0, sizeof(blank_memory));
+
+        /* Option which does not fit into 576 bytes continues in file field */
+        uint8_t tags[] = {DHCP_OPTION_HOST_NAME, DHCP_OPTION_DOMAIN_NAME, DHCP_OPTION_VENDOR_SPECIFIC_INFO};
+        dhcp_message_t *reply = make_reply(tags, 3);
+        ASSERT_NEQ(NULL, reply);
+        ASSERT_EQ(0, dhcp_packet_build(reply));
+
+        uint8_t overload[] = {DHCP_OPTION_OVERLOAD, 1, 1, DHCP_OPTION_END};
+        ASSERT_MEM_EQ(overload, reply->packet->options + 3 + 2 * 102, sizeof(overload));
+        ASSERT_EQ(DHCP_PACKET_HEADER_SIZE + 3 + 2 * 102 + sizeof(overload), reply->packet_lenght);
+        ASSERT_EQ(DHCP_OPTION_VENDOR_SPECIFIC_INFO, (uint8_t)reply->packet->filename[0]);
+        ASSERT_EQ(100, reply->packet->filename[1]);
+        ASSERT_EQ(DHCP_OPTION_END, (uint8_t)reply->packet->filename[102]);
+        ASSERT_MEM_EQ(blank_memory, reply->packet->sname, sizeof(reply->packet->sname));
+        dhcp_message_destroy(&reply);
+
+        /* Options which do not fit even into file and sname cannot be sent */
+        uint8_t too_many[] = {12, 15, 43, 17, 18, 40, 47};
+        reply = make_reply(too_many, sizeof(too_many));
+        ASSERT_NEQ(NULL, reply);
+        ASSERT_EQ(-1, dhcp_packet_build(reply));
+        dhcp_message_destroy(&reply);
+
+        /* Fields used by server are not overloaded */
+        reply = make_reply(tags, 3);
+        ASSERT_NEQ(NULL, reply);
+        strcpy(reply->packet->filename, "boot.img");
+        ASSERT_EQ(-1, dhcp_packet_build(reply));
+        dhcp_message_destroy(&reply);
+
+        PASS();
+}
+
 SUITE(packet_parser_builder)
 {
         RUN_TEST(message_create_and_destroy);
         RUN_TEST(packet_parse_to_message);
         RUN_TEST(packet_build_packet);
+        RUN_TEST(packet_peek_type);
+        RUN_TEST(packet_build_lenght);
+        RUN_TEST(packet_build_max_message_size);
+        RUN_TEST(packet_build_overload);
 }
 
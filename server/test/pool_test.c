@@ -3,7 +3,9 @@
 #include "tests.h"
 #include "greatest.h"
 #include <address_pool.h>
+#include <pthread.h>
 #include <stdio.h>
+#include <string.h>
 #include <utils/xtoy.h>
 
 TEST test_create_new_pool_and_destroy_it()
@@ -84,14 +86,14 @@ TEST test_pool_allocate_address()
         // we expect address to be used
         ASSERT_EQ(1, address_pool_get_address_allocation_str(pool, "192.168.1.11"));
         // we expect second byte of of the bitmask to have only 3rd bit set to 1
-        ASSERT_EQ(0b00000100, pool->leases_bm[1]);
+        ASSERT_EQ(0b00000100ULL << 8, pool->leases_bm[0]);
 
         rv = address_pool_clear_address_allocation_str(pool, "192.168.1.11");
 
         // we expect address to be free again
         ASSERT_EQ(0, address_pool_get_address_allocation_str(pool, "192.168.1.11"));
         // we expect second byte of of the bitmask to have only 3rd bit set to 1
-        ASSERT_EQ(0b00000000, pool->leases_bm[1]);
+        ASSERT_EQ(0, pool->leases_bm[0]);
         ASSERT_EQ(100, pool->available_addresses);
         
         address_pool_destroy(&pool);
@@ -113,8 +115,10 @@ TEST test_pool_allocate_address_edge_cases()
         ASSERT_EQ(1, address_pool_get_address_allocation_str(pool, "192.168.1.1"));
         ASSERT_EQ(1, address_pool_get_address_allocation_str(pool, "192.168.1.254"));
 
+        // last address is in the last byte of the fourth word
+        ASSERT_EQ(4, pool->leases_bm_words);
         ASSERT_EQ(0b00000001, pool->leases_bm[0]);
-        ASSERT_EQ(0b00100000, pool->leases_bm[31]);
+        ASSERT_EQ(0b00100000ULL << 56, pool->leases_bm[3]);
 
         address_pool_destroy(&pool);
         PASS();
@@ -142,6 +146,296 @@ TEST test_pool_allocate_address_pool_not_starting_with_8_multiplicier_address()
         PASS();
 }
 
+TEST test_pool_assign_first_on_large_pool()
+{
+        address_pool_t *pool = address_pool_new_str("test", "10.0.0.1", "10.0.255.254", "255.255.0.0");
+        ASSERT_NEQ(NULL, pool);
+        ASSERT_EQ(65534, pool->available_addresses);
+        ASSERT_EQ(1024, pool->leases_bm_words);
+
+        /* Addresses are assigned in order until pool is depleted */
+        uint32_t start = pool->start_address;
+        uint32_t address = 0;
+        for (uint32_t i = 0; i < 65534; i++) {
+                ASSERT_EQ(0, address_pool_assign_first(pool, &address));
+                ASSERT_EQ(start + i, address);
+        }
+        ASSERT_EQ(0, pool->available_addresses);
+        ASSERT_EQ(-1, address_pool_assign_first(pool, &address));
+        ASSERT_EQ(~0ULL, pool->full_bm[0]);
+
+        /* The lowest released address is assigned first, also if it is before the hint */
+        ASSERT_EQ(0, address_pool_clear_address_allocation(pool, start + 40000));
+        ASSERT_EQ(0, address_pool_clear_address_allocation(pool, start + 70));
+        ASSERT_EQ(0, address_pool_clear_address_allocation(pool, start + 65533));
+        ASSERT_EQ(0, address_pool_assign_first(pool, &address));
+        ASSERT_EQ(start + 70, address);
+        ASSERT_EQ(0, address_pool_assign_first(pool, &address));
+        ASSERT_EQ(start + 40000, address);
+
+        /* Address taken by set is skipped */
+        ASSERT_EQ(0, address_pool_clear_address_allocation(pool, start + 5));
+        ASSERT_EQ(0, address_pool_set_address_allocation(pool, start + 5));
+        ASSERT_EQ(0, address_pool_assign_first(pool, &address));
+        ASSERT_EQ(start + 65533, address);
+        ASSERT_EQ(-1, address_pool_assign_first(pool, &address));
+
+        address_pool_destroy(&pool);
+        PASS();
+}
+
+TEST test_pool_strategy_hash()
+{
+        address_pool_t *pool = address_pool_new_str("test", "10.0.0.1", "10.0.0.200", "255.255.255.0");
+        ASSERT_NEQ(NULL, pool);
+        ASSERT_EQ(0, address_pool_set_strategy(pool, ADDRESS_POOL_STRATEGY_HASH));
+
+        uint8_t chaddr[] = {0x02, 0x00, 0x5e, 0x10, 0x20, 0x30};
+        uint32_t address, other;
+
+        /* Client gets the same address again once it is released */
+        ASSERT_EQ(0, address_pool_assign(pool, chaddr, &address));
+        ASSERT_EQ(0, address_pool_clear_address_allocation(pool, address));
+        ASSERT_EQ(0, address_pool_assign(pool, chaddr, &other));
+        ASSERT_EQ(address, other);
+
+        /* On collision the next available address is probed */
+        ASSERT_EQ(0, address_pool_assign(pool, chaddr, &other));
+        ASSERT_EQ(address == pool->end_address ? pool->start_address : address + 1, other);
+
+        /* Without chaddr the lowest address is assigned */
+        ASSERT_EQ(0, address_pool_clear_address_allocation(pool, other));
+        ASSERT_EQ(0, address_pool_assign(pool, NULL, &other));
+        ASSERT_EQ(pool->start_address == address ? address + 1 : pool->start_address, other);
+
+        /* Every address can be assigned, probing wraps around */
+        for (uint32_t i = 2; i < 200; i++)
+                ASSERT_EQ(0, address_pool_assign(pool, chaddr, &other));
+        ASSERT_EQ(-1, address_pool_assign(pool, chaddr, &other));
+
+        address_pool_destroy(&pool);
+        PASS();
+}
+
+TEST test_pool_strategy_random()
+{
+        address_pool_t *pool = address_pool_new_str("test", "10.0.0.1", "10.0.1.44", "255.255.254.0");
+        ASSERT_NEQ(NULL, pool);
+        ASSERT_EQ(0, address_pool_set_strategy(pool, ADDRESS_POOL_STRATEGY_RANDOM));
+        ASSERT_EQ(300, pool->available_addresses);
+
+        /* Every address is assigned exactly once, also the last ones found by selection */
+        uint8_t seen[300] = {0};
+        uint32_t address, ascending = 0;
+        for (uint32_t i = 0; i < 300; i++) {
+                ASSERT_EQ(0, address_pool_assign(pool, NULL, &address));
+                ASSERT(address_belongs_to_pool(pool, address));
+                ASSERT_EQ(0, seen[address - pool->start_address]);
+                seen[address - pool->start_address] = 1;
+                ascending += (address == pool->start_address + i);
+        }
+        ASSERT_EQ(-1, address_pool_assign(pool, NULL, &address));
+        ASSERT(ascending < 300);
+
+        address_pool_destroy(&pool);
+        PASS();
+}
+
+TEST test_pool_strategy_lru()
+{
+        address_pool_t *pool = address_pool_new_str("test", "10.0.0.1", "10.0.0.10", "255.255.255.0");
+        ASSERT_NEQ(NULL, pool);
+
+        /* Addresses in use before the strategy is set are not queued */
+        uint32_t start = pool->start_address;
+        uint32_t address;
+        ASSERT_EQ(0, address_pool_set_address_allocation(pool, start + 1));
+        ASSERT_EQ(0, address_pool_set_strategy(pool, ADDRESS_POOL_STRATEGY_LRU));
+
+        ASSERT_EQ(0, address_pool_assign(pool, NULL, &address));
+        ASSERT_EQ(start, address);
+        ASSERT_EQ(0, address_pool_assign(pool, NULL, &address));
+        ASSERT_EQ(start + 2, address);
+
+        /* Released addresses are reused after the ones never used */
+        ASSERT_EQ(0, address_pool_clear_address_allocation(pool, start + 2));
+        ASSERT_EQ(0, address_pool_clear_address_allocation(pool, start));
+        ASSERT_EQ(0, address_pool_set_address_allocation(pool, start + 5));
+        for (uint32_t i = 3; i < 10; i++) {
+                if (i == 5)
+                        continue;
+                ASSERT_EQ(0, address_pool_assign(pool, NULL, &address));
+                ASSERT_EQ(start + i, address);
+        }
+        ASSERT_EQ(0, address_pool_assign(pool, NULL, &address));
+        ASSERT_EQ(start + 2, address);
+        ASSERT_EQ(0, address_pool_assign(pool, NULL, &address));
+        ASSERT_EQ(start, address);
+        ASSERT_EQ(-1, address_pool_assign(pool, NULL, &address));
+
+        /* Switching back frees the queue */
+        ASSERT_EQ(0, address_pool_set_strategy(pool, ADDRESS_POOL_STRATEGY_FIRST));
+        ASSERT_EQ(NULL, pool->lru_next);
+        ASSERT_EQ(ADDRESS_POOL_STRATEGY_LRU, address_pool_strategy_parse("lru"));
+        ASSERT_EQ(-1, address_pool_strategy_parse("fastest"));
+        ASSERT_STR_EQ("hash", address_pool_strategy_name(ADDRESS_POOL_STRATEGY_HASH));
+
+        address_pool_destroy(&pool);
+        PASS();
+}
+
+#define STRESS_THREADS 8
+#define STRESS_ROUNDS 20000
+#define STRESS_HELD 40
+
+struct stress_args {
+        address_pool_t *pool;
+        uint32_t *owners;       // thread owning every address of pool, 0 if none
+        uint32_t id;
+        uint32_t duplicates;
+        uint32_t failures;
+};
+
+/* Every thread keeps STRESS_HELD addresses, releasing the oldest one when it assigns a new one */
+static void *stress_thread(void *priv)
+{
+        struct stress_args *args = (struct stress_args*)priv;
+        address_pool_t *pool = args->pool;
+        uint32_t held[STRESS_HELD] = {0};
+        uint32_t address, expected;
+        uint8_t chaddr[6] = {0x02, 0, 0, 0, 0, 0};
+
+        for (uint32_t round = 0; round < STRESS_ROUNDS; round++) {
+                uint32_t slot = round % STRESS_HELD;
+                if (held[slot]) {
+                        __atomic_store_n(&args->owners[held[slot] - pool->start_address], 0, __ATOMIC_RELAXED);
+                        if (address_pool_clear_address_allocation(pool, held[slot]) < 0)
+                                args->failures++;
+                        held[slot] = 0;
+                }
+
+                memcpy(chaddr + 2, &round, sizeof(round));
+                chaddr[1] = args->id;
+                if (address_pool_assign(pool, chaddr, &address) < 0) {
+                        args->failures++;
+                        continue;
+                }
+
+                expected = 0;
+                if (!__atomic_compare_exchange_n(&args->owners[address - pool->start_address], &expected, 
+                                        args->id, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                        args->duplicates++;
+                held[slot] = address;
+        }
+
+        for (uint32_t i = 0; i < STRESS_HELD; i++) {
+                if (!held[i])
+                        continue;
+                __atomic_store_n(&args->owners[held[i] - pool->start_address], 0, __ATOMIC_RELAXED);
+                if (address_pool_clear_address_allocation(pool, held[i]) < 0)
+                        args->failures++;
+        }
+
+        return NULL;
+}
+
+TEST test_pool_concurrent_assign_and_release()
+{
+        for (int strategy = 0; strategy < ADDRESS_POOL_STRATEGY_COUNT; strategy++) {
+                /* Threads together hold 320 of 330 addresses, so they fight for the last ones */
+                address_pool_t *pool = address_pool_new_str("test", "10.0.0.1", "10.0.1.74", "255.255.254.0");
+                ASSERT_NEQ(NULL, pool);
+                ASSERT_EQ(0, address_pool_set_strategy(pool, strategy));
+
+                uint32_t owners[330] = {0};
+                struct stress_args args[STRESS_THREADS];
+                pthread_t threads[STRESS_THREADS];
+
+                for (uint32_t i = 0; i < STRESS_THREADS; i++) {
+                        args[i] = (struct stress_args) {.pool = pool, .owners = owners, .id = i + 1};
+                        ASSERT_EQ(0, pthread_create(&threads[i], NULL, stress_thread, &args[i]));
+                }
+                for (uint32_t i = 0; i < STRESS_THREADS; i++)
+                        pthread_join(threads[i], NULL);
+
+                for (uint32_t i = 0; i < STRESS_THREADS; i++) {
+                        ASSERTm(address_pool_strategy_name(strategy), args[i].duplicates == 0);
+                        ASSERT_EQ_FMT(0, args[i].failures, "%u");
+                }
+
+                /* Every address is available again and the whole pool can be assigned */
+                ASSERT_EQ(330, pool->available_addresses);
+                for (uint32_t i = 0; i < pool->leases_bm_words; i++)
+                        ASSERT_EQ(0, pool->leases_bm[i]);
+                ASSERT_EQ(0, pool->full_bm[0]);
+                ASSERT_EQ(0, pool->free_hint);
+
+                /* Lowest address first, hint must not skip addresses released during the run */
+                uint32_t address;
+                for (uint32_t i = 0; i < 330; i++) {
+                        ASSERT_EQ(0, address_pool_assign_first(pool, &address));
+                        ASSERT_EQ(pool->start_address + i, address);
+                }
+                ASSERT_EQ(-1, address_pool_assign(pool, NULL, &address));
+
+                address_pool_destroy(&pool);
+        }
+
+        PASS();
+}
+
+/* Thread releases a random address it holds and takes the lowest available one, it keeps what it holds at the end */
+static void *first_churn_thread(void *priv)
+{
+        struct stress_args *args = (struct stress_args*)priv;
+        uint32_t held[STRESS_HELD] = {0};
+        uint32_t seed = args->id;
+
+        for (uint32_t round = 0; round < STRESS_ROUNDS; round++) {
+                uint32_t slot = round < STRESS_HELD ? round : rand_r(&seed) % STRESS_HELD;
+                if (held[slot] && address_pool_clear_address_allocation(args->pool, held[slot]) < 0)
+                        args->failures++;
+                if (address_pool_assign_first(args->pool, &held[slot]) < 0) {
+                        args->failures++;
+                        held[slot] = 0;
+                }
+        }
+
+        return NULL;
+}
+
+TEST test_pool_first_hint_under_churn()
+{
+        address_pool_t *pool = address_pool_new_str("test", "10.0.0.1", "10.0.1.74", "255.255.254.0");
+        ASSERT_NEQ(NULL, pool);
+
+        struct stress_args args[STRESS_THREADS];
+        pthread_t threads[STRESS_THREADS];
+
+        for (uint32_t i = 0; i < STRESS_THREADS; i++) {
+                args[i] = (struct stress_args) {.pool = pool, .id = i + 1};
+                ASSERT_EQ(0, pthread_create(&threads[i], NULL, first_churn_thread, &args[i]));
+        }
+        for (uint32_t i = 0; i < STRESS_THREADS; i++)
+                pthread_join(threads[i], NULL);
+        for (uint32_t i = 0; i < STRESS_THREADS; i++)
+                ASSERT_EQ_FMT(0, args[i].failures, "%u");
+
+        /* Address released while other thread moved the hint over it must not stay below the hint */
+        ASSERT_EQ(330 - STRESS_THREADS * STRESS_HELD, pool->available_addresses);
+        for (uint32_t i = 0; i < pool->free_hint; i++)
+                ASSERT_EQ(~0ULL, pool->leases_bm[i]);
+
+        uint32_t lowest = 0, address;
+        while (address_pool_get_address_allocation(pool, pool->start_address + lowest))
+                lowest++;
+        ASSERT_EQ(0, address_pool_assign_first(pool, &address));
+        ASSERT_EQ(pool->start_address + lowest, address);
+
+        address_pool_destroy(&pool);
+        PASS();
+}
+
 SUITE(pool)
 {
         RUN_TEST(test_create_new_pool_and_destroy_it);
@@ -153,5 +447,11 @@ SUITE(pool)
         RUN_TEST(test_create_pool_switched_addresses);
         RUN_TEST(test_create_pool_valid_range_dhcp_option_present);
         RUN_TEST(test_pool_allocate_address_pool_not_starting_with_8_multiplicier_address);
+        RUN_TEST(test_pool_assign_first_on_large_pool);
+        RUN_TEST(test_pool_strategy_hash);
+        RUN_TEST(test_pool_strategy_random);
+        RUN_TEST(test_pool_strategy_lru);
+        RUN_TEST(test_pool_concurrent_assign_and_release);
+        RUN_TEST(test_pool_first_hint_under_churn);
 }
 
@@ -0,0 +1,270 @@
+#include "greatest.h"
+#include "tests.h"
+#include <raw_tx.h>
+#include <dhcp_server.h>
+#include <arpa/inet.h>
+#include <linux/if_packet.h>
+#include <net/ethernet.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/udp.h>
+#include <poll.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define TEST_PORT 6868
+
+/* Loopback device has all zero MAC address */
+static const uint8_t lo_mac[6] = {0};
+
+static uint32_t checksum_add(uint32_t sum, const void *data, size_t len)
+{
+        const uint8_t *p = data;
+
+        for (; len > 1; len -= 2, p += 2)
+                sum += (p[0] << 8) | p[1];
+        if (len)
+                sum += p[0] << 8;
+
+        return sum;
+}
+
+/* Returns 0 if data with checksum field included is valid */
+static uint16_t checksum_fold(uint32_t sum)
+{
+        while (sum >> 16)
+                sum = (sum & 0xffff) + (sum >> 16);
+
+        return ~sum & 0xffff;
+}
+
+/* 
+ * Frames on loopback with 127.0.0.1 destination are dropped by routing as martian,
+ * so they are captured by another packet socket and verified here
+ */
+static int open_capture_socket()
+{
+        struct sockaddr_ll sll = {
+                .sll_family = AF_PACKET,
+                .sll_protocol = htons(ETH_P_IP),
+                .sll_ifindex = if_nametoindex("lo"),
+        };
+
+        int fd = socket(AF_PACKET, SOCK_RAW | SOCK_NONBLOCK, htons(ETH_P_IP));
+        if (fd < 0)
+                return -1;
+
+        if (bind(fd, (struct sockaddr*)&sll, sizeof(sll)) < 0) {
+                close(fd);
+                return -1;
+        }
+
+        return fd;
+}
+
+/* Receive valid frames sent to TEST_PORT, returns number of frames or -1 if frame is malformed */
+static int receive_frames(int fd, uint32_t *xids, int max)
+{
+        uint8_t frame[2048];
+        struct sockaddr_ll from;
+        socklen_t from_len;
+        struct pollfd pfd = { .fd = fd, .events = POLLIN };
+        int count = 0;
+
+        while (count < max && poll(&pfd, 1, 200) > 0) {
+                from_len = sizeof(from);
+                ssize_t len = recvfrom(fd, frame, sizeof(frame), 0, (struct sockaddr*)&from, &from_len);
+                if (len < 0)
+                        break;
+
+                /* Loopback device shows every frame also as outgoing */
+                struct iphdr *ip = (struct iphdr*)(frame + sizeof(struct ether_header));
+                struct udphdr *udp = (struct udphdr*)(ip + 1);
+                if (from.sll_pkttype == PACKET_OUTGOING || ip->protocol != IPPROTO_UDP || 
+                    ntohs(udp->dest) != TEST_PORT)
+                        continue;
+
+                if (len != sizeof(struct ether_header) + sizeof(struct iphdr) + 
+                           sizeof(struct udphdr) + sizeof(dhcp_packet_t))
+                        return -1;
+                if (ntohs(ip->tot_len) != len - sizeof(struct ether_header) || 
+                    checksum_fold(checksum_add(0, ip, sizeof(struct iphdr))) != 0)
+                        return -1;
+
+                /* UDP checksum includes pseudo header of addresses, protocol and length */
+                uint16_t udp_len = ntohs(udp->len);
+                uint32_t sum = checksum_add(IPPROTO_UDP + udp_len, &ip->saddr, 8);
+                if (ntohs(udp->source) != 67 || checksum_fold(checksum_add(sum, udp, udp_len)) != 0)
+                        return -1;
+
+                xids[count++] = ntohl(((dhcp_packet_t*)(udp + 1))->xid);
+        }
+
+        return count;
+}
+
+TEST test_raw_tx_loopback_delivery()
+{
+        dhcp_packet_t packet = {0};
+        uint32_t xid = 0;
+
+        raw_tx_t *tx = raw_tx_new("lo", INADDR_LOOPBACK, 4);
+        if (!tx)
+                SKIPm("Packet socket is not available, CAP_NET_RAW is required");
+
+        int fd = open_capture_socket();
+        ASSERT_GTE(fd, 0);
+
+        packet.xid = htonl(0xdeadbeef);
+        ASSERT_EQ(0, raw_tx_queue(tx, lo_mac, INADDR_LOOPBACK, TEST_PORT, &packet, sizeof(packet)));
+        ASSERT_EQ(1, tx->pending);
+        ASSERT_EQ(0, raw_tx_flush(tx));
+        ASSERT_EQ(0, tx->pending);
+
+        ASSERT_EQ(1, receive_frames(fd, &xid, 1));
+        ASSERT_EQ(0xdeadbeef, xid);
+        ASSERT_EQ(1, tx->stats.tx_frames);
+
+        close(fd);
+        raw_tx_destroy(&tx);
+        ASSERT_EQ(NULL, tx);
+        PASS();
+}
+
+TEST test_raw_tx_ring_wraps()
+{
+        dhcp_packet_t packet = {0};
+        uint32_t xids[32];
+
+        raw_tx_t *tx = raw_tx_new("lo", INADDR_LOOPBACK, 4);
+        if (!tx)
+                SKIPm("Packet socket is not available, CAP_NET_RAW is required");
+
+        int fd = open_capture_socket();
+        ASSERT_GTE(fd, 0);
+
+        /* Full ring is flushed by raw_tx_queue, so more frames than ring holds can be queued */
+        uint32_t count = tx->frame_nr * 3;
+        for (uint32_t i = 0; i < count; i++) {
+                packet.xid = htonl(i);
+                raw_tx_queue(tx, lo_mac, INADDR_LOOPBACK, TEST_PORT, &packet, sizeof(packet));
+        }
+        ASSERT_EQ(0, raw_tx_flush(tx));
+
+        int received = receive_frames(fd, xids, 32);
+        ASSERT_EQ(count, tx->stats.tx_frames + tx->stats.tx_dropped);
+        ASSERT_EQ(tx->stats.tx_frames, received);
+        ASSERT_EQ(0, xids[0]);
+
+        close(fd);
+        raw_tx_destroy(&tx);
+        PASS();
+}
+
+TEST test_raw_tx_flush_failures()
+{
+        dhcp_packet_t packet = {0};
+        uint32_t xid = 0;
+        int pair[2];
+
+        raw_tx_t *tx = raw_tx_new("lo", INADDR_LOOPBACK, 4);
+        if (!tx)
+                SKIPm("Packet socket is not available, CAP_NET_RAW is required");
+
+        int fd = open_capture_socket();
+        ASSERT_GTE(fd, 0);
+
+        /* Full datagram socket stands in for packet socket whose queue is full */
+        ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK, 0, pair));
+        while (send(pair[0], &packet, 1, 0) > 0)
+                ;
+        int ring_fd = tx->fd;
+        tx->fd = pair[0];
+
+        packet.xid = htonl(0x600d);
+        ASSERT_EQ(0, raw_tx_queue(tx, lo_mac, INADDR_LOOPBACK, TEST_PORT, &packet, sizeof(packet)));
+        ASSERT_EQ(0, raw_tx_flush(tx));
+        ASSERT_EQ(1, tx->pending);
+
+        /* Frame left in ring is sent by next flush */
+        tx->fd = ring_fd;
+        ASSERT_EQ(0, raw_tx_flush(tx));
+        ASSERT_EQ(0, tx->pending);
+        ASSERT_EQ(1, receive_frames(fd, &xid, 1));
+        ASSERT_EQ(0x600d, xid);
+
+        /* Hard error releases the frame instead of leaving it half sent */
+        packet.xid = htonl(0xbad);
+        ASSERT_EQ(0, raw_tx_queue(tx, lo_mac, INADDR_LOOPBACK, TEST_PORT, &packet, sizeof(packet)));
+        tx->fd = -1;
+        ASSERT_EQ(-1, raw_tx_flush(tx));
+        ASSERT_EQ(0, tx->pending);
+        ASSERT_EQ(1, tx->stats.tx_dropped);
+
+        tx->fd = ring_fd;
+        ASSERT_EQ(0, raw_tx_flush(tx));
+        ASSERT_EQ(0, receive_frames(fd, &xid, 1));
+
+        close(pair[0]);
+        close(pair[1]);
+        close(fd);
+        raw_tx_destroy(&tx);
+        PASS();
+}
+
+TEST test_send_reply_unicast_selection()
+{
+        dhcp_server_t server = {0};
+        dhcp_interface_t iface = {0};
+        dhcp_packet_t packet = {0};
+        dhcp_message_t message = {.packet = &packet};
+
+        iface.raw_tx = raw_tx_new("lo", INADDR_LOOPBACK, 4);
+        if (!iface.raw_tx)
+                SKIPm("Packet socket is not available, CAP_NET_RAW is required");
+
+        iface.sock_fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+        ASSERT_GTE(iface.sock_fd, 0);
+        iface.broadcast_addr = INADDR_LOOPBACK;
+        server.iface = &iface;
+
+        message.type = DHCP_OFFER;
+        packet.htype = DHCP_HTYPE_ETHERNET;
+        packet.hlen = 6;
+        dhcp_message_set_yiaddr(&message, INADDR_LOOPBACK);
+
+        /* Client asked for broadcast */
+        dhcp_message_set_flags(&message, DHCP_FLAG_BROADCAST);
+        ASSERT_EQ(0, dhcp_server_send_reply(&server, &message));
+        ASSERT_EQ(0, iface.raw_tx->stats.tx_frames);
+
+        /* Client already has an address and can answer ARP */
+        dhcp_message_set_flags(&message, 0);
+        dhcp_message_set_ciaddr(&message, INADDR_LOOPBACK);
+        ASSERT_EQ(0, dhcp_server_send_reply(&server, &message));
+        ASSERT_EQ(0, iface.raw_tx->stats.tx_frames);
+
+        /* NAK is always broadcasted */
+        dhcp_message_set_ciaddr(&message, 0);
+        message.type = DHCP_NAK;
+        ASSERT_EQ(0, dhcp_server_send_reply(&server, &message));
+        ASSERT_EQ(0, iface.raw_tx->stats.tx_frames);
+
+        message.type = DHCP_OFFER;
+        ASSERT_EQ(0, dhcp_server_send_reply(&server, &message));
+        ASSERT_EQ(1, iface.raw_tx->stats.tx_frames);
+
+        dhcp_interface_close(&iface);
+        PASS();
+}
+
+SUITE(raw_tx)
+{
+        RUN_TEST(test_raw_tx_loopback_delivery);
+        RUN_TEST(test_raw_tx_ring_wraps);
+        RUN_TEST(test_raw_tx_flush_failures);
+        RUN_TEST(test_send_reply_unicast_selection);
+}
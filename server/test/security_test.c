@@ -2,8 +2,20 @@
 #include "greatest.h"
 #include "utils/llist.h"
 #include <security/acl.h>
+#include <security/dynamic_acl.h>
+#include <security/dhcp_snooping/dhcp_snoop.h>
+#include <dhcp_packet.h>
+#include <utils/xtoy.h>
+#include <RFC/RFC-2131.h>
+#include <RFC/RFC-2132.h>
+#include <arpa/inet.h>
+#include <poll.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
 
 #define IF_ACL_NULL_SKIP if (!acl || !acl->entries) {SKIP();}
 
@@ -98,6 +110,133 @@ TEST test_security_ACL_destroy()
         PASS();
 }
 
+/* Answer fake DHCPDISCOVER of a scan the way rogue server would */
+TEST test_security_dynamic_ACL_denies_client_filling_cache()
+{
+        uint8_t attacker[6] = {0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0x01};
+        uint8_t client[6] = {0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0x02};
+
+        ACL_t *dacl = dynamic_ACL_new();
+        transaction_cache_t *cache = trans_cache_new(8, 60);
+        dhcp_message_t *msg = calloc(1, sizeof(dhcp_message_t));
+        ASSERT_NEQ(NULL, dacl);
+        ASSERT_NEQ(NULL, cache);
+        ASSERT_NEQ(NULL, msg);
+        dacl->enabled = true;
+
+        msg->type = DHCP_DISCOVER;
+        memcpy(msg->chaddr, attacker, 6);
+        for (uint32_t i = 0; i < 3; i++) {
+                msg->xid = 100 + i;
+                ASSERT_EQ(0, trans_cache_add_message(cache, msg));
+        }
+        ASSERT_EQ(ACL_ALLOW, dynamic_ACL_check(dacl, attacker, cache));
+
+        /* Client with half of the cache is denied and stays in the list only once */
+        msg->xid = 103;
+        ASSERT_EQ(0, trans_cache_add_message(cache, msg));
+        ASSERT_EQ(ACL_DENY, dynamic_ACL_check(dacl, attacker, cache));
+        ASSERT_EQ(ACL_DENY, dynamic_ACL_check(dacl, attacker, cache));
+        ASSERT_EQ(dacl->entries->first, dacl->entries->last);
+        ASSERT_EQ(ACL_ALLOW, dynamic_ACL_check(dacl, client, cache));
+
+        /* Client stays denied after its transactions are gone */
+        ASSERT_EQ(0, trans_cache_purge(cache));
+        ASSERT_EQ(ACL_DENY, dynamic_ACL_check(dacl, attacker, cache));
+
+        trans_cache_destroy(&cache);
+        dynamic_ACL_destroy(&dacl);
+        free(msg);
+        PASS();
+}
+
+static int send_rogue_offer(int fd)
+{
+        dhcp_message_t *m = dhcp_message_new();
+        struct pollfd pfd = { .fd = fd, .events = POLLIN };
+        struct sockaddr_in addr = {
+                .sin_family = AF_INET,
+                .sin_port = htons(68),
+                .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+        };
+        int rv = -1;
+
+        if (!m || poll(&pfd, 1, 1000) <= 0 || recv(fd, m->packet, sizeof(dhcp_packet_t), 0) <= 0)
+                goto exit;
+        if (dhcp_packet_parse(m) < 0 || m->type != DHCP_DISCOVER)
+                goto exit;
+
+        uint8_t type = DHCP_OFFER;
+        uint32_t id = ipv4_address_to_uint32("10.6.6.6");
+        dhcp_option_destroy_list(&m->work->dhcp_options);
+        m->work->dhcp_options = llist_new();
+        dhcp_option_add(m->work->dhcp_options, dhcp_option_new_values(DHCP_OPTION_DHCP_MESSAGE_TYPE, 1, &type));
+        dhcp_option_add(m->work->dhcp_options, dhcp_option_new_values(DHCP_OPTION_SERVER_IDENTIFIER, 4, &id));
+        m->packet->opcode = BOOTREPLY;
+        m->type = DHCP_OFFER;
+        if (dhcp_packet_build(m) < 0)
+                goto exit;
+
+        rv = sendto(fd, m->packet, sizeof(dhcp_packet_t), 0, (struct sockaddr*)&addr, sizeof(addr));
+exit:
+        if (m)
+                dhcp_message_destroy(&m);
+        return rv;
+}
+
+TEST test_security_snoop_scan_does_not_block()
+{
+#ifndef CONFIG_SECURITY_ENABLE_DHCP_SNOOPING
+        SKIPm("DHCP snooping is not compiled in");
+#endif
+        dhcp_server_t server = {0};
+        char *res = NULL;
+        strcpy(server.config.interface, "lo");
+        server.epoll_fd = epoll_create1(0);
+        server.timers.wheel = timer_wheel_new(1000);
+        ASSERT_NEQ(NULL, server.timers.wheel);
+
+        /* Socket standing in for rogue server, listening for the fake DHCPDISCOVER */
+        int rogue = socket(AF_INET, SOCK_DGRAM, 0);
+        struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(67) };
+        int flag = 1;
+        setsockopt(rogue, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof(flag));
+        if (bind(rogue, (struct sockaddr*)&addr, sizeof(addr)) < 0)
+                SKIPm("Cannot bind DHCP server port");
+
+        int id = dhcp_snooper_start_scan(&server, "aa:bb:cc:dd:ee:ff", NULL);
+        if (id < 0) {
+                close(rogue);
+                SKIPm("Cannot open DHCP client socket on lo, CAP_NET_RAW and free port 68 are required");
+        }
+
+        /* Scan returns immediately, result is available after its deadline */
+        ASSERT_EQ(DHCP_SNOOP_SCAN_RUNNING, dhcp_snooper_scan_result(id, &res));
+        ASSERT_EQ(NULL, res);
+
+        ASSERT_GT(send_rogue_offer(rogue), 0);
+        struct epoll_event ev;
+        ASSERT_EQ(1, epoll_wait(server.epoll_fd, &ev, 1, 1000));
+        ASSERT(dhcp_snooper_handle_fd(ev.data.fd));
+        ASSERT_FALSE(dhcp_snooper_handle_fd(server.epoll_fd));
+
+        timer_wheel_advance(server.timers.wheel, DHCP_SNOOP_SCAN_DURATION - 1);
+        ASSERT_EQ(DHCP_SNOOP_SCAN_RUNNING, dhcp_snooper_scan_result(id, &res));
+        timer_wheel_advance(server.timers.wheel, 1);
+        ASSERT_EQ(DHCP_SNOOP_POTENTIAL_ROGUE, dhcp_snooper_scan_result(id, &res));
+        ASSERT_NEQ(NULL, strstr(res, "10.6.6.6"));
+
+        /* Result can be collected only once */
+        ASSERT_EQ(DHCP_SNOOP_UNKNOWN_SCAN, dhcp_snooper_scan_result(id, &res));
+
+        free(res);
+        dhcp_snooper_cleanup();
+        timer_wheel_destroy(&server.timers.wheel);
+        close(server.epoll_fd);
+        close(rogue);
+        PASS();
+}
+
 SUITE(security)
 {
         RUN_TEST(test_security_ACL_new);
@@ -111,5 +250,7 @@ SUITE(security)
 
         /* must be run AFTER all tests utilising acl strucutre */
         RUN_TEST(test_security_ACL_destroy);
+        RUN_TEST(test_security_dynamic_ACL_denies_client_filling_cache);
+        RUN_TEST(test_security_snoop_scan_does_not_block);
 }
 
@@ -0,0 +1,144 @@
+#define _GNU_SOURCE
+#include "greatest.h"
+#include "tests.h"
+#include <socket_filter.h>
+#include <dhcp_packet.h>
+#include <RFC/RFC-2131.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+static void make_packet(dhcp_packet_t *p, uint8_t opcode, uint8_t mac_last)
+{
+        memset(p, 0, sizeof(dhcp_packet_t));
+        p->opcode = opcode;
+        p->htype = 1;
+        p->hlen = 6;
+        p->xid = htonl(0x1234);
+        p->cookie = htonl(MAGIC_COOKIE);
+        uint8_t chaddr[] = {0xaa, 0xbb, 0xcc, 0xdd, 0xee, mac_last};
+        memcpy(p->chaddr, chaddr, sizeof(chaddr));
+}
+
+/* Send len bytes of packet to socket fd and return whether it passed the filter */
+static bool passes_filter(int fd, struct sockaddr_in *addr, dhcp_packet_t *p, size_t len)
+{
+        uint8_t buff[sizeof(dhcp_packet_t)];
+        struct pollfd pfd = {.fd = fd, .events = POLLIN};
+        int tx = socket(AF_INET, SOCK_DGRAM, 0);
+        if (tx < 0)
+                return false;
+
+        sendto(tx, p, len, 0, (struct sockaddr*)addr, sizeof(struct sockaddr_in));
+        close(tx);
+
+        if (poll(&pfd, 1, 100) <= 0)
+                return false;
+
+        return recv(fd, buff, sizeof(buff), 0) == (ssize_t)len;
+}
+
+TEST test_socket_filter_accepts_only_requests()
+{
+        struct sockaddr_in addr;
+        int fd = open_loopback_socket(&addr);
+        if (fd < 0)
+                SKIP();
+
+        ASSERT_EQ(0, socket_filter_attach(fd, NULL));
+
+        dhcp_packet_t p;
+        make_packet(&p, BOOTREQUEST, 0x01);
+        ASSERT(passes_filter(fd, &addr, &p, sizeof(p)));
+        ASSERT(passes_filter(fd, &addr, &p, SOCKET_FILTER_MIN_LENGHT - SOCKET_FILTER_UDP_HLEN));
+
+        /* Truncated header */
+        ASSERT_FALSE(passes_filter(fd, &addr, &p, SOCKET_FILTER_MIN_LENGHT - SOCKET_FILTER_UDP_HLEN - 1));
+
+        /* Replies of servers */
+        make_packet(&p, BOOTREPLY, 0x01);
+        ASSERT_FALSE(passes_filter(fd, &addr, &p, sizeof(p)));
+
+        /* Not a DHCP packet */
+        make_packet(&p, BOOTREQUEST, 0x01);
+        p.cookie = 0;
+        ASSERT_FALSE(passes_filter(fd, &addr, &p, sizeof(p)));
+
+        close(fd);
+        PASS();
+}
+
+TEST test_socket_filter_rejects_blacklisted_clients()
+{
+        struct sockaddr_in addr;
+        int fd = open_loopback_socket(&addr);
+        if (fd < 0)
+                SKIP();
+
+        ACL_t *acl = ACL_new();
+        ASSERT_NEQ(NULL, acl);
+        acl->enabled = true;
+        acl->is_blacklist = true;
+        llist_append(acl->entries, strdup("aa:bb:cc:dd:ee:02"), true);
+        llist_append(acl->entries, strdup("aa:bb:cc:dd:ee:03"), true);
+        ASSERT_EQ(0, socket_filter_attach(fd, acl));
+
+        dhcp_packet_t p;
+        make_packet(&p, BOOTREQUEST, 0x01);
+        ASSERT(passes_filter(fd, &addr, &p, sizeof(p)));
+        make_packet(&p, BOOTREQUEST, 0x02);
+        ASSERT_FALSE(passes_filter(fd, &addr, &p, sizeof(p)));
+        make_packet(&p, BOOTREQUEST, 0x03);
+        ASSERT_FALSE(passes_filter(fd, &addr, &p, sizeof(p)));
+
+        /* Whitelist is left to the server */
+        acl->is_blacklist = false;
+        ASSERT_EQ(0, socket_filter_attach(fd, acl));
+        ASSERT(passes_filter(fd, &addr, &p, sizeof(p)));
+        make_packet(&p, BOOTREQUEST, 0x01);
+        ASSERT(passes_filter(fd, &addr, &p, sizeof(p)));
+
+        ACL_destroy(&acl);
+        close(fd);
+        PASS();
+}
+
+TEST test_socket_filter_size_limit()
+{
+        static struct sock_filter code[BPF_MAXINSNS];
+        char mac[18];
+
+        ASSERT_EQ(SOCKET_FILTER_HEADER_INSNS + 1, socket_filter_build(NULL, code, BPF_MAXINSNS));
+        ASSERT_EQ(-1, socket_filter_build(NULL, code, SOCKET_FILTER_HEADER_INSNS));
+
+        ACL_t *acl = ACL_new();
+        ASSERT_NEQ(NULL, acl);
+        acl->enabled = true;
+        acl->is_blacklist = true;
+        for (int i = 0; i < SOCKET_FILTER_MAX_ACL_ENTRIES + 10; i++) {
+                snprintf(mac, sizeof(mac), "02:00:00:00:%02x:%02x", (i >> 8) & 0xff, i & 0xff);
+                llist_append(acl->entries, strdup(mac), true);
+        }
+
+        /* Entries which do not fit are left out */
+        ASSERT_EQ(SOCKET_FILTER_HEADER_INSNS + 1 + SOCKET_FILTER_MAX_ACL_ENTRIES * SOCKET_FILTER_ACL_ENTRY_INSNS,
+                  socket_filter_build(acl, code, BPF_MAXINSNS));
+
+        /* Disabled ACL is not compiled in */
+        acl->enabled = false;
+        ASSERT_EQ(SOCKET_FILTER_HEADER_INSNS + 1, socket_filter_build(acl, code, BPF_MAXINSNS));
+
+        ACL_destroy(&acl);
+        PASS();
+}
+
+SUITE(socket_filter)
+{
+        RUN_TEST(test_socket_filter_accepts_only_requests);
+        RUN_TEST(test_socket_filter_rejects_blacklisted_clients);
+        RUN_TEST(test_socket_filter_size_limit);
+}
@@ -13,6 +13,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/epoll.h>
 #include <utils/llist.h>
 #include <cclog_macros.h>
 #include "database.h"
@@ -40,13 +41,13 @@ void test_database()
         }
 
         dhcp_message_t *m = NULL;
-        llist_foreach(t->messages_ll, {
-                m = (dhcp_message_t*)node->data;
+        for (uint8_t i = 0; i < t->num_of_messages; i++) {
+                m = t->messages[i];
                 // dhcp_packet_parse(m);
 
                 printf("type: %s", rfc2131_dhcp_message_type_to_str(m->type));
-                dhcp_packet_dump(&m->packet);
-        })
+                dhcp_packet_dump(m->packet);
+        }
 
         return;
 }
@@ -61,20 +62,38 @@ void test_dhcp_snooper()
 
         dhcp_server_t server = {0};
         strcpy(server.config.interface, "eno1");
-        // if_failed(init_dhcp_server(&server), error);
+        server.epoll_fd = epoll_create1(0);
+        server.timers.wheel = timer_wheel_new(1000);
+        if_null(server.timers.wheel, error);
         
         char *msg = NULL;
 
         llist_t *whitelist = llist_new();
         if_null(whitelist, error);
-        // uint32_t address = ipv4_address_to_uint32("192.168.0.1");
-        // llist_append(whitelist, &address, false);
+        // uint32_t *address = malloc(sizeof(uint32_t));
+        // *address = ipv4_address_to_uint32("192.168.0.1");
+        // llist_append(whitelist, address, true);
+
+        int id = dhcp_snooper_start_scan(&server, "a8:a5:fb:b8:61:3d", whitelist);
+        if_failed(id, error);
 
-        int rv = dhcp_snooper_perform_scan(&server, "a8:a5:fb:b8:61:3d", whitelist, &msg);
+        /* Minimal event loop, wheel is advanced once per second */
+        struct epoll_event ev;
+        int rv = DHCP_SNOOP_SCAN_RUNNING;
+        while (rv == DHCP_SNOOP_SCAN_RUNNING) {
+                if (epoll_wait(server.epoll_fd, &ev, 1, 1000) > 0)
+                        dhcp_snooper_handle_fd(ev.data.fd);
+                else
+                        timer_wheel_advance(server.timers.wheel, 1);
+
+                rv = dhcp_snooper_scan_result(id, &msg);
+        }
 
         printf("RV = %d\nMSG = %s\n", rv, msg);
+        free(msg);
+        timer_wheel_destroy(&server.timers.wheel);
+        close(server.epoll_fd);
         return;
 error:
         printf("erorr\n");
 }
-
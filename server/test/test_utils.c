@@ -0,0 +1,27 @@
+#include "tests.h"
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+int open_loopback_socket(struct sockaddr_in *addr)
+{
+        socklen_t len = sizeof(struct sockaddr_in);
+        int fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+        if (fd < 0)
+                return -1;
+
+        memset(addr, 0, sizeof(struct sockaddr_in));
+        addr->sin_family = AF_INET;
+        addr->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr->sin_port = 0;
+
+        if (bind(fd, (struct sockaddr*)addr, len) < 0 ||
+            getsockname(fd, (struct sockaddr*)addr, &len) < 0) {
+                close(fd);
+                return -1;
+        }
+
+        return fd;
+}
@@ -2,6 +2,7 @@
 #define SERVER_TESTS
 
 #include "greatest.h"
+#include <netinet/in.h>
 
 // #define __RUN_TIMER_TESTS__
 
@@ -17,9 +18,19 @@ SUITE(transaction);
 SUITE(timer);
 SUITE(config);
 SUITE(security);
+SUITE(io_batch);
+SUITE(uring);
+SUITE(raw_tx);
+SUITE(ingress);
+SUITE(option_cache);
+SUITE(socket_filter);
+SUITE(xdp_filter);
 
 void test_manual();
 
+/* Create UDP socket bound to random port on loopback, stores the address in addr */
+int open_loopback_socket(struct sockaddr_in *addr);
+
 #ifdef __PIPELINE_BUILD
 #define SKIP_IF_PIPELINE_BUILD SKIP();
 #else 
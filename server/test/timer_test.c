@@ -189,7 +189,169 @@ TEST test_timer_expire_call_cb_null()
         PASS();
 }
 
+static int count_callback(uint32_t time, void *data)
+{
+        (*(int*)data)++;
+        return 0;
+}
+
+TEST test_timer_wheel_expire()
+{
+        timer_wheel_t *wheel = timer_wheel_new(500);
+        ASSERT_NEQ(NULL, wheel);
+        struct timer *t = timer_new(TIMER_ONCE, 10, false, count_callback);
+        ASSERT_NEQ(NULL, t);
+        int calls = 0;
+
+        /* Stopped timer is not scheduled until started */
+        ASSERT_EQ(0, timer_wheel_attach(wheel, t, &calls));
+        ASSERT_EQ(0, wheel->count);
+        ASSERT_EQ(0, timer_wheel_advance(wheel, 100));
+        timer_start(t);
+        ASSERT_EQ(1, wheel->count);
+
+        /* 10 seconds are 20 ticks of 500 ms */
+        ASSERT_EQ(0, timer_wheel_advance(wheel, 19));
+        ASSERT_EQ(0, calls);
+        ASSERT_EQ(1, timer_wheel_advance(wheel, 1));
+        ASSERT_EQ(1, calls);
+        ASSERT_EQ(false, t->is_running);
+        ASSERT_EQ(10, t->rtime);
+        ASSERT_EQ(0, wheel->count);
+
+        ASSERT_EQ(0, timer_wheel_advance(wheel, 100));
+        ASSERT_EQ(1, calls);
+
+        timer_destroy(&t);
+        timer_wheel_destroy(&wheel);
+        ASSERT_EQ(NULL, wheel);
+        PASS();
+}
+
+TEST test_timer_wheel_stop_and_repeat()
+{
+        timer_wheel_t *wheel = timer_wheel_new(1000);
+        ASSERT_NEQ(NULL, wheel);
+        struct timer *once = timer_new(TIMER_ONCE, 10, true, count_callback);
+        struct timer *repeat = timer_new(TIMER_REPEAT, 3, true, count_callback);
+        ASSERT_NEQ(NULL, once);
+        ASSERT_NEQ(NULL, repeat);
+        int once_calls = 0;
+        int repeat_calls = 0;
+
+        /* Running timers are scheduled when attached */
+        ASSERT_EQ(0, timer_wheel_attach(wheel, once, &once_calls));
+        ASSERT_EQ(0, timer_wheel_attach(wheel, repeat, &repeat_calls));
+        ASSERT_EQ(2, wheel->count);
+
+        /* Stopped timer keeps remaining time */
+        timer_wheel_advance(wheel, 4);
+        timer_stop(once);
+        ASSERT_EQ(6, once->rtime);
+        timer_wheel_advance(wheel, 20);
+        ASSERT_EQ(0, once_calls);
+        timer_start(once);
+        timer_wheel_advance(wheel, 5);
+        ASSERT_EQ(0, once_calls);
+        timer_wheel_advance(wheel, 1);
+        ASSERT_EQ(1, once_calls);
+
+        /* 30 ticks elapsed, repeating timer fired every 3 */
+        ASSERT_EQ(10, repeat_calls);
+        ASSERT_EQ(true, repeat->is_running);
+
+        /* Reset timer starts from default time, stop and start keep it */
+        timer_reset(once);
+        timer_stop(once);
+        timer_start(once);
+        ASSERT_EQ(10, once->rtime);
+
+        /* Destroyed timer is removed from the wheel */
+        timer_destroy(&repeat);
+        timer_destroy(&once);
+        ASSERT_EQ(0, wheel->count);
+
+        timer_wheel_destroy(&wheel);
+        PASS();
+}
+
+TEST test_timer_wheel_long_timers()
+{
+        timer_wheel_t *wheel = timer_wheel_new(1000);
+        ASSERT_NEQ(NULL, wheel);
+        /* Timers in every level of the wheel and one beyond its range */
+        uint32_t seconds[] = {1, 63, 64, 65, 4095, 4096, 300000, 16777215, 16777216, 20000000};
+        struct timer *t[10];
+        int calls[10] = {0};
+
+        for (int i = 0; i < 10; i++) {
+                t[i] = timer_new(TIMER_ONCE, seconds[i], true, count_callback);
+                ASSERT_NEQ(NULL, t[i]);
+                ASSERT_EQ(0, timer_wheel_attach(wheel, t[i], &calls[i]));
+        }
+
+        /* Every timer fires exactly at its tick */
+        uint64_t elapsed = 0;
+        for (int i = 0; i < 10; i++) {
+                timer_wheel_advance(wheel, seconds[i] - 1 - elapsed);
+                ASSERT_EQ_FMT(0, calls[i], "%d");
+                timer_wheel_advance(wheel, 1);
+                ASSERT_EQ_FMT(1, calls[i], "%d");
+                elapsed = seconds[i];
+        }
+        ASSERT_EQ(0, wheel->count);
+        ASSERT_EQ(10, wheel->stats.expired);
+
+        for (int i = 0; i < 10; i++)
+                timer_destroy(&t[i]);
+        timer_wheel_destroy(&wheel);
+        PASS();
+}
+
+struct stop_args {
+        struct timer *other;
+        int calls;
+};
+
+static int stop_other_callback(uint32_t time, void *data)
+{
+        struct stop_args *args = data;
+
+        args->calls++;
+        timer_stop(args->other);
+        return 0;
+}
+
+TEST test_timer_wheel_callback_stops_timer_in_same_slot()
+{
+        timer_wheel_t *wheel = timer_wheel_new(1000);
+        ASSERT_NEQ(NULL, wheel);
+        struct timer *a = timer_new(TIMER_ONCE, 5, true, stop_other_callback);
+        struct timer *b = timer_new(TIMER_ONCE, 5, true, stop_other_callback);
+        struct stop_args a_args = { .other = NULL };
+        struct stop_args b_args = { .other = NULL };
+        a_args.other = b;
+        b_args.other = a;
+
+        ASSERT_EQ(0, timer_wheel_attach(wheel, a, &a_args));
+        ASSERT_EQ(0, timer_wheel_attach(wheel, b, &b_args));
+
+        /* Whichever expires first stops the other one */
+        ASSERT_EQ(1, timer_wheel_advance(wheel, 5));
+        ASSERT_EQ(1, a_args.calls + b_args.calls);
+        ASSERT_EQ(0, wheel->count);
+
+        timer_destroy(&a);
+        timer_destroy(&b);
+        timer_wheel_destroy(&wheel);
+        PASS();
+}
+
 SUITE(timer) {
+        RUN_TEST(test_timer_wheel_expire);
+        RUN_TEST(test_timer_wheel_stop_and_repeat);
+        RUN_TEST(test_timer_wheel_long_timers);
+        RUN_TEST(test_timer_wheel_callback_stops_timer_in_same_slot);
         RUN_TEST(test_timer_new_and_destroy);
         RUN_TEST(test_timer_start);
         RUN_TEST(test_timer_stop);
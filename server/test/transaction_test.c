@@ -3,9 +3,10 @@
 #include "allocator.h"
 #include "dhcp_packet.h"
 #include "dhcp_server.h"
+#include "lease.h"
+#include "message_slab.h"
 #include "greatest.h"
 #include "tests.h"
-#include "timer_args.h"
 #include "transaction.h"
 #include "utils/xtoy.h"
 #include <stdint.h>
@@ -42,7 +43,7 @@ TEST test_trans_new_and_destroy()
 {
         transaction_t *t = trans_new(60);
         ASSERT_NEQ(NULL, t);
-        ASSERT_NEQ(NULL, t->messages_ll);
+        ASSERT_EQ(0, t->num_of_messages);
 
         trans_destroy(&t);
         ASSERT_EQ(NULL, t);
@@ -52,7 +53,7 @@ TEST test_trans_new_and_destroy()
 TEST test_transaction_add() {
         transaction_t *t = trans_new(60);
         ASSERT_NEQ(NULL, t);
-        ASSERT_NEQ(NULL, t->messages_ll);
+        ASSERT_EQ(0, t->num_of_messages);
         
         dhcp_message_t *msg1 = calloc(1, sizeof(dhcp_message_t));
         dhcp_message_t *msg2 = calloc(1, sizeof(dhcp_message_t));
@@ -76,7 +77,7 @@ TEST test_transaction_add() {
 TEST test_transaction_add_mismatched_xid() {
         transaction_t *t = trans_new(60);
         ASSERT_NEQ(NULL, t);
-        ASSERT_NEQ(NULL, t->messages_ll);
+        ASSERT_EQ(0, t->num_of_messages);
         
         dhcp_message_t *msg1 = calloc(1, sizeof(dhcp_message_t));
         dhcp_message_t *msg2 = calloc(1, sizeof(dhcp_message_t));
@@ -174,7 +175,7 @@ TEST test_cache_init_and_destroy()
         transaction_cache_t *cache = trans_cache_new(15, 60);
         ASSERT_NEQ(NULL, cache);
         for (int i = 0; i < 15; i++)
-                ASSERT_EQ(false, cache->transactions[i]->timer->is_running);
+                ASSERT_EQ(false, trans_cache_slot(cache, i)->timer.is_running);
 
         trans_cache_destroy(&cache);
         ASSERT_EQ(NULL, cache);
@@ -193,9 +194,9 @@ TEST test_cache_add_message()
         msg1->xid = 0x5555;
         
         ASSERT_EQ(0, trans_cache_add_message(cache, msg1));
-        ASSERT_EQ(true, cache->transactions[0]->timer->is_running);
-        ASSERT_EQ(1, cache->transactions[0]->num_of_messages);
-        ASSERT_EQ(0x5555, cache->transactions[0]->xid);
+        ASSERT_EQ(true, trans_cache_slot(cache, 0)->timer.is_running);
+        ASSERT_EQ(1, trans_cache_slot(cache, 0)->num_of_messages);
+        ASSERT_EQ(0x5555, trans_cache_slot(cache, 0)->xid);
 
         trans_cache_destroy(&cache);
         PASS();
@@ -217,9 +218,9 @@ TEST test_cache_add_multiple_messages_to_same_transaction()
         
         ASSERT_EQ(0, trans_cache_add_message(cache, msg1));
         ASSERT_EQ(0, trans_cache_add_message(cache, msg2));
-        ASSERT_EQ(true, cache->transactions[0]->timer->is_running);
-        ASSERT_EQ(2, cache->transactions[0]->num_of_messages);
-        ASSERT_EQ(0x5555, cache->transactions[0]->xid);
+        ASSERT_EQ(true, trans_cache_slot(cache, 0)->timer.is_running);
+        ASSERT_EQ(2, trans_cache_slot(cache, 0)->num_of_messages);
+        ASSERT_EQ(0x5555, trans_cache_slot(cache, 0)->xid);
         
         trans_cache_destroy(&cache);
         PASS();
@@ -252,15 +253,15 @@ TEST test_cache_add_multiple_messages_to_different_transactions()
         ASSERT_EQ(0, trans_cache_add_message(cache, msg3));
         ASSERT_EQ(0, trans_cache_add_message(cache, msg4));
         
-        ASSERT_EQ(true, cache->transactions[0]->timer->is_running);
-        ASSERT_EQ(true, cache->transactions[1]->timer->is_running);
-        ASSERT_EQ(true, cache->transactions[2]->timer->is_running);
-        ASSERT_EQ(1, cache->transactions[0]->num_of_messages);
-        ASSERT_EQ(2, cache->transactions[1]->num_of_messages);
-        ASSERT_EQ(1, cache->transactions[2]->num_of_messages);
-        ASSERT_EQ(0x5555, cache->transactions[0]->xid);
-        ASSERT_EQ(0x6666, cache->transactions[1]->xid);
-        ASSERT_EQ(0x7777, cache->transactions[2]->xid);
+        ASSERT_EQ(true, trans_cache_slot(cache, 0)->timer.is_running);
+        ASSERT_EQ(true, trans_cache_slot(cache, 1)->timer.is_running);
+        ASSERT_EQ(true, trans_cache_slot(cache, 2)->timer.is_running);
+        ASSERT_EQ(1, trans_cache_slot(cache, 0)->num_of_messages);
+        ASSERT_EQ(2, trans_cache_slot(cache, 1)->num_of_messages);
+        ASSERT_EQ(1, trans_cache_slot(cache, 2)->num_of_messages);
+        ASSERT_EQ(0x5555, trans_cache_slot(cache, 0)->xid);
+        ASSERT_EQ(0x6666, trans_cache_slot(cache, 1)->xid);
+        ASSERT_EQ(0x7777, trans_cache_slot(cache, 2)->xid);
         
         trans_cache_destroy(&cache);
         PASS();
@@ -281,17 +282,22 @@ TEST test_cache_overflow_cache_size()
                 ASSERT_EQ(0, trans_cache_add_message(cache, msg1));
         }
 
+        /* Cache without memory limit cannot grow, the oldest transactions make room */
         msg1->xid = 5000;
-        ASSERT_EQ(-1, trans_cache_add_message(cache, msg1));
+        ASSERT_EQ(0, trans_cache_add_message(cache, msg1));
         msg1->xid = 6000;
-        ASSERT_EQ(-1, trans_cache_add_message(cache, msg1));
+        ASSERT_EQ(0, trans_cache_add_message(cache, msg1));
+        ASSERT_EQ(15, cache->size);
+        ASSERT_EQ(2, cache->stats.evicted);
+        ASSERT_EQ(NULL, trans_cache_retrieve_transaction(cache, 1000));
+        ASSERT_EQ(NULL, trans_cache_retrieve_transaction(cache, 1001));
         
-        ASSERT_EQ(1, cache->transactions[0]->num_of_messages);
-        ASSERT_EQ(1, cache->transactions[1]->num_of_messages);
-        ASSERT_EQ(1, cache->transactions[2]->num_of_messages);
-        ASSERT_EQ(1000, cache->transactions[0]->xid);
-        ASSERT_EQ(1001, cache->transactions[1]->xid);
-        ASSERT_EQ(1002, cache->transactions[2]->xid);
+        ASSERT_EQ(1, trans_cache_slot(cache, 0)->num_of_messages);
+        ASSERT_EQ(1, trans_cache_slot(cache, 1)->num_of_messages);
+        ASSERT_EQ(1, trans_cache_slot(cache, 2)->num_of_messages);
+        ASSERT_EQ(5000, trans_cache_slot(cache, 0)->xid);
+        ASSERT_EQ(6000, trans_cache_slot(cache, 1)->xid);
+        ASSERT_EQ(1002, trans_cache_slot(cache, 2)->xid);
         
         trans_cache_destroy(&cache);
         PASS();
@@ -317,6 +323,175 @@ TEST test_cache_retrieve_transaction()
         PASS();
 }
 
+TEST test_cache_large_release_and_reuse()
+{
+        const uint32_t size = 100000;
+        transaction_cache_t *cache = trans_cache_new(size, 60);
+        ASSERT_NEQ(NULL, cache);
+        
+        dhcp_message_t *msg1 = calloc(1, sizeof(dhcp_message_t));
+        ASSERT_NEQ(NULL, msg1);
+        msg1->type = DHCP_DISCOVER;
+
+        /* Xids differing only in high bits must not end up in one probe sequence */
+        for (uint32_t i = 0; i < size; i++) {
+                msg1->xid = (i << 16) | (i >> 16);
+                ASSERT_EQ(0, trans_cache_add_message(cache, msg1));
+        }
+        ASSERT_EQ(0, cache->free_count);
+
+        /* Every other transaction expires, the rest stays reachable */
+        for (uint32_t i = 0; i < size; i += 2)
+                trans_cache_release(cache, trans_cache_retrieve_transaction(cache, (i << 16) | (i >> 16)));
+        ASSERT_EQ(size / 2, cache->free_count);
+
+        for (uint32_t i = 0; i < size; i++) {
+                transaction_t *t = trans_cache_retrieve_transaction(cache, (i << 16) | (i >> 16));
+                if (i % 2) {
+                        ASSERT_NEQ(NULL, t);
+                        ASSERT_EQ((i << 16) | (i >> 16), t->xid);
+                } else {
+                        ASSERT_EQ(NULL, t);
+                }
+        }
+
+        /* Released slot is reused first, releasing free slot does nothing */
+        transaction_t *last = trans_cache_slot(cache, size - 2);
+        trans_cache_release(cache, last);
+        ASSERT_EQ(size / 2, cache->free_count);
+        msg1->xid = 0xffffffff;
+        ASSERT_EQ(0, trans_cache_add_message(cache, msg1));
+        ASSERT_EQ(last, trans_cache_retrieve_transaction(cache, 0xffffffff));
+        ASSERT_EQ(0, trans_cache_add_message(cache, msg1));
+        ASSERT_EQ(2, last->num_of_messages);
+
+        trans_cache_destroy(&cache);
+        free(msg1);
+        PASS();
+}
+
+TEST test_cache_grow_evict_and_shrink()
+{
+        dhcp_server_t server = {0};
+        timer_wheel_t *wheel = timer_wheel_new(1000);
+        ASSERT_NEQ(NULL, wheel);
+
+        transaction_cache_t *cache = trans_cache_new(4, 60);
+        ASSERT_NEQ(NULL, cache);
+        ASSERT_EQ(0, trans_cache_schedule_on(cache, wheel, &server));
+        size_t initial_memory = trans_cache_memory(cache);
+
+        /* Memory limit allows 10 slots, cache grows by doubling and the last chunk is shorter */
+        trans_cache_set_memory_limit(cache, 10 * TRANS_CACHE_SLOT_BYTES);
+        ASSERT_EQ(10, cache->max_size);
+
+        dhcp_message_t *msg1 = calloc(1, sizeof(dhcp_message_t));
+        dhcp_message_t *ack = calloc(1, sizeof(dhcp_message_t));
+        ASSERT_NEQ(NULL, msg1);
+        ASSERT_NEQ(NULL, ack);
+        msg1->type = DHCP_DISCOVER;
+        ack->type = DHCP_ACK;
+        ack->xid = 100;
+
+        for (uint32_t i = 0; i < 10; i++) {
+                msg1->xid = 100 + i;
+                ASSERT_EQ(0, trans_cache_add_message(cache, msg1));
+        }
+        ASSERT_EQ(10, cache->size);
+        ASSERT_EQ(3, cache->chunk_count);
+        ASSERT_EQ(2, cache->stats.grown);
+        ASSERT_EQ(10, cache->stats.max_in_use);
+        ASSERT(trans_cache_memory(cache) > initial_memory);
+
+        /* Finished transaction is kept, the oldest pending one is evicted */
+        ASSERT_EQ(0, trans_cache_add_message(cache, ack));
+        msg1->xid = 200;
+        ASSERT_EQ(0, trans_cache_add_message(cache, msg1));
+        ASSERT_EQ(1, cache->stats.evicted);
+        ASSERT_NEQ(NULL, trans_cache_retrieve_transaction(cache, 100));
+        ASSERT_EQ(NULL, trans_cache_retrieve_transaction(cache, 101));
+        ASSERT_NEQ(NULL, trans_cache_retrieve_transaction(cache, 200));
+
+        /* Cache does not shrink while it is busy */
+        ASSERT_EQ(0, trans_cache_shrink(cache));
+
+        /* Timers of grown slots run on the wheel too, idle cache shrinks chunk by chunk */
+        timer_wheel_advance(wheel, 61);
+        ASSERT_EQ(0, trans_cache_in_use(cache));
+        ASSERT_EQ(1, trans_cache_shrink(cache));
+        ASSERT_EQ(8, cache->size);
+        ASSERT_EQ(1, trans_cache_shrink(cache));
+        ASSERT_EQ(4, cache->size);
+        ASSERT_EQ(0, trans_cache_shrink(cache));
+        ASSERT_EQ(2, cache->stats.shrunk);
+        ASSERT_EQ(initial_memory, trans_cache_memory(cache));
+        ASSERT_EQ(4, cache->free_count);
+
+        /* Cache can grow again */
+        for (uint32_t i = 0; i < 6; i++) {
+                msg1->xid = 300 + i;
+                ASSERT_EQ(0, trans_cache_add_message(cache, msg1));
+        }
+        ASSERT_EQ(8, cache->size);
+        for (uint32_t i = 0; i < 6; i++)
+                ASSERT_NEQ(NULL, trans_cache_retrieve_transaction(cache, 300 + i));
+
+        trans_cache_destroy(&cache);
+        timer_wheel_destroy(&wheel);
+        free(msg1);
+        free(ack);
+        PASS();
+}
+
+TEST test_cache_client_index()
+{
+        uint8_t client_a[6] = {0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0x01};
+        uint8_t client_b[6] = {0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0x02};
+
+        transaction_cache_t *cache = trans_cache_new(4, 60);
+        ASSERT_NEQ(NULL, cache);
+        trans_cache_set_memory_limit(cache, 16 * TRANS_CACHE_SLOT_BYTES);
+
+        /* Transactions keep references to messages, so each one has its own */
+        dhcp_message_t *msgs = calloc(8, sizeof(dhcp_message_t));
+        ASSERT_NEQ(NULL, msgs);
+        for (uint32_t i = 0; i < 8; i++) {
+                msgs[i].type = DHCP_DISCOVER;
+                msgs[i].xid = (i < 3) ? 100 + i : 200 + i;
+                memcpy(msgs[i].chaddr, (i < 3) ? client_a : client_b, 6);
+        }
+
+        /* Messages of running transaction are not counted again */
+        for (uint32_t i = 0; i < 4; i++) {
+                ASSERT_EQ(0, trans_cache_add_message(cache, &msgs[i]));
+                ASSERT_EQ(0, trans_cache_add_message(cache, &msgs[i]));
+        }
+        ASSERT_EQ(3, trans_cache_client_transactions(cache, client_a));
+        ASSERT_EQ(1, trans_cache_client_transactions(cache, client_b));
+
+        /* Counts survive rebuild of index when cache grows */
+        for (uint32_t i = 4; i < 8; i++)
+                ASSERT_EQ(0, trans_cache_add_message(cache, &msgs[i]));
+        ASSERT_EQ(1, cache->stats.grown);
+        ASSERT_EQ(3, trans_cache_client_transactions(cache, client_a));
+        ASSERT_EQ(5, trans_cache_client_transactions(cache, client_b));
+
+        /* Expired transactions are not counted, client without transactions is removed */
+        ASSERT_EQ(0, trans_expire(trans_cache_retrieve_transaction(cache, 203)));
+        ASSERT_EQ(4, trans_cache_client_transactions(cache, client_b));
+        for (uint32_t i = 0; i < 3; i++)
+                ASSERT_EQ(0, trans_expire(trans_cache_retrieve_transaction(cache, 100 + i)));
+        ASSERT_EQ(0, trans_cache_client_transactions(cache, client_a));
+        ASSERT_EQ(4, trans_cache_client_transactions(cache, client_b));
+
+        ASSERT_EQ(0, trans_cache_purge(cache));
+        ASSERT_EQ(0, trans_cache_client_transactions(cache, client_b));
+
+        trans_cache_destroy(&cache);
+        free(msgs);
+        PASS();
+}
+
 TEST test_cache_retrieve_non_existent_transaction()
 {
         transaction_cache_t *cache = trans_cache_new(15, 60);
@@ -399,10 +574,10 @@ TEST test_cache_purge()
         ASSERT_NEQ(NULL, cache);
 
         for(int i = 0; i < cache->size; i++) {
-                ASSERT_EQ(0, cache->transactions[i]->xid);
-                ASSERT_EQ(0, cache->transactions[i]->num_of_messages);
-                ASSERT_EQ(0, cache->transactions[i]->transaction_begin);
-                ASSERT_EQ(false, cache->transactions[i]->timer->is_running);
+                ASSERT_EQ(0, trans_cache_slot(cache, i)->xid);
+                ASSERT_EQ(0, trans_cache_slot(cache, i)->num_of_messages);
+                ASSERT_EQ(0, trans_cache_slot(cache, i)->transaction_begin);
+                ASSERT_EQ(false, trans_cache_slot(cache, i)->timer.is_running);
         }
 
         trans_cache_destroy(&cache);
@@ -411,17 +586,14 @@ TEST test_cache_purge()
 
 TEST test_cache_wait_until_transaction_is_finished()
 {
-#ifndef __RUN_TIMER_TESTS__
-        SKIP();
-#endif
-        
         dhcp_server_t server = {0};
-        trans_update_args_t args = {0};
-        args.server = &server;
+        timer_wheel_t *wheel = timer_wheel_new(1000);
+        ASSERT_NEQ(NULL, wheel);
         
         server.trans_cache = trans_cache_new(15, 60);
         transaction_cache_t *cache = server.trans_cache;
         ASSERT_NEQ(NULL, cache);
+        ASSERT_EQ(0, trans_cache_schedule_on(cache, wheel, &server));
         
         dhcp_message_t *msg1 = calloc(1, sizeof(dhcp_message_t));
         ASSERT_NEQ(NULL, msg1);
@@ -429,53 +601,52 @@ TEST test_cache_wait_until_transaction_is_finished()
         msg1->xid = 0x5555;
         
         ASSERT_EQ(0, trans_cache_add_message(cache, msg1));
-        ASSERT_EQ(true, cache->transactions[0]->timer->is_running);
-        ASSERT_EQ(1, cache->transactions[0]->num_of_messages);
-        ASSERT_EQ(0x5555, cache->transactions[0]->xid);
+        ASSERT_EQ(true, trans_cache_slot(cache, 0)->timer.is_running);
+        ASSERT_EQ(1, trans_cache_slot(cache, 0)->num_of_messages);
+        ASSERT_EQ(0x5555, trans_cache_slot(cache, 0)->xid);
 
         for (int i = 0; i < 65; i++) {
-                args.index = 0;
-                trans_update_timer(&args);
-                sleep(1);
+                timer_wheel_advance(wheel, 1);
 
                 /* Add another message */
                 if (i == 30) {
                         msg1->xid = 0x6666;
                         ASSERT_EQ(0, trans_cache_add_message(cache, msg1));
-                        ASSERT_EQ(true, cache->transactions[1]->timer->is_running);
-                        ASSERT_EQ(1, cache->transactions[1]->num_of_messages);
-                        ASSERT_EQ(0x6666, cache->transactions[1]->xid);
-                }
-                if (i >= 30) {
-                        args.index = 1;
-                        trans_update_timer(&args);
+                        ASSERT_EQ(true, trans_cache_slot(cache, 1)->timer.is_running);
+                        ASSERT_EQ(1, trans_cache_slot(cache, 1)->num_of_messages);
+                        ASSERT_EQ(0x6666, trans_cache_slot(cache, 1)->xid);
                 }
         }
 
-        ASSERT_EQ(false, cache->transactions[0]->timer->is_running);
-        ASSERT_EQ(0, cache->transactions[0]->num_of_messages);
-        ASSERT_EQ(0, cache->transactions[0]->xid);
+        ASSERT_EQ(false, trans_cache_slot(cache, 0)->timer.is_running);
+        ASSERT_EQ(0, trans_cache_slot(cache, 0)->num_of_messages);
+        ASSERT_EQ(0, trans_cache_slot(cache, 0)->xid);
         
-        ASSERT_EQ(true, cache->transactions[1]->timer->is_running);
-        ASSERT_EQ(1, cache->transactions[1]->num_of_messages);
-        ASSERT_EQ(0x6666, cache->transactions[1]->xid);
+        ASSERT_EQ(true, trans_cache_slot(cache, 1)->timer.is_running);
+        ASSERT_EQ(1, trans_cache_slot(cache, 1)->num_of_messages);
+        ASSERT_EQ(0x6666, trans_cache_slot(cache, 1)->xid);
 
         /* Add third message after first one is expired and second one is not */
         msg1->xid = 0x7777;
         ASSERT_EQ(0, trans_cache_add_message(cache, msg1));
-        ASSERT_EQ(true, cache->transactions[0]->timer->is_running);
-        ASSERT_EQ(1, cache->transactions[0]->num_of_messages);
-        ASSERT_EQ(0x7777, cache->transactions[0]->xid);
+        ASSERT_EQ(true, trans_cache_slot(cache, 0)->timer.is_running);
+        ASSERT_EQ(1, trans_cache_slot(cache, 0)->num_of_messages);
+        ASSERT_EQ(0x7777, trans_cache_slot(cache, 0)->xid);
+
+        /* Second transaction expires 60 ticks after it was started */
+        timer_wheel_advance(wheel, 25);
+        ASSERT_EQ(true, trans_cache_slot(cache, 1)->timer.is_running);
+        timer_wheel_advance(wheel, 1);
+        ASSERT_EQ(false, trans_cache_slot(cache, 1)->timer.is_running);
+        ASSERT_EQ(0, trans_cache_slot(cache, 1)->num_of_messages);
 
         trans_cache_destroy(&cache);
+        timer_wheel_destroy(&wheel);
         PASS();
 }
 
 TEST test_cache_wait_until_transaction_is_finished_return_address_to_pool()
 {
-#ifndef __RUN_TIMER_TESTS__
-        SKIP();
-#endif
         dhcp_server_t server = {0};
         server.allocator = address_allocator_new();
         ASSERT_NEQ(NULL, server.allocator);
@@ -483,12 +654,13 @@ TEST test_cache_wait_until_transaction_is_finished_return_address_to_pool()
         uint32_t addr_buff;
         ASSERT_EQ(ALLOCATOR_OK, allocator_request_this_address_str(server.allocator, "192.168.1.10", &addr_buff));
         ASSERT_EQ(false, allocator_is_address_available_str(server.allocator, "192.168.1.10"));
-        trans_update_args_t args = {0};
-        args.server = &server;
+        timer_wheel_t *wheel = timer_wheel_new(1000);
+        ASSERT_NEQ(NULL, wheel);
 
         server.trans_cache = trans_cache_new(15, 60);
         transaction_cache_t *cache = server.trans_cache;
         ASSERT_NEQ(NULL, cache);
+        ASSERT_EQ(0, trans_cache_schedule_on(cache, wheel, &server));
         
         dhcp_message_t *msg1 = calloc(1, sizeof(dhcp_message_t));
         ASSERT_NEQ(NULL, msg1);
@@ -496,53 +668,193 @@ TEST test_cache_wait_until_transaction_is_finished_return_address_to_pool()
         msg1->xid = 0x5555;
         dhcp_message_t *msg2 = calloc(1, sizeof(dhcp_message_t));
         ASSERT_NEQ(NULL, msg1);
+        dhcp_packet_t packet = {0};
+        msg2->packet = &packet;
         msg2->type = DHCP_OFFER;
         msg2->xid = 0x5555;
-        msg2->yiaddr = ipv4_address_to_uint32("192.168.1.10");
+        dhcp_message_set_yiaddr(msg2, ipv4_address_to_uint32("192.168.1.10"));
         
         ASSERT_EQ(0, trans_cache_add_message(cache, msg1));
         ASSERT_EQ(0, trans_cache_add_message(cache, msg2));
-        ASSERT_EQ(true, cache->transactions[0]->timer->is_running);
-        ASSERT_EQ(2, cache->transactions[0]->num_of_messages);
-        ASSERT_EQ(0x5555, cache->transactions[0]->xid);
+        ASSERT_EQ(true, trans_cache_slot(cache, 0)->timer.is_running);
+        ASSERT_EQ(2, trans_cache_slot(cache, 0)->num_of_messages);
+        ASSERT_EQ(0x5555, trans_cache_slot(cache, 0)->xid);
 
         for (int i = 0; i < 65; i++) {
-                args.index = 0;
-                trans_update_timer(&args);
-                sleep(1);
+                timer_wheel_advance(wheel, 1);
 
                 /* Add another message */
                 if (i == 30) {
                         msg1->xid = 0x6666;
                         ASSERT_EQ(0, trans_cache_add_message(cache, msg1));
-                        ASSERT_EQ(true, cache->transactions[1]->timer->is_running);
-                        ASSERT_EQ(1, cache->transactions[1]->num_of_messages);
-                        ASSERT_EQ(0x6666, cache->transactions[1]->xid);
-                }
-                if (i >= 30) {
-                        args.index = 1;
-                        trans_update_timer(&args);
+                        ASSERT_EQ(true, trans_cache_slot(cache, 1)->timer.is_running);
+                        ASSERT_EQ(1, trans_cache_slot(cache, 1)->num_of_messages);
+                        ASSERT_EQ(0x6666, trans_cache_slot(cache, 1)->xid);
                 }
         }
 
-        ASSERT_EQ(false, cache->transactions[0]->timer->is_running);
-        ASSERT_EQ(0, cache->transactions[0]->num_of_messages);
-        ASSERT_EQ(0, cache->transactions[0]->xid);
+        ASSERT_EQ(false, trans_cache_slot(cache, 0)->timer.is_running);
+        ASSERT_EQ(0, trans_cache_slot(cache, 0)->num_of_messages);
+        ASSERT_EQ(0, trans_cache_slot(cache, 0)->xid);
         /* Address should be available again */
         ASSERT_EQ(true, allocator_is_address_available_str(server.allocator, "192.168.1.10"));
         
-        ASSERT_EQ(true, cache->transactions[1]->timer->is_running);
-        ASSERT_EQ(1, cache->transactions[1]->num_of_messages);
-        ASSERT_EQ(0x6666, cache->transactions[1]->xid);
+        ASSERT_EQ(true, trans_cache_slot(cache, 1)->timer.is_running);
+        ASSERT_EQ(1, trans_cache_slot(cache, 1)->num_of_messages);
+        ASSERT_EQ(0x6666, trans_cache_slot(cache, 1)->xid);
 
         /* Add third message after first one is expired and second one is not */
         msg1->xid = 0x7777;
         ASSERT_EQ(0, trans_cache_add_message(cache, msg1));
-        ASSERT_EQ(true, cache->transactions[0]->timer->is_running);
-        ASSERT_EQ(1, cache->transactions[0]->num_of_messages);
-        ASSERT_EQ(0x7777, cache->transactions[0]->xid);
+        ASSERT_EQ(true, trans_cache_slot(cache, 0)->timer.is_running);
+        ASSERT_EQ(1, trans_cache_slot(cache, 0)->num_of_messages);
+        ASSERT_EQ(0x7777, trans_cache_slot(cache, 0)->xid);
 
         trans_cache_destroy(&cache);
+        timer_wheel_destroy(&wheel);
+        allocator_destroy(&server.allocator);
+        PASS();
+}
+
+TEST test_transaction_holds_message_reference()
+{
+        transaction_t *t = trans_new(60);
+        message_slab_t *slab = message_slab_new(2, 2);
+        ASSERT_NEQ(NULL, t);
+        ASSERT_NEQ(NULL, slab);
+
+        dhcp_message_t *m = message_slab_alloc(slab);
+        ASSERT_NEQ(NULL, m);
+        ASSERT_EQ(1, m->refs);
+        ASSERT_EQ(1, slab->free_count);
+        m->type = DHCP_DISCOVER;
+        m->xid = 0x5555;
+
+        /* Transaction stores the same message, not a copy */
+        ASSERT_EQ(0, trans_add(t, m));
+        ASSERT_EQ(2, m->refs);
+        ASSERT_EQ(m, trans_get_index(t, 0));
+
+        dhcp_message_t *held = m;
+        dhcp_message_unref(&m);
+        ASSERT_EQ(NULL, m);
+        ASSERT_EQ(1, held->refs);
+        ASSERT_EQ(1, slab->free_count);
+
+        /* Dropping the last reference returns message to slab */
+        trans_clear(t);
+        ASSERT_EQ(0, t->num_of_messages);
+        ASSERT_EQ(2, slab->free_count);
+
+        trans_destroy(&t);
+        message_slab_destroy(&slab);
+        ASSERT_EQ(NULL, slab);
+        PASS();
+}
+
+TEST test_transaction_add_too_many_messages()
+{
+        transaction_t *t = trans_new(60);
+        ASSERT_NEQ(NULL, t);
+
+        dhcp_message_t m = {0};
+        m.type = DHCP_DISCOVER;
+        m.xid = 0x5555;
+
+        for (int i = 0; i < TRANS_MAX_MESSAGES; i++)
+                ASSERT_EQ(0, trans_add(t, &m));
+        ASSERT_EQ(-1, trans_add(t, &m));
+        ASSERT_EQ(TRANS_MAX_MESSAGES, t->num_of_messages);
+
+        trans_destroy(&t);
+        PASS();
+}
+
+TEST test_message_slab_fallback()
+{
+        message_slab_t *slab = message_slab_new(1, 1);
+        ASSERT_NEQ(NULL, slab);
+
+        dhcp_message_t *m1 = message_slab_alloc(slab);
+        dhcp_message_t *m2 = message_slab_alloc(slab);
+        ASSERT_NEQ(NULL, m1);
+        ASSERT_NEQ(NULL, m2);
+        ASSERT_EQ(slab, m1->slab);
+        ASSERT_EQ(NULL, m2->slab);
+        ASSERT_EQ(2, slab->stats.allocs);
+        ASSERT_EQ(1, slab->stats.fallbacks);
+        ASSERT_EQ(1, slab->stats.max_in_use);
+
+        dhcp_message_unref(&m1);
+        dhcp_message_unref(&m2);
+        ASSERT_EQ(1, slab->free_count);
+
+        /* Reused message is cleared */
+        m1 = message_slab_alloc(slab);
+        ASSERT_EQ(0, m1->xid);
+        ASSERT_NEQ(NULL, m1->work->dhcp_options);
+        ASSERT_EQ(NULL, m1->work->dhcp_options->first);
+        dhcp_message_unref(&m1);
+
+        message_slab_destroy(&slab);
+        PASS();
+}
+
+TEST test_message_slab_compact()
+{
+        transaction_t *t = trans_new(60);
+        message_slab_t *slab = message_slab_new(4, 1);
+        ASSERT_NEQ(NULL, t);
+        ASSERT_NEQ(NULL, slab);
+
+        /* Request padded to 300 bytes by client */
+        uint8_t options[] = {DHCP_OPTION_DHCP_MESSAGE_TYPE, 1, DHCP_DISCOVER, 
+                             DHCP_OPTION_CLIENT_IDENTIFIER, 3, 1, 2, 3, DHCP_OPTION_END};
+        dhcp_message_t *m = message_slab_alloc(slab);
+        ASSERT_NEQ(NULL, m);
+        ASSERT_EQ(&m->work->packet, m->packet);
+        dhcp_message_set_cookie(m, MAGIC_COOKIE);
+        dhcp_message_set_yiaddr(m, 0xc0a8010a);
+        memcpy(m->packet->options, options, sizeof(options));
+        m->packet_lenght = DHCP_PACKET_MIN_SIZE;
+        ASSERT_EQ(0, dhcp_packet_parse(m));
+        ASSERT_EQ(0, trans_add(t, m));
+
+        /* Only one message can have work buffers, next one comes from heap */
+        dhcp_message_t *other = message_slab_alloc(slab);
+        ASSERT_EQ(NULL, other->slab);
+        dhcp_message_unref(&other);
+
+        /* Stored message keeps header and options up to END in the smallest buffer */
+        ASSERT_EQ(0, dhcp_message_compact(m));
+        ASSERT_EQ(NULL, m->work);
+        ASSERT_EQ(DHCP_PACKET_HEADER_SIZE + sizeof(options), m->packet_lenght);
+        ASSERT_EQ(1, slab->free_work_count);
+        ASSERT_EQ(slab->classes[0].count - 1, slab->classes[0].free_count);
+        ASSERT_EQ(0xc0a8010a, dhcp_message_yiaddr(m));
+
+        /* Options are found without view */
+        uint8_t lenght = 0;
+        uint32_t type = 0;
+        const uint8_t *client_id = dhcp_message_option(m, DHCP_OPTION_CLIENT_IDENTIFIER, &lenght);
+        ASSERT_NEQ(NULL, client_id);
+        ASSERT_EQ(3, lenght);
+        ASSERT_MEM_EQ(options + 5, client_id, 3);
+        ASSERT_EQ(0, dhcp_message_option_number(m, DHCP_OPTION_DHCP_MESSAGE_TYPE, &type));
+        ASSERT_EQ(DHCP_DISCOVER, type);
+        ASSERT_EQ(NULL, dhcp_message_option(m, DHCP_OPTION_HOST_NAME, NULL));
+
+        /* Work buffers are free for next message, packet buffer returns with the message */
+        other = message_slab_alloc(slab);
+        ASSERT_EQ(slab, other->slab);
+        dhcp_message_unref(&other);
+        dhcp_message_unref(&m);
+        trans_clear(t);
+        ASSERT_EQ(4, slab->free_count);
+        ASSERT_EQ(slab->classes[0].count, slab->classes[0].free_count);
+
+        trans_destroy(&t);
+        message_slab_destroy(&slab);
         PASS();
 }
 
@@ -554,6 +866,10 @@ SUITE(transaction)
         RUN_TEST(test_transaction_get_index);
         RUN_TEST(test_tramsaction_search_for);
         RUN_TEST(test_tramsaction_search_for_last);
+        RUN_TEST(test_transaction_holds_message_reference);
+        RUN_TEST(test_transaction_add_too_many_messages);
+        RUN_TEST(test_message_slab_fallback);
+        RUN_TEST(test_message_slab_compact);
 
         RUN_TEST(test_cache_init_and_destroy);
         RUN_TEST(test_cache_add_message);
@@ -561,10 +877,15 @@ SUITE(transaction)
         RUN_TEST(test_cache_add_multiple_messages_to_different_transactions);
         RUN_TEST(test_cache_overflow_cache_size);
         RUN_TEST(test_cache_retrieve_transaction);
+        RUN_TEST(test_cache_large_release_and_reuse);
+        RUN_TEST(test_cache_grow_evict_and_shrink);
+        RUN_TEST(test_cache_client_index);
         RUN_TEST(test_cache_retrieve_non_existent_transaction);
         RUN_TEST(test_cache_retrieve_messages_from_transaction);
         RUN_TEST(test_cache_purge);
         RUN_TEST(test_cache_wait_until_transaction_is_finished);
         RUN_TEST(test_cache_wait_until_transaction_is_finished_return_address_to_pool);
+
+        lease_index_clear();
 }
 
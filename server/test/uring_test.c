@@ -0,0 +1,153 @@
+#include "greatest.h"
+#include "tests.h"
+#include <uring.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#ifdef CONFIG_IO_URING
+typedef struct uring_test_ctx {
+        uint32_t count;
+        uint32_t xids[8];
+        size_t len;
+} uring_test_ctx_t;
+
+static void uring_test_rx(void *priv, dhcp_message_t *message, size_t len)
+{
+        uring_test_ctx_t *ctx = priv;
+        if (ctx->count < 8)
+                ctx->xids[ctx->count] = ntohl(message->packet->xid);
+        ctx->count++;
+        ctx->len = len;
+}
+#endif
+
+TEST test_uring_receive_and_send()
+{
+#ifndef CONFIG_IO_URING
+        SKIP();
+#else
+        struct sockaddr_in srv_addr, cli_addr;
+        int srv_fd = open_loopback_socket(&srv_addr);
+        int cli_fd = open_loopback_socket(&cli_addr);
+        if (srv_fd < 0 || cli_fd < 0)
+                SKIP();
+
+        uring_t *ring = uring_new(srv_fd, 4, NULL);
+        /* Kernel without io_uring, server would fall back to io_batch */
+        if (!ring)
+                SKIP();
+        ASSERT_EQ(4, ring->nbufs);
+        ASSERT_EQ(8, ring->tx_free_count);
+
+        /* 6 datagrams into 4 buffers, buffers are recycled after each callback */
+        dhcp_packet_t p = {0};
+        uring_test_ctx_t ctx = {0};
+        for (uint32_t i = 0; i < 6; i++) {
+                p.xid = htonl(0x2000 + i);
+                ASSERT_EQ(sizeof(dhcp_packet_t), sendto(cli_fd, &p, sizeof(p), 0,
+                                (struct sockaddr*)&srv_addr, sizeof(srv_addr)));
+
+                struct pollfd pfd = { .fd = ring->event_fd, .events = POLLIN };
+                ASSERT_EQ(1, poll(&pfd, 1, 1000));
+                uint64_t count;
+                ASSERT_EQ(sizeof(count), read(ring->event_fd, &count, sizeof(count)));
+                ASSERT_EQ(1, uring_receive(ring, uring_test_rx, &ctx));
+        }
+        ASSERT_EQ(6, ctx.count);
+        ASSERT_EQ(sizeof(dhcp_packet_t), ctx.len);
+        for (uint32_t i = 0; i < 6; i++)
+                ASSERT_EQ(0x2000 + i, ctx.xids[i]);
+        ASSERT_EQ(6, ring->stats.rx_packets);
+
+        /* 10 replies with 8 send slots forces reclaim of completed slots */
+        for (uint32_t i = 0; i < 10; i++) {
+                p.xid = htonl(0x3000 + i);
+                ASSERT_EQ(0, uring_queue_send(ring, &p, sizeof(p), &cli_addr));
+        }
+        ASSERT_EQ(0, uring_flush(ring));
+
+        for (uint32_t i = 0; i < 10; i++) {
+                struct pollfd pfd = { .fd = cli_fd, .events = POLLIN };
+                ASSERT_EQ(1, poll(&pfd, 1, 1000));
+                ASSERT_EQ(sizeof(dhcp_packet_t), recv(cli_fd, &p, sizeof(p), 0));
+                ASSERT_EQ(0x3000 + i, ntohl(p.xid));
+        }
+
+        uring_destroy(&ring);
+        ASSERT_EQ(NULL, ring);
+        close(srv_fd);
+        close(cli_fd);
+        PASS();
+#endif
+}
+
+TEST test_uring_reclaim_with_pending_receive()
+{
+#ifndef CONFIG_IO_URING
+        SKIP();
+#else
+        struct sockaddr_in srv_addr, cli_addr;
+        int srv_fd = open_loopback_socket(&srv_addr);
+        int cli_fd = open_loopback_socket(&cli_addr);
+        if (srv_fd < 0 || cli_fd < 0)
+                SKIP();
+
+        uring_t *ring = uring_new(srv_fd, 2, NULL);
+        if (!ring)
+                SKIP();
+        ASSERT_EQ(4, ring->tx_free_count);
+
+        /* Receive completions are queued ahead of completions of the sends below */
+        dhcp_packet_t p = {0};
+        for (uint32_t i = 0; i < 2; i++) {
+                p.xid = htonl(0x4000 + i);
+                ASSERT_EQ(sizeof(dhcp_packet_t), sendto(cli_fd, &p, sizeof(p), 0,
+                                (struct sockaddr*)&srv_addr, sizeof(srv_addr)));
+        }
+        struct pollfd pfd = { .fd = ring->event_fd, .events = POLLIN };
+        ASSERT_EQ(1, poll(&pfd, 1, 1000));
+
+        /* Sixth reply finds all slots used, reclaim has to step over receive completions */
+        for (uint32_t i = 0; i < 6; i++) {
+                p.xid = htonl(0x5000 + i);
+                ASSERT_EQ(0, uring_queue_send(ring, &p, sizeof(p), &cli_addr));
+        }
+        ASSERT_EQ(0, ring->stats.tx_dropped);
+        ASSERT(ring->stash_count > 0);
+
+        /* Stashed datagrams are not lost */
+        uring_test_ctx_t ctx = {0};
+        for (int tries = 0; ctx.count < 2 && tries < 10; tries++) {
+                ASSERT(uring_receive(ring, uring_test_rx, &ctx) >= 0);
+                if (ctx.count < 2)
+                        poll(&pfd, 1, 100);
+        }
+        ASSERT_EQ(2, ctx.count);
+        ASSERT_EQ(0x4000, ctx.xids[0]);
+        ASSERT_EQ(0x4001, ctx.xids[1]);
+        ASSERT_EQ(0, ring->stash_count);
+
+        for (uint32_t i = 0; i < 6; i++) {
+                struct pollfd cfd = { .fd = cli_fd, .events = POLLIN };
+                ASSERT_EQ(1, poll(&cfd, 1, 1000));
+                ASSERT_EQ(sizeof(dhcp_packet_t), recv(cli_fd, &p, sizeof(p), 0));
+                ASSERT_EQ(0x5000 + i, ntohl(p.xid));
+        }
+
+        uring_destroy(&ring);
+        close(srv_fd);
+        close(cli_fd);
+        PASS();
+#endif
+}
+
+SUITE(uring)
+{
+        RUN_TEST(test_uring_receive_and_send);
+        RUN_TEST(test_uring_reclaim_with_pending_receive);
+}
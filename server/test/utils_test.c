@@ -36,11 +36,29 @@ TEST test_util_mac_to_uint8()
         PASS();
 }
 
+TEST test_util_reentrant_conversions()
+{
+        char a[IPV4_ADDRESS_STRLEN];
+        char b[IPV4_ADDRESS_STRLEN];
+        char m[MAC_ADDRESS_STRLEN];
+        uint8_t mac[] = {0x01, 0x02, 0x03, 0x04, 0x05, 0x06};
+
+        /* Both results must be usable at once */
+        uint32_to_ipv4_address_r(0xc0a80001, a, sizeof(a));
+        uint32_to_ipv4_address_r(0x0a000001, b, sizeof(b));
+        ASSERT_STR_EQ("192.168.0.1", a);
+        ASSERT_STR_EQ("10.0.0.1", b);
+        ASSERT_STR_EQ("255.255.255.255", uint32_to_ipv4_address_r(0xffffffff, a, sizeof(a)));
+        ASSERT_STR_EQ("01:02:03:04:05:06", uint8_array_to_mac_r(mac, m, sizeof(m)));
+        PASS();
+}
+
 SUITE(utils)
 {
         RUN_TEST(test_util_ipov4_string_to_uint32);
         RUN_TEST(test_util_uint32_to_ipv4_string);
         RUN_TEST(test_util_uint8_to_mac);
         RUN_TEST(test_util_mac_to_uint8);
+        RUN_TEST(test_util_reentrant_conversions);
 }
 
@@ -0,0 +1,169 @@
+#include "greatest.h"
+#include "tests.h"
+#include <security/xdp_filter.h>
+#include <dhcp_packet.h>
+#include <RFC/RFC-2131.h>
+#include <arpa/inet.h>
+#include <linux/bpf.h>
+#include <linux/if_ether.h>
+#include <netinet/in.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define FRAME_DHCP_OFFSET (ETH_HLEN + 20 + 8)
+
+/* Ethernet frame with IPv4 and UDP header followed by DHCP request of client mac_last */
+static void make_frame(uint8_t *frame, uint16_t port, uint8_t mac_last)
+{
+        memset(frame, 0, FRAME_DHCP_OFFSET + sizeof(dhcp_packet_t));
+
+        uint16_t type = htons(ETH_P_IP);
+        memcpy(frame + 12, &type, sizeof(type));
+        frame[ETH_HLEN] = 0x45;
+        frame[ETH_HLEN + 9] = IPPROTO_UDP;
+        uint16_t dest = htons(port);
+        memcpy(frame + ETH_HLEN + 20 + 2, &dest, sizeof(dest));
+
+        dhcp_packet_t *p = (dhcp_packet_t*)(frame + FRAME_DHCP_OFFSET);
+        p->opcode = BOOTREQUEST;
+        p->cookie = htonl(MAGIC_COOKIE);
+        uint8_t chaddr[] = {0xaa, 0xbb, 0xcc, 0xdd, 0xee, mac_last};
+        memcpy(p->chaddr, chaddr, sizeof(chaddr));
+}
+
+/* Run program on frame of client mac_last, returns XDP action or -1 */
+static int run_program(xdp_filter_t *xdp, uint16_t port, uint8_t mac_last)
+{
+        uint8_t frame[FRAME_DHCP_OFFSET + sizeof(dhcp_packet_t)];
+        make_frame(frame, port, mac_last);
+
+        union bpf_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.test.prog_fd = xdp->prog_fd;
+        attr.test.data_in = (uint64_t)(uintptr_t)frame;
+        attr.test.data_size_in = sizeof(frame);
+        attr.test.repeat = 1;
+
+        if (syscall(__NR_bpf, BPF_PROG_TEST_RUN, &attr, sizeof(attr)) < 0)
+                return -1;
+
+        return attr.test.retval;
+}
+
+static ACL_t *make_acl(bool is_blacklist)
+{
+        ACL_t *acl = ACL_new();
+        if (!acl)
+                return NULL;
+
+        acl->enabled = true;
+        acl->is_blacklist = is_blacklist;
+        llist_append(acl->entries, strdup("aa:bb:cc:dd:ee:02"), true);
+        llist_append(acl->entries, strdup("aa:bb:cc:dd:ee:03"), true);
+
+        return acl;
+}
+
+TEST test_xdp_filter_blacklist()
+{
+        ACL_t *acl = make_acl(true);
+        ASSERT_NEQ(NULL, acl);
+
+        xdp_filter_t *xdp = xdp_filter_new(acl, 0, 0);
+        if (!xdp) {
+                ACL_destroy(&acl);
+                SKIP();
+        }
+
+        uint64_t drops[XDP_FILTER_DROP_COUNT];
+        ASSERT_EQ(XDP_PASS, run_program(xdp, DHCP_SERVER_PORT, 0x01));
+        ASSERT_EQ(XDP_DROP, run_program(xdp, DHCP_SERVER_PORT, 0x02));
+        ASSERT_EQ(XDP_DROP, run_program(xdp, DHCP_SERVER_PORT, 0x03));
+
+        /* Only packets for server are inspected */
+        ASSERT_EQ(XDP_PASS, run_program(xdp, DHCP_CLIENT_PORT, 0x02));
+
+        ASSERT_EQ(0, xdp_filter_stats(xdp, drops));
+        ASSERT_EQ(2, drops[XDP_FILTER_DROP_ACL]);
+        ASSERT_EQ(0, drops[XDP_FILTER_DROP_DACL]);
+
+        /* Entries can be changed without reloading program */
+        llist_clear(acl->entries);
+        llist_append(acl->entries, strdup("aa:bb:cc:dd:ee:03"), true);
+        ASSERT_EQ(0, xdp_filter_sync_acl(xdp, acl));
+        ASSERT_EQ(XDP_PASS, run_program(xdp, DHCP_SERVER_PORT, 0x02));
+        ASSERT_EQ(XDP_DROP, run_program(xdp, DHCP_SERVER_PORT, 0x03));
+
+        xdp_filter_destroy(&xdp);
+        ASSERT_EQ(NULL, xdp);
+        ACL_destroy(&acl);
+        PASS();
+}
+
+TEST test_xdp_filter_whitelist_and_dynamic_acl()
+{
+        ACL_t *acl = make_acl(false);
+        ASSERT_NEQ(NULL, acl);
+
+        xdp_filter_t *xdp = xdp_filter_new(acl, 0, 0);
+        if (!xdp) {
+                ACL_destroy(&acl);
+                SKIP();
+        }
+
+        uint64_t drops[XDP_FILTER_DROP_COUNT];
+        uint8_t denied[] = {0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0x03};
+        ASSERT_EQ(XDP_DROP, run_program(xdp, DHCP_SERVER_PORT, 0x01));
+        ASSERT_EQ(XDP_PASS, run_program(xdp, DHCP_SERVER_PORT, 0x02));
+        ASSERT_EQ(XDP_PASS, run_program(xdp, DHCP_SERVER_PORT, 0x03));
+
+        ASSERT_EQ(0, xdp_filter_deny(xdp, denied));
+        ASSERT_EQ(XDP_DROP, run_program(xdp, DHCP_SERVER_PORT, 0x03));
+        ASSERT_EQ(XDP_PASS, run_program(xdp, DHCP_SERVER_PORT, 0x02));
+
+        ASSERT_EQ(0, xdp_filter_stats(xdp, drops));
+        ASSERT_EQ(1, drops[XDP_FILTER_DROP_ACL]);
+        ASSERT_EQ(1, drops[XDP_FILTER_DROP_DACL]);
+
+        xdp_filter_destroy(&xdp);
+        ACL_destroy(&acl);
+        PASS();
+}
+
+TEST test_xdp_filter_rate_limit()
+{
+        /* One packet per second, so the burst is used up long before the next token comes */
+        xdp_filter_t *xdp = xdp_filter_new(NULL, 1, 3);
+        if (!xdp)
+                SKIP();
+
+        uint64_t drops[XDP_FILTER_DROP_COUNT];
+        for (int i = 0; i < 3; i++)
+                ASSERT_EQ(XDP_PASS, run_program(xdp, DHCP_SERVER_PORT, 0x01));
+        ASSERT_EQ(XDP_DROP, run_program(xdp, DHCP_SERVER_PORT, 0x01));
+        ASSERT_EQ(XDP_DROP, run_program(xdp, DHCP_SERVER_PORT, 0x01));
+
+        /* Every client has its own bucket */
+        ASSERT_EQ(XDP_PASS, run_program(xdp, DHCP_SERVER_PORT, 0x02));
+
+        ASSERT_EQ(0, xdp_filter_stats(xdp, drops));
+        ASSERT_EQ(0, drops[XDP_FILTER_DROP_ACL]);
+        ASSERT_EQ(2, drops[XDP_FILTER_DROP_RATE]);
+
+        /* Program can be attached to interface in generic mode */
+        ASSERT_EQ(0, xdp_filter_attach(xdp, "lo"));
+        ASSERT_EQ(1, xdp->link_count);
+        ASSERT_EQ(-1, xdp_filter_attach(xdp, "nonexistent0"));
+
+        xdp_filter_destroy(&xdp);
+        PASS();
+}
+
+SUITE(xdp_filter)
+{
+        RUN_TEST(test_xdp_filter_blacklist);
+        RUN_TEST(test_xdp_filter_whitelist_and_dynamic_acl);
+        RUN_TEST(test_xdp_filter_rate_limit);
+}